@@ -7,7 +7,6 @@
 namespace Steel
 {
     class BTModel;
-    class DynamicLines;
 
     class BTNavigator: public BTNode
     {
@@ -49,8 +48,8 @@ namespace Steel
         AgentId fromVariableStrategyTargetAgentFn(BTModel *btModel);
         AgentId noneStrategyTargetAgentFn(BTModel *btModel);
 
-        void initDebugLines(Ogre::SceneNode *parentNode);
-        void deleteDebugLines();
+        /// Submits target and move lines to the level's debug lines batch, for this frame only.
+        void drawDebugLines(BTModel *btModel, Ogre::Vector3 const &position, Ogre::Vector3 const &targetPos, Ogre::Vector3 const &velocity);
 
         // not owned
         // owned
@@ -64,11 +63,6 @@ namespace Steel
         bool mLookAtTarget;
         /// Agent position last frame.
         Ogre::Vector3 mPreviousPosition;
-
-        /// points to the current target
-        DynamicLines *mDebugTargetLine;
-        /// represent the speed and direction of the model
-        DynamicLines *mDebugMoveLine;
     };
 }
 
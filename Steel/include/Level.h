@@ -1,7 +1,9 @@
 #ifndef STEEL_LEVEL_H_
 #define STEEL_LEVEL_H_
 
+#include <map>
 #include <memory>
+#include <set>
 
 #include "steeltypes.h"
 #include "tools/ConfigFile.h"
@@ -21,6 +23,12 @@ namespace Steel
     class BTModelManager;
     class BlackBoardModelManager;
     class SelectionManager;
+    class DebugLinesBatch;
+    class BinaryLevelFile;
+    class JsonStreamReader;
+    class JsonStreamWriter;
+    class LevelSnapshotWriter;
+    class UnitTestExecutionContext;
 
     class Level: public TerrainManagerEventListener
     {
@@ -28,6 +36,9 @@ namespace Steel
         Level();
         Level(Level &level);
         Level &operator=(const Level &level);
+        friend bool utest_LevelDirtyTracking(UnitTestExecutionContext const *context);
+        friend bool utest_LevelIncrementalSaveSpeed(UnitTestExecutionContext const *context);
+        friend bool utest_LevelAutosaveSpeed(UnitTestExecutionContext const *context);
 
         static const char *BACKGROUND_COLOR_ATTRIBUTE;
         static const char *NAME_ATTRIBUTE;
@@ -44,17 +55,60 @@ namespace Steel
         static const char *MODEL_REF_OVERRIDE_ATTRIBUTE;
 
     public:
+        /// Whether the level is saved in the binary format (see BinaryLevelFile) rather than in json.
+        static const Ogre::String BINARY_FORMAT_SETTING;
+        static const bool DEFAULT_BINARY_FORMAT;
+        /**
+         * Whether agents and models of json saves are parsed on worker threads while the previous ones are being created.
+         * Off by default until it is measured to pay off on multi-core machines (see utest_JsonRecordPrefetcherSpeed).
+         */
+        static const Ogre::String PARALLEL_LOADING_SETTING;
+        static const bool DEFAULT_PARALLEL_LOADING;
+        /// Seconds between two autosaves (see autosave). 0 disables them.
+        static const Ogre::String AUTOSAVE_INTERVAL_SETTING;
+        static const float DEFAULT_AUTOSAVE_INTERVAL;
+        /**
+         * Whether saves and autosaves only append what changed since the previous one to a journal (see LevelJournal)
+         * kept next to the last full save, rather than writing the whole level.
+         */
+        static const Ogre::String INCREMENTAL_SAVE_SETTING;
+        static const bool DEFAULT_INCREMENTAL_SAVE;
+        /// Once the journal outgrows this ratio of its full save's size, the next save is a full one again.
+        static const Ogre::String JOURNAL_COMPACTION_RATIO_SETTING;
+        static const float DEFAULT_JOURNAL_COMPACTION_RATIO;
+
         Level(Engine *engine, File path, Ogre::String name);
         virtual ~Level();
 
         /// Read properties in the given string and set them where they should.
         bool deserialize(Ogre::String &s);
+        /// Same as deserialize(Ogre::String &), from an already parsed root.
+        bool deserialize(Json::Value &root);
+        /**
+         * Same as deserialize(Json::Value &), decoding agents and models one record at a time. Records of journal (segments
+         * folded by LevelJournal::merge, or null) are created instead of the file's ones with the same id.
+         */
+        bool deserialize(BinaryLevelFile const &file, Json::Value const &journal = Json::Value::null);
+        /**
+         * Same as deserialize(Ogre::String &), parsing agents and models one at a time, right before they are created.
+         * Records overridden by journal (see deserialize(BinaryLevelFile const &, Json::Value const &)) are skipped unparsed.
+         */
+        bool deserialize(JsonStreamReader &reader, Json::Value const &journal = Json::Value::null);
+        /**
+         * Same as deserialize(JsonStreamReader &), each manager's models and the agents being parsed ahead on their own
+         * worker thread (see JsonRecordPrefetcher). Models and agents are still created on the calling thread.
+         */
+        bool deserializeParallel(File const &savefile);
 
         /// Ffills the list of AgentId with agents that own nodes in the the given list.
         void getAgentsIdsFromSceneNodes(std::list<Ogre::SceneNode *> &nodes, Selection &selection);
 
         /// Returns the name of the json file that contains this level's properies.
         File getSavefile();
+        /// Same as getSavefile, for the binary format.
+        File getBinarySavefile();
+        /// Journal of incremental saves over the last full one (see INCREMENTAL_SAVE_SETTING).
+        File getJournalFile();
 
         void loadConfig(ConfigFile const &config);
 
@@ -84,8 +138,21 @@ namespace Steel
          * Return true if the saving went successfully.
          */
         bool save();
+        /**
+         * Same as save, the file being written on a worker thread from a snapshot of the level taken right away: the
+         * calling frame only pays for the snapshot. Returns false if the previous autosave is still being written.
+         * Once the level has a full save, the snapshot only holds what changed since (see collectIncrement): it is
+         * appended to the journal, or the worker rebuilds the full save from the one on disk. A full snapshot
+         * (serialize(Json::Value &)) costs the frame as much as a synchronous save (see utest_LevelAutosaveSpeed), and is
+         * only taken for a level that has no save yet, or after an autosave failed.
+         */
+        bool autosave();
         /// Collects level's agents' properties and put them in a string.
         void serialize(Ogre::String &s);
+        /// Same as serialize(Ogre::String &), without rendering the tree.
+        void serialize(Json::Value &root);
+        /// Same as serialize(Ogre::String &), written straight to the stream one agent/model at a time.
+        void serialize(JsonStreamWriter &writer);
 
         /// Main loop iteration.
         void update(float timestep);
@@ -163,6 +230,8 @@ namespace Steel
         inline SelectionManager *const selectionMan() const {return mSelectionMan;}
         inline LocationModelManager *const locationModelMan() const {return mLocationModelMan;}
         inline BlackBoardModelManager *const blackBoardModelMan() const {return mBlackBoardModelManagerMan;}
+        /// Batch all debug lines of the level are submitted to.
+        inline DebugLinesBatch *const debugLines() const {return mDebugLines;}
 
         inline Engine *const engine() const {return mEngine;}
         inline Ogre::Viewport *viewport() const {return mViewport;}
@@ -178,12 +247,49 @@ namespace Steel
 
         /// If found and set to true in an object of a model serialization, values of the object skip their way through dynamicFillSerialization.
         static const char *DF_CANCEL_DYNAMIC_FILLING_ATTRIBUTE;
+        /// Size of the file buffer json saves are streamed through.
+        static const size_t SAVE_BUFFER_SIZE;
         /**
          * Fills dynamic fields with values of dynamic queries. Optional aid helps filling dynamic
          * fields involving the owner agent. This method is recursive.
          */
         bool dynamicFillSerialization(Json::Value &node, Steel::AgentId aid = INVALID_ID);
 
+        /// Where things are in a json save, as found by a first pass of a JsonStreamReader over it.
+        class SaveIndex
+        {
+        public:
+            /// Level properties (all members but agents and managers).
+            Json::Value properties;
+            bool hasManagers;
+            std::map<ModelType, u64> modelsPositions;
+            bool hasAgents;
+            u64 agentsPosition;
+        };
+        /// Members are stored in key order, while models are to be created in ModelType order, and agents last.
+        bool indexSave(JsonStreamReader &reader, SaveIndex &index);
+
+        /// Name, gravity, background, camera and terrain.
+        bool deserializeProperties(Json::Value &root);
+        /// Creates the agent aid from its serialization. Returns false only if the agent could not be created.
+        bool deserializeAgent(AgentId aid, Json::Value &agentData);
+        /// Creates the models a merged journal adds or replaces in mm (nulls are removed ones, and are skipped).
+        void deserializeJournalModels(ModelManager *mm, Ogre::String const &type, Json::Value const &records);
+        /// Same as deserializeJournalModels, for agents. Returns false if an agent could not be created.
+        bool deserializeJournalAgents(Json::Value const &records);
+
+        /// Whether the next save can be appended to the journal of the full save at basePath.
+        bool incrementalSaveDue(Ogre::String const &basePath);
+        /**
+         * Fills a journal segment with what changed since the previous save, and marks it saved. Only agents and models
+         * the managers report as dirty are looked at, and properties are written if they differ from the saved ones.
+         */
+        void collectIncrement(Json::Value &segment);
+        /// Marks the whole level as saved into the full save at basePath.
+        void markSaved(Ogre::String const &basePath);
+        /// Logs finished autosaves. A failed one clears the saved base: the next save is a full one.
+        void collectAutosaves();
+
         //not owned
         Engine *mEngine;
 
@@ -219,13 +325,45 @@ namespace Steel
         LocationModelManager *mLocationModelMan;
         BlackBoardModelManager *mBlackBoardModelManagerMan;
 
+        /// Single renderable for all debug lines (location links, BT navigation, ...).
+        DebugLinesBatch *mDebugLines;
+
         /// Main camera
         Camera *mCamera;
 
         Ogre::Light *mMainLight;
         /// See GRAVITY_ATTRIBUTE
         Ogre::Vector3 mGravity;
+
+        /// See BINARY_FORMAT_SETTING.
+        bool mBinaryFormat;
+        /// See PARALLEL_LOADING_SETTING.
+        bool mParallelLoading;
+        /// See AUTOSAVE_INTERVAL_SETTING.
+        float mAutosaveInterval;
+        float mTimeSinceAutosave;
+        /// Writes autosaves.
+        LevelSnapshotWriter *mSnapshotWriter;
+        /// See INCREMENTAL_SAVE_SETTING.
+        bool mIncrementalSave;
+        /// See JOURNAL_COMPACTION_RATIO_SETTING.
+        float mJournalCompactionRatio;
+        /// Full save the last saved state builds upon (through the journal). Empty if unknown.
+        Ogre::String mSavedBase;
+        /// Models of persistent agents as last saved, to tell new, deleted and relinked ones.
+        std::map<AgentId, std::map<ModelType, ModelId>> mSavedAgents;
+        /// Number of saved agents linking each saved model.
+        std::map<ModelType, std::map<ModelId, u32>> mSavedModels;
+        /// Properties as last saved. Null if unknown.
+        Json::Value mSavedProperties;
     };
+
+    /// What collectIncrement picks up of agent links, tags, blackboard writes, deletions and physics motion.
+    bool utest_LevelDirtyTracking(UnitTestExecutionContext const *context);
+    /// Level::save of a few changes over a large level, incremental against full, then loaded back over its journal.
+    bool utest_LevelIncrementalSaveSpeed(UnitTestExecutionContext const *context);
+    /// Main thread cost of an autosave of a large level (capture and queue), against a synchronous save, before and after it.
+    bool utest_LevelAutosaveSpeed(UnitTestExecutionContext const *context);
 }
 
 #endif /* STEEL_LEVEL_H_ */
@@ -10,6 +10,7 @@ namespace Steel
 
     class BlackBoardModel;
     class BTModel;
+    class JsonStreamWriter;
     class Level;
     class LocationModel;
     class Model;
@@ -50,6 +51,8 @@ namespace Steel
         /// Setup new Agent according to data in the json serialization.
         bool fromJson(Json::Value &models);
         Json::Value toJson();
+        /// Same as toJson(), written straight to the stream as the value of its last key.
+        void toJson(JsonStreamWriter &writer);
 
         /// Assigns a model to the agent for the given type.
         bool linkToModel(ModelType modelType, ModelId modelId);
@@ -171,12 +174,16 @@ namespace Steel
         /// A persistent agent is saved with the level it lives in.
         bool isPersistent();
         void setPersistent(bool flag);
+        /// Whether the agent changed since its manager last handed out its dirty ids (see AgentManager::takeDirtyAgents).
+        /// Does not account for its models (see Model::isDirty).
+        inline bool isDirty() const {return mDirty;}
+        inline void clearDirty() {mDirty = false;}
 
         //////////////////////////////////////////////////////////////////////
         // handy
         inline Ogre::String const &name()const {return mName;}
         inline bool hasName()const {return StringUtils::BLANK != name();}
-        inline void setName(Ogre::String const &name) {mName = name;}
+        inline void setName(Ogre::String const &name) {mName = name; markDirty();}
 
         //////////////////////////////////////////////////////////////////////
         // signals
@@ -188,6 +195,9 @@ namespace Steel
         Signal getSignal(Agent::PublicSignal eSignal);
 
     private:
+        /// Sets the dirty flag, queuing the agent in its manager if it was not set.
+        void markDirty();
+
         /// Tags used internally, grouped here.
         struct PropertyTags
         {
@@ -216,6 +226,9 @@ namespace Steel
         /// Stack of behaviors. Current one is in mModelIds though.
         std::list<ModelId> mBehaviorsStack;
 
+        /// Changed since last saved (see isDirty).
+        bool mDirty = true;
+
         struct Signals
         {
             /// Emitted when the agent is selected
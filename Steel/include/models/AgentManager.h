@@ -50,6 +50,11 @@ namespace Steel
             void removeTaggedAgent(Tag const &tag, AgentId const aid);
             /// Retreive all agents tagged with the given tag
             const std::set< AgentId > & agentTagged(Steel::Tag tag);
+
+            /// Queues the agent as changed. Called by agents on their first change following a clearDirty.
+            void queueDirtyAgent(AgentId aid);
+            /// Moves ids of agents that changed, were created or deleted since the last call into aids, and clears their dirty flag.
+            void takeDirtyAgents(std::vector<AgentId> &aids);
             
             enum class PublicSignal : u32
             {
@@ -79,6 +84,9 @@ namespace Steel
             /// Tag to agent map
             std::map<Tag, std::set<AgentId>> mTagRegister;
 
+            /// See queueDirtyAgent.
+            std::vector<AgentId> mDirtyAgents;
+
     };
 }
 #endif
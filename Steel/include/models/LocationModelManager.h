@@ -4,10 +4,10 @@
 #include "steeltypes.h"
 #include "_ModelManager.h"
 #include "LocationModel.h"
+#include "tools/DebugLinesBatch.h"
 
 namespace Steel
 {
-    class DynamicLines;
     class Level;
     class LocationModelManager: public _ModelManager<LocationModel>
     {
@@ -28,7 +28,11 @@ namespace Steel
         ModelId newModel(ModelId &mid);
 
         std::vector<ModelId> fromJson(Json::Value const&model);
+        std::vector<ModelId> fromJson(JsonStreamReader &reader);
+        /// Models are under ModelManager::MODELS_ATTRIBUTES, next to path roots.
+        bool modelsKeyedByIds() {return false;}
         void toJson(Json::Value &object, std::list<ModelId> const& modelIds);
+        void toJson(JsonStreamWriter &writer, std::list<ModelId> const& modelIds);
         void onAgentUnlinkedFromModel(Agent *agent, ModelId mid);
         bool onAgentLinkedToModel(Agent *agent, ModelId mid);
 
@@ -81,14 +85,13 @@ namespace Steel
         bool deserializeToModel(Json::Value const&model, ModelId &mid);
         /// The pair content is (src, dst)
         ModelPair makeKey(ModelId mid0, ModelId mid1);
-        bool getDebugLine(ModelPair const &key, DynamicLines *&line);
         void removeDebugLines(ModelId mid);
         void removeDebugLine(ModelPair const &key);
         /// Returns all debug lines keys involving the given model id.
         /// Returns a list of all pairs from the model to its destinations, and from the model's sources to it.
         std::list<ModelPair> collectModelPairs(ModelId mid);
-        // owned
-        std::map<ModelPair, DynamicLines *> mDebugLines;
+        /// Handles of the lines drawn in the level's debug lines batch.
+        std::map<ModelPair, DebugLinesBatch::LineId> mDebugLines;
 
         /// keys if a path name, value is the id of the agent attached to the root LocationModel.
         std::map<LocationPathName, AgentId> mPathsRoots;
@@ -63,12 +63,35 @@ namespace Steel
             /// reads tags from serialization. Returns true if all went ok.
             bool deserializeTags(Json::Value const &value);
 
+            /// Whether the model changed since its manager last handed out its dirty ids (see ModelManager::takeDirtyModels).
+            inline bool isDirty() const {return mDirty;}
+            inline void markDirty()
+            {
+                if(!mDirty && nullptr != mDirtyQueue)
+                    mDirtyQueue->push_back(mModelId);
+
+                mDirty = true;
+            }
+            inline void clearDirty() {mDirty = false;}
+            /**
+             * The given id is pushed to the queue on the first change following a clearDirty, so that finding what
+             * changed does not mean going through all models. Set by the manager when the model is allocated, which
+             * queues it as a new model.
+             */
+            void setDirtyQueue(std::vector<ModelId> *queue, ModelId mid);
+
         protected:
             /// Number of agents referencing it.
             unsigned long mRefCount;
 
             /// Tags the model delegates t its agents
             std::set<Tag> mTags;
+
+            /// See isDirty.
+            bool mDirty;
+            /// not owned
+            std::vector<ModelId> *mDirtyQueue;
+            ModelId mModelId;
     };
 
 }
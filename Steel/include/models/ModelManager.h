@@ -6,6 +6,8 @@
 namespace Steel
 {
     class Agent;
+    class JsonStreamReader;
+    class JsonStreamWriter;
     class Model;
     /**
      * Pure abstract class used as a common interface for the template-specialized versions of model managers.
@@ -32,11 +34,17 @@ namespace Steel
         virtual void onAgentUnlinkedFromModel(Agent *agent, ModelId id) = 0;
 
         virtual std::vector<ModelId> fromJson(Json::Value const&nodes) = 0;
+        /// Same as fromJson(Json::Value const&), reading the stream's next value one model at a time.
+        virtual std::vector<ModelId> fromJson(JsonStreamReader &reader) = 0;
         /// Meant to be reimplemented by subclasses when models use extra params in their M::fromJson
         virtual bool fromSingleJson(Json::Value const &node, ModelId &id, bool updateModel = false) = 0;
+        /// Whether fromJson takes an object of models keyed by their ids, each of which can be passed to fromSingleJson.
+        virtual bool modelsKeyedByIds() = 0;
         
         /// Serializes all models referenced by modelIds in object node.
         virtual void toJson(Json::Value &nodes, std::list<ModelId> const &modelIds) = 0;
+        /// Same as toJson(Json::Value &, ...), written straight to the stream as the value of its last key.
+        virtual void toJson(JsonStreamWriter &writer, std::list<ModelId> const &modelIds) = 0;
         /// Redirects the call to the pointed model. Returns false if the model is invalid.
         virtual bool toSingleJson(ModelId mid, Json::Value &node) = 0;
 
@@ -46,6 +54,9 @@ namespace Steel
         /// Returns the model tags, or an empty set if the given id is not valid.
         virtual std::set<Tag> modelTags(ModelId mid) = 0;
 
+        /// Moves ids of models that changed (or were released) since the last call into ids, and clears their dirty flag.
+        virtual void takeDirtyModels(std::vector<ModelId> &ids) = 0;
+
         /// Clears every models.
         virtual void clear() = 0;
     };
@@ -1,11 +1,12 @@
 #ifndef STEEL_PHYSICSMODEL_H
 #define STEEL_PHYSICSMODEL_H
 
-#include <stack>
+#include <vector>
 
 #include "steeltypes.h"
 #include "Model.h"
 #include "SignalEmitter.h"
+#include "models/PhysicsSnapshot.h"
 
 class btDynamicsWorld;
 class btPairCachingGhostObject;
@@ -17,6 +18,7 @@ namespace Steel
 {
     class SignalListener;
     class PhysicsModelManager;
+    class StepForcesBatch;
     class OgreModel;
     class Agent;
     /**
@@ -65,7 +67,7 @@ namespace Steel
 
         PhysicsModel();
         PhysicsModel(PhysicsModel const &o);
-        void init(btDynamicsWorld *world, OgreModel *omodel);
+        void init(btDynamicsWorld *world, OgreModel *omodel, PhysicsModelManager *manager, ModelId mid);
         PhysicsModel &operator=(const PhysicsModel &other);
         virtual ~PhysicsModel();
 
@@ -103,7 +105,16 @@ namespace Steel
         void setSelected(bool selected);
         void cleanup();
 
+        /// Per frame update: collision signals and transform notifications.
         void update(float timestep, PhysicsModelManager *manager);
+        /// True if the model has forces to apply at each physics substep (keep-vertical, levitation).
+        inline bool hasStepForces() const {return mLevitate || DEFAULT_MODEL_KEEP_VERTICAL_FACTOR != mKeepVerticalFactor;}
+        /// Appends the model's simulation state (body, kinematic state and states stack) to the snapshot.
+        void saveState(PhysicsSnapshot &snapshot) const;
+        /// Sets the model back to a recorded state. stack points to the record's stackDepth entries.
+        void restoreState(PhysicsSnapshot::BodyRecord const &record, PhysicsSnapshot::StackRecord const *stack);
+        /// Adds the body and its per substep forces parameters to the batch. Models must be mirrored again when those change.
+        void mirrorStepForces(StepForcesBatch &batch) const;
         /// used to store a void* within the physics object TODO: store an AgentId
         void setUserPointer(Agent *agent);
 
@@ -123,6 +134,11 @@ namespace Steel
         /// World interactions are physics interactions with other physics object of the world.
         void enableWorldInteractions(bool flag);
 
+        /// True if contacts with tagged agents make the model emit signals (see EMIT_ON_TAG_ATTRIBUTE).
+        inline bool emitsOnContact() const {return mIsGhost && 0 != mEmitOnTagMask;}
+        /// Called by the manager when an agent starts touching this model. Emits signals matching the agent's tags.
+        void onContactEnter(Agent *other);
+
         BoundingShape shape() const {return mShape;}
         void setShape(OgreModel *const omodel, BoundingShape requestedShape);
 
@@ -137,9 +153,10 @@ namespace Steel
         void createRigidBody(Steel::OgreModel *const omodel);
         /// Destructs the model's rigid body.
         void destroyRigidBody();
-        btCollisionShape *createShapeForEntity(Steel::OgreModel *const omodel, Steel::BoundingShape requestedShape, btVector3 &inertia);
-        /// Dispatches signals upon valid collisions.
-        void collisionCheck(PhysicsModelManager *manager);
+        /// Replaces the body's shape (and the ghost's) by the given one, and releases the previous one.
+        void swapShape(btCollisionShape *shape);
+        /// Bit a tag sets in a tags mask. Several tags share a bit, masks are only used for early rejection.
+        static inline u64 tagMaskBit(Tag tag) {return 1UL << (tag & 63UL);}
 
         /// Removes the model's rigidbody from the world, as well as its ghostObject, if any.
         void removeFromWorld();
@@ -148,6 +165,10 @@ namespace Steel
 
         //not owned
         btDynamicsWorld *mWorld;
+        /// Owns the shapes cache.
+        PhysicsModelManager *mManager;
+        /// Id within mManager.
+        ModelId mId;
 
         //owned
         btRigidBody *mBody;
@@ -157,14 +178,14 @@ namespace Steel
         bool mIsKinematics;
         float mRotationFactor;
         float mKeepVerticalFactor;
-        /// kinematics/rigidBody states stack
+        /// kinematics/rigidBody states stack, top last
         struct State
         {
             bool isKinematics;
             int bodyCollisionFlags;
             bool isSelected;
         };
-        std::stack<State> mStates;
+        std::vector<State> mStates;
         /// Shape of the physic model representing the graphic model.
         BoundingShape mShape;
         bool mIsSelected;
@@ -182,8 +203,8 @@ namespace Steel
         btPairCachingGhostObject *mGhostObject;
         /// See EMIT_ON_TAG_ATTRIBUTE docstring
         std::map<Tag, std::set<Signal>> mEmitOnTag;
-        /// other agents currently colliding with this one
-        std::set<AgentId> mCollidingAgents;
+        /// Mask of mEmitOnTag keys (see tagMaskBit).
+        u64 mEmitOnTagMask;
         /// See LEVITATE_ATTRIBUTE
         bool mLevitate;
     };
@@ -2,19 +2,62 @@
 #define STEEL_PHYSICSMODELMANAGER_H
 
 class btCollisionObjectWrapper;
+class btCollisionShape;
+class btCollisionWorld;
 class btDynamicsWorld;
 class btGhostPairCallback;
 
 #include "steeltypes.h"
 #include "_ModelManager.h"
 #include "PhysicsModel.h"
+#include "ShapeCooker.h"
+#include "StepForcesBatch.h"
+#include "terrain/PhysicsStepListener.h"
 
 namespace Steel
 {
-    class PhysicsModelManager: public _ModelManager<PhysicsModel>
+    class UnitTestExecutionContext;
+
+    class PhysicsModelManager: public _ModelManager<PhysicsModel>, public PhysicsStepListener
     {
 
         public:
+            /// A change in the contact state of 2 agents (aid0<aid1) during the last update.
+            class ContactEvent
+            {
+            public:
+                enum class Type : u8
+                {
+                    ENTER = 0,
+                    STAY,
+                    EXIT
+                };
+                Type type;
+                AgentId aid0;
+                AgentId aid1;
+            };
+
+            /// A segment cast against the world, from -> to. A positive radius makes it a sphere sweep.
+            class Query
+            {
+            public:
+                Ogre::Vector3 from;
+                Ogre::Vector3 to;
+                float radius;
+            };
+
+            /// Closest hit of a Query. Terrain hits have an INVALID_ID aid.
+            class QueryHit
+            {
+            public:
+                AgentId aid;
+                Ogre::Vector3 point;
+                Ogre::Vector3 normal;
+                /// Position of the hit along the query segment, 1.f when nothing was hit.
+                float fraction;
+                inline bool hasHit() const {return fraction < 1.f;}
+            };
+
             PhysicsModelManager(Level *level, btDynamicsWorld *world);
             virtual ~PhysicsModelManager();
 
@@ -26,13 +69,117 @@ namespace Steel
             /// Callback used to sync a PhysicsModel to its OgreModel upon linkage.
             bool onAgentLinkedToModel(Agent *agent, ModelId mid);
 
+            /// Dispatches contact events, then updates models bullet moved since last update (sleeping ones are skipped).
             void update(float timestep);
+            /// Models' motion states push their id there when bullet moves them (see RigidBodyStateWrapper).
+            inline std::vector<ModelId> *transformedQueue() {return &mTransformedModelsQueue;}
+            /// To be called when a model's hasStepForces might have changed.
+            void invalidateStepForcedModels();
+
+            /**
+             * Returns a collision shape of the given kind for the model's mesh at the given scale, building it
+             * if needed. Shapes are shared and reference counted: give them back with releaseShape. The unscaled
+             * geometry of a mesh is built once and shared by all scales.
+             */
+            btCollisionShape *acquireShape(OgreModel *omodel, BoundingShape boundingShape, Ogre::Vector3 const &scale);
+            /// Returns the same kind of shape as the given one (which must come from this cache), at another scale.
+            btCollisionShape *acquireShape(btCollisionShape *shape, Ogre::Vector3 const &scale);
+            /// Releases a shape obtained with acquireShape. It is deleted once unused.
+            void releaseShape(btCollisionShape *shape);
+            /// Scale a cached shape was acquired with.
+            Ogre::Vector3 shapeScale(btCollisionShape *shape) const;
+
+            /**
+             * Casts all queries against the world, in parallel on the physics worker threads (see
+             * TerrainPhysicsManager::THREAD_COUNT_SETTING), and fills results with their closest hits, in the same order.
+             * If filterTag is valid, only agents tagged with it are hit (and terrain is not). Ghosts are never hit.
+             * Must not be called while the world is being stepped.
+             */
+            void castQueries(std::vector<Query> const &queries, std::vector<QueryHit> &results, Tag filterTag = INVALID_TAG) const;
+            /// Same as castQueries, against any world whose objects carry their Agent as user pointer (or none).
+            static void castQueries(btCollisionWorld *world, std::vector<Query> const &queries, std::vector<QueryHit> &results,
+                                    Tag filterTag = INVALID_TAG);
+
+            /**
+             * Records the simulation state of all models into the snapshot (previous content is dropped, memory is
+             * kept). Cheap enough to be taken every frame (rewind, replays, what-if steps).
+             */
+            void takeSnapshot(PhysicsSnapshot &snapshot) const;
+            /**
+             * Sets models back to their recorded state. Models created or deleted since the snapshot was taken are
+             * left alone (the snapshot does not create nor delete models).
+             */
+            void restoreSnapshot(PhysicsSnapshot const &snapshot);
+
+            /// Contact events of the last update, sorted by agents pair.
+            inline std::vector<ContactEvent> const &contactEvents() const {return mContactEvents;}
+            /// PhysicsStepListener interface. Applies models' per substep forces, in one batch.
+            void onPhysicsStep(float fixedTimestep);
         protected:
+            typedef std::pair<AgentId, AgentId> AgentPair;
+
+            /// Identifies a shape in the cache.
+            class ShapeKey
+            {
+            public:
+                Ogre::String mesh;
+                BoundingShape boundingShape;
+                Ogre::Vector3 scale;
+                bool operator<(ShapeKey const &o) const;
+            };
+            class ShapeEntry
+            {
+            public:
+                btCollisionShape *shape;
+                u32 refCount;
+                /// Unscaled shape this one wraps (and holds a reference to), if any.
+                btCollisionShape *base;
+                ShapeKey key;
+            };
+            btCollisionShape *acquireShape(ShapeKey const &key, Ogre::Entity *entity);
+            /// Builds (or loads the cooked version of) the unscaled shape of a mesh.
+            btCollisionShape *createBaseShape(Ogre::Entity *entity, BoundingShape boundingShape);
+            /// Builds a scaled version of a base shape, sharing its geometry whenever possible.
+            btCollisionShape *createScaledShape(btCollisionShape *base, BoundingShape boundingShape, Ogre::Vector3 const &scale);
+            void deleteShape(btCollisionShape *shape, BoundingShape boundingShape, bool isBase);
+
+            /**
+             * Single pass over the dispatcher's manifolds, collecting touching agents pairs, and diffing them
+             * against last update's to produce mContactEvents. Cost is proportional to the number of manifolds.
+             */
+            void collectContacts();
+            /// Forwards ENTER events to models emitting on contact.
+            void dispatchContactEvents();
+
             // not owned
             btDynamicsWorld *mWorld;
             //owned
             btGhostPairCallback* mbulletGhostPairCallback;
+
+            /// Touching agents pairs, sorted. Swapped each update.
+            std::vector<AgentPair> mContacts;
+            std::vector<AgentPair> mPreviousContacts;
+            /// Flat buffer of the last update's events.
+            std::vector<ContactEvent> mContactEvents;
+
+            /// Shape cache
+            std::map<ShapeKey, btCollisionShape *> mShapesByKey;
+            std::map<btCollisionShape *, ShapeEntry> mShapes;
+            /// Builds and caches on disk unscaled shapes.
+            ShapeCooker mShapeCooker;
+
+            /// Models moved by the current/last physics step. Swapped each update.
+            std::vector<ModelId> mTransformedModelsQueue;
+            std::vector<ModelId> mTransformedModels;
+            /// Models with per substep forces, mirrored and rebuilt on demand.
+            StepForcesBatch mStepForces;
+            bool mStepForcedModelsDirty;
     };
+
+    /// Closest hits of rays and sweeps, tag filtering, ghosts skipping.
+    bool utest_PhysicsQueries(UnitTestExecutionContext const *context);
+    /// Queries per second against a grid of bodies, for 1 to n threads.
+    bool utest_PhysicsQueriesThroughput(UnitTestExecutionContext const *context);
 }
 #endif // STEEL_PHYSICSMODELMANAGER_H
 // kate: indent-mode cstyle; indent-width 4; replace-tabs on; 
@@ -0,0 +1,80 @@
+#ifndef STEEL_PHYSICSSNAPSHOT_H
+#define STEEL_PHYSICSSNAPSHOT_H
+
+#include <vector>
+
+#include "steeltypes.h"
+
+class btRigidBody;
+
+namespace Steel
+{
+    class UnitTestExecutionContext;
+
+    /**
+     * Simulation state of all PhysicsModels of a manager, in flat POD records: transforms, velocities, activation,
+     * kinematic state and states stack. Buffers keep their capacity across takes, so that once warm, taking a
+     * snapshot every frame does not allocate. See PhysicsModelManager::takeSnapshot/restoreSnapshot.
+     */
+    class PhysicsSnapshot
+    {
+    public:
+        /// State of a rigid body.
+        class BodyRecord
+        {
+        public:
+            ModelId mid;
+            float position[3];
+            float rotation[4];
+            float linearVelocity[3];
+            float angularVelocity[3];
+            s32 activationState;
+            float deactivationTime;
+            s32 collisionFlags;
+            u8 isKinematics;
+            u8 isSelected;
+            /// Number of StackRecords of that model (they follow the previous model's).
+            u16 stackDepth;
+        };
+
+        /// An entry of a PhysicsModel states stack, bottom first.
+        class StackRecord
+        {
+        public:
+            s32 bodyCollisionFlags;
+            u8 isKinematics;
+            u8 isSelected;
+        };
+
+        PhysicsSnapshot();
+
+        /// Empties the snapshot, keeping its memory.
+        void clear();
+        /// Preallocates room for the given number of bodies.
+        void reserve(size_t bodies, size_t stackEntries = 0);
+        /// Size of the records, in bytes.
+        size_t byteSize() const;
+
+        inline std::vector<BodyRecord> &bodies() {return mBodies;}
+        inline std::vector<BodyRecord> const &bodies() const {return mBodies;}
+        inline std::vector<StackRecord> &stacks() {return mStacks;}
+        inline std::vector<StackRecord> const &stacks() const {return mStacks;}
+
+        /// Fills the body part of a record (transform, velocities, activation, flags).
+        static void saveBody(btRigidBody const *body, BodyRecord &record);
+        /// Sets the body back to the recorded state. Forces are cleared. Does not touch motion state nor world membership.
+        static void restoreBody(btRigidBody *body, BodyRecord const &record);
+
+    private:
+        std::vector<BodyRecord> mBodies;
+        std::vector<StackRecord> mStacks;
+    };
+
+    /// PhysicsModelManager::takeSnapshot/restoreSnapshot round trip: transforms, kinematic state and states stacks.
+    bool utest_PhysicsSnapshot(UnitTestExecutionContext const *context);
+    /// Snapshot and restore times of 10k bodies.
+    bool utest_PhysicsSnapshotSpeed(UnitTestExecutionContext const *context);
+}
+
+#endif // STEEL_PHYSICSSNAPSHOT_H
+// kate: indent-mode cstyle; indent-width 4; replace-tabs on;
@@ -0,0 +1,86 @@
+#ifndef STEEL_SHAPECOOKER_H
+#define STEEL_SHAPECOOKER_H
+
+#include <vector>
+
+#include <OgreMesh.h>
+
+#include "steeltypes.h"
+#include "tools/File.h"
+#include "tools/FileEventListener.h"
+
+class btBulletWorldImporter;
+class btCollisionShape;
+
+namespace Steel
+{
+    class UnitTestExecutionContext;
+
+    /**
+     * Builds the unscaled collision shapes of meshes, and keeps the expensive ones (convex hulls, BVH trimeshes)
+     * serialized in a cache directory, keyed by a hash of the mesh file content. A cooked shape is loaded back
+     * with a single read instead of being rebuilt. Mesh files are watched, and their shapes recooked when they change.
+     */
+    class ShapeCooker: public FileEventListener
+    {
+        friend bool utest_ShapeCooker(UnitTestExecutionContext const *context);
+
+    public:
+        ShapeCooker();
+        virtual ~ShapeCooker();
+
+        /// Cooked shapes go to (and are read from) the given directory, created if needed.
+        void init(File const &cacheDir);
+        /// Stops watching mesh files.
+        void shutdown();
+
+        /// Returns true if building the given kind of shape is worth caching.
+        static bool isCookable(BoundingShape boundingShape);
+
+        /// Returns the unscaled shape of a mesh, loaded from the cache if up to date, built (and cooked) otherwise.
+        btCollisionShape *shape(Ogre::MeshPtr const &mesh, BoundingShape boundingShape);
+        /// Deletes a shape returned by shape(), along with the data it owns.
+        void deleteShape(btCollisionShape *shape, BoundingShape boundingShape);
+
+        /// FileEventListener interface. Recooks the shapes of a modified mesh file.
+        void onFileChangeEvent(File file);
+
+    protected:
+        /// On disk file a mesh was loaded from.
+        class MeshSource
+        {
+        public:
+            File file;
+            Ogre::String group;
+            /// Hash of the file content the cooked shapes match.
+            u64 hash;
+            /// Kinds of shapes cooked for that mesh.
+            std::set<BoundingShape> boundingShapes;
+        };
+
+        /// Builds a shape out of the mesh geometry (the slow part).
+        btCollisionShape *build(Ogre::MeshPtr const &mesh, BoundingShape boundingShape);
+        /// Returns the cached shape in the given file, or nullptr. Unreadable files are deleted.
+        btCollisionShape *load(File file);
+        bool save(btCollisionShape *shape, File const &file);
+
+        /// Finds the file a mesh was loaded from (registering it if needed), or returns nullptr for non file based meshes.
+        MeshSource *source(Ogre::MeshPtr const &mesh);
+        File cacheFile(Ogre::String const &meshName, BoundingShape boundingShape, u64 hash) const;
+        static bool readFile(File const &file, std::vector<char> &buffer);
+        /// FNV-1a, stable across runs and platforms.
+        static u64 hash(std::vector<char> const &buffer);
+
+        File mCacheDir;
+        /// Mesh name -> source
+        std::map<Ogre::String, MeshSource> mSources;
+        /// Shapes loaded from the cache, with the importer that owns their data.
+        std::map<btCollisionShape *, btBulletWorldImporter *> mImporters;
+    };
+
+    /// Cache file names of meshes in subdirectories, and a shape cooked to one and loaded back.
+    bool utest_ShapeCooker(UnitTestExecutionContext const *context);
+}
+
+#endif // STEEL_SHAPECOOKER_H
+// kate: indent-mode cstyle; indent-width 4; replace-tabs on;
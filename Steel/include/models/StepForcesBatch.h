@@ -0,0 +1,68 @@
+#ifndef STEEL_STEPFORCESBATCH_H
+#define STEEL_STEPFORCESBATCH_H
+
+#include <vector>
+
+#include "steeltypes.h"
+
+class btRigidBody;
+
+namespace Steel
+{
+    class UnitTestExecutionContext;
+
+    /**
+     * Per physics substep forces of PhysicsModels (keep-vertical torque, levitation), computed for all bodies at once.
+     * Per body parameters are mirrored in structure-of-arrays buffers (rebuilt only when models change), bodies' up
+     * vectors are gathered each substep, and impulses are computed by a vectorized kernel (AVX or SSE when the
+     * target has them, scalar otherwise) before being applied to the bodies in a single pass.
+     */
+    class StepForcesBatch
+    {
+    public:
+        StepForcesBatch();
+
+        /// Drops all mirrored bodies.
+        void clear();
+        /// Mirrors a body's parameters. keepVertical is the keep-vertical factor times the rotation factor; lift is mass if levitating, 0 otherwise.
+        void add(btRigidBody *body, float keepVertical, float lift);
+        inline size_t size() const {return mBodies.size();}
+
+        /// Gathers up vectors, computes impulses, and applies them to awake bodies.
+        void apply(float fixedTimestep);
+
+        /**
+         * The kernel itself: torque = (up x UNIT_Y) * keepVertical * dt, which reduces to (-up.z, 0, up.x) * keepVertical * dt,
+         * and impulse.y = lift * dt. Output arrays may not alias inputs.
+         */
+        static void computeImpulses(size_t count, float dt,
+                                    float const *upX, float const *upZ, float const *keepVertical, float const *lift,
+                                    float *torqueX, float *torqueZ, float *impulseY);
+        /// Scalar version of computeImpulses, as a reference.
+        static void computeImpulsesScalar(size_t begin, size_t count, float dt,
+                                          float const *upX, float const *upZ, float const *keepVertical, float const *lift,
+                                          float *torqueX, float *torqueZ, float *impulseY);
+        /// Name of the instruction set computeImpulses was built with.
+        static char const *simdName();
+
+    private:
+        std::vector<btRigidBody *> mBodies;
+        // mirrored parameters
+        std::vector<float> mKeepVertical;
+        std::vector<float> mLift;
+        // gathered each substep
+        std::vector<float> mUpX;
+        std::vector<float> mUpZ;
+        std::vector<u8> mAwake;
+        // kernel output
+        std::vector<float> mTorqueX;
+        std::vector<float> mTorqueZ;
+        std::vector<float> mImpulseY;
+    };
+
+    /// Bodies processed per microsecond, by the kernel alone and with gathering/applying.
+    bool utest_StepForcesBatchThroughput(UnitTestExecutionContext const *context);
+}
+
+#endif // STEEL_STEPFORCESBATCH_H
+// kate: indent-mode cstyle; indent-width 4; replace-tabs on;
@@ -56,6 +56,8 @@ namespace Steel
 
         /// Initializes new models according to data in the json serialization.
         virtual std::vector<ModelId> fromJson(Json::Value const &models);
+        /// Same as above, each model being parsed right before being deserialized.
+        virtual std::vector<ModelId> fromJson(JsonStreamReader &reader);
         /**
          * Initializes a single model pointed to by mid, according to data in the
          * json serialization.
@@ -69,9 +71,12 @@ namespace Steel
          * allocation.
          */
         virtual bool fromSingleJson(Json::Value const &model, ModelId &mid, bool updateModel = false);
+        virtual bool modelsKeyedByIds() {return true;}
 
         /// Dumps refenreced models' json representation into the given object.
         virtual void toJson(Json::Value &object, std::list<ModelId> const &modelIds);
+        /// Same output as above, one model at a time.
+        virtual void toJson(JsonStreamWriter &writer, std::list<ModelId> const &modelIds);
         /// Redirects the call to the pointed model. Returns false if the model is invalid.
         virtual bool toSingleJson(ModelId mid, Json::Value &object);
 
@@ -88,6 +93,8 @@ namespace Steel
         /// Returns the model tags, or an empty set if the given id is not valid.
         virtual std::set<Tag> modelTags(ModelId mid);
 
+        virtual void takeDirtyModels(std::vector<ModelId> &ids);
+
         inline Level *level() {return mLevel;}
 
     protected:
@@ -103,6 +110,9 @@ namespace Steel
         /// Cleans up the model and marks it as allocable.
         void deallocateModel(ModelId id);
 
+        /// Ids of the given models that would be serialized, as json keys, in json order (without duplicates).
+        std::vector<std::pair<Ogre::String, ModelId> > serializableModels(std::list<ModelId> const &modelIds);
+
         virtual bool deserializeToModel(Json::Value const &model, ModelId &mid);
 
         // not owned
@@ -111,6 +121,8 @@ namespace Steel
         /// Contains models.
         std::vector<ManagedModel> mModels;
         std::list<ModelId> mModelsFreeList;
+        /// Models queue themselves in there when they change (see Model::setDirtyQueue).
+        std::vector<ModelId> mDirtyModels;
     };
 }
 
@@ -43,6 +43,7 @@ namespace Json
 
 namespace Steel
 {
+    typedef unsigned char u8;
     typedef short unsigned int u16;
     typedef unsigned int u32;
     typedef unsigned long u64;
@@ -0,0 +1,16 @@
+#ifndef STEEL_PHYSICSSTEPLISTENER_H
+#define STEEL_PHYSICSSTEPLISTENER_H
+
+namespace Steel
+{
+    /// Notified by TerrainPhysicsManager before each fixed physics substep.
+    class PhysicsStepListener
+    {
+    public:
+        /// Called before each internal substep of the physics world, with the (fixed) substep duration.
+        virtual void onPhysicsStep(float fixedTimestep) = 0;
+    };
+}
+
+#endif // STEEL_PHYSICSSTEPLISTENER_H
+// kate: indent-mode cstyle; indent-width 4; replace-tabs on; 
@@ -0,0 +1,60 @@
+#ifndef STEEL_TERRAINBRUSH_H
+#define STEEL_TERRAINBRUSH_H
+
+#include <OgreCommon.h>
+
+#include "steeltypes.h"
+#include "terrain/TerrainManager.h"
+
+namespace Steel
+{
+    class UnitTestExecutionContext;
+
+    /**
+     * Height modification kernel behind TerrainManager::raiseTerrainAt.
+     * Only vertices within the brush bounding rectangle are visited, the shape function is picked once per stroke
+     * (through a template), and rows are processed with AVX or SSE (when the target has them) with a scalar tail.
+     */
+    class TerrainBrush
+    {
+    public:
+        /// A brush stroke, expressed in vertex units of the terrain it is applied to.
+        class Stroke
+        {
+        public:
+            float centerX;
+            float centerZ;
+            float radius;
+            /// World height of the brush center (target of RaiseMode::ABSOLUTE).
+            float centerHeight;
+            float intensity;
+            TerrainManager::RaiseMode mode;
+            TerrainManager::RaiseShape shape;
+        };
+
+        /**
+         * Applies the stroke to a size*size row major height array (first row at the bottom, as Ogre::Terrain's).
+         * Returns the rectangle of vertices that may have changed, right/bottom exclusive (as Ogre::Terrain::dirtyRect
+         * expects), empty if the brush does not touch the terrain.
+         */
+        static Ogre::Rect apply(float *heights, long size, Stroke const &stroke);
+
+        /// Expresses a world space brush (as given to TerrainManager::raiseTerrainAt) in the given terrain's vertex units.
+        static Stroke strokeFor(Ogre::Terrain *terrain, Ogre::Vector3 const &center, float intensity, float radius,
+                                TerrainManager::RaiseMode mode, TerrainManager::RaiseShape shape);
+
+        /// Smallest rectangle containing both (an empty rectangle being neutral).
+        static Ogre::Rect merge(Ogre::Rect const &a, Ogre::Rect const &b);
+
+        /// Name of the instruction set the kernel was built with.
+        static char const *simdName();
+    };
+
+    /// Checks the kernel against a straightforward per vertex version.
+    bool utest_TerrainBrush(UnitTestExecutionContext const *context);
+    /// Times large radius strokes.
+    bool utest_TerrainBrushSpeed(UnitTestExecutionContext const *context);
+}
+
+#endif // STEEL_TERRAINBRUSH_H
+// kate: indent-mode cstyle; indent-width 4; replace-tabs on;
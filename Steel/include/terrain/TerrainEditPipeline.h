@@ -0,0 +1,121 @@
+#ifndef STEEL_TERRAINEDITPIPELINE_H
+#define STEEL_TERRAINEDITPIPELINE_H
+
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "steeltypes.h"
+#include "terrain/TerrainBrush.h"
+
+namespace Ogre
+{
+    class Terrain;
+}
+
+namespace Steel
+{
+    /**
+     * Runs brush strokes on a worker thread, against a staging copy of each edited terrain's heights.
+     * Strokes are queued per terrain and coalesced until the worker is idle, then sent as a single batch.
+     * The worker computes new heights and blendmap values of the dirty areas; publishing them to Ogre and Bullet is
+     * left to the main thread (see TerrainManager::syncTerrainEdits). Ogre objects are never dereferenced by the worker.
+     * All methods are to be called from the main thread.
+     */
+    class TerrainEditPipeline
+    {
+    private:
+        TerrainEditPipeline(const TerrainEditPipeline &o);
+        TerrainEditPipeline &operator=(const TerrainEditPipeline &o);
+
+    public:
+        /// Strokes to apply to a terrain, in order.
+        class Job
+        {
+        public:
+            Job();
+
+            Ogre::Terrain *terrain;
+            long size;
+            long blendMapSize;
+            /// Blendmap rules of the terrain, empty if it has no rule based blendmaps.
+            TerrainManager::BlendRules rules;
+            /// Heights to seed the staging copy with, when there is none yet.
+            std::vector<float> initialHeights;
+            std::vector<TerrainBrush::Stroke> strokes;
+        };
+
+        /// Outcome of a job. Buffers are row major over their rectangle.
+        class Result
+        {
+        public:
+            Result();
+
+            Ogre::Terrain *terrain;
+            /// Dirty vertices, right/bottom exclusive.
+            Ogre::Rect rect;
+            std::vector<float> heights;
+            /// Dirty blendmap texels (image space), empty if the terrain has no rule based blendmaps.
+            Ogre::Rect texels;
+            /// Blendmap layers recomputed, and their values over texels.
+            std::vector<Ogre::uint8> layers;
+            std::vector<std::vector<float> > blends;
+        };
+
+        TerrainEditPipeline();
+        virtual ~TerrainEditPipeline();
+
+        /// Starts the worker.
+        void init();
+        /// Stops the worker, dropping queued strokes, unpublished results and staging copies.
+        void shutdown();
+
+        /// Adds a stroke to the terrain's pending job. A relative stroke repeating the previous one is merged into it.
+        void queue(Ogre::Terrain *terrain, long blendMapSize, TerrainManager::BlendRules const &rules,
+                   TerrainBrush::Stroke const &stroke);
+        /// Hands pending jobs to the worker, if it is idle. Returns true if something was submitted.
+        bool submit();
+        /**
+         * Moves the results of the last submission into the given vector, waiting for them if asked to.
+         * Returns false if there is nothing (yet) to collect.
+         */
+        bool collect(std::vector<Result> &results, bool wait);
+        /// Drops the staging copy of a terrain, which heights were modified outside of the pipeline. Waits for the worker.
+        void invalidate(Ogre::Terrain *terrain);
+        /// Same as invalidate, for all terrains.
+        void invalidateAll();
+
+        /// True if strokes are pending or being processed (never when the worker is not running).
+        bool hasWork() const;
+
+    private:
+        /// Worker thread main function.
+        void run();
+        /// Applies mJobs to the staging copies, filling mResults.
+        void process();
+        /// Blocks until the worker is done with the in flight submission, if any.
+        void waitIdle();
+
+        // main thread only
+        std::map<Ogre::Terrain *, Job> mPending;
+
+        // owned by the worker while a submission is in flight, by the main thread otherwise
+        std::vector<Job> mJobs;
+        std::vector<Result> mResults;
+        std::map<Ogre::Terrain *, std::vector<float> > mStaging;
+
+        std::thread mWorker;
+        mutable std::mutex mMutex;
+        std::condition_variable mCondition;
+        /// Set from submission to collection.
+        bool mInFlight;
+        /// Set by the worker when mResults are ready.
+        bool mDone;
+        bool mMustStop;
+    };
+}
+
+#endif // STEEL_TERRAINEDITPIPELINE_H
+// kate: indent-mode cstyle; indent-width 4; replace-tabs on;
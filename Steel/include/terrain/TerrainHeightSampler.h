@@ -0,0 +1,151 @@
+#ifndef STEEL_TERRAINHEIGHTSAMPLER_H
+#define STEEL_TERRAINHEIGHTSAMPLER_H
+
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <OgreCommon.h>
+#include <OgreVector3.h>
+#include <OgreMath.h>
+#include <OgreRay.h>
+
+#include "steeltypes.h"
+
+namespace Steel
+{
+    class UnitTestExecutionContext;
+
+    /**
+     * Read only copy of the terrain slots heights, for code that needs the ground under a position without going
+     * through Ogre or Bullet queries (drop placement, agents snapping/steering, ...).
+     * Tiles are immutable once published: edits (see updateTile) publish a new version of the tile, so that readers
+     * never lock nor see half written data. Writes are done by the main thread (TerrainManager keeps the sampler in sync
+     * with loads, edits and unloads); reads may happen from any thread, preferably through a Snapshot when sampling a lot.
+     * Heights are interpolated bilinearly between vertices (Ogre::Terrain interpolates over triangles, hence
+     * minor differences). Each tile also keeps a min/max pyramid of its heights, which rays are marched through
+     * without needing a render system (see Snapshot::intersectRay).
+     */
+    class TerrainHeightSampler
+    {
+    private:
+        TerrainHeightSampler(const TerrainHeightSampler &o);
+        TerrainHeightSampler &operator=(const TerrainHeightSampler &o);
+
+    public:
+        /// Ground properties at a position.
+        class Sample
+        {
+        public:
+            Ogre::Real height;
+            Ogre::Vector3 normal;
+            /// Angle between the ground and the horizontal plane.
+            Ogre::Radian slope;
+        };
+
+        /// Bounds of a tile's heights over square blocks of 2^n*2^n cells (n being the level).
+        class MinMaxLevel
+        {
+        public:
+            /// Blocks per side.
+            long side;
+            std::vector<float> minHeights;
+            std::vector<float> maxHeights;
+        };
+
+        /// A slot's heights, and where they lie in the world.
+        class Tile
+        {
+        public:
+            long slotX;
+            long slotY;
+            long size;
+            Ogre::Real worldSize;
+            /// World x of the first column.
+            Ogre::Real minX;
+            /// World z of the first row (rows go toward -z, as Ogre::Terrain's).
+            Ogre::Real maxZ;
+            /// World height of a 0 height vertex.
+            Ogre::Real baseHeight;
+            Ogre::Real verticesPerUnit;
+            std::vector<float> heights;
+            /// Level 0 bounds single cells, the last level the whole tile.
+            std::vector<MinMaxLevel> pyramid;
+        };
+        typedef std::vector<std::shared_ptr<Tile const> > Tiles;
+
+        /// Tiles as they were when the snapshot was taken. Cheap to copy, usable from any thread.
+        class Snapshot
+        {
+            friend class TerrainHeightSampler;
+        public:
+            Snapshot();
+            Snapshot(std::shared_ptr<Tiles const> const &tiles);
+
+            /// Sets height to the ground height at (x, z). Returns false if no tile is there.
+            bool height(Ogre::Real x, Ogre::Real z, Ogre::Real &height) const;
+            /// Same as height, with normal and slope.
+            bool sample(Ogre::Real x, Ogre::Real z, Sample &sample) const;
+            /// Ground height under each position (y is ignored), missing where no tile is. Returns the number of hits.
+            size_t heights(Ogre::Vector3 const *positions, size_t count, Ogre::Real *heights, Ogre::Real missing) const;
+            /// Same as heights, with normals and slopes. Samples of positions not over a tile are left untouched.
+            size_t samples(Ogre::Vector3 const *positions, size_t count, Sample *samples, bool *hits = nullptr) const;
+            /**
+             * Sets position to the first point where the ray meets the ground, if it does within maxDistance
+             * (0 for no limit, as Ogre::TerrainGroup::rayIntersects). Blocks of cells the ray passes above or below
+             * are skipped whole; cells left are intersected exactly.
+             */
+            bool intersectRay(Ogre::Ray const &ray, Ogre::Real maxDistance, Ogre::Vector3 &position) const;
+            /// Same as intersectRay, for each ray. Returns the number of hits.
+            size_t intersectRays(Ogre::Ray const *rays, size_t count, Ogre::Real maxDistance, Ogre::Vector3 *positions, bool *hits) const;
+
+            inline bool empty() const {return nullptr == mTiles || mTiles->empty();}
+
+        private:
+            /// Tile containing (x, z), trying the hint first.
+            Tile const *find(Ogre::Real x, Ogre::Real z, Tile const *hint) const;
+
+            std::shared_ptr<Tiles const> mTiles;
+        };
+
+        TerrainHeightSampler();
+        virtual ~TerrainHeightSampler();
+
+        /// Current tiles.
+        Snapshot snapshot() const;
+
+        // one off queries, see Snapshot
+        bool height(Ogre::Real x, Ogre::Real z, Ogre::Real &height) const;
+        bool sample(Ogre::Real x, Ogre::Real z, Sample &sample) const;
+        size_t heights(Ogre::Vector3 const *positions, size_t count, Ogre::Real *heights, Ogre::Real missing) const;
+        bool intersectRay(Ogre::Ray const &ray, Ogre::Real maxDistance, Ogre::Vector3 &position) const;
+
+        /**
+         * Publishes (replacing any previous one) a slot's tile, from its size*size heights (first row at the bottom,
+         * as Ogre::Terrain's), centered on position.
+         */
+        void setTile(long x, long y, long size, Ogre::Real worldSize, Ogre::Vector3 const &position, float const *heights);
+        /// Publishes a new version of a slot's tile, which heights (and bounds) are taken from the given array over rect only.
+        void updateTile(long x, long y, float const *heights, Ogre::Rect const &rect);
+        void removeTile(long x, long y);
+        void clear();
+
+    private:
+        /// Replaces the published tiles.
+        void publish(std::shared_ptr<Tiles const> const &tiles);
+
+        /// Guards mTiles (the pointer, not the tiles).
+        mutable std::mutex mMutex;
+        std::shared_ptr<Tiles const> mTiles;
+    };
+
+    /// Checks samples against vertex heights, and normals after a tile update.
+    bool utest_TerrainHeightSampler(UnitTestExecutionContext const *context);
+    /// Sampling throughput of worker threads.
+    bool utest_TerrainHeightSamplerThroughput(UnitTestExecutionContext const *context);
+    /// Checks pyramid ray marching against an exhaustive test of all cells, after an incremental update too.
+    bool utest_TerrainRayPyramid(UnitTestExecutionContext const *context);
+}
+
+#endif // STEEL_TERRAINHEIGHTSAMPLER_H
+// kate: indent-mode cstyle; indent-width 4; replace-tabs on;
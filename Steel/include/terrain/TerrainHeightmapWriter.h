@@ -0,0 +1,85 @@
+#ifndef STEEL_TERRAINHEIGHTMAPWRITER_H
+#define STEEL_TERRAINHEIGHTMAPWRITER_H
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <OgrePrerequisites.h>
+
+#include "steeltypes.h"
+
+namespace Steel
+{
+    /**
+     * Encodes and writes heightmap files on a worker thread, from copies of the heights taken at queue time.
+     * Files are written next to their destination, then renamed over it, so that a crash never leaves a truncated
+     * heightmap behind. Writes are done in queue order. All methods are to be called from the main thread.
+     */
+    class TerrainHeightmapWriter
+    {
+    private:
+        TerrainHeightmapWriter(const TerrainHeightmapWriter &o);
+        TerrainHeightmapWriter &operator=(const TerrainHeightmapWriter &o);
+
+    public:
+        typedef std::pair<long, long> SlotKey;
+
+        class Job
+        {
+        public:
+            SlotKey key;
+            Ogre::String path;
+            /// Heights of the slot as they were when queued, side*side.
+            std::vector<float> heights;
+            size_t side;
+            /// Edit revision of the slot the heights correspond to (see TerrainManager::HeightmapFile).
+            u32 revision;
+        };
+
+        class Done
+        {
+        public:
+            SlotKey key;
+            Ogre::String path;
+            u32 revision;
+            bool success;
+        };
+
+        TerrainHeightmapWriter();
+        virtual ~TerrainHeightmapWriter();
+
+        /// Starts the worker.
+        void init();
+        /// Writes whatever is queued, then stops the worker.
+        void shutdown();
+
+        /// Hands a job to the worker (its heights are moved).
+        void queue(Job &job);
+        /// Moves finished jobs into the given vector. Returns false if there was none.
+        bool collect(std::vector<Done> &done);
+        /// Blocks until all queued jobs are written.
+        void flush();
+
+        /// Synchronous version, used by the worker. Returns false (and logs why) on failure.
+        static bool write(Ogre::String const &path, float const *heights, size_t side);
+
+    private:
+        /// Worker thread main function.
+        void run();
+
+        std::thread mWorker;
+        std::mutex mMutex;
+        std::condition_variable mCondition;
+        std::deque<Job> mJobs;
+        std::vector<Done> mDone;
+        /// A job was popped and is being written.
+        bool mBusy;
+        bool mMustStop;
+    };
+}
+
+#endif // STEEL_TERRAINHEIGHTMAPWRITER_H
+// kate: indent-mode cstyle; indent-width 4; replace-tabs on;
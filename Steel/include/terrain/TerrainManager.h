@@ -1,6 +1,10 @@
 #ifndef STEEL_TERRAINMANAGER_H
 #define STEEL_TERRAINMANAGER_H
 
+#include <map>
+#include <mutex>
+#include <vector>
+
 #include <json/json.h>
 
 #include <OgreLight.h>
@@ -8,6 +12,7 @@
 #include <OgreFrameListener.h>
 #include <OgreTerrainGroup.h>
 
+#include "steeltypes.h"
 #include "tools/File.h"
 
 namespace Ogre
@@ -23,6 +28,11 @@ namespace Steel
     class Level;
     class TerrainManagerEventListener;
     class TerrainPhysicsManager;
+    class TerrainEditPipeline;
+    class TerrainPager;
+    class TerrainHeightSampler;
+    class TerrainHeightmapWriter;
+    class UnitTestExecutionContext;
     //class TerrainMaterialGenerator;
 
     class TerrainManager: public Ogre::FrameListener
@@ -78,7 +88,7 @@ namespace Steel
 
         inline Level *level() {return mLevel;}
 
-        /// adds and instanciate a slot.
+        /// adds and instanciate a slot (or hands it to the pager, when paging).
         void addTerrainSlot(TerrainManager::TerrainSlotData slot);
 
         /// takes a terrain and serialize its layers into the given json object.
@@ -112,6 +122,21 @@ namespace Steel
         Json::Value toJson();
         float *loadTerrainHeightmapFrom(Ogre::String filepath, int size);
         void saveTerrainHeightmapAs(long int x, long int y, Ogre::Terrain *instance, Ogre::String &heightmapPath);
+        void saveTerrainHeightmapAs(long int x, long int y, float const *heights, size_t side, Ogre::String &heightmapPath);
+        /**
+         * Reads and decodes a 16bpp heightmap file of the given size, without going through Ogre resource groups, hence
+         * usable from any thread (decoding itself is serialized, see imageCodecMutex). Returns an OGRE_ALLOC_T'd array (as Ogre::Terrain::ImportData::inputFloat expects),
+         * or nullptr if the file can't be read or does not have the expected size.
+         */
+        static float *readHeightmap(Ogre::String const &filepath, int size);
+        /// Heights of a flat terrain (see readHeightmap).
+        static float *flatHeightmap(int size);
+        /**
+         * Held around every Ogre::Image decode/encode call. Codec plugins (FreeImage, DevIL) are not guaranteed to be
+         * reentrant, and Ogre built without threading support does not lock its codec registry, so pager and writer
+         * threads only parallelize file io and pixel conversion.
+         */
+        static std::mutex &imageCodecMutex();
 
         enum class RaiseMode : unsigned int
         {
@@ -125,16 +150,58 @@ namespace Steel
             SINH,
             TRANGULAR
         };
+        /**
+         * Height based blendmap rule: the layer's blend value goes from 0 at minHeight up to 1 at
+         * minHeight+fadeDistance (a step if fadeDistance is 0). Read from the level file (key "blendRules").
+         */
+        class BlendRule
+        {
+        public:
+            Ogre::uint8 layer;
+            Ogre::Real minHeight;
+            Ogre::Real fadeDistance;
+        };
+        typedef std::vector<BlendRule> BlendRules;
+        /// Rules used when the level file does not define any.
+        static BlendRules defaultBlendRules();
+
+        /// A terrain modified by an edit, and the rectangle of its vertices that may have changed (right/bottom exclusive).
+        class TerrainEdit
+        {
+        public:
+            Ogre::Terrain *terrain;
+            Ogre::Rect rect;
+        };
+        typedef std::vector<TerrainEdit> TerrainEdits;
+
         /** Raise all terrain vertices in an round shaped area centered at the given position (terraCenter) (world coords)
          * and of the given radius, by a decreasing value starting at the given value at the center, and reaching 0
          * at radius.
-         * Returns slot coordinaes of terrains that were modified in the process.
+         * Returns terrains that were modified in the process, along with their dirty rectangles (see TerrainBrush).
+         */
+        TerrainEdits raiseTerrainAt(Ogre::Vector3 terraCenter,
+                                    Ogre::Real intensity,
+                                    Ogre::Real radius,
+                                    RaiseMode rmode = RaiseMode::ABSOLUTE,
+                                    RaiseShape rshape = RaiseShape::UNIFORM);
+
+        /**
+         * Same as raiseTerrainAt, but the modification is done in the background: the stroke is queued, coalesced with
+         * other strokes of the frame, applied by a worker thread and published at the next syncTerrainEdits that finds
+         * it done. Strokes are applied in order.
+         */
+        void queueRaiseTerrainAt(Ogre::Vector3 terraCenter,
+                                 Ogre::Real intensity,
+                                 Ogre::Real radius,
+                                 RaiseMode rmode = RaiseMode::ABSOLUTE,
+                                 RaiseShape rshape = RaiseShape::UNIFORM);
+        /**
+         * Publishes terrain edits finished by the background worker to Ogre and Bullet, then hands it strokes queued
+         * since. Does not block. Called once per frame by the engine, before the level update.
          */
-        Ogre::TerrainGroup::TerrainList raiseTerrainAt(Ogre::Vector3 terraCenter,
-                Ogre::Real intensity,
-                Ogre::Real radius,
-                RaiseMode rmode = RaiseMode::ABSOLUTE,
-                RaiseShape rshape = RaiseShape::UNIFORM);
+        void syncTerrainEdits();
+        /// Waits for all queued strokes to be applied and published. Returns terrains modified since the last call.
+        std::set<Ogre::Terrain *> flushTerrainEdits();
 
         /// take a terrain slot seralization and return its deserialized version
         bool terrainSlotFromJson(Json::Value &terrainSlotValue, Steel::TerrainManager::TerrainSlotData &terrainSlot);
@@ -144,9 +211,36 @@ namespace Steel
 
         /// Recompute blendmaps according to rules
         void updateBlendMaps(Ogre::Terrain *terrain);
+        /// Recompute blendmap texels depending on the given vertices (right/bottom exclusive), and upload only those.
+        void updateBlendMaps(Ogre::Terrain *terrain, Ogre::Rect const &vertices);
+        /// Rules applying to the given terrain (the ones which layer it has), empty if it is not rule blended.
+        BlendRules blendRulesFor(Ogre::Terrain *terrain) const;
+        inline BlendRules const &blendRules() const {return mBlendRules;}
+        /**
+         * Evaluates blendmap rules over the given texel rectangle (image space) of a terrain with the given heights
+         * (size*size, first row at the bottom). outputs[i] receives rule i's values, and points at the rectangle's
+         * top left texel in a row major buffer of the given stride.
+         * Does not touch Ogre objects, hence usable from any thread.
+         */
+        static void computeBlendMaps(float const *heights, long size, long blendMapSize, Ogre::Rect const &texels,
+                                     BlendRules const &rules, float *const *outputs, long stride);
+        /// Same as computeBlendMaps, large rectangles being split in bands of rows evaluated on parallel threads.
+        static void computeBlendMapsParallel(float const *heights, long size, long blendMapSize, Ogre::Rect const &texels,
+                                             BlendRules const &rules, float *const *outputs, long stride);
+        /// Blendmap texels (image space) depending on a rectangle of vertices (both right/bottom exclusive).
+        static Ogre::Rect blendMapRect(Ogre::Rect const &vertices, long size, long blendMapSize);
 
         /// Recompute heightmap for the given terrain
         void updateHeightmap(Ogre::Terrain *terrain);
+
+        /// Defines a slot with the given heights (ownership is taken) and loads it, in the background if not blocking.
+        void loadTerrainSlot(TerrainSlotData const &slot, float *heights, bool blocking);
+        /// A terrain was (re)loaded by the pager.
+        void onPagedTerrainLoaded(Ogre::Terrain *terrain);
+        /// Publishes pending background edits, and forgets about the terrain's edit state (it is going to be unloaded).
+        void releaseTerrainEdits(Ogre::Terrain *terrain);
+        /// Drops a slot's Ogre and physics terrains.
+        void removeTerrainSlot(long x, long y);
         
         /// Returns the number of terrains currently defined
         bool hasLoadedTerrains() const;
@@ -154,6 +248,9 @@ namespace Steel
         // getters
         inline Ogre::TerrainGroup *const terrainGroup() const {return mTerrainGroup;}
         inline TerrainPhysicsManager *const terrainPhysicsMan()const {return mTerrainPhysicsMan;}
+        inline TerrainPager *const pager()const {return mPager;}
+        /// Thread safe height/normal queries over a copy of the loaded slots heights.
+        inline TerrainHeightSampler *const heightSampler()const {return mHeightSampler;}
         inline Ogre::SceneManager *const sceneManager()const {return mSceneManager;}
 
     protected:
@@ -170,6 +267,46 @@ namespace Steel
         /// Calls event listeners' callback methods.
         void yieldEvent(LoadingState state);
 
+        /// Publishes results of the edit pipeline (optionally waiting for them), and submits pending strokes.
+        void publishTerrainEdits(bool wait);
+        /// Flags a terrain which heights have been modified in place.
+        void onHeightsModified(Ogre::Terrain *terrain, Ogre::Rect const &rect);
+        /// (Re)publishes a loaded terrain's heights to the sampler.
+        void updateHeightSampler(Ogre::Terrain *terrain);
+
+        /// Position slots are paged around.
+        Ogre::Vector3 pagingPosition();
+
+        /// Serialization of a loaded slot (saves its heightmap if needed, see saveHeightmap).
+        Json::Value terrainSlotToJson(long x, long y, Ogre::Terrain *terrain, Ogre::String &heightmapPath);
+
+        /// Save state of a slot's heightmap file.
+        class HeightmapFile
+        {
+        public:
+            /// File the slot's heights are (or are being) saved to. Blank if there is none.
+            Ogre::String path;
+            /// Incremented by each edit of the slot.
+            u32 revision;
+            /// Revision last handed to the writer.
+            u32 queuedRevision;
+            /// Revision the file is known to hold.
+            u32 savedRevision;
+        };
+        typedef std::pair<long, long> SlotKey;
+
+        /// Where the slot's heightmap goes, in this level's directory.
+        Ogre::String heightmapPathOf(long x, long y) const;
+        /// Slot is (re)defined from the given heightmap (blank for flat).
+        void resetHeightmapFile(long x, long y, Ogre::String const &path);
+        /**
+         * Returns the path of the heightmap holding the slot's current heights. If the file is missing, out of date, or
+         * outside of this level's directory (loaded from another level), a copy of the heights is handed to the background writer, and the path it will be written to is returned.
+         */
+        Ogre::String saveHeightmap(long x, long y, float const *heights, size_t side);
+        /// Processes heightmap writes finished by the writer.
+        void collectHeightmapWrites();
+
         // not owned
         Level *mLevel;
         Ogre::SceneManager *mSceneManager;
@@ -184,8 +321,26 @@ namespace Steel
         bool mTerrainsImported;
         File mPath;
         TerrainPhysicsManager *mTerrainPhysicsMan;
+        /// Background terrain edits.
+        TerrainEditPipeline *mEditPipeline;
+        /// Terrains modified by the edit pipeline since the last flushTerrainEdits.
+        std::set<Ogre::Terrain *> mEditedTerrains;
+        /// Camera based slot loading, when enabled (see TerrainPager::LOAD_DISTANCE_SETTING).
+        TerrainPager *mPager;
+        /// Copy of loaded terrains heights, for queries from any thread.
+        TerrainHeightSampler *mHeightSampler;
+        /// Background heightmap saving.
+        TerrainHeightmapWriter *mHeightmapWriter;
+        std::map<SlotKey, HeightmapFile> mHeightmapFiles;
+        /// Height based blendmap rules, applied to all terrains.
+        BlendRules mBlendRules;
         //TerrainMaterialGenerator *mTerrainMaterialGenerator;
     };
+
+    /// Checks banded and sub-rectangle blendmap evaluation against a full serial pass.
+    bool utest_BlendMapRules(UnitTestExecutionContext const *context);
+    /// Times serial, banded and sub-rectangle blendmap evaluation of 1024^2 maps.
+    bool utest_BlendMapRulesSpeed(UnitTestExecutionContext const *context);
 }
 #endif // STEEL_TERRAINMANAGER_H
 // kate: indent-mode cstyle; indent-width 4; replace-tabs on; 
@@ -0,0 +1,158 @@
+#ifndef STEEL_TERRAINPAGER_H
+#define STEEL_TERRAINPAGER_H
+
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <OgreVector3.h>
+
+#include "steeltypes.h"
+#include "terrain/TerrainManager.h"
+
+namespace Ogre
+{
+    class Terrain;
+}
+
+namespace Steel
+{
+    class ConfigFile;
+    class UnitTestExecutionContext;
+
+    /**
+     * Loads and unloads terrain slots around a position (the camera's), instead of building them all up front.
+     * Heightmaps are read by worker threads (decoding is serialized, see TerrainManager::imageCodecMutex), Ogre prepares terrains in its own work queue, and only
+     * the final load step runs on the main thread. Physics terrains are attached and detached (see
+     * TerrainPhysicsManager::activateTerrainFor) within a smaller distance. Slots are unloaded a bit further away than
+     * they are loaded, so that moving back and forth around a boundary does not thrash.
+     * Distances are measured on the horizontal plane, from the position to the closest point of a slot.
+     */
+    class TerrainPager
+    {
+    private:
+        TerrainPager(const TerrainPager &o);
+        TerrainPager &operator=(const TerrainPager &o);
+
+    public:
+        /// Slots closer than that get loaded. 0 (default) disables paging: all slots are built at level load.
+        static const Ogre::String LOAD_DISTANCE_SETTING;
+        static const float DEFAULT_LOAD_DISTANCE;
+        /// Loaded slots closer than that have their physics terrain attached.
+        static const Ogre::String PHYSICS_DISTANCE_SETTING;
+        static const float DEFAULT_PHYSICS_DISTANCE;
+        /// Unload distances, as a factor of load distances (> 1).
+        static const Ogre::String HYSTERESIS_SETTING;
+        static const float DEFAULT_HYSTERESIS;
+        /// Number of heightmap reading threads.
+        static const Ogre::String THREAD_COUNT_SETTING;
+        static const u32 DEFAULT_THREAD_COUNT;
+
+        enum class SlotState : unsigned int
+        {
+            /// Nothing in memory (except unsaved heights, see Slot::heights).
+            UNLOADED = 0,
+            /// Heightmap being read by a worker.
+            READING,
+            /// Heights in memory, waiting to be handed to Ogre.
+            READ,
+            /// Defined in the terrain group, being prepared/loaded by Ogre.
+            LOADING,
+            LOADED
+        };
+
+        class Slot
+        {
+        public:
+            Slot();
+
+            TerrainManager::TerrainSlotData data;
+            SlotState state;
+            /// READ: heights given to Ogre at load (OGRE_ALLOC_T'd, Ogre frees them).
+            float *readHeights;
+            /// Heights of a slot that was modified, then unloaded: the heightmap file is out of date.
+            std::vector<float> heights;
+            /// Heights were modified since the slot was loaded.
+            bool modified;
+            bool physicsAttached;
+        };
+        typedef std::pair<long, long> SlotKey;
+        typedef std::map<SlotKey, Slot> Slots;
+
+        TerrainPager();
+        virtual ~TerrainPager();
+
+        /// Reads settings. Paging is on if the load distance is positive, in which case workers are started.
+        void init(TerrainManager *terrainMan, ConfigFile const &config);
+        /// Stops workers, and forgets all slots. Does not touch Ogre terrains.
+        void shutdown();
+
+        inline bool enabled() const {return mLoadDistance > .0f;}
+        inline Slots const &slots() const {return mSlots;}
+
+        /// Declares a slot, which will be loaded when needed.
+        void addSlot(TerrainManager::TerrainSlotData const &slot);
+        /**
+         * Loads/unloads slots around the given position, and collects finished reads. Main thread only.
+         * If blocking, slots within load distance are read and loaded before returning (used at level load).
+         */
+        void update(Ogre::Vector3 const &position, bool blocking = false);
+        /// Flags a loaded terrain as modified, so that its heights survive an unload.
+        void onTerrainModified(Ogre::Terrain *terrain);
+        /// The slot's heights were saved to the given file, which is now its heightmap.
+        void onHeightmapSaved(SlotKey const &key, Ogre::String const &heightmapPath);
+
+    private:
+        class ReadRequest
+        {
+        public:
+            SlotKey key;
+            Ogre::String path;
+            int size;
+        };
+
+        class ReadResult
+        {
+        public:
+            SlotKey key;
+            float *heights;
+        };
+
+        /// Worker threads main function.
+        void run();
+        /// Distance from the position to the closest point of the slot, on the XZ plane.
+        float distanceTo(Slot const &slot, Ogre::Vector3 const &position) const;
+        /// Fills slot.readHeights from memory or file, on the calling thread.
+        void readNow(Slot &slot);
+        void requestRead(Slot &slot);
+        /// Hands read heights to Ogre.
+        void load(Slot &slot, bool blocking);
+        /// Drops the Ogre and physics terrains of a LOADED slot.
+        void unload(Slot &slot);
+
+        // not owned
+        TerrainManager *mTerrainMan;
+
+        // owned
+        Slots mSlots;
+        float mLoadDistance;
+        float mPhysicsDistance;
+        float mHysteresis;
+
+        std::vector<std::thread> mWorkers;
+        std::mutex mMutex;
+        std::condition_variable mCondition;
+        std::deque<ReadRequest> mRequests;
+        std::vector<ReadResult> mResults;
+        bool mMustStop;
+    };
+
+    /// Benchmarks paged level start time, for a small and a large slot grid.
+    bool utest_TerrainPagerStartup(UnitTestExecutionContext const *context);
+}
+
+#endif // STEEL_TERRAINPAGER_H
+// kate: indent-mode cstyle; indent-width 4; replace-tabs on;
@@ -6,6 +6,7 @@
 
 #include "steeltypes.h"
 #include "terrain/TerrainManagerEventListener.h"
+#include "terrain/PhysicsStepListener.h"
 
 namespace Ogre
 {
@@ -18,10 +19,14 @@ namespace BtOgre
 }
 
 class btHeightfieldTerrainShape;
+class btConstraintSolverPoolMt;
+class btITaskScheduler;
 
 namespace Steel
 {
     class TerrainManager;
+    class ConfigFile;
+    class UnitTestExecutionContext;
 
     class TerrainPhysicsManager: public TerrainManagerEventListener, Ogre::FrameListener
     {
@@ -29,25 +34,99 @@ namespace Steel
         TerrainPhysicsManager(const TerrainPhysicsManager &other);
         virtual TerrainPhysicsManager &operator=(const TerrainPhysicsManager &other);
         virtual bool operator==(const TerrainPhysicsManager &other) const;
+        /// Heightfield shape which height range can grow after construction.
+        class HeightfieldShape;
+        friend bool utest_QuantizedHeightfield(UnitTestExecutionContext const *context);
         class TerrainPhysics
         {
         public:
             TerrainPhysics();
             virtual ~TerrainPhysics();
             
-            void init(float *heightfieldData, btHeightfieldTerrainShape *terrainShape, btDefaultMotionState *motionState, btRigidBody *body);
+            void init(float *heightfieldData, short *quantizedData, HeightfieldShape *terrainShape, btDefaultMotionState *motionState, btRigidBody *body);
             void shutdown(btDynamicsWorld *const world);
             
+            /// Mirrored heights, or nullptr if quantized.
             float *mHeightfieldData;
-            btHeightfieldTerrainShape *mTerrainShape;
+            /// Mirrored heights, quantized over [mMinHeight, mMaxHeight], or nullptr.
+            short *mQuantizedData;
+            HeightfieldShape *mTerrainShape;
             btDefaultMotionState *mMotionState;
             btRigidBody *mBody;
+            /// Height range of the shape. Only grows (shrinking it would need a full scan). Padded when quantized.
+            float mMinHeight;
+            float mMaxHeight;
         };
 
     public:
+        /// Duration of a physics substep, in seconds.
+        static const Ogre::String FIXED_TIMESTEP_SETTING;
+        static const float DEFAULT_FIXED_TIMESTEP;
+        /**
+         * Maximum number of substeps run in a single frame. When a frame is too long to be caught up
+         * in that many substeps, the remaining time is dropped: the simulation slows down instead of
+         * spiraling into ever longer frames.
+         */
+        static const Ogre::String MAX_SUBSTEPS_SETTING;
+        static const u32 DEFAULT_MAX_SUBSTEPS;
+        /**
+         * Number of threads used by the physics world. 1 (default) builds a serial world, more builds a
+         * btDiscreteDynamicsWorldMt running on bullet's task scheduler. Read when the world is built
+         * (ie at level creation).
+         */
+        static const Ogre::String THREAD_COUNT_SETTING;
+        static const u32 DEFAULT_THREAD_COUNT;
+        /**
+         * If true, physics heightfields store 16 bits heights, quantized over the slot's height range (plus some
+         * headroom), instead of a float copy of Ogre's heights. Halves their memory, for an error of less than
+         * range/131068. Edits that go out of the range requantize the whole slot. Read when terrains are created.
+         */
+        static const Ogre::String QUANTIZED_HEIGHTFIELDS_SETTING;
+        static const bool DEFAULT_QUANTIZED_HEIGHTFIELDS;
+
+        /// Bullet objects a dynamics world is made of.
+        class WorldParts
+        {
+        public:
+            btBroadphaseInterface *broadphase = nullptr;
+            btDefaultCollisionConfiguration *collisionConfig = nullptr;
+            btCollisionDispatcher *dispatcher = nullptr;
+            /// Only set for multithreaded worlds.
+            btConstraintSolverPoolMt *solverPool = nullptr;
+            btSequentialImpulseConstraintSolver *solver = nullptr;
+            btDiscreteDynamicsWorld *world = nullptr;
+            /// Threads the world actually runs on.
+            u32 threadCount = 1;
+        };
+        /**
+         * Builds an empty world running on the given number of threads, or as many as bullet's scheduler has. Falls
+         * back to a serial world (and returns false) if bullet was not built with thread support.
+         */
+        static bool buildWorld(WorldParts &parts, u32 threadCount);
+        /// Deletes the parts of a world. Objects still in the world are not deleted.
+        static void destroyWorld(WorldParts &parts);
+
+        /// Physics stepping figures.
+        class StepStats
+        {
+        public:
+            /// substeps run during the last update
+            u32 lastSubsteps = 0;
+            /// highest lastSubsteps seen so far
+            u32 peakSubsteps = 0;
+            /// substeps run since startup
+            u64 totalSubsteps = 0L;
+            /// substeps skipped because of the max substeps policy, since startup
+            u64 droppedSubsteps = 0L;
+            /// number of updates since startup
+            u64 updateCount = 0L;
+        };
+
         TerrainPhysicsManager(TerrainManager *terrainMan);
         virtual ~TerrainPhysicsManager();
 
+        void loadConfig(ConfigFile const &config);
+
         /// Instanciates a physics terrain. See bullet terrain demo for reference.
         bool createTerrainFor(Ogre::Terrain *ogreTerrain);
         /// Deletes a physics terrain
@@ -69,11 +148,23 @@ namespace Steel
         /// Returns whether debug draw of physic shapes is activated
         bool getDebugDraw();
 
-        /// Main loop iteration
+        /**
+         * Main loop iteration. The simulation is advanced in fixed substeps, the remainder being used
+         * to interpolate bodies transforms (forwarded to scene nodes by their motion states).
+         */
         void update(float timestep);
 
+        /// The given listener will be notified before each physics substep.
+        void addPhysicsStepListener(PhysicsStepListener *listener);
+        void removePhysicsStepListener(PhysicsStepListener *listener);
+
         /// Update height values
         void updateHeightmap(Ogre::Terrain *terrain);
+        /**
+         * Update height values within the given rectangle of Ogre vertices (right/bottom exclusive, see
+         * TerrainManager::raiseTerrainAt). Only those rows are copied, and only bodies above the rectangle are woken up.
+         */
+        void updateHeightmap(Ogre::Terrain *terrain, Ogre::Rect const &rect);
 
         // getters
         inline btDynamicsWorld *world()
@@ -84,13 +175,23 @@ namespace Steel
         /// Returns the PhysicsTerrain representing the given terrain.
         TerrainPhysics *getTerrainFor(Ogre::Terrain *ogreTerrain) const;
 
+        inline StepStats const &stepStats() const {return mStepStats;}
+        inline float fixedTimestep() const {return mFixedTimestep;}
+        inline u32 maxSubsteps() const {return mMaxSubsteps;}
+
         // setters
         /// De/activate debug draw of physic shapes
         void setDebugDraw(bool flag);
         void setWorldGravity(Ogre::Vector3 const &gravity);
+        void setFixedTimestep(float value);
+        void setMaxSubsteps(u32 value);
 
     protected:
-        void updateHeightmap(Ogre::Terrain *oterrain, TerrainPhysics *pterrain);
+        void updateHeightmap(Ogre::Terrain *oterrain, TerrainPhysics *pterrain, Ogre::Rect const &rect);
+        /// World transform of a terrain body, which origin is at the middle of its height range.
+        btTransform terrainTransform(Ogre::Terrain *oterrain, TerrainPhysics *pterrain);
+        /// Bullet internal pre-tick callback, forwards to PhysicsStepListener's.
+        static void preTickCallback(btDynamicsWorld *world, btScalar timeStep);
         // not owned
         /// owner
         TerrainManager *mTerrainMan;
@@ -99,13 +200,27 @@ namespace Steel
         std::map<Ogre::Terrain *, TerrainPhysics *> mTerrains;
 
         btDynamicsWorld *mWorld;
-        btSequentialImpulseConstraintSolver *mSolver;
-        btCollisionDispatcher *mDispatcher;
-        btDefaultCollisionConfiguration *mCollisionConfig;
-        btBroadphaseInterface *mBroadphase;
+        /// What mWorld is made of.
+        WorldParts mWorldParts;
         BtOgre::DebugDrawer *mDebugDrawer;
 
+        /// See FIXED_TIMESTEP_SETTING
+        float mFixedTimestep;
+        /// See MAX_SUBSTEPS_SETTING
+        u32 mMaxSubsteps;
+        StepStats mStepStats;
+        std::set<PhysicsStepListener *> mStepListeners;
+        /// See QUANTIZED_HEIGHTFIELDS_SETTING
+        bool mQuantizedHeightfields;
+
+        /// Shared by all multithreaded worlds. Created on first use, never deleted.
+        static btITaskScheduler *sTaskScheduler;
     };
+
+    /// Steps a stress scene with an increasing number of threads, and logs the step duration for each.
+    bool utest_PhysicsThreadScaling(UnitTestExecutionContext const *context);
+    /// Bounds the error of quantized heightfields, after creation and after a dirty rectangle update.
+    bool utest_QuantizedHeightfield(UnitTestExecutionContext const *context);
 }
 #endif // STEEL_TERRAINPHYSICSMANAGER_H
 // kate: indent-mode cstyle; indent-width 4; replace-tabs on; 
@@ -0,0 +1,122 @@
+#ifndef STEEL_BINARYLEVELFILE_H
+#define STEEL_BINARYLEVELFILE_H
+
+#include <string>
+#include <vector>
+
+#include <json/json.h>
+#include <OgrePrerequisites.h>
+
+#include "steeltypes.h"
+
+namespace Steel
+{
+    class UnitTestExecutionContext;
+
+    /**
+     * Binary counterpart of a level's json save (see Level::serialize), read in place from a memory mapped file.
+     *
+     * The level root is cut into sections: "agents", one "managers/<ModelType>" per model manager, and "level" with
+     * everything else (name, camera, terrain, ...). Sections keyed by ids (agents, most managers) are stored as a
+     * table of fixed size records (id, offset, size), which payloads can be decoded one at a time without building the
+     * rest of the level; other sections are stored whole. Values keep their json type (strings stay strings, ints stay
+     * ints, reals are stored bit exact), so that converting to binary and back gives the same json.
+     *
+     * Records of agents, OgreModels and PhysicsModels start with typed fields stored at fixed offsets (model ids,
+     * transforms, physics properties) instead of generic values. Text fields are only typed if
+     * they format back the same way (as Ogre::StringConverter writes them), and come back as that same text; fields
+     * of another form are kept as generic values.
+     *
+     * Layout (host byte order, checked at load time through the marker):
+     * - header: magic, version, byte order marker, section count (u32 each),
+     * - section table: kind, name size (u32), name offset, data offset, data size (u64),
+     * - section names and data.
+     * Record sections: record count (u64), then (id, offset, size) (u64 each, offset relative to the section), then
+     * payloads. Payloads of typed records: present fields mask, text fields mask (u32 each), all typed fields (u64 ids,
+     * f32 vector components, f64 reals, u8 bools), then the other fields as a generic object. Version 1 files (all
+     * records generic) are still read.
+     */
+    class BinaryLevelFile
+    {
+    private:
+        BinaryLevelFile(const BinaryLevelFile &o);
+        BinaryLevelFile &operator=(const BinaryLevelFile &o);
+
+    public:
+        /// Typed fields of a records section.
+        class RecordLayout;
+
+        static u32 const MAGIC;
+        static u32 const VERSION;
+
+        static char const *const LEVEL_SECTION;
+        static char const *const AGENTS_SECTION;
+        /// Prefix of model manager sections, followed by the ModelType name.
+        static char const *const MANAGERS_SECTION_PREFIX;
+
+        enum class SectionKind : u32
+        {
+            TREE = 0,
+            RECORDS = 1
+        };
+
+        class Section
+        {
+        public:
+            Ogre::String name;
+            SectionKind kind;
+            /// From the start of the file.
+            u64 offset;
+            u64 size;
+            /// Records sections only.
+            u64 recordCount;
+            /// Typed fields of the records, nullptr if they are all generic.
+            RecordLayout const *layout;
+        };
+
+        BinaryLevelFile();
+        virtual ~BinaryLevelFile();
+
+        /// Maps the file at path. Returns false (and logs why) if it cannot be read or is not a valid level file.
+        bool open(Ogre::String const &path);
+        /// Same as open, over a buffer owned by the caller, that must outlive this object (or the next open/close).
+        bool open(char const *data, size_t size);
+        void close();
+
+        inline std::vector<Section> const &sections() const {return mSections;}
+        /// Section of the given name, or nullptr.
+        Section const *section(Ogre::String const &name) const;
+
+        /// Decodes a whole section. Record sections are decoded as an object keyed by the records ids.
+        bool readSection(Section const &section, Json::Value &value) const;
+        /// Decodes a single record of a records section.
+        bool readRecord(Section const &section, u64 index, u64 &id, Json::Value &value) const;
+        /// Decodes the whole file back into the level root it was made from.
+        bool toJson(Json::Value &root) const;
+
+        /// Encodes a level root (as made by Level::serialize) into bytes.
+        static void fromJson(Json::Value const &root, std::string &bytes);
+        /// Writes bytes to path, through a temporary file renamed over it. Returns false (and logs why) on failure.
+        static bool write(Ogre::String const &path, std::string const &bytes);
+
+    private:
+        bool parseHeader();
+
+        /// Mapped file, or caller's buffer.
+        char const *mData;
+        size_t mSize;
+        /// Set if mData was mapped by open(path).
+        bool mMapped;
+        /// Used where mapping is not available.
+        std::vector<char> mBuffer;
+        std::vector<Section> mSections;
+    };
+
+    /// Json -> binary -> json round trip of a synthetic level.
+    bool utest_BinaryLevelFile(UnitTestExecutionContext const *context);
+    /// Load/save times and sizes of a large synthetic level, in json and binary.
+    bool utest_BinaryLevelFileSpeed(UnitTestExecutionContext const *context);
+}
+
+#endif // STEEL_BINARYLEVELFILE_H
+// kate: indent-mode cstyle; indent-width 4; replace-tabs on;
@@ -0,0 +1,97 @@
+#ifndef STEEL_DEBUGLINESBATCH_H
+#define STEEL_DEBUGLINESBATCH_H
+
+#include <vector>
+
+#include <OgreColourValue.h>
+#include <OgreRenderOperation.h>
+
+#include "steeltypes.h"
+#include "tools/DynamicRenderable.h"
+
+namespace Steel
+{
+    /**
+     * Single renderable holding all debug lines of a level, in one growable vertex buffer.
+     * Lines come in 2 flavors:
+     * - persistent lines, identified by a handle, that stay until removed (ie location links),
+     * - transient lines, that only live until the next flush (ie BT navigation feedback).
+     * Only the range of vertices modified since the last flush is uploaded to the hardware buffer.
+     */
+    class DebugLinesBatch : public DynamicRenderable
+    {
+    public:
+        typedef u32 LineId;
+        static const LineId INVALID_LINE_ID;
+
+        DebugLinesBatch();
+        virtual ~DebugLinesBatch();
+
+        /// Mandatory call before usage.
+        void init(Ogre::String const &resourceGroup);
+
+        /// Adds a persistent line and returns its handle.
+        LineId addLine(Ogre::Vector3 const &from, Ogre::Vector3 const &to, Ogre::ColourValue const &color = Ogre::ColourValue::White);
+        /// Moves the ends of an existing persistent line. Returns false if the handle is not valid.
+        bool setLine(LineId id, Ogre::Vector3 const &from, Ogre::Vector3 const &to);
+        /// Removes a persistent line. Its handle becomes invalid (and can be reused by a later addLine).
+        void removeLine(LineId id);
+        inline bool isValid(LineId id) const {return id < mLineToSlot.size() && INVALID_SLOT != mLineToSlot[id];}
+
+        /// Adds a line that is drawn until the next flush only.
+        void addTransientLine(Ogre::Vector3 const &from, Ogre::Vector3 const &to, Ogre::ColourValue const &color = Ogre::ColourValue::White);
+
+        /// Removes all lines.
+        void clear();
+
+        /// Uploads modified vertices to the hardware buffer, and drops transient lines. To be called once per frame.
+        void flush();
+
+        /// Number of lines drawn (persistent and transient) since last flush.
+        inline size_t linesCount() const {return mLastFlushedVertexCount / 2;}
+
+    protected:
+        /// Implementation DynamicRenderable, position + color decl.
+        virtual void createVertexDeclaration();
+        /// Implementation DynamicRenderable, pushes the dirty vertex range to the hardware buffer.
+        virtual void fillHardwareBuffers();
+
+    private:
+        /// Per vertex data, as uploaded.
+        struct Vertex
+        {
+            float x, y, z;
+            Ogre::RGBA color;
+        };
+        static const u32 INVALID_SLOT;
+        static u32 sNextId;
+
+        void writeLine(size_t slot, Ogre::Vector3 const &from, Ogre::Vector3 const &to);
+        void writeVertex(Vertex &vertex, Ogre::Vector3 const &pos);
+        /// Extends the dirty range to include the given vertices.
+        void markDirty(size_t firstVertex, size_t lastVertex);
+
+        u32 mId;
+        Ogre::MaterialPtr mMaterial;
+
+        /// Persistent lines vertices (2 per line, contiguous), followed by transient ones.
+        std::vector<Vertex> mVertices;
+        /// Number of persistent lines, ie index of the first transient vertex / 2.
+        size_t mPersistentCount;
+
+        /// LineId -> slot in mVertices (in lines).
+        std::vector<u32> mLineToSlot;
+        /// slot -> LineId, used to patch handles when slots get swapped on removal.
+        std::vector<LineId> mSlotToLine;
+        /// Available handles.
+        std::vector<LineId> mFreeLineIds;
+
+        /// Dirty vertex range, [mDirtyBegin, mDirtyEnd[.
+        size_t mDirtyBegin;
+        size_t mDirtyEnd;
+        size_t mLastFlushedVertexCount;
+    };
+}
+
+#endif
+// kate: indent-mode cstyle; indent-width 4; replace-tabs on;
@@ -103,6 +103,9 @@ namespace Steel
         /// Returns true if the path points to a regular file;
         bool isFile() const;
 
+        /// Last modification time, in microseconds since the epoch. 0 if the file can't be status'ed.
+        u64 lastModified() const;
+
         /// Returns true is the file exists, and is readable and writable.
         bool isValid() const;
 
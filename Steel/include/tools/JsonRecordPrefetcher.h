@@ -0,0 +1,76 @@
+#ifndef STEEL_JSONRECORDPREFETCHER_H
+#define STEEL_JSONRECORDPREFETCHER_H
+
+#include <memory>
+#include <vector>
+
+#include <json/json.h>
+#include <OgrePrerequisites.h>
+
+#include "steeltypes.h"
+
+namespace Steel
+{
+    class UnitTestExecutionContext;
+
+    /**
+     * Parses members of json objects (records) on worker threads, ahead of their consumption by the main thread.
+     * Each object is given by a file and the position of the object in it (see JsonStreamReader::position), and is
+     * parsed by its own worker, through its own JsonStreamReader, into a queue of at most maxQueuedRecords records:
+     * workers only run ahead of the consumer by that much, which bounds memory use.
+     * A null value is an object without members. Methods are to be called from a single (main) thread.
+     */
+    class JsonRecordPrefetcher
+    {
+    private:
+        JsonRecordPrefetcher(const JsonRecordPrefetcher &o);
+        JsonRecordPrefetcher &operator=(const JsonRecordPrefetcher &o);
+
+        class Channel;
+
+    public:
+        static const size_t DEFAULT_MAX_QUEUED_RECORDS;
+
+        /// A member of a prefetched object.
+        class Record
+        {
+        public:
+            Ogre::String key;
+            Json::Value value;
+        };
+
+        typedef size_t ChannelId;
+
+        JsonRecordPrefetcher(size_t maxQueuedRecords = DEFAULT_MAX_QUEUED_RECORDS);
+        virtual ~JsonRecordPrefetcher();
+
+        /// Starts parsing the object at position in the file at path.
+        ChannelId add(Ogre::String const &path, u64 position);
+        /**
+         * Moves the next member of the channel's object into record, waiting for it to be parsed if needed.
+         * Returns false once all members were consumed, or if parsing failed (see ok).
+         */
+        bool next(ChannelId channel, Record &record);
+        /// False if the channel's object could not be parsed.
+        bool ok(ChannelId channel);
+        Ogre::String errorMessage(ChannelId channel);
+
+        /// Stops all workers, whether they are done or not.
+        void stop();
+
+    private:
+        /// Worker main function.
+        void run(Channel *channel);
+
+        size_t mMaxQueuedRecords;
+        std::vector<std::unique_ptr<Channel> > mChannels;
+    };
+
+    /// Prefetched records against a whole tree parsing, with tiny queues.
+    bool utest_JsonRecordPrefetcher(UnitTestExecutionContext const *context);
+    /// Loading time of a large synthetic level, parsed on the consuming thread and prefetched.
+    bool utest_JsonRecordPrefetcherSpeed(UnitTestExecutionContext const *context);
+}
+
+#endif // STEEL_JSONRECORDPREFETCHER_H
+// kate: indent-mode cstyle; indent-width 4; replace-tabs on;
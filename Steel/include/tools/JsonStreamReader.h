@@ -0,0 +1,95 @@
+#ifndef STEEL_JSONSTREAMREADER_H
+#define STEEL_JSONSTREAMREADER_H
+
+#include <istream>
+#include <vector>
+
+#include <json/json.h>
+#include <OgrePrerequisites.h>
+
+#include "steeltypes.h"
+
+namespace Steel
+{
+    class UnitTestExecutionContext;
+
+    /**
+     * Reads a json document from a stream piece by piece, through a fixed size buffer, so that big documents (levels)
+     * never need to be held in memory whole. The caller walks objects key by key, and for each member either
+     * descends into it (beginObject), parses it into a Json::Value (readValue), or skips it without building anything
+     * (skipValue). Positions of values can be kept and seeked back to later, for documents whose members are not
+     * stored in the order they are to be processed in.
+     * Values are parsed as Json::Reader parses them (same value types).
+     */
+    class JsonStreamReader
+    {
+    private:
+        JsonStreamReader(const JsonStreamReader &o);
+        JsonStreamReader &operator=(const JsonStreamReader &o);
+
+    public:
+        static const size_t DEFAULT_BUFFER_SIZE;
+
+        JsonStreamReader(std::istream &stream, size_t bufferSize = DEFAULT_BUFFER_SIZE);
+        virtual ~JsonStreamReader();
+
+        /// Type of the next value, without consuming it. Returns Json::nullValue on error (see ok).
+        Json::ValueType nextType();
+        /// Enters the object that comes next.
+        bool beginObject();
+        /**
+         * Reads the next key of the current object, whose value is to be consumed next. Returns false when the
+         * object ends (and leaves it), or on error (see ok).
+         */
+        bool nextKey(Ogre::String &key);
+        /// Parses the next value.
+        bool readValue(Json::Value &value);
+        /// Goes past the next value.
+        bool skipValue();
+
+        /// Offset in the stream of the next value.
+        u64 position();
+        /// Goes back (or forth) to a position given by position(). Objects entered so far are forgotten.
+        bool seek(u64 position);
+
+        inline bool ok() const {return mOk;}
+        /// What went wrong, and where.
+        inline Ogre::String const &errorMessage() const {return mErrorMessage;}
+
+    private:
+        /// Skips whitespaces, and returns the next char without consuming it, or -1 at the end of the stream.
+        int peek();
+        /// Consumes the next char, that must be c.
+        bool expect(char c);
+        /// Loads the next chunk of the stream.
+        bool fill();
+        bool fail(Ogre::String const &message);
+
+        bool parseValue(Json::Value *value, u32 depth);
+        /// s can be nullptr, to skip the string.
+        bool parseString(std::string *s);
+        bool parseNumber(Json::Value *value);
+        bool parseLiteral(char const *literal);
+
+        std::istream &mStream;
+        std::vector<char> mBuffer;
+        /// Next char in mBuffer.
+        size_t mPos;
+        /// Number of valid chars in mBuffer.
+        size_t mSize;
+        /// Stream offset of mBuffer[0].
+        u64 mBufferOffset;
+        /// Whether each entered object had a member yet.
+        std::vector<bool> mHasMembers;
+        bool mOk;
+        Ogre::String mErrorMessage;
+    };
+
+    /// Streamed parsing, skipping and seeking, against Json::Reader.
+    bool utest_JsonStreamReader(UnitTestExecutionContext const *context);
+    /// Record by record parsing of a large synthetic level against a whole tree parsing.
+    bool utest_JsonStreamReaderSpeed(UnitTestExecutionContext const *context);
+}
+
+#endif // STEEL_JSONSTREAMREADER_H
+// kate: indent-mode cstyle; indent-width 4; replace-tabs on;
@@ -0,0 +1,61 @@
+#ifndef STEEL_JSONSTREAMWRITER_H
+#define STEEL_JSONSTREAMWRITER_H
+
+#include <ostream>
+#include <vector>
+
+#include <json/json.h>
+#include <OgrePrerequisites.h>
+
+#include "steeltypes.h"
+
+namespace Steel
+{
+    class UnitTestExecutionContext;
+
+    /**
+     * Writes a json document to a stream as it is produced, in the exact format of Json::StyledWriter (what
+     * Json::Value::toStyledString gives), so that big documents (levels) never need to be held in memory whole.
+     * Objects are opened and closed explicitly, and their members written one at a time, either as nested objects or
+     * as whole (small) values. Members are to be given in increasing key order, as Json::Value stores them.
+     */
+    class JsonStreamWriter
+    {
+    private:
+        JsonStreamWriter(const JsonStreamWriter &o);
+        JsonStreamWriter &operator=(const JsonStreamWriter &o);
+
+    public:
+        JsonStreamWriter(std::ostream &stream);
+        virtual ~JsonStreamWriter();
+
+        /// Opens an object, as the document root or as the value of the last key.
+        void beginObject();
+        void endObject();
+        /// Starts a member of the current object, which value is to be written next.
+        void key(Ogre::String const &name);
+        /// Writes a whole value, as the document root or as the value of the last key.
+        void value(Json::Value const &value);
+        /// Ends the document.
+        void end();
+
+        inline bool good() const {return mStream.good();}
+
+    private:
+        void writeIndent();
+
+        std::ostream &mStream;
+        /// Whether each open object has members yet.
+        std::vector<bool> mHasMembers;
+        /// Renders values before they are indented into the stream.
+        Json::StyledWriter mWriter;
+    };
+
+    /// Streamed output against Json::StyledWriter's.
+    bool utest_JsonStreamWriter(UnitTestExecutionContext const *context);
+    /// Save throughput of a large synthetic level, streamed and through a whole tree.
+    bool utest_JsonStreamWriterSpeed(UnitTestExecutionContext const *context);
+}
+
+#endif // STEEL_JSONSTREAMWRITER_H
+// kate: indent-mode cstyle; indent-width 4; replace-tabs on;
@@ -0,0 +1,69 @@
+#ifndef STEEL_LEVELJOURNAL_H
+#define STEEL_LEVELJOURNAL_H
+
+#include <vector>
+
+#include <json/json.h>
+#include <OgrePrerequisites.h>
+
+#include "steeltypes.h"
+
+namespace Steel
+{
+    class UnitTestExecutionContext;
+
+    /**
+     * Journal of incremental level saves, kept next to a full (base) save. It is made of text lines: a header naming
+     * the base save it applies to (its size and modification time), then one compact json object (a segment) per
+     * incremental save:
+     * {"agents": {aid: record or null}, "models": {type: {mid: record or null}}, "managers": {type: serialization},
+     * "properties": {name, backgroundColor, camera, gravity, terrain}}
+     * Null records were removed. "models" holds managers whose models are keyed by ids (see
+     * ModelManager::modelsKeyedByIds), "managers" the whole serialization of the other ones.
+     * Segments are only ever appended; one torn by a crash is dropped when the journal is read back, and cut off it.
+     */
+    class LevelJournal
+    {
+    private:
+        LevelJournal();
+        LevelJournal(const LevelJournal &o);
+        LevelJournal &operator=(const LevelJournal &o);
+
+    public:
+        static const char *BASE_ATTRIBUTE;
+        static const char *AGENTS_ATTRIBUTE;
+        static const char *MODELS_ATTRIBUTE;
+        static const char *MANAGERS_ATTRIBUTE;
+        static const char *PROPERTIES_ATTRIBUTE;
+
+        /// Starts an empty journal over the base save at basePath, replacing the one at path.
+        static bool reset(Ogre::String const &path, Ogre::String const &basePath);
+        /// Appends a segment to the journal at path.
+        static bool append(Ogre::String const &path, Json::Value const &segment);
+        /// Whether the journal at path applies to the base save at basePath, as it is now.
+        static bool belongsTo(Ogre::String const &path, Ogre::String const &basePath);
+        /**
+         * Reads the segments of the journal at path. Returns false if it cannot be read, or does not apply to the
+         * base save at basePath. A torn segment is cut off the file along with what follows it, so that the next
+         * ones are appended after the last whole one.
+         */
+        static bool read(Ogre::String const &path, Ogre::String const &basePath, std::vector<Json::Value> &segments);
+        /// Applies a segment to a level serialization (see Level::serialize(Json::Value &)).
+        static void apply(Json::Value const &segment, Json::Value &root);
+        /**
+         * Folds a segment into merged, itself a segment: applying merged is applying the segments it was given, in order.
+         * Removed records stay as nulls, so that it can override a base save while the base is being read.
+         */
+        static void merge(Json::Value const &segment, Json::Value &merged);
+        /// Size of the file at path, in bytes, or 0 if it does not exist.
+        static u64 fileSize(Ogre::String const &path);
+    };
+
+    /// Segments written, read back, applied and merged, against the tree they should give.
+    bool utest_LevelJournal(UnitTestExecutionContext const *context);
+    /// Full save of a large synthetic level, against a journaled save of a few changes.
+    bool utest_LevelJournalSpeed(UnitTestExecutionContext const *context);
+}
+
+#endif // STEEL_LEVELJOURNAL_H
+// kate: indent-mode cstyle; indent-width 4; replace-tabs on;
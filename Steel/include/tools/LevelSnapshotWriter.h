@@ -0,0 +1,110 @@
+#ifndef STEEL_LEVELSNAPSHOTWRITER_H
+#define STEEL_LEVELSNAPSHOTWRITER_H
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <json/json.h>
+#include <OgrePrerequisites.h>
+
+#include "steeltypes.h"
+
+namespace Steel
+{
+    class UnitTestExecutionContext;
+
+    /**
+     * Formats and writes level snapshots (serialized trees, see Level::serialize(Json::Value &)) on a worker thread,
+     * so that the frame a snapshot is taken in only pays for taking it. Files are written next to their destination,
+     * then renamed over it. A snapshot queued right after an older one for the same file that has not been
+     * started replaces it: only the latest state is worth writing. Journal segments (see LevelJournal) are appended in queue order,
+     * and never replaced. A full save can also be rebuilt from the previous one and a segment (see Job::incremental), so
+     * that the frame does not have to capture the whole level. All methods are to be called from the main thread.
+     */
+    class LevelSnapshotWriter
+    {
+    private:
+        LevelSnapshotWriter(const LevelSnapshotWriter &o);
+        LevelSnapshotWriter &operator=(const LevelSnapshotWriter &o);
+
+    public:
+        enum class Format : u32
+        {
+            /// Same output as Level::serialize(JsonStreamWriter &).
+            JSON = 0,
+            /// See BinaryLevelFile.
+            BINARY,
+            /// A segment appended to a LevelJournal.
+            JOURNAL
+        };
+
+        class Job
+        {
+        public:
+            Ogre::String path;
+            Format format;
+            /// Taken over (swapped) when queued.
+            Json::Value root;
+            /// If not empty, journal restarted over the full save once it is written.
+            Ogre::String journalPath;
+            /**
+             * If true (and format is not JOURNAL), root is a segment: the full save at path is read back, the segments
+             * of the journal at journalPath (if it applies to it) then root are applied over it, and the result replaces it.
+             */
+            bool incremental = false;
+        };
+
+        class Done
+        {
+        public:
+            Ogre::String path;
+            bool success;
+            /// Time spent formatting and writing.
+            double milliseconds;
+        };
+
+        LevelSnapshotWriter();
+        virtual ~LevelSnapshotWriter();
+
+        /// Starts the worker.
+        void init();
+        /// Writes whatever is queued, then stops the worker.
+        void shutdown();
+
+        /// Hands a snapshot to the worker. Its root is left null.
+        void queue(Job &job);
+        /// Moves finished jobs into the given vector. Returns false if there was none.
+        bool collect(std::vector<Done> &done);
+        /// Blocks until all queued snapshots are written.
+        void flush();
+        /// True if nothing is queued nor being written.
+        bool idle();
+
+        /// Synchronous version, used by the worker. Returns false on failure.
+        static bool write(Job const &job);
+
+    private:
+        /// Worker thread main function.
+        void run();
+
+        std::thread mWorker;
+        std::mutex mMutex;
+        std::condition_variable mCondition;
+        std::deque<Job> mJobs;
+        std::vector<Done> mDone;
+        /// A job was popped and is being written.
+        bool mBusy;
+        bool mMustStop;
+    };
+
+    /// Written files against Json::StyledWriter and BinaryLevelFile, replacement of queued snapshots, journal segments, rebuilt saves.
+    bool utest_LevelSnapshotWriter(UnitTestExecutionContext const *context);
+    /// Main thread cost of capturing and queueing a large snapshot, against writing it synchronously and rebuilding it from a segment.
+    bool utest_LevelSnapshotWriterSpeed(UnitTestExecutionContext const *context);
+}
+
+#endif // STEEL_LEVELSNAPSHOTWRITER_H
+// kate: indent-mode cstyle; indent-width 4; replace-tabs on;
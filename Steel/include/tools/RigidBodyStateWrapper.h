@@ -1,14 +1,20 @@
 #ifndef STEEL_BTRIGIDBODYWRAPPER_H
 #define STEEL_BTRIGIDBODYWRAPPER_H
 
+#include <vector>
+
 #include <BtOgrePG.h>
 
+#include "steeltypes.h"
+
 namespace Steel
 {
     /**
      * Because neither btOgre nor bullet offer motionState changes notifications, 
      * this class subclasses btRigidBody and can be pooled to retreive whether 
      * it has been modified since the last time it was pooled.
+     * The transforms it receives are interpolated between the last 2 fixed physics substeps
+     * (see TerrainPhysicsManager::update), and forwarded as is to the OgreModel scene node.
      */
     class RigidBodyStateWrapper: public BtOgre::RigidBodyState
     {
@@ -22,11 +28,20 @@ namespace Steel
         
         /// Returns whether this body worldtransform has changed since the last call. Resets the flag.
         bool poolTransform();
+
+        /**
+         * The given id is pushed to the queue on the first transform change following a pooling, so that
+         * bodies bullet leaves alone (sleeping ones) need no pooling at all.
+         */
+        void setTransformedQueue(std::vector<ModelId> *queue, ModelId mid);
         
         /// btRigidBody overwriting
         virtual void setWorldTransform(const btTransform &in);
     protected:
         bool mIsTransformed;
+        /// not owned
+        std::vector<ModelId> *mTransformedQueue;
+        ModelId mModelId;
     };
 }
 #endif // STEEL_BTRIGIDBODYWRAPPER_H
@@ -11,7 +11,7 @@
 #include "models/AgentManager.h"
 #include "models/Agent.h"
 #include "tools/JsonUtils.h"
-#include "tools/DynamicLines.h"
+#include "tools/DebugLinesBatch.h"
 
 namespace Steel
 {
@@ -26,8 +26,7 @@ namespace Steel
     BTNavigator::BTNavigator(const Steel::BTShapeToken &token) : BTNode(token),
         mTargetAgentStrategy(TargetAgentStrategy::None), mTargetAgentStrategyFn(nullptr),
         mTargetAgentIdVariable(StringUtils::BLANK), mTargetAgent(INVALID_ID),
-        mSpeed(.0f),
-        mDebugTargetLine(nullptr), mDebugMoveLine(nullptr)
+        mSpeed(.0f)
     {
         setTargetAgentStrategyFunction(mTargetAgentStrategy);
     }
@@ -35,39 +34,13 @@ namespace Steel
     BTNavigator::BTNavigator(BTNavigator const &o): BTNode(o),
         mTargetAgentStrategy(o.mTargetAgentStrategy), mTargetAgentStrategyFn(nullptr),
         mTargetAgentIdVariable(o.mTargetAgentIdVariable), mTargetAgent(o.mTargetAgent),
-        mSpeed(o.mSpeed), mDebugTargetLine(o.mDebugTargetLine), mDebugMoveLine(o.mDebugMoveLine)
+        mSpeed(o.mSpeed)
     {
         setTargetAgentStrategyFunction(mTargetAgentStrategy);
     }
 
     BTNavigator::~BTNavigator()
     {
-        deleteDebugLines();
-    }
-
-    void BTNavigator::deleteDebugLines()
-    {
-        if(nullptr != mDebugTargetLine)
-        {
-            mDebugTargetLine->clear();
-
-            if(nullptr != mDebugTargetLine->getParentSceneNode())
-                mDebugTargetLine->getParentSceneNode()->detachObject(mDebugTargetLine);
-
-            delete mDebugTargetLine;
-            mDebugTargetLine = nullptr;
-        }
-
-        if(nullptr != mDebugMoveLine)
-        {
-            mDebugMoveLine->clear();
-
-            if(nullptr != mDebugMoveLine->getParentSceneNode())
-                mDebugMoveLine->getParentSceneNode()->detachObject(mDebugMoveLine);
-
-            delete mDebugMoveLine;
-            mDebugMoveLine = nullptr;
-        }
     }
 
     bool BTNavigator::parseNodeContent(Json::Value &root)
@@ -127,21 +100,13 @@ namespace Steel
         return INVALID_ID;
     }
 
-    void BTNavigator::initDebugLines(Ogre::SceneNode *parentNode)
+    void BTNavigator::drawDebugLines(BTModel *btModel, Ogre::Vector3 const &position, Ogre::Vector3 const &targetPos, Ogre::Vector3 const &velocity)
     {
-        if(nullptr == mDebugTargetLine)
-        {
-            mDebugTargetLine = new DynamicLines();
-            mDebugTargetLine->setColor(Ogre::ColourValue::White);
-            parentNode->attachObject(mDebugTargetLine);
-        }
-
-        if(nullptr == mDebugMoveLine)
-        {
-            mDebugMoveLine = new DynamicLines();
-            mDebugMoveLine->setColor(Ogre::ColourValue::Red);
-            parentNode->attachObject(mDebugMoveLine);
-        }
+        DebugLinesBatch *lines = btModel->level()->debugLines();
+        // points to the current target
+        lines->addTransientLine(position, targetPos, Ogre::ColourValue::White);
+        // represent the speed and direction of the model
+        lines->addTransientLine(position, position + velocity, Ogre::ColourValue::Red);
     }
 
     void BTNavigator::run(BTModel *btModel, float timestep)
@@ -162,9 +127,6 @@ namespace Steel
                 mState = BTNodeState::RUNNING;
                 mPreviousPosition = agent->position() + agent->rotation() * Ogre::Vector3::UNIT_SCALE;
 
-                if(0 && btModel->debug() && btModel->level()->engine()->stats().frameCount > 100)
-                    initDebugLines(btModel->level()->levelRoot());
-
             case BTNodeState::RUNNING:
             {
                 Agent *targetAgent;
@@ -189,9 +151,6 @@ namespace Steel
                 if(agent->position().squaredDistance(targetPos) < velocity.squaredLength())
                 {
                     mState = BTNodeState::SUCCESS;
-
-                    if(btModel->debug())
-                        deleteDebugLines();
                 }
                 else
                 {
@@ -210,23 +169,7 @@ namespace Steel
                     }
 
                     if(btModel->debug())
-                    {
-                        if(nullptr != mDebugTargetLine)
-                        {
-                            mDebugTargetLine->clear();
-                            mDebugTargetLine->addPoint(position);
-                            mDebugTargetLine->addPoint(targetPos);
-                            mDebugTargetLine->update();
-                        }
-
-                        if(nullptr != mDebugMoveLine)
-                        {
-                            mDebugMoveLine->clear();
-                            mDebugMoveLine->addPoint(position);
-                            mDebugMoveLine->addPoint(position + velocity);
-                            mDebugMoveLine->update();
-                        }
-                    }
+                        drawDebugLines(btModel, position, targetPos, velocity);
                 }
 
 
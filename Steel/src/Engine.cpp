@@ -418,6 +418,9 @@ namespace Steel
             // update level
             if(nullptr != mLevel)
             {
+                // sync point of background terrain edits: publish them before anything reads the terrain this frame
+                mLevel->terrainManager()->syncTerrainEdits();
+
                 float dt = float(timer.getMilliseconds() - graphicsStart) / 1000.f;
                 fireOnBeforeLevelUpdate(dt);
                 mLevel->update(dt);
@@ -640,6 +643,22 @@ namespace Steel
         }
         else if(command[0] == "reloadConfig")
             loadConfig(mConfig);
+        else if(command[0] == "utests")
+        {
+            // utests.<category>, ie utests.Steel.benchmark
+            if(command.size() > 1)
+            {
+                UnitTestExecutionContext context;
+                context.engine = this;
+                UnitTestManager::instance().execute(StringUtils::join(command, ".", 1), context, false);
+            }
+            else
+            {
+                Debug::warning(intro)("invalid command (missing test category ?):");
+                Debug::warning(StringUtils::join(command, ".")).endl();
+                return false;
+            }
+        }
         else if(command[0] == "set_level")
         {
             if(command.size() > 1)
@@ -735,6 +754,9 @@ namespace Steel
         setupReferencePathsLookupTable(source);
 
         config.getSetting(Engine::GHOST_CAMERA_ROTATION_SPEED_SETTING, mGhostCamRotationSpeed, mGhostCamRotationSpeed);
+
+        if(nullptr != mLevel)
+            mLevel->loadConfig(config);
     }
 
     void Engine::setupReferencePathsLookupTable(Ogre::String const &source)
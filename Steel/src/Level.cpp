@@ -10,9 +10,13 @@
 #include <Debug.h>
 #endif
 
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
 #include <iostream>
 #include <map>
 #include <set>
+#include <sstream>
 
 #include <json/json.h>
 
@@ -23,15 +27,28 @@
 #include "Camera.h"
 #include "SelectionManager.h"
 #include "SignalManager.h"
+#include "TagManager.h"
 #include "models/Agent.h"
 #include "models/AgentManager.h"
+#include "models/BlackBoardModel.h"
 #include "models/BlackBoardModelManager.h"
 #include "models/BTModelManager.h"
 #include "models/LocationModelManager.h"
 #include "models/Model.h"
+#include "models/OgreModel.h"
 #include "models/OgreModelManager.h"
+#include "models/PhysicsModel.h"
 #include "models/PhysicsModelManager.h"
+#include "terrain/TerrainHeightSampler.h"
 #include "terrain/TerrainPhysicsManager.h"
+#include "tests/UnitTestManager.h"
+#include "tools/BinaryLevelFile.h"
+#include "tools/DebugLinesBatch.h"
+#include "tools/JsonRecordPrefetcher.h"
+#include "tools/JsonStreamReader.h"
+#include "tools/JsonStreamWriter.h"
+#include "tools/LevelJournal.h"
+#include "tools/LevelSnapshotWriter.h"
 #include "tools/OgreUtils.h"
 #include "tools/StringUtils.h"
 #include "tools/JsonUtils.h"
@@ -48,6 +65,18 @@ namespace Steel
     const char *Level::GRAVITY_ATTRIBUTE = "gravity";
 
     const char *Level::DF_CANCEL_DYNAMIC_FILLING_ATTRIBUTE = "$cancelDynamicFilling";
+    const size_t Level::SAVE_BUFFER_SIZE = 1 << 20;
+
+    const Ogre::String Level::BINARY_FORMAT_SETTING = "Level::binaryFormat";
+    const bool Level::DEFAULT_BINARY_FORMAT = false;
+    const Ogre::String Level::PARALLEL_LOADING_SETTING = "Level::parallelLoading";
+    const bool Level::DEFAULT_PARALLEL_LOADING = false;
+    const Ogre::String Level::AUTOSAVE_INTERVAL_SETTING = "Level::autosaveInterval";
+    const float Level::DEFAULT_AUTOSAVE_INTERVAL = 0.f;
+    const Ogre::String Level::INCREMENTAL_SAVE_SETTING = "Level::incrementalSave";
+    const bool Level::DEFAULT_INCREMENTAL_SAVE = false;
+    const Ogre::String Level::JOURNAL_COMPACTION_RATIO_SETTING = "Level::journalCompactionRatio";
+    const float Level::DEFAULT_JOURNAL_COMPACTION_RATIO = .5f;
 
     const char *Level::MODELS_ATTRIBUTE = "models";
     const char *Level::MODEL_TYPE_ATTRIBUTE = "modelType";
@@ -59,9 +88,12 @@ namespace Steel
         mBackgroundColor(Ogre::ColourValue::Black), mSceneManager(nullptr), mLevelRoot(nullptr),
         mManagers(), mAgentMan(nullptr), mOgreModelMan(nullptr),
         mPhysicsModelMan(nullptr), mBTModelMan(nullptr), mTerrainMan(), mSelectionMan(nullptr), mLocationModelMan(nullptr),
-        mBlackBoardModelManagerMan(nullptr),
+        mBlackBoardModelManagerMan(nullptr), mDebugLines(nullptr),
         mCamera(nullptr), mMainLight(nullptr),
-        mGravity(Ogre::Vector3::ZERO)
+        mGravity(Ogre::Vector3::ZERO), mBinaryFormat(DEFAULT_BINARY_FORMAT),
+        mParallelLoading(DEFAULT_PARALLEL_LOADING), mAutosaveInterval(DEFAULT_AUTOSAVE_INTERVAL), mTimeSinceAutosave(0.f),
+        mSnapshotWriter(nullptr), mIncrementalSave(DEFAULT_INCREMENTAL_SAVE),
+        mJournalCompactionRatio(DEFAULT_JOURNAL_COMPACTION_RATIO), mSavedBase(), mSavedAgents(), mSavedModels(), mSavedProperties()
     {
         Debug::log(logName() + "()").endl();
 
@@ -93,6 +125,11 @@ namespace Steel
         mCamera->cam()->setAspectRatio(aspectRatio);
 
         mLevelRoot = mSceneManager->getRootSceneNode()->createChildSceneNode("levelNode", Ogre::Vector3::ZERO);
+
+        mDebugLines = new DebugLinesBatch();
+        mDebugLines->init(mName);
+        mLevelRoot->attachObject(mDebugLines);
+
         mTerrainMan.init(this, mName + ".terrainManager", path.subfile(mName), mSceneManager);
 
         mOgreModelMan = new OgreModelManager(this, mSceneManager, mLevelRoot);
@@ -105,12 +142,18 @@ namespace Steel
         mSelectionMan = new SelectionManager(this);
 
         mSceneManager->setAmbientLight(Ogre::ColourValue::White);
+
+        mSnapshotWriter = new LevelSnapshotWriter();
+        mSnapshotWriter->init();
     }
 
     Level::~Level()
     {
         Debug::log(logName() + ".~Level()").endl();
 
+        // a pending autosave is written before anything goes away
+        STEEL_DELETE(mSnapshotWriter);
+
         if(nullptr != mSelectionMan)
             mSelectionMan->clearSelection();
 
@@ -140,6 +183,12 @@ namespace Steel
         mManagers.clear();
         mTerrainMan.shutdown();
 
+        if(nullptr != mDebugLines)
+        {
+            mLevelRoot->detachObject(mDebugLines);
+            STEEL_DELETE(mDebugLines);
+        }
+
         if(mSceneManager != nullptr)
         {
             Ogre::RenderWindow *window = mEngine->renderWindow();
@@ -202,16 +251,47 @@ namespace Steel
         return mPath.subfile(mName + ".lvl");
     }
 
-    void Level::loadConfig(ConfigFile const &config)
+    File Level::getBinarySavefile()
     {
+        return mPath.subfile(mName + ".lvlb");
+    }
 
+    File Level::getJournalFile()
+    {
+        return mPath.subfile(mName + ".lvlj");
+    }
+
+    void Level::loadConfig(ConfigFile const &config)
+    {
+        config.getSetting(Level::BINARY_FORMAT_SETTING, mBinaryFormat, DEFAULT_BINARY_FORMAT);
+        config.getSetting(Level::PARALLEL_LOADING_SETTING, mParallelLoading, DEFAULT_PARALLEL_LOADING);
+        config.getSetting(Level::AUTOSAVE_INTERVAL_SETTING, mAutosaveInterval, DEFAULT_AUTOSAVE_INTERVAL);
+        config.getSetting(Level::INCREMENTAL_SAVE_SETTING, mIncrementalSave, DEFAULT_INCREMENTAL_SAVE);
+        config.getSetting(Level::JOURNAL_COMPACTION_RATIO_SETTING, mJournalCompactionRatio, DEFAULT_JOURNAL_COMPACTION_RATIO);
+        mTerrainMan.terrainPhysicsMan()->loadConfig(config);
     }
 
     bool Level::load()
     {
         Debug::log(logName() + ".load()").indent().endl();
 
-        File savefile = getSavefile();
+        // reads what was last autosaved
+        mSnapshotWriter->flush();
+        collectAutosaves();
+        mTimeSinceAutosave = 0.f;
+
+        // the configured format first, the other one if there is no such save, or if it is more recent (format
+        // toggled after the last save)
+        File savefile = mBinaryFormat ? getBinarySavefile() : getSavefile();
+        File const otherSavefile = mBinaryFormat ? getSavefile() : getBinarySavefile();
+
+        if(otherSavefile.exists() && (!savefile.exists() || otherSavefile.lastModified() > savefile.lastModified()))
+        {
+            if(savefile.exists())
+                Debug::warning(logName() + ".load(): ")(otherSavefile)(" is more recent than ")(savefile)(", loading it instead.").endl();
+
+            savefile = otherSavefile;
+        }
 
         if(!savefile.exists())
         {
@@ -220,11 +300,40 @@ namespace Steel
             return false;
         }
 
-        Ogre::String s = savefile.read();
+        // changes saved incrementally over it
+        File const journal = getJournalFile();
+        std::vector<Json::Value> segments;
+
+        if(journal.exists() && !LevelJournal::read(journal.fullPath(), savefile.fullPath(), segments))
+            Debug::warning(logName() + ".load(): ignoring ")(journal)(", which is not about ")(savefile).endl();
+
         mTerrainMan.addTerrainManagerEventListener(this);
+        bool deserialized = false;
+        bool const isBinary = savefile.fullPath() == getBinarySavefile().fullPath();
+
+        // segments override the records of the base as it is streamed
+        Json::Value merged;
+
+        for(auto const & segment : segments)
+            LevelJournal::merge(segment, merged);
+
+        if(isBinary)
+        {
+            BinaryLevelFile file;
+            deserialized = file.open(savefile.fullPath()) && deserialize(file, merged);
+        }
+        else if(mParallelLoading && segments.empty())
+            deserialized = deserializeParallel(savefile);
+        else
+        {
+            std::ifstream stream(savefile.fullPath().c_str(), std::ios::in | std::ios::binary);
+            JsonStreamReader reader(stream);
+            deserialized = deserialize(reader, merged);
+        }
 
-        if(!deserialize(s))
+        if(!deserialized)
         {
+            mSavedBase.clear();
             mAgentMan->deleteAllAgents();
 
             for(auto modelTypeInt = toIntegral(ModelType::FIRST); modelTypeInt != toIntegral(ModelType::LAST); ++modelTypeInt)
@@ -244,6 +353,7 @@ namespace Steel
         }
 
         mTerrainMan.terrainPhysicsMan()->setWorldGravity(mGravity);
+        markSaved(savefile.fullPath());
 
         Debug::log(logName() + ".load(): loaded ")(savefile)(" successfully.").unIndent().endl();
         SignalManager::instance().fire(getSignal(PublicSignal::loaded));
@@ -254,16 +364,141 @@ namespace Steel
     {
         Debug::log(logName() + ".save():").endl();
 
-        Ogre::String s = StringUtils::BLANK;
-        serialize(s);
+        // an older autosave must not land over this save, nor a failed one be appended to
+        mSnapshotWriter->flush();
+        collectAutosaves();
+        mTimeSinceAutosave = 0.f;
+        File savefile = mBinaryFormat ? getBinarySavefile() : getSavefile();
+        File const journal = getJournalFile();
 
-        File savefile = getSavefile();
-        savefile.write(s, File::OM_OVERWRITE);
+        if(incrementalSaveDue(savefile.fullPath()))
+        {
+            Json::Value segment;
+            collectIncrement(segment);
+
+            if(LevelJournal::append(journal.fullPath(), segment))
+            {
+                Debug::log(logName() + ".save() into ")(journal).endl();
+                return true;
+            }
+
+            // what the segment held is in the full save
+            Debug::warning(logName() + ".save(): could not append to ")(journal)(", saving the whole level.").endl();
+            mSavedBase.clear();
+        }
+
+        if(mBinaryFormat)
+        {
+            std::string bytes;
+            {
+                Json::Value root;
+                serialize(root);
+                BinaryLevelFile::fromJson(root, bytes);
+            }
+
+            if(!BinaryLevelFile::write(savefile.fullPath(), bytes))
+            {
+                Debug::error(logName() + ".save(): could not write ")(savefile).endl();
+                return false;
+            }
+        }
+        else
+        {
+            // streamed next to the savefile, then renamed over it
+            Ogre::String const tmpPath = savefile.fullPath() + ".tmp";
+            {
+                std::vector<char> buffer(SAVE_BUFFER_SIZE);
+                std::ofstream stream;
+                stream.rdbuf()->pubsetbuf(buffer.data(), buffer.size());
+                stream.open(tmpPath.c_str(), std::ios::out | std::ios::trunc);
+
+                if(!stream.is_open())
+                {
+                    Debug::error(logName() + ".save(): could not open ")(tmpPath).endl();
+                    return false;
+                }
+
+                JsonStreamWriter writer(stream);
+                serialize(writer);
+
+                if(!writer.good())
+                {
+                    Debug::error(logName() + ".save(): could not write ")(tmpPath).endl();
+                    stream.close();
+                    std::remove(tmpPath.c_str());
+                    return false;
+                }
+            }
 
+            if(0 != std::rename(tmpPath.c_str(), savefile.fullPath().c_str()))
+            {
+                Debug::error(logName() + ".save(): could not rename ")(tmpPath)(" to ")(savefile).endl();
+                std::remove(tmpPath.c_str());
+                return false;
+            }
+        }
+
+        // the journal was about the previous full save
+        if((mIncrementalSave || journal.exists()) && !LevelJournal::reset(journal.fullPath(), savefile.fullPath()))
+            Debug::warning(logName() + ".save(): could not restart ")(journal).endl();
+
+        // a save in the other format is now stale
+        File otherSavefile = mBinaryFormat ? getSavefile() : getBinarySavefile();
+
+        if(otherSavefile.exists())
+            otherSavefile.rm();
+
+        markSaved(savefile.fullPath());
         Debug::log(logName() + ".save() into ")(savefile).endl();
         return true;
     }
 
+    bool Level::autosave()
+    {
+        if(!mSnapshotWriter->idle())
+        {
+            Debug::warning(logName() + ".autosave(): previous autosave still being written, skipping.").endl();
+            return false;
+        }
+
+        Ogre::Timer timer;
+        LevelSnapshotWriter::Job job;
+        Ogre::String const basePath = (mBinaryFormat ? getBinarySavefile() : getSavefile()).fullPath();
+        File const journal = getJournalFile();
+
+        if(incrementalSaveDue(basePath))
+        {
+            job.format = LevelSnapshotWriter::Format::JOURNAL;
+            job.path = journal.fullPath();
+            collectIncrement(job.root);
+        }
+        else
+        {
+            job.format = mBinaryFormat ? LevelSnapshotWriter::Format::BINARY : LevelSnapshotWriter::Format::JSON;
+            job.path = basePath;
+
+            if(mIncrementalSave || journal.exists())
+                job.journalPath = journal.fullPath();
+
+            // the worker rebuilds the save from the one on disk: only a level without one is captured whole
+            job.incremental = basePath == mSavedBase;
+
+            if(job.incremental)
+                collectIncrement(job.root);
+            else
+            {
+                serialize(job.root);
+                markSaved(basePath);
+            }
+        }
+
+        mSnapshotWriter->queue(job);
+        mTimeSinceAutosave = 0.f;
+
+        Debug::log(logName() + ".autosave(): snapshot taken in ")(timer.getMicroseconds() / 1000.)("ms").endl();
+        return true;
+    }
+
     Signal Level::getSignal(Level::PublicSignal signal) const
     {
 #define STEEL_LEVEL_GETSIGNAL_CASE(NAME) case NAME:return SignalManager::instance().toSignal(logName()+"::"+#NAME)
@@ -365,6 +600,8 @@ namespace Steel
             load();
         else if(command[0] == "save")
             save();
+        else if(command[0] == "autosave")
+            autosave();
         else if(command.size() > 1 && command[0] == "PhysicsTerrainManager" && command[1] == "switch_debug_draw")
             mTerrainMan.terrainPhysicsMan()->setDebugDraw(!mTerrainMan.terrainPhysicsMan()->getDebugDraw());
         else if(command[0] == "delete")
@@ -374,9 +611,121 @@ namespace Steel
     }
 
     void Level::serialize(Ogre::String &s)
+    {
+        std::ostringstream stream;
+        JsonStreamWriter writer(stream);
+        serialize(writer);
+        s = stream.str();
+//         Debug::log(s).endl();
+    }
+
+    void Level::serialize(JsonStreamWriter &writer)
     {
         Debug::log(logName() + ".serialise()").endl().indent();
-        Json::Value root;
+
+        // members are written in Json::Value's order (sorted keys), so that the output is the one of
+        // serialize(Json::Value &)'s tree: agents, backgroundColor, camera, gravity, managers, name, terrain.
+        writer.beginObject();
+
+        // serialise agents
+        Debug::log("processing agents...").endl().indent();
+        std::vector<std::pair<Ogre::String, Agent *> > agents;
+
+        // list of models to save
+        std::map<ModelType, std::list<ModelId>> persistentModels;
+
+        for(std::map<AgentId, Agent *>::iterator it_agents = mAgentMan->mAgents.begin(); it_agents != mAgentMan->mAgents.end(); ++it_agents)
+        {
+            AgentId aid = (*it_agents).first;
+            Agent *agent = (*it_agents).second;
+
+            if(!agent->isPersistent())
+                continue;
+
+            agents.push_back(std::make_pair(Ogre::StringConverter::toString(aid), agent));
+
+            for(auto const & it : agent->modelsIds())
+                persistentModels.emplace(it.first, std::list<ModelId>()).first->second.push_back(it.second);
+        }
+
+        std::sort(agents.begin(), agents.end());
+        writer.key(Level::AGENTS_ATTRIBUTE);
+
+        if(agents.empty())
+            writer.value(Json::Value());
+        else
+        {
+            writer.beginObject();
+
+            for(auto const & it : agents)
+            {
+                writer.key(it.first);
+                it.second->toJson(writer);
+            }
+
+            writer.endObject();
+        }
+
+        Debug::log("all agents done.").unIndent().endl();
+
+        writer.key(Level::BACKGROUND_COLOR_ATTRIBUTE);
+        writer.value(JsonUtils::toJson(mBackgroundColor));
+        writer.key(Level::CAMERA_ATTRIBUTE);
+        writer.value(mCamera->toJson());
+        writer.key(Level::GRAVITY_ATTRIBUTE);
+        writer.value(JsonUtils::toJson(mGravity));
+
+        // serialise models
+        Debug::log("processing models...").endl();
+        std::vector<std::pair<Ogre::String, ModelType> > managers;
+
+        for(auto modelTypeInt = toIntegral(ModelType::FIRST); modelTypeInt != toIntegral(ModelType::LAST); ++modelTypeInt)
+        {
+            ModelType modelType = (ModelType)modelTypeInt;
+
+            if(nullptr == modelManager(modelType))
+            {
+                Debug::warning(logName() + ".serialize(): no modelManager of type ")(toString(modelType)).endl();
+                continue;
+            }
+
+            managers.push_back(std::make_pair(toString(modelType), modelType));
+        }
+
+        std::sort(managers.begin(), managers.end());
+        writer.key(Level::MANAGERS_ATTRIBUTE);
+
+        if(managers.empty())
+            writer.value(Json::Value());
+        else
+        {
+            writer.beginObject();
+
+            for(auto const & it : managers)
+            {
+                writer.key(it.first);
+                modelManager(it.second)->toJson(writer, persistentModels.emplace(it.second, std::list<ModelId>()).first->second);
+            }
+
+            writer.endObject();
+        }
+
+        Debug::log("all models done.").unIndent().endl();
+
+        writer.key(Level::NAME_ATTRIBUTE);
+        writer.value(Json::Value(mName));
+        writer.key(Level::TERRAIN_ATTRIBUTE);
+        writer.value(mTerrainMan.toJson());
+
+        writer.endObject();
+        writer.end();
+        Debug::log("serialization done").unIndent().endl();
+    }
+
+    void Level::serialize(Json::Value &root)
+    {
+        Debug::log(logName() + ".serialise()").endl().indent();
+        root = Json::Value();
         root[Level::NAME_ATTRIBUTE] = mName;
 
         root[Level::BACKGROUND_COLOR_ATTRIBUTE] = JsonUtils::toJson(mBackgroundColor);
@@ -384,9 +733,9 @@ namespace Steel
         root[Level::CAMERA_ATTRIBUTE] = mCamera->toJson();
         root[Level::TERRAIN_ATTRIBUTE] = mTerrainMan.toJson();
 
-        // serialise agents
+        // serialise agents, straight into root: subtrees are not copied over
         Debug::log("processing agents...").endl().indent();
-        Json::Value agents;
+        Json::Value &agents = root[Level::AGENTS_ATTRIBUTE];
 
         // list of models to save
         std::map<ModelType, std::list<ModelId>> persistentModels;
@@ -396,64 +745,556 @@ namespace Steel
             AgentId aid = (*it_agents).first;
             Agent *agent = (*it_agents).second;
 
-            if(!agent->isPersistent())
-                continue;
+            if(!agent->isPersistent())
+                continue;
+
+            agents[Ogre::StringConverter::toString(aid)] = agent->toJson();
+
+            for(auto const & it : agent->modelsIds())
+                persistentModels.emplace(it.first, std::list<ModelId>()).first->second.push_back(it.second);
+
+        }
+
+        Debug::log("all agents done.").unIndent().endl();
+
+        // serialise models
+        Debug::log("processing models...").endl();
+        Json::Value &models = root[Level::MANAGERS_ATTRIBUTE];
+
+        for(auto modelTypeInt = toIntegral(ModelType::FIRST); modelTypeInt != toIntegral(ModelType::LAST); ++modelTypeInt)
+        {
+            ModelType modelType = (ModelType)modelTypeInt;
+            ModelManager *mm = modelManager(modelType);
+
+            if(mm == nullptr)
+            {
+                Debug::warning(logName() + ".serialize(): no modelManager of type ")(toString(modelType)).endl();
+                continue;
+            }
+
+            std::list<ModelId> const &modelsIds = persistentModels.emplace(modelType, std::list<ModelId>()).first->second;
+            mm->toJson(models[toString(modelType)], modelsIds);
+        }
+
+        root[Level::GRAVITY_ATTRIBUTE] = JsonUtils::toJson(mGravity);
+
+        Debug::log("all models done.").unIndent().endl();
+
+        Debug::log("serialization done").unIndent().endl();
+    }
+
+    bool Level::deserialize(Ogre::String &s)
+    {
+//         Debug::log(s).endl();
+        Json::Reader reader;
+        Json::Value root;
+        bool parsingOk = reader.parse(s, root, false);
+
+        if(!parsingOk)
+        {
+            Debug::error("could not parse this:").endl();
+            Debug::error(s).endl();
+            Debug::error(reader.getFormattedErrorMessages()).endl();
+            return false;
+        }
+
+        return deserialize(root);
+    }
+
+    bool Level::deserialize(Json::Value &root)
+    {
+        Debug::log(logName() + ".deserialize():").endl().indent();
+
+        if(!deserializeProperties(root))
+        {
+            Debug::log.unIndent();
+            return false;
+        }
+
+        Debug::log("instanciate ALL the models ! \\o/").endl();
+        Json::Value dict = root[Level::MANAGERS_ATTRIBUTE];
+
+        if(dict.isNull())
+        {
+            Debug::warning("no models, really ?").endl();
+        }
+        else
+        {
+            for(auto modelTypeInt = toIntegral(ModelType::FIRST); modelTypeInt != toIntegral(ModelType::LAST); ++modelTypeInt)
+            {
+                ModelType modelType = (ModelType)modelTypeInt;
+                Ogre::String type = toString(modelType);
+                Json::Value models = dict[type];
+
+                if(models.isNull())
+                {
+                    Debug::log("no models for type ")(type).endl();
+                    continue;
+                }
+
+                ModelManager *mm = modelManager(modelType);
+
+                if(mm == nullptr)
+                {
+                    Debug::warning("no modelManager for type ")(type).endl();
+                    continue;
+                }
+
+                mm->fromJson(models);
+            }
+
+            Debug::log("models done").endl();
+        }
+
+        Debug::log("now instanciate ALL the agents ! \\o/").endl();
+        dict = root[Level::AGENTS_ATTRIBUTE];
+
+        for(Json::ValueIterator it = dict.begin(); it != dict.end(); ++it)
+        {
+            AgentId aid = Ogre::StringConverter::parseUnsignedLong(it.key().asString(), INVALID_ID);
+            assert(aid != INVALID_ID);
+
+            if(!deserializeAgent(aid, *it))
+            {
+                Debug::log.unIndent();
+                return false;
+            }
+        }
+
+        Debug::log("agents done").endl();
+        Debug::log(logName() + ".deserialize(): done").unIndent().endl();
+        return true;
+    }
+
+    bool Level::deserialize(BinaryLevelFile const &file, Json::Value const &journal)
+    {
+        Debug::log(logName() + ".deserialize(binary):").endl().indent();
+
+        BinaryLevelFile::Section const *section = file.section(BinaryLevelFile::LEVEL_SECTION);
+        Json::Value root;
+        bool propertiesRead = nullptr != section && file.readSection(*section, root);
+        Json::Value const &journalProperties = journal[LevelJournal::PROPERTIES_ATTRIBUTE];
+
+        for(Json::ValueConstIterator it = journalProperties.begin(); it != journalProperties.end(); ++it)
+            root[it.memberName()] = *it;
+
+        if(!propertiesRead || !deserializeProperties(root))
+        {
+            Debug::error(logName())(": could not deserialize level properties.").endl();
+            Debug::log.unIndent();
+            return false;
+        }
+
+        // records are decoded one at a time, straight into their manager
+        Json::Value const &journalManagers = journal[LevelJournal::MANAGERS_ATTRIBUTE];
+        Json::Value const &journalModels = journal[LevelJournal::MODELS_ATTRIBUTE];
+        Json::Value record;
+        u64 id;
+
+        for(auto modelTypeInt = toIntegral(ModelType::FIRST); modelTypeInt != toIntegral(ModelType::LAST); ++modelTypeInt)
+        {
+            ModelType modelType = (ModelType)modelTypeInt;
+            Ogre::String type = toString(modelType);
+            section = file.section(BinaryLevelFile::MANAGERS_SECTION_PREFIX + type);
+            Json::Value const &overrides = journalModels[type];
+
+            if(nullptr == section && !journalManagers.isMember(type) && overrides.isNull())
+            {
+                Debug::log("no models for type ")(type).endl();
+                continue;
+            }
+
+            ModelManager *mm = modelManager(modelType);
+
+            if(mm == nullptr)
+            {
+                Debug::warning("no modelManager for type ")(type).endl();
+                continue;
+            }
+
+            // saved as a whole by the journal
+            if(journalManagers.isMember(type))
+            {
+                mm->fromJson(journalManagers[type]);
+                continue;
+            }
+
+            if(nullptr != section && BinaryLevelFile::SectionKind::TREE == section->kind)
+            {
+                if(file.readSection(*section, record))
+                    mm->fromJson(record);
+
+                continue;
+            }
+
+            for(u64 i = 0; nullptr != section && i < section->recordCount; ++i)
+            {
+                if(!file.readRecord(*section, i, id, record) || overrides.isMember(Ogre::StringConverter::toString(id)))
+                    continue;
+
+                ModelId mid = id;
+
+                if(!mm->fromSingleJson(record, mid))
+                    Debug::error("could not deserialize model ")(type)(" ")(id).endl();
+            }
+
+            deserializeJournalModels(mm, type, overrides);
+        }
+
+        Debug::log("models done").endl();
+
+        section = file.section(BinaryLevelFile::AGENTS_SECTION);
+        Json::Value const &journalAgents = journal[LevelJournal::AGENTS_ATTRIBUTE];
+
+        for(u64 i = 0; nullptr != section && i < section->recordCount; ++i)
+        {
+            if(!file.readRecord(*section, i, id, record) || journalAgents.isMember(Ogre::StringConverter::toString(id)))
+                continue;
+
+            if(!deserializeAgent(id, record))
+            {
+                Debug::log.unIndent();
+                return false;
+            }
+        }
+
+        if(!deserializeJournalAgents(journalAgents))
+        {
+            Debug::log.unIndent();
+            return false;
+        }
+
+        Debug::log("agents done").endl();
+        Debug::log(logName() + ".deserialize(binary): done").unIndent().endl();
+        return true;
+    }
+
+    bool Level::deserialize(JsonStreamReader &reader, Json::Value const &journal)
+    {
+        Debug::log(logName() + ".deserialize(stream):").endl().indent();
+
+        SaveIndex index;
+
+        if(!indexSave(reader, index))
+        {
+            Debug::log.unIndent();
+            return false;
+        }
+
+        Json::Value const &journalProperties = journal[LevelJournal::PROPERTIES_ATTRIBUTE];
+
+        for(Json::ValueConstIterator it = journalProperties.begin(); it != journalProperties.end(); ++it)
+            index.properties[it.memberName()] = *it;
+
+        if(!deserializeProperties(index.properties))
+        {
+            Debug::log.unIndent();
+            return false;
+        }
+
+        Debug::log("instanciate ALL the models ! \\o/").endl();
+
+        Json::Value const &journalManagers = journal[LevelJournal::MANAGERS_ATTRIBUTE];
+        Json::Value const &journalModels = journal[LevelJournal::MODELS_ATTRIBUTE];
+
+        if(!index.hasManagers && journalManagers.empty() && journalModels.empty())
+            Debug::warning("no models, really ?").endl();
+
+        for(auto modelTypeInt = toIntegral(ModelType::FIRST); modelTypeInt != toIntegral(ModelType::LAST); ++modelTypeInt)
+        {
+            ModelType modelType = (ModelType)modelTypeInt;
+            Ogre::String type = toString(modelType);
+            auto it = index.modelsPositions.find(modelType);
+            Json::Value const &overrides = journalModels[type];
+
+            if(index.modelsPositions.end() == it && !journalManagers.isMember(type) && overrides.isNull())
+            {
+                Debug::log("no models for type ")(type).endl();
+                continue;
+            }
+
+            ModelManager *mm = modelManager(modelType);
+
+            if(mm == nullptr)
+            {
+                Debug::warning("no modelManager for type ")(type).endl();
+                continue;
+            }
+
+            // saved as a whole by the journal
+            if(journalManagers.isMember(type))
+            {
+                mm->fromJson(journalManagers[type]);
+                continue;
+            }
+
+            if(index.modelsPositions.end() != it)
+            {
+                reader.seek(it->second);
+
+                if(overrides.empty())
+                    mm->fromJson(reader);
+                else if(Json::objectValue == reader.nextType())
+                {
+                    // records the journal replaces or removes are skipped without being parsed
+                    Json::Value node;
+                    Ogre::String key;
+                    reader.beginObject();
+
+                    while(reader.nextKey(key))
+                    {
+                        if(overrides.isMember(key))
+                        {
+                            reader.skipValue();
+                            continue;
+                        }
+
+                        if(!reader.readValue(node))
+                            break;
+
+                        ModelId mid = Ogre::StringConverter::parseUnsignedLong(key, INVALID_ID);
+
+                        if(!mm->fromSingleJson(node, mid))
+                            Debug::error("could not deserialize model ")(type)(" ")(key).endl();
+                    }
+                }
+
+                if(!reader.ok())
+                {
+                    Debug::error("could not parse models of type ")(type)(": ")(reader.errorMessage()).endl();
+                    Debug::log.unIndent();
+                    return false;
+                }
+            }
+
+            deserializeJournalModels(mm, type, overrides);
+        }
+
+        Debug::log("models done").endl();
+
+        Debug::log("now instanciate ALL the agents ! \\o/").endl();
+
+        Json::Value const &journalAgents = journal[LevelJournal::AGENTS_ATTRIBUTE];
+
+        if(index.hasAgents && reader.seek(index.agentsPosition) && Json::objectValue == reader.nextType())
+        {
+            Json::Value agentData;
+            Ogre::String key;
+            reader.beginObject();
+
+            while(reader.nextKey(key))
+            {
+                if(journalAgents.isMember(key))
+                {
+                    reader.skipValue();
+                    continue;
+                }
+
+                if(!reader.readValue(agentData))
+                    break;
+
+                AgentId aid = Ogre::StringConverter::parseUnsignedLong(key, INVALID_ID);
+                assert(aid != INVALID_ID);
+
+                if(!deserializeAgent(aid, agentData))
+                {
+                    Debug::log.unIndent();
+                    return false;
+                }
+            }
+        }
+
+        if(!reader.ok())
+        {
+            Debug::error("could not parse agents: ")(reader.errorMessage()).endl();
+            Debug::log.unIndent();
+            return false;
+        }
+
+        if(!deserializeJournalAgents(journalAgents))
+        {
+            Debug::log.unIndent();
+            return false;
+        }
+
+        Debug::log("agents done").endl();
+        Debug::log(logName() + ".deserialize(stream): done").unIndent().endl();
+        return true;
+    }
+
+    bool Level::deserializeParallel(File const &savefile)
+    {
+        Debug::log(logName() + ".deserialize(parallel):").endl().indent();
+
+        SaveIndex index;
+        {
+            std::ifstream stream(savefile.fullPath().c_str(), std::ios::in | std::ios::binary);
+            JsonStreamReader reader(stream);
+
+            if(!indexSave(reader, index))
+            {
+                Debug::log.unIndent();
+                return false;
+            }
+        }
+
+        // workers parse all managers' models and the agents, while properties (terrain !) are being loaded
+        JsonRecordPrefetcher prefetcher;
+        std::map<ModelType, JsonRecordPrefetcher::ChannelId> modelsChannels;
+
+        for(auto const & it : index.modelsPositions)
+        {
+            if(nullptr != modelManager(it.first))
+                modelsChannels[it.first] = prefetcher.add(savefile.fullPath(), it.second);
+        }
+
+        JsonRecordPrefetcher::ChannelId agentsChannel = 0;
+
+        if(index.hasAgents)
+            agentsChannel = prefetcher.add(savefile.fullPath(), index.agentsPosition);
+
+        if(!deserializeProperties(index.properties))
+        {
+            Debug::log.unIndent();
+            return false;
+        }
+
+        Debug::log("instanciate ALL the models ! \\o/").endl();
+
+        if(!index.hasManagers)
+            Debug::warning("no models, really ?").endl();
+
+        JsonRecordPrefetcher::Record record;
+
+        for(auto modelTypeInt = toIntegral(ModelType::FIRST); modelTypeInt != toIntegral(ModelType::LAST) && index.hasManagers; ++modelTypeInt)
+        {
+            ModelType modelType = (ModelType)modelTypeInt;
+            Ogre::String type = toString(modelType);
+
+            if(index.modelsPositions.end() == index.modelsPositions.find(modelType))
+            {
+                Debug::log("no models for type ")(type).endl();
+                continue;
+            }
+
+            ModelManager *mm = modelManager(modelType);
+            auto it = modelsChannels.find(modelType);
+
+            if(mm == nullptr || modelsChannels.end() == it)
+            {
+                Debug::warning("no modelManager for type ")(type).endl();
+                continue;
+            }
+
+            if(mm->modelsKeyedByIds())
+            {
+                while(prefetcher.next(it->second, record))
+                {
+                    ModelId mid = Ogre::StringConverter::parseUnsignedLong(record.key, INVALID_ID);
+
+                    if(!mm->fromSingleJson(record.value, mid))
+                        Debug::error("could not deserialize model ")(type)(" ")(record.key).endl();
+                }
+            }
+            else
+            {
+                // layout of its own, handed over whole
+                Json::Value models(Json::objectValue);
 
-            agents[Ogre::StringConverter::toString(aid)] = agent->toJson();
+                while(prefetcher.next(it->second, record))
+                    models[record.key].swap(record.value);
 
-            for(auto const & it : agent->modelsIds())
-                persistentModels.emplace(it.first, std::list<ModelId>()).first->second.push_back(it.second);
+                if(models.size() > 0)
+                    mm->fromJson(models);
+            }
 
+            if(!prefetcher.ok(it->second))
+            {
+                Debug::error("could not parse models of type ")(type)(": ")(prefetcher.errorMessage(it->second)).endl();
+                Debug::log.unIndent();
+                return false;
+            }
         }
 
-        root[Level::AGENTS_ATTRIBUTE] = agents;
-        Debug::log("all agents done.").unIndent().endl();
+        Debug::log("models done").endl();
 
-        // serialise models
-        Debug::log("processing models...").endl();
-        Json::Value models;
+        Debug::log("now instanciate ALL the agents ! \\o/").endl();
 
-        for(auto modelTypeInt = toIntegral(ModelType::FIRST); modelTypeInt != toIntegral(ModelType::LAST); ++modelTypeInt)
+        while(index.hasAgents && prefetcher.next(agentsChannel, record))
         {
-            ModelType modelType = (ModelType)modelTypeInt;
-            ModelManager *mm = modelManager(modelType);
+            AgentId aid = Ogre::StringConverter::parseUnsignedLong(record.key, INVALID_ID);
+            assert(aid != INVALID_ID);
 
-            if(mm == nullptr)
+            if(!deserializeAgent(aid, record.value))
             {
-                Debug::warning(logName() + ".serialize(): no modelManager of type ")(toString(modelType)).endl();
-                continue;
+                Debug::log.unIndent();
+                return false;
             }
-
-            std::list<ModelId> modelsIds = persistentModels.emplace(modelType, std::list<ModelId>()).first->second;
-            mm->toJson(models[toString(modelType)], modelsIds);
         }
 
-        root[Level::MANAGERS_ATTRIBUTE] = models;
-        root[Level::GRAVITY_ATTRIBUTE] = JsonUtils::toJson(mGravity);
-
-        Debug::log("all models done.").unIndent().endl();
+        if(index.hasAgents && !prefetcher.ok(agentsChannel))
+        {
+            Debug::error("could not parse agents: ")(prefetcher.errorMessage(agentsChannel)).endl();
+            Debug::log.unIndent();
+            return false;
+        }
 
-        Debug::log("serialization done").unIndent().endl();
-        s = root.toStyledString();
-//         Debug::log(s).endl();
+        Debug::log("agents done").endl();
+        Debug::log(logName() + ".deserialize(parallel): done").unIndent().endl();
+        return true;
     }
 
-    bool Level::deserialize(Ogre::String &s)
+    bool Level::indexSave(JsonStreamReader &reader, SaveIndex &index)
     {
-        Debug::log(logName() + ".deserialize():").endl().indent();
-//         Debug::log(s).endl();
-        Json::Reader reader;
-        Json::Value root;
-        bool parsingOk = reader.parse(s, root, false);
+        // level properties are read (they are small), and the positions of each manager's models and of the agents noted
+        index.properties = Json::Value(Json::objectValue);
+        index.modelsPositions.clear();
+        index.hasManagers = index.hasAgents = false;
+        index.agentsPosition = 0;
+        Ogre::String key;
+        reader.beginObject();
+
+        while(reader.nextKey(key))
+        {
+            if(Level::AGENTS_ATTRIBUTE == key)
+            {
+                index.hasAgents = true;
+                index.agentsPosition = reader.position();
+                reader.skipValue();
+            }
+            else if(Level::MANAGERS_ATTRIBUTE == key && Json::objectValue == reader.nextType())
+            {
+                index.hasManagers = true;
+                Ogre::String type;
+                reader.beginObject();
 
-        if(!parsingOk)
+                while(reader.nextKey(type))
+                {
+                    ModelType modelType = toModelType(type);
+
+                    if(ModelType::LAST == modelType)
+                        Debug::warning("unknown model type ")(type)(", skipping it.").endl();
+                    else
+                        index.modelsPositions[modelType] = reader.position();
+
+                    reader.skipValue();
+                }
+            }
+            else
+                reader.readValue(index.properties[key]);
+        }
+
+        if(!reader.ok())
         {
-            Debug::error("could not parse this:").endl();
-            Debug::error(s).endl();
-            Debug::error(reader.getFormattedErrorMessages()).endl();
+            Debug::error("could not parse level: ")(reader.errorMessage()).endl();
             return false;
         }
 
+        return true;
+    }
+
+    bool Level::deserializeProperties(Json::Value &root)
+    {
         Json::Value value;
 
         // get level info
@@ -498,69 +1339,240 @@ namespace Steel
             return false;
         }
 
-        Debug::log("instanciate ALL the models ! \\o/").endl();
-        Json::Value dict = root[Level::MANAGERS_ATTRIBUTE];
+        return true;
+    }
 
-        if(dict.isNull())
+    bool Level::deserializeAgent(AgentId aid, Json::Value &agentData)
+    {
+        Agent *agent = mAgentMan->newAgent(aid);
+
+        if(nullptr == agent)
         {
-            Debug::warning("no models, really ?").endl();
+            Debug::error("could not create agent ")(aid)(".").endl().breakHere();
+            return false;
         }
-        else
+
+        agent->fromJson(agentData);
+
+        if(agent->modelsIds().size() == 0)
         {
-            for(auto modelTypeInt = toIntegral(ModelType::FIRST); modelTypeInt != toIntegral(ModelType::LAST); ++modelTypeInt)
+            Debug::warning("deleting agent ")(aid)(" with 0 models.").endl();
+            mAgentMan->deleteAgent(aid);
+        }
+
+        return true;
+    }
+
+    void Level::deserializeJournalModels(ModelManager *mm, Ogre::String const &type, Json::Value const &records)
+    {
+        for(Json::ValueConstIterator it = records.begin(); it != records.end(); ++it)
+        {
+            if(it->isNull())
+                continue;
+
+            ModelId mid = Ogre::StringConverter::parseUnsignedLong(it.memberName(), INVALID_ID);
+
+            if(!mm->fromSingleJson(*it, mid))
+                Debug::error("could not deserialize journaled model ")(type)(" ")(it.memberName()).endl();
+        }
+    }
+
+    bool Level::deserializeJournalAgents(Json::Value const &records)
+    {
+        for(Json::ValueConstIterator it = records.begin(); it != records.end(); ++it)
+        {
+            if(it->isNull())
+                continue;
+
+            AgentId aid = Ogre::StringConverter::parseUnsignedLong(it.memberName(), INVALID_ID);
+            assert(aid != INVALID_ID);
+            Json::Value agentData = *it;
+
+            if(!deserializeAgent(aid, agentData))
+                return false;
+        }
+
+        return true;
+    }
+
+    bool Level::incrementalSaveDue(Ogre::String const &basePath)
+    {
+        if(!mIncrementalSave || basePath != mSavedBase)
+            return false;
+
+        // past some size, replaying the journal costs more than writing the whole level once
+        Ogre::String const journalPath = getJournalFile().fullPath();
+
+        if(LevelJournal::fileSize(journalPath) > LevelJournal::fileSize(basePath) * mJournalCompactionRatio)
+            return false;
+
+        return LevelJournal::belongsTo(journalPath, basePath);
+    }
+
+    void Level::collectIncrement(Json::Value &segment)
+    {
+        segment = Json::Value(Json::objectValue);
+
+        // small, but the terrain's are not worth appending again if unchanged
+        Json::Value properties(Json::objectValue);
+        properties[Level::NAME_ATTRIBUTE] = mName;
+        properties[Level::BACKGROUND_COLOR_ATTRIBUTE] = JsonUtils::toJson(mBackgroundColor);
+        properties[Level::CAMERA_ATTRIBUTE] = mCamera->toJson();
+        properties[Level::GRAVITY_ATTRIBUTE] = JsonUtils::toJson(mGravity);
+        properties[Level::TERRAIN_ATTRIBUTE] = mTerrainMan.toJson();
+
+        for(Json::ValueConstIterator it = properties.begin(); it != properties.end(); ++it)
+        {
+            if(!mSavedProperties.isObject() || !mSavedProperties.isMember(it.memberName()) || mSavedProperties[it.memberName()] != *it)
+                segment[LevelJournal::PROPERTIES_ATTRIBUTE][it.memberName()] = *it;
+        }
+
+        mSavedProperties.swap(properties);
+
+        // what changed since the last save, as reported by the managers
+        std::vector<AgentId> aids;
+        mAgentMan->takeDirtyAgents(aids);
+        std::set<AgentId> const dirtyAgents(aids.begin(), aids.end());
+        std::map<ModelType, std::set<ModelId>> dirtyModels;
+        std::vector<ModelId> mids;
+
+        for(auto const & it : mManagers)
+        {
+            it.second->takeDirtyModels(mids);
+            dirtyModels[it.first].insert(mids.begin(), mids.end());
+        }
+
+        // no longer linked by any saved agent
+        std::map<ModelType, std::set<ModelId>> droppedModels;
+        Json::Value agents(Json::objectValue);
+
+        for(AgentId const aid : dirtyAgents)
+        {
+            Agent *agent = mAgentMan->getAgent(aid);
+            bool const persistent = nullptr != agent && agent->isPersistent();
+            auto saved = mSavedAgents.find(aid);
+
+            if(!persistent && mSavedAgents.end() == saved)
+                continue;
+
+            std::map<ModelType, ModelId> const models = persistent ? agent->modelsIds() : std::map<ModelType, ModelId>();
+            std::map<ModelType, ModelId> const previous = mSavedAgents.end() == saved ? std::map<ModelType, ModelId>() : saved->second;
+            agents[Ogre::StringConverter::toString(aid)] = persistent ? agent->toJson() : Json::Value();
+
+            for(auto const & it : previous)
             {
-                ModelType modelType = (ModelType)modelTypeInt;
-                Ogre::String type = toString(modelType);
-                Json::Value models = dict[type];
+                auto link = models.find(it.first);
 
-                if(models.isNull())
-                {
-                    Debug::log("no models for type ")(type).endl();
+                if(models.end() != link && link->second == it.second)
                     continue;
-                }
 
-                ModelManager *mm = modelManager(modelType);
+                std::map<ModelId, u32> &counts = mSavedModels[it.first];
+                auto count = counts.find(it.second);
 
-                if(mm == nullptr)
+                if(counts.end() != count && 0 == --count->second)
                 {
-                    Debug::warning("no modelManager for type ")(type).endl();
-                    continue;
+                    counts.erase(count);
+                    droppedModels[it.first].insert(it.second);
                 }
+            }
 
-                mm->fromJson(models);
+            for(auto const & it : models)
+            {
+                auto link = previous.find(it.first);
+
+                if(previous.end() != link && link->second == it.second)
+                    continue;
+
+                // new to the save, dirty or not
+                if(1 == ++mSavedModels[it.first][it.second])
+                    dirtyModels[it.first].insert(it.second);
             }
 
-            Debug::log("models done").endl();
+            if(persistent)
+                mSavedAgents[aid] = models;
+            else
+                mSavedAgents.erase(saved);
         }
 
-        Debug::log("now instanciate ALL the agents ! \\o/").endl();
-        dict = root[Level::AGENTS_ATTRIBUTE];
+        if(agents.size() > 0)
+            segment[LevelJournal::AGENTS_ATTRIBUTE] = agents;
 
-        for(Json::ValueIterator it = dict.begin(); it != dict.end(); ++it)
+        for(auto const & it : mManagers)
         {
-            AgentId aid = Ogre::StringConverter::parseUnsignedLong(it.key().asString(), INVALID_ID);
-            assert(aid != INVALID_ID);
+            ModelType const modelType = it.first;
+            ModelManager *mm = it.second;
+            std::map<ModelId, u32> const &saved = mSavedModels[modelType];
+            std::set<ModelId> const &dropped = droppedModels[modelType];
+            std::set<ModelId> &changed = dirtyModels[modelType];
+            changed.insert(dropped.begin(), dropped.end());
+
+            if(!mm->modelsKeyedByIds())
+            {
+                bool touched = false;
 
-            Agent *agent = mAgentMan->newAgent(aid);
+                for(ModelId const mid : changed)
+                    touched |= saved.end() != saved.find(mid) || dropped.end() != dropped.find(mid);
 
-            if(nullptr == agent)
-            {
-                Debug::error("could not create agent ")(aid)(".").endl().breakHere();
-                return false;
+                if(!touched)
+                    continue;
+
+                // records do not map to models: the whole manager it is
+                std::list<ModelId> ids;
+
+                for(auto const & savedIt : saved)
+                    ids.push_back(savedIt.first);
+
+                mm->toJson(segment[LevelJournal::MANAGERS_ATTRIBUTE][toString(modelType)], ids);
+                continue;
             }
 
-            agent->fromJson(*it);
+            Json::Value models(Json::objectValue);
 
-            if(agent->modelsIds().size() == 0)
+            for(ModelId const mid : changed)
             {
-                Debug::warning("deleting agent ")(aid)(" with 0 models.").endl();
-                mAgentMan->deleteAgent(aid);
+                if(saved.end() != saved.find(mid))
+                {
+                    Json::Value &node = models[Ogre::StringConverter::toString(mid)];
+                    node = Json::Value(Json::objectValue);
+                    mm->toSingleJson(mid, node);
+                }
+                else if(dropped.end() != dropped.find(mid))
+                    models[Ogre::StringConverter::toString(mid)] = Json::Value();
             }
+
+            if(models.size() > 0)
+                segment[LevelJournal::MODELS_ATTRIBUTE][toString(modelType)] = models;
         }
+    }
 
-        Debug::log("agents done").endl();
-        Debug::log(logName() + ".deserialize(): done").unIndent().endl();
-        return true;
+    void Level::markSaved(Ogre::String const &basePath)
+    {
+        mSavedBase = basePath;
+        mSavedAgents.clear();
+        mSavedModels.clear();
+        // the next segment has them all
+        mSavedProperties = Json::Value();
+
+        // changes so far are in the save
+        std::vector<AgentId> aids;
+        mAgentMan->takeDirtyAgents(aids);
+        std::vector<ModelId> mids;
+
+        for(auto const & it : mManagers)
+            it.second->takeDirtyModels(mids);
+
+        for(auto const & it : mAgentMan->mAgents)
+        {
+            Agent *agent = it.second;
+
+            if(!agent->isPersistent())
+                continue;
+
+            mSavedAgents[it.first] = agent->modelsIds();
+
+            for(auto const & modelIt : agent->modelsIds())
+                ++mSavedModels[modelIt.first][modelIt.second];
+        }
     }
 
     void Level::update(float timestep)
@@ -572,6 +1584,37 @@ namespace Steel
         //mOgreModelMan.update(timestep);
         //mLocationModelMan.update(timestep);
         mBTModelMan->update(timestep);
+
+        // models are done submitting their debug lines
+        mDebugLines->flush();
+
+        // end of the frame: the snapshot is consistent
+        mTimeSinceAutosave += timestep;
+
+        if(mAutosaveInterval > 0.f && mTimeSinceAutosave >= mAutosaveInterval)
+            autosave();
+
+        collectAutosaves();
+    }
+
+    void Level::collectAutosaves()
+    {
+        std::vector<LevelSnapshotWriter::Done> done;
+
+        if(!mSnapshotWriter->collect(done))
+            return;
+
+        for(auto const & it : done)
+        {
+            if(it.success)
+                Debug::log(logName() + ".collectAutosaves(): autosaved into ")(it.path)(" in ")(it.milliseconds)("ms").endl();
+            else
+            {
+                Debug::error(logName() + ".collectAutosaves(): could not autosave into ")(it.path).endl();
+                // what was marked saved was not: start over from a full save
+                mSavedBase.clear();
+            }
+        }
     }
 
     bool Level::instanciateResource(File const &file)
@@ -942,13 +1985,12 @@ namespace Steel
                       mousPos.y / static_cast<float>(mEngine->renderWindow()->getHeight()));
 
         // get terrain under the cam
-        Ogre::Terrain *terrain = nullptr;
         auto camPos = cam->camNode()->convertLocalToWorldPosition(Ogre::Vector3::ZERO);
-        float height = mTerrainMan.terrainGroup()->getHeightAtWorldPosition(camPos, &terrain);
+        Ogre::Real height = .0f;
 
         Ogre::Plane plane(Ogre::Vector3::UNIT_Y, 0.f);
 
-        if(nullptr != terrain)
+        if(mTerrainMan.heightSampler()->height(camPos.x, camPos.z, height))
         {
             // cam is above a terrain, we use its height as base for the plane
             plane.d += height;
@@ -1098,5 +2140,266 @@ namespace Steel
         return true;
     }
 
+    namespace
+    {
+        /// Creates a persistent (or not) agent linked to a new cube OgreModel at the given position.
+        AgentId newCubeAgent(Level *level, Ogre::Vector3 const &position, bool persistent)
+        {
+            AgentId aid = level->agentMan()->newAgent();
+            Agent *agent = level->agentMan()->getAgent(aid);
+            ModelId mid = level->ogreModelMan()->newModel("Prefab_Cube", position, Ogre::Quaternion::IDENTITY);
+
+            if(!agent->linkToModel(ModelType::OGRE, mid))
+            {
+                level->agentMan()->deleteAgent(aid);
+                return INVALID_ID;
+            }
+
+            agent->setPersistent(persistent);
+            return aid;
+        }
+
+        /// Member names of segment[attribute][key], or of segment[attribute] if key is null.
+        std::set<Ogre::String> segmentKeys(Json::Value const &segment, char const *attribute, char const *key = nullptr)
+        {
+            Json::Value const &records = nullptr == key ? segment[attribute] : segment[attribute][key];
+            std::set<Ogre::String> keys;
+
+            if(records.isObject())
+            {
+                for(auto const & name : records.getMemberNames())
+                    keys.insert(name);
+            }
+
+            return keys;
+        }
+    }
+
+    bool utest_LevelDirtyTracking(UnitTestExecutionContext const *context)
+    {
+        Level *level = context->engine->createLevel("utest_LevelDirtyTracking");
+        AgentManager *agentMan = level->agentMan();
+        Ogre::String const ogre = toString(ModelType::OGRE), blackBoard = toString(ModelType::BLACKBOARD);
+        bool allWasFine = true;
+
+        auto check = [&allWasFine](bool condition, char const * what)
+        {
+            if(!condition)
+            {
+                Debug::error("utest_LevelDirtyTracking(): ", what).endl();
+                allWasFine = false;
+            }
+        };
+
+        // a physics agent with a blackboard, another agent, and a non persistent one
+        AgentId const aid = newCubeAgent(level, Ogre::Vector3::ZERO, true);
+        AgentId const otherAid = newCubeAgent(level, Ogre::Vector3(10.f, 0.f, 0.f), true);
+        AgentId const transientAid = newCubeAgent(level, Ogre::Vector3(20.f, 0.f, 0.f), false);
+
+        if(INVALID_ID == aid || INVALID_ID == otherAid || INVALID_ID == transientAid)
+        {
+            Debug::error(STEEL_METH_INTRO, "could not create agents.").endl();
+            delete level;
+            return false;
+        }
+
+        Agent *agent = agentMan->getAgent(aid), *other = agentMan->getAgent(otherAid), *transient = agentMan->getAgent(transientAid);
+        agent->linkToModel(ModelType::PHYSICS, level->physicsModelMan()->newModel());
+        agent->linkToModel(ModelType::BLACKBOARD, level->blackBoardModelMan()->newModel());
+        Ogre::String const aidKey = Ogre::StringConverter::toString(aid), otherAidKey = Ogre::StringConverter::toString(otherAid);
+        Ogre::String const omidKey = Ogre::StringConverter::toString(agent->ogreModelId());
+        Ogre::String const otherOmidKey = Ogre::StringConverter::toString(other->ogreModelId());
+        Ogre::String const bbmidKey = Ogre::StringConverter::toString(agent->blackBoardModelId());
+
+        level->markSaved("utest_LevelDirtyTracking");
+        Json::Value segment;
+
+        level->collectIncrement(segment);
+        check(segment.isMember(LevelJournal::PROPERTIES_ATTRIBUTE) && !segment.isMember(LevelJournal::AGENTS_ATTRIBUTE)
+              && !segment.isMember(LevelJournal::MODELS_ATTRIBUTE), "first segment after a full save should only hold properties.");
+
+        // what did not change is not written again
+        level->collectIncrement(segment);
+        check(0 == segment.size(), "unchanged level should give an empty segment.");
+
+        other->tag(TagManager::instance().toTag("__utest_LevelDirtyTracking.tag"));
+        transient->ogreModel()->setPosition(Ogre::Vector3(30.f, 0.f, 0.f));
+        level->collectIncrement(segment);
+        check(std::set<Ogre::String>({otherAidKey}) == segmentKeys(segment, LevelJournal::AGENTS_ATTRIBUTE)
+              && !segment.isMember(LevelJournal::MODELS_ATTRIBUTE), "tagging should only write the tagged agent.");
+
+        agent->blackBoardModel()->setVariable("__utest_LevelDirtyTracking", "1");
+        level->collectIncrement(segment);
+        check(!segment.isMember(LevelJournal::AGENTS_ATTRIBUTE) && 1 == segment[LevelJournal::MODELS_ATTRIBUTE].size()
+              && std::set<Ogre::String>({bbmidKey}) == segmentKeys(segment, LevelJournal::MODELS_ATTRIBUTE, blackBoard.c_str()),
+              "blackboard write should only write the blackboard.");
+
+        // moved by its body, as the simulation does
+        Ogre::Vector3 const moved(0.f, 5.f, 0.f);
+        agent->physicsModel()->setPosition(moved);
+        level->physicsModelMan()->update(0.f);
+        level->collectIncrement(segment);
+        Json::Value const &ogreRecord = segment[LevelJournal::MODELS_ATTRIBUTE][ogre][omidKey];
+        check(!segment.isMember(LevelJournal::AGENTS_ATTRIBUTE) && std::set<Ogre::String>({omidKey}) == segmentKeys(segment, LevelJournal::MODELS_ATTRIBUTE, ogre.c_str())
+              && JsonUtils::asVector3(ogreRecord[OgreModel::POSITION_ATTRIBUTE], Ogre::Vector3::ZERO).positionEquals(moved, 1e-3f),
+              "physics motion should write the moved OgreModel.");
+
+        agent->unlinkFromModel(ModelType::BLACKBOARD);
+        level->collectIncrement(segment);
+        check(std::set<Ogre::String>({aidKey}) == segmentKeys(segment, LevelJournal::AGENTS_ATTRIBUTE)
+              && segment[LevelJournal::MODELS_ATTRIBUTE][blackBoard].isMember(bbmidKey)
+              && segment[LevelJournal::MODELS_ATTRIBUTE][blackBoard][bbmidKey].isNull(), "unlinking should remove the model.");
+
+        agent->linkToModel(ModelType::BLACKBOARD, level->blackBoardModelMan()->newModel());
+        Ogre::String const newBbmidKey = Ogre::StringConverter::toString(agent->blackBoardModelId());
+        level->collectIncrement(segment);
+        check(std::set<Ogre::String>({aidKey}) == segmentKeys(segment, LevelJournal::AGENTS_ATTRIBUTE)
+              && segment[LevelJournal::MODELS_ATTRIBUTE][blackBoard][newBbmidKey].isObject(), "linking should write the model.");
+
+        agentMan->deleteAgent(otherAid);
+        level->collectIncrement(segment);
+        check(segment[LevelJournal::AGENTS_ATTRIBUTE].isMember(otherAidKey) && segment[LevelJournal::AGENTS_ATTRIBUTE][otherAidKey].isNull()
+              && segment[LevelJournal::MODELS_ATTRIBUTE][ogre].isMember(otherOmidKey)
+              && segment[LevelJournal::MODELS_ATTRIBUTE][ogre][otherOmidKey].isNull(), "deletion should remove the agent and its model.");
+
+        level->collectIncrement(segment);
+        check(0 == segment.size(), "segment should be empty once all was saved.");
+
+        Ogre::String const path = level->mPath.fullPath();
+        delete level;
+        std::remove(path.c_str());
+        return allWasFine;
+    }
+
+    bool utest_LevelIncrementalSaveSpeed(UnitTestExecutionContext const *context)
+    {
+        u32 const count = 10000;
+        Level *level = context->engine->createLevel("utest_LevelIncrementalSaveSpeed");
+        level->mIncrementalSave = true;
+        std::vector<AgentId> aids;
+
+        for(u32 i = 0; i < count; ++i)
+            aids.push_back(newCubeAgent(level, Ogre::Vector3((float)(i % 100), 0.f, (float)(i / 100)), true));
+
+        if(aids.end() != std::find(aids.begin(), aids.end(), INVALID_ID))
+        {
+            Debug::error(STEEL_METH_INTRO, "could not create agents.").endl();
+            delete level;
+            return false;
+        }
+
+        Ogre::Timer timer;
+        bool success = level->save();
+        double const fullMs = timer.getMicroseconds() / 1000.;
+        Debug::log(STEEL_METH_INTRO, count, " agents: full save in ", fullMs, "ms").endl().indent();
+
+        for(u32 const changes : {0u, 1u, 100u})
+        {
+            for(u32 i = 0; i < changes; ++i)
+                level->agentMan()->getAgent(aids[i])->ogreModel()->move(Ogre::Vector3::UNIT_Y);
+
+            timer.reset();
+            success &= level->save();
+            double const incrementalMs = timer.getMicroseconds() / 1000.;
+            Debug::log(changes, " agents moved: incremental save in ", incrementalMs, "ms, ratio to full: ",
+                       incrementalMs / std::max(fullMs, 1e-3)).endl();
+        }
+
+        u64 const journalSize = LevelJournal::fileSize(level->getJournalFile().fullPath());
+        Debug::log("journal size: ", journalSize, " bytes").endl().unIndent();
+        success &= journalSize > 0;
+
+        if(!success)
+            Debug::error(STEEL_METH_INTRO, "could not save.").endl();
+
+        // loaded back, journaled records replacing the base ones as it is streamed
+        Ogre::Vector3 const movedPosition = level->agentMan()->getAgent(aids[0])->ogreModel()->position();
+        delete level;
+        level = context->engine->createLevel("utest_LevelIncrementalSaveSpeed");
+
+        timer.reset();
+        bool const loaded = level->load();
+        Debug::log(STEEL_METH_INTRO, "journaled load in ", timer.getMicroseconds() / 1000., "ms").endl();
+
+        Agent *moved = loaded ? level->agentMan()->getAgent(aids[0]) : nullptr;
+        Agent *last = loaded ? level->agentMan()->getAgent(aids.back()) : nullptr;
+
+        if(nullptr == moved || nullptr == last || nullptr == moved->ogreModel()
+                || !moved->ogreModel()->position().positionEquals(movedPosition))
+        {
+            Debug::error(STEEL_METH_INTRO, "journaled save did not load back as saved.").endl();
+            success = false;
+        }
+
+        Ogre::String const path = level->mPath.fullPath();
+        std::remove(level->getSavefile().fullPath().c_str());
+        std::remove(level->getJournalFile().fullPath().c_str());
+        delete level;
+        std::remove(path.c_str());
+        return success;
+    }
+
+    bool utest_LevelAutosaveSpeed(UnitTestExecutionContext const *context)
+    {
+        u32 const count = 10000;
+        Level *level = context->engine->createLevel("utest_LevelAutosaveSpeed");
+        level->mIncrementalSave = false;
+        bool success = true;
+
+        for(u32 i = 0; i < count && success; ++i)
+            success = INVALID_ID != newCubeAgent(level, Ogre::Vector3((float)(i % 100), 0.f, (float)(i / 100)), true);
+
+        if(!success)
+        {
+            Debug::error(STEEL_METH_INTRO, "could not create agents.").endl();
+            delete level;
+            return false;
+        }
+
+        // what the frame an autosave is taken in pays: the whole capture, and the hand over to the worker
+        Ogre::Timer timer;
+        LevelSnapshotWriter::Job job;
+        job.path = level->getSavefile().fullPath();
+        job.format = LevelSnapshotWriter::Format::JSON;
+        level->serialize(job.root);
+        double const serializeMs = timer.getMicroseconds() / 1000.;
+        level->mSnapshotWriter->queue(job);
+        double const captureMs = timer.getMicroseconds() / 1000.;
+        level->mSnapshotWriter->flush();
+
+        timer.reset();
+        success &= level->autosave();
+        double const autosaveMs = timer.getMicroseconds() / 1000.;
+        level->mSnapshotWriter->flush();
+
+        timer.reset();
+        success &= level->save();
+        double const saveMs = timer.getMicroseconds() / 1000.;
+
+        // once saved, only what changed is captured, and the worker rebuilds the save
+        timer.reset();
+        success &= level->autosave();
+        double const savedAutosaveMs = timer.getMicroseconds() / 1000.;
+        level->mSnapshotWriter->flush();
+
+        std::vector<LevelSnapshotWriter::Done> done;
+        level->mSnapshotWriter->collect(done);
+
+        for(auto const & it : done)
+            success &= it.success;
+
+        Debug::log(STEEL_METH_INTRO, count, " agents: serialize(Json::Value &) in ", serializeMs, "ms, with queue() ", captureMs,
+                   "ms; autosave() ", autosaveMs, "ms; synchronous save() ", saveMs, "ms; autosave() once saved ", savedAutosaveMs,
+                   "ms (rebuilt by the worker in ", done.empty() ? 0. : done.back().milliseconds, "ms)").endl();
+
+        if(!success)
+            Debug::error(STEEL_METH_INTRO, "could not save.").endl();
+
+        Ogre::String const path = level->mPath.fullPath();
+        std::remove(level->getSavefile().fullPath().c_str());
+        delete level;
+        std::remove(path.c_str());
+        return success;
+    }
 }
 // kate: indent-mode cstyle; indent-width 4; replace-tabs on; 
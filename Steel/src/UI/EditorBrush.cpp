@@ -6,6 +6,7 @@
 #include "UI/UI.h"
 #include "Camera.h"
 #include "Level.h"
+#include "terrain/TerrainHeightSampler.h"
 #include "tools/Cylinder.h"
 #include "tools/OgreUtils.h"
 #include "tools/DynamicLines.h"
@@ -294,12 +295,12 @@ namespace Steel
                 {
                     case Input::Code::MC_MIDDLE:
                     {
-                        Ogre::Terrain *terrain;
-                        auto pos = level->terrainManager()->terrainGroup()->getHeightAtWorldPosition(sTerraBrushVisual->getPosition(), &terrain);
+                        Ogre::Vector3 const brushPos = sTerraBrushVisual->getPosition();
+                        Ogre::Real height = .0f;
 
                         // keep last valid value
-                        if(terrain != nullptr)
-                            mSelectedTerrainHeight = pos;
+                        if(level->terrainManager()->heightSampler()->height(brushPos.x, brushPos.z, height))
+                            mSelectedTerrainHeight = height;
 
                         break;
                     }
@@ -374,12 +375,15 @@ namespace Steel
             {
                 if(mContinuousModeActivated)
                 {
-                    //now might be the right time to update blendmaps
+                    // stroke is over: wait for the background edits, then update derived data once.
+                    // Blendmaps are kept up to date by the edits themselves.
+                    std::set<Ogre::Terrain *> edited = level->terrainManager()->flushTerrainEdits();
+                    mModifiedTerrains.insert(edited.begin(), edited.end());
+
                     for(auto it = mModifiedTerrains.begin(); it != mModifiedTerrains.end(); ++it)
                     {
                         Ogre::Terrain *terrain = *it;
                         terrain->update(true);
-                        level->terrainManager()->updateBlendMaps(terrain);
 //                             level->terrainManager()->updateHeightmap(terrain);
                         continue;
 
@@ -391,6 +395,9 @@ namespace Steel
 
                         terrain->updateDerivedData(true);
                     }
+
+                    // paged terrains may go away before the next stroke
+                    mModifiedTerrains.clear();
                 }
 
                 break;
@@ -657,7 +664,6 @@ namespace Steel
 
                     if(mContinuousModeActivated)
                     {
-                        Ogre::TerrainGroup::TerrainList newTids;
                         Ogre::Real _intensity;
                         Ogre::Real _radius = radius();
                         TerrainManager::RaiseMode rMode = TerrainManager::RaiseMode::RELATIVE;
@@ -679,8 +685,8 @@ namespace Steel
                             _intensity = -intensity();
                         }
 
-                        newTids = level->terrainManager()->raiseTerrainAt(hitTest.position, _intensity, _radius, rMode, mRaiseShape);
-                        mModifiedTerrains.insert(newTids.begin(), newTids.end());
+                        // applied in the background, see TerrainManager::syncTerrainEdits
+                        level->terrainManager()->queueRaiseTerrainAt(hitTest.position, _intensity, _radius, rMode, mRaiseShape);
                     }
                 }
                 else
@@ -23,6 +23,7 @@
 #include "models/OgreModelManager.h"
 #include "models/PhysicsModel.h"
 #include "tools/JsonUtils.h"
+#include "tools/JsonStreamWriter.h"
 
 namespace Steel
 {
@@ -62,7 +63,7 @@ namespace Steel
 
     Agent::Agent(const Agent &o)
         : mId(o.mId), mLevel(o.mLevel), mModelIds(o.mModelIds), mIsSelected(o.mIsSelected), mTags(o.mTags),
-          mBehaviorsStack(o.mBehaviorsStack)
+          mBehaviorsStack(o.mBehaviorsStack), mDirty(o.mDirty)
     {
     }
 
@@ -103,6 +104,7 @@ namespace Steel
         }
 
         mBehaviorsStack = o.mBehaviorsStack;
+        mDirty = o.mDirty;
 
         return *this;
     }
@@ -132,7 +134,7 @@ namespace Steel
                 continue;
 
             ++nExpected;
-            ModelId modelId = (ModelId) Ogre::StringConverter::parseUnsignedLong(mTypeValue.asString());
+            ModelId modelId = JsonUtils::asModelId(mTypeValue, INVALID_ID);
 
             if(!linkToModel(modelType, modelId))
             {
@@ -169,6 +171,7 @@ namespace Steel
         {
             mTags.insert(std::pair<Tag, unsigned>(tag, 1));
             mLevel->agentMan()->addTaggedAgent(tag, mId);
+            markDirty();
         }
         else
             it->second++;
@@ -193,6 +196,7 @@ namespace Steel
         {
             mTags.erase(it);
             mLevel->agentMan()->removeTaggedAgent(tag, mId);
+            markDirty();
         }
     }
 
@@ -254,6 +258,7 @@ namespace Steel
         }
 
         tag(mm->modelTags(modelId));
+        markDirty();
 
         return true;
     }
@@ -295,6 +300,7 @@ namespace Steel
         untag(mm->modelTags(mid));
         mm->onAgentUnlinkedFromModel(this, mid);
         mModelIds.erase(it);
+        markDirty();
     }
 
     void Agent::popBT()
@@ -450,6 +456,11 @@ namespace Steel
         return root;
     }
 
+    void Agent::toJson(JsonStreamWriter &writer)
+    {
+        writer.value(toJson());
+    }
+
     Ogre::Vector3 Agent::position() const
     {
         auto model = ogreModel();
@@ -787,6 +798,14 @@ namespace Steel
         flag ? tag(sPropertyTags.persistent) : untag(sPropertyTags.persistent);
     }
 
+    void Agent::markDirty()
+    {
+        if(!mDirty)
+            mLevel->agentMan()->queueDirtyAgent(mId);
+
+        mDirty = true;
+    }
+
 }
 // kate: indent-mode cstyle; indent-width 4; replace-tabs on; 
 
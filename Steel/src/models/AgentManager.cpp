@@ -12,7 +12,7 @@ namespace Steel
 
     AgentManager::AgentManager(Level *level): mLevel(level),
         mAgents(), mFreeList(), mNextFreeId(0),
-        mTagRegister()
+        mTagRegister(), mDirtyAgents()
     {
         Agent::staticInit();
     }
@@ -57,6 +57,8 @@ namespace Steel
     {
         Agent *t = new Agent(getFreeAgentId(), mLevel);
         mAgents.insert(std::pair<AgentId, Agent *>(t->id(), t));
+        // new agents are dirty
+        mDirtyAgents.push_back(t->id());
 //         Debug::log("new agent with id ")(t->id()).endl();
         SignalManager::instance().emit(getSignal(PublicSignal::agentCreated));
         return t->id();
@@ -71,6 +73,7 @@ namespace Steel
         {
             t = new Agent(id, mLevel);
             mAgents.insert(std::pair<AgentId, Agent *>(t->id(), t));
+            mDirtyAgents.push_back(id);
             Debug::log("new agent with id ")(t->id()).endl();
             SignalManager::instance().emit(getSignal(PublicSignal::agentCreated));
         }
@@ -128,12 +131,14 @@ namespace Steel
         delete(*it).second;
         mAgents.erase(it);
         mFreeList.push_back(id);
+        mDirtyAgents.push_back(id);
     }
 
     void AgentManager::deleteAllAgents()
     {
         while(mAgents.size())
         {
+            mDirtyAgents.push_back(mAgents.begin()->first);
             delete mAgents.begin()->second;
             mAgents.erase(mAgents.begin());
         }
@@ -210,6 +215,25 @@ namespace Steel
         return mTagRegister.emplace(tag, std::set<AgentId>()).first->second;
     }
 
+    void AgentManager::queueDirtyAgent(AgentId aid)
+    {
+        mDirtyAgents.push_back(aid);
+    }
+
+    void AgentManager::takeDirtyAgents(std::vector<AgentId> &aids)
+    {
+        aids.clear();
+        aids.swap(mDirtyAgents);
+
+        for(AgentId const aid : aids)
+        {
+            Agent *agent = getAgent(aid);
+
+            if(nullptr != agent)
+                agent->clearDirty();
+        }
+    }
+
     Signal AgentManager::getSignal(AgentManager::PublicSignal signal) const
     {
 #define STEEL_AGENTMANAGER_GETSIGNAL_CASE(NAME) case NAME:return SignalManager::instance().toSignal("Steel::AgentManager::"#NAME)
@@ -29,7 +29,7 @@ namespace Steel
     {
     }
 
-    BTModel::BTModel(const BTModel &o):
+    BTModel::BTModel(const BTModel &o): Model(o),
         mOwnerAgent(o.mOwnerAgent), mBlackBoardModelId(o.mBlackBoardModelId), mLevel(o.mLevel),
         mStateStream(o.mStateStream), mCurrentStateIndex(o.mCurrentStateIndex), mStatesStack(o.mStatesStack),
         mPaused(o.mPaused), mKilled(o.mKilled), mDebug(o.mDebug)
@@ -88,6 +88,7 @@ namespace Steel
             return false;
         }
 
+        markDirty();
         return true;
     }
 
@@ -128,6 +129,8 @@ namespace Steel
         if(mPaused || mKilled)
             return;
 
+        // a running tree changes state, hence what it saves
+        markDirty();
         BTStateIndex prevStateIndex = mCurrentStateIndex;
         BTStateIndex newIndex = mCurrentStateIndex;
         BTNode *node = nullptr;
@@ -65,6 +65,7 @@ namespace Steel
     {
         bool isNew = mVariables.end() == mVariables.find(name);
 
+        markDirty();
         mVariables.erase(name);
         mVariables[name] = value;
 
@@ -78,6 +79,7 @@ namespace Steel
     {
         bool isNew = mVariables.end() == mVariables.find(name);
 
+        markDirty();
         mVariables.erase(name);
         mVariables[name] = Ogre::StringConverter::toString(value);
 
@@ -114,7 +116,10 @@ namespace Steel
         mVariables.erase(name);
         
         if(existed)
+        {
+            markDirty();
             emit(getSignal(PublicSignal::variableDeleted));
+        }
     }
 
     Signal BlackBoardModel::getSignal(BlackBoardModel::PublicSignal signal) const
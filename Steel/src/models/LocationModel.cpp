@@ -146,6 +146,7 @@ namespace Steel
         }
 
         mDestinations.insert(aid);
+        markDirty();
         return true;
     }
 
@@ -153,6 +154,7 @@ namespace Steel
     {
         if(mDestinations.erase(aid) > 0)
         {
+            markDirty();
             Agent *agent = mLocationModelMan->level()->agentMan()->getAgent(aid);
 
             if(nullptr == agent)
@@ -214,7 +216,7 @@ namespace Steel
         }
 
         mSources.insert(aid);
-
+        markDirty();
         return true;
     }
 
@@ -222,6 +224,7 @@ namespace Steel
     {
         if(mSources.erase(aid) > 0)
         {
+            markDirty();
             Agent *agent = mLocationModelMan->level()->agentMan()->getAgent(aid);
 
             if(nullptr == agent)
@@ -245,11 +248,13 @@ namespace Steel
     void LocationModel::attachAgent(AgentId aid)
     {
         mAttachedAgent = aid;
+        markDirty();
     }
 
     void LocationModel::setPosition(Ogre::Vector3 const &pos)
     {
         mPosition = pos;
+        markDirty();
     }
 
     Ogre::Vector3 LocationModel::position()
@@ -306,7 +311,7 @@ namespace Steel
 
     void LocationModel::_setPath(const Steel::LocationPathName &name)
     {
-        applyToNetWork(std::bind([&name](LocationModel * model)->void {model->mPath = name;}, std::placeholders::_1));
+        applyToNetWork(std::bind([&name](LocationModel * model)->void {model->mPath = name; model->markDirty();}, std::placeholders::_1));
     }
 }
 // kate: indent-mode cstyle; indent-width 4; replace-tabs on; 
@@ -1,6 +1,8 @@
 #include "models/LocationModelManager.h"
-#include <tools/DynamicLines.h>
+#include <tools/DebugLinesBatch.h>
 #include <tools/JsonUtils.h>
+#include <tools/JsonStreamReader.h>
+#include <tools/JsonStreamWriter.h>
 #include <models/Agent.h>
 #include <Level.h>
 #include <models/AgentManager.h>
@@ -20,10 +22,7 @@ namespace Steel
     LocationModelManager::~LocationModelManager()
     {
         for(auto it : mDebugLines)
-        {
-            mLevel->levelRoot()->detachObject(it.second);
-            delete it.second;
-        }
+            mLevel->debugLines()->removeLine(it.second);
 
         mDebugLines.clear();
     }
@@ -38,6 +37,40 @@ namespace Steel
         return _ModelManager<LocationModel>::fromJson(root[ModelManager::MODELS_ATTRIBUTES]);
     }
 
+    std::vector<ModelId> LocationModelManager::fromJson(JsonStreamReader &reader)
+    {
+        if(Json::objectValue != reader.nextType())
+        {
+            Json::Value root;
+            return reader.readValue(root) ? fromJson(root) : std::vector<ModelId>();
+        }
+
+        std::vector<ModelId> ids;
+        Ogre::String key;
+        mPathsRoots.clear();
+        reader.beginObject();
+
+        while(reader.nextKey(key))
+        {
+            if(ModelManager::MODELS_ATTRIBUTES == key)
+                ids = _ModelManager<LocationModel>::fromJson(reader);
+            else if(LocationModelManager::PATH_ROOTS_ATTRIBUTE == key)
+            {
+                Json::Value value;
+                reader.readValue(value);
+                mPathsRoots = JsonUtils::asStringUnsignedLongMap(value);
+            }
+            else
+                reader.skipValue();
+        }
+
+        // models are stored first, paths are announced once they are all there
+        if(mPathsRoots.size() > 0)
+            SignalManager::instance().emit(newLocationPathCreatedSignal());
+
+        return ids;
+    }
+
     ModelId LocationModelManager::newModel()
     {
         ModelId mid = INVALID_ID;
@@ -68,6 +101,34 @@ namespace Steel
             root[ModelManager::MODELS_ATTRIBUTES] = models;
     }
 
+    void LocationModelManager::toJson(JsonStreamWriter &writer, std::list<ModelId> const &modelIds)
+    {
+        bool const hasModels = !serializableModels(modelIds).empty();
+
+        if(!hasModels && 0 == mPathsRoots.size())
+        {
+            writer.value(Json::Value());
+            return;
+        }
+
+        // "models" < "pathRoots"
+        writer.beginObject();
+
+        if(hasModels)
+        {
+            writer.key(ModelManager::MODELS_ATTRIBUTES);
+            _ModelManager<LocationModel>::toJson(writer, modelIds);
+        }
+
+        if(mPathsRoots.size())
+        {
+            writer.key(LocationModelManager::PATH_ROOTS_ATTRIBUTE);
+            writer.value(JsonUtils::toJson(mPathsRoots));
+        }
+
+        writer.endObject();
+    }
+
     bool LocationModelManager::linkAgents(AgentId srcAgentId, AgentId dstAgentId)
     {
         Agent *src = mLevel->agentMan()->getAgent(srcAgentId);
@@ -237,45 +298,13 @@ namespace Steel
         if(INVALID_ID == key.first || INVALID_ID == key.second)
             return;
 
-        DynamicLines *line;
-
-        if(getDebugLine(key, line))
-        {
-            line->clear();
-            line->update();
-            mLevel->levelRoot()->detachObject(line);
-            delete line;
-        }
-
-        mDebugLines.erase(key);
-    }
-
-    bool LocationModelManager::getDebugLine(ModelPair const &key, DynamicLines *&line)
-    {
         auto it = mDebugLines.find(key);
 
         if(mDebugLines.end() == it)
-        {
-            line = new DynamicLines();
-            line->init(mLevel->name(), Ogre::RenderOperation::OT_LINE_LIST, false);
-            auto ret = mDebugLines.emplace(key, line);
-
-            if(!ret.second)
-            {
-                delete line;
-                Debug::error("LocationModelManager::getDebugLine(): can't insert ").endl();
-                line = nullptr;
-                return false;
-            }
-
-            mLevel->levelRoot()->attachObject(line);
-        }
-        else
-        {
-            line = it->second;
-        }
+            return;
 
-        return true;
+        mLevel->debugLines()->removeLine(it->second);
+        mDebugLines.erase(it);
     }
 
     bool LocationModelManager::onAgentLinkedToModel(Agent *agent, ModelId mid)
@@ -351,15 +380,14 @@ namespace Steel
         if(!(isValid(key.first) && isValid(key.second)))
             return;
 
-        DynamicLines *line = nullptr;
+        Ogre::Vector3 const from = at(key.first)->position();
+        Ogre::Vector3 const to = at(key.second)->position();
+        auto it = mDebugLines.find(key);
 
-        if(getDebugLine(key, line))
-        {
-            line->clear();
-            line->addPoint(at(key.first)->position());
-            line->addPoint(at(key.second)->position());
-            line->update();
-        }
+        if(mDebugLines.end() == it)
+            mDebugLines.emplace(key, mLevel->debugLines()->addLine(from, to));
+        else
+            mLevel->debugLines()->setLine(it->second, from, to);
     }
 
     void LocationModelManager::setModelPath(ModelId mid, LocationPathName const &name)
@@ -20,12 +20,13 @@ namespace Steel
     const char *Model::AGENT_TAGS_ATTRIBUTES = "agentTags";
 
     Model::Model() :
-        mRefCount(0), mTags(std::set<Tag>())
+        mRefCount(0), mTags(std::set<Tag>()), mDirty(true), mDirtyQueue(nullptr), mModelId(INVALID_ID)
     {
 
     }
 
-    Model::Model(const Model &o): mRefCount(o.mRefCount), mTags(o.mTags)
+    Model::Model(const Model &o): mRefCount(o.mRefCount), mTags(o.mTags), mDirty(o.mDirty),
+        mDirtyQueue(o.mDirtyQueue), mModelId(o.mModelId)
     {
     }
 
@@ -37,6 +38,8 @@ namespace Steel
     {
         mRefCount = o.mRefCount;
         mTags = o.mTags;
+        // keeps its own slot (and queue)
+        markDirty();
         return *this;
     }
 
@@ -48,6 +51,16 @@ namespace Steel
     void Model::cleanup()
     {
         mTags.clear();
+        // the deletion has to be saved
+        markDirty();
+    }
+
+    void Model::setDirtyQueue(std::vector<ModelId> *queue, ModelId mid)
+    {
+        mDirtyQueue = queue;
+        mModelId = mid;
+        mDirty = false;
+        markDirty();
     }
 
     void Model::serializeTags(Json::Value &value)
@@ -137,6 +137,7 @@ namespace Steel
     void OgreModel::move(const Ogre::Vector3 &dpos)
     {
         mSceneNode->translate(dpos);
+        markDirty();
     }
 
     void OgreModel::rotate(const Ogre::Vector3 &rotation)
@@ -144,16 +145,19 @@ namespace Steel
         mSceneNode->rotate(Ogre::Vector3::UNIT_X, Ogre::Degree(rotation.x), Ogre::Node::TS_WORLD);
         mSceneNode->rotate(Ogre::Vector3::UNIT_Y, Ogre::Degree(rotation.y), Ogre::Node::TS_WORLD);
         mSceneNode->rotate(Ogre::Vector3::UNIT_Z, Ogre::Degree(rotation.z), Ogre::Node::TS_WORLD);
+        markDirty();
     }
 
     void OgreModel::rescale(const Ogre::Vector3 &scale)
     {
         mSceneNode->scale(scale);
+        markDirty();
     }
 
     void OgreModel::rotate(const Ogre::Quaternion &q)
     {
         mSceneNode->rotate(q, Ogre::Node::TS_WORLD);
+        markDirty();
     }
 
     void OgreModel::setNodeAny(Steel::AgentId aid)
@@ -164,16 +168,19 @@ namespace Steel
     void OgreModel::setPosition(const Ogre::Vector3 &pos)
     {
         mSceneNode->setPosition(pos);
+        markDirty();
     }
 
     void OgreModel::setRotation(const Ogre::Quaternion &rot)
     {
         mSceneNode->setOrientation(rot);
+        markDirty();
     }
 
     void OgreModel::setScale(const Ogre::Vector3 &sca)
     {
         mSceneNode->setScale(sca);
+        markDirty();
     }
 
     void OgreModel::setSelected(bool selected)
@@ -314,6 +321,7 @@ namespace Steel
 
         mEntity->setMaterial(mm->getByName(resName));
         mHasMaterialOverride = true;
+        markDirty();
     }
 
     bool OgreModel::isVisible() const
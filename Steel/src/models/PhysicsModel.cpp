@@ -21,6 +21,7 @@
 #include "models/AgentManager.h"
 #include "models/OgreModel.h"
 #include "models/PhysicsModelManager.h"
+#include "models/StepForcesBatch.h"
 #include "tools/JsonUtils.h"
 #include "tools/RigidBodyStateWrapper.h"
 #include "tools/StringUtils.h"
@@ -55,18 +56,20 @@ namespace Steel
     const Ogre::String PhysicsModel::BBOX_SHAPE_NAME_TRIMESH = "trimesh";
 
     PhysicsModel::PhysicsModel(): Model(), SignalEmitter(),
-        mWorld(nullptr), mBody(nullptr),
+        mWorld(nullptr), mManager(nullptr), mId(INVALID_ID), mBody(nullptr),
         mMass(PhysicsModel::DEFAULT_MODEL_MASS), mFriction(PhysicsModel::DEFAULT_MODEL_FRICTION),
         mDamping(PhysicsModel::DEFAULT_MODEL_DAMPING), mIsKinematics(false),
         mRotationFactor(PhysicsModel::DEFAULT_MODEL_ROTATION_FACTOR), mKeepVerticalFactor(PhysicsModel::DEFAULT_MODEL_KEEP_VERTICAL_FACTOR),
         mStates(), mShape(BoundingShape::SPHERE), mIsSelected(false),
-        mIsGhost(false), mGhostObject(nullptr), mEmitOnTag(), mCollidingAgents(),
+        mIsGhost(false), mGhostObject(nullptr), mEmitOnTag(), mEmitOnTagMask(0),
         mLevitate(PhysicsModel::DEFAULT_MODEL_LEVITATE)
     {
     }
 
     PhysicsModel::PhysicsModel(PhysicsModel const &o): Model(o), SignalEmitter(),
         mWorld(o.mWorld),
+        mManager(o.mManager),
+        mId(o.mId),
         mBody(o.mBody),
         mMass(o.mMass),
         mFriction(o.mFriction),
@@ -79,7 +82,7 @@ namespace Steel
         mIsGhost(o.mIsGhost),
         mGhostObject(o.mGhostObject),
         mEmitOnTag(o.mEmitOnTag),
-        mCollidingAgents(o.mCollidingAgents),
+        mEmitOnTagMask(o.mEmitOnTagMask),
         mLevitate(o.mLevitate)
     {
     }
@@ -90,6 +93,8 @@ namespace Steel
         {
             Model::operator=(o);
             mWorld = o.mWorld;
+            mManager = o.mManager;
+            mId = o.mId;
             mBody = o.mBody;
             mMass = o.mMass;
             mIsKinematics = o.mIsKinematics;
@@ -98,7 +103,7 @@ namespace Steel
             mIsGhost = o.mIsGhost;
             mGhostObject = o.mGhostObject;
             mEmitOnTag = o.mEmitOnTag;
-            mCollidingAgents = o.mCollidingAgents;
+            mEmitOnTagMask = o.mEmitOnTagMask;
         }
 
         return *this;
@@ -125,12 +130,19 @@ namespace Steel
         }
 
         mEmitOnTag.clear();
+        mEmitOnTagMask = 0;
+
+        if(nullptr != mManager)
+            mManager->invalidateStepForcedModels();
+
         Model::cleanup();
     }
 
-    void PhysicsModel::init(btDynamicsWorld *world, Steel::OgreModel *omodel)
+    void PhysicsModel::init(btDynamicsWorld *world, Steel::OgreModel *omodel, PhysicsModelManager *manager, ModelId mid)
     {
         mWorld = world;
+        mManager = manager;
+        mId = mid;
         Ogre::String intro = "PhysicsModel::init(): ";
 
         if(nullptr == world)
@@ -160,8 +172,8 @@ namespace Steel
 //             //btCollisionObject::CF_NO_CONTACT_RESPONSE
 //             btCollisionObject::CF_STATIC_OBJECT
 //         );
+        // bodies can fall asleep, see PhysicsModelManager::update
         addToWorld();
-        mBody->setActivationState(DISABLE_DEACTIVATION);
 
         // ghost setup if needed
         setGhost(mIsGhost);
@@ -171,16 +183,21 @@ namespace Steel
 
     void PhysicsModel::createRigidBody(Steel::OgreModel *const omodel)
     {
-        // Create shape
-        btVector3 inertia;
-        btCollisionShape *shape = createShapeForEntity(omodel, mShape, inertia);
+        // Get a (shared) shape
+        btVector3 inertia(.0f, .0f, .0f);
+        btCollisionShape *shape = mManager->acquireShape(omodel, mShape, omodel->scale());
+
+        if(nullptr != shape)
+            shape->calculateLocalInertia(mMass, inertia);
 
         //Create BtOgre MotionState (connects Ogre and Bullet).
         RigidBodyStateWrapper *state = new RigidBodyStateWrapper(omodel->sceneNode());
+        state->setTransformedQueue(mManager->transformedQueue(), mId);
 
         //Create the Body.
         mBody = new btRigidBody(mMass, state, shape, inertia);
         mBody->setFriction(mFriction);
+        mManager->invalidateStepForcedModels();
 
         setDamping(mDamping);
     }
@@ -192,7 +209,7 @@ namespace Steel
         btCollisionShape *shape = mBody->getCollisionShape();
 
         if(nullptr != shape)
-            delete shape;
+            mManager->releaseShape(shape);
 
         btMotionState *motionState = mBody->getMotionState();
 
@@ -200,6 +217,8 @@ namespace Steel
             delete motionState;
 
         STEEL_DELETE(mBody);
+        // the batch must not see the deleted body
+        mManager->invalidateStepForcedModels();
     }
 
     void PhysicsModel::enableWorldInteractions(bool flag)
@@ -218,6 +237,8 @@ namespace Steel
     {
         if(nullptr != mBody)
         {
+            markDirty();
+
             if(flag)
             {
                 enableWorldInteractions(false);
@@ -228,6 +249,8 @@ namespace Steel
 
                 mGhostObject->setWorldTransform(mBody->getWorldTransform());
                 mGhostObject->setCollisionShape(mBody->getCollisionShape());
+                // contacts of the ghost are reported as contacts of the agent
+                mGhostObject->setUserPointer(mBody->getUserPointer());
                 mGhostObject->setCollisionFlags(btCollisionObject::CF_NO_CONTACT_RESPONSE |
                                                 btCollisionObject::CF_CHARACTER_OBJECT |
                                                 btCollisionObject::CF_STATIC_OBJECT |
@@ -250,7 +273,11 @@ namespace Steel
 
     void PhysicsModel::setKeepVerticalFactor(float value)
     {
+        markDirty();
         mKeepVerticalFactor = value;
+
+        if(nullptr != mManager)
+            mManager->invalidateStepForcedModels();
     }
 
     float PhysicsModel::keepVerticalFactor()
@@ -260,8 +287,11 @@ namespace Steel
 
     void PhysicsModel::setDamping(float value)
     {
-        if(nullptr != mBody)
-            mBody->setDamping(value, value);
+        if(nullptr == mBody)
+            return;
+
+        markDirty();
+        mBody->setDamping(value, value);
     }
 
     float PhysicsModel::linearDamping()
@@ -361,8 +391,16 @@ namespace Steel
             }
         }
 
+        mEmitOnTagMask = 0;
+
+        for(auto const & item : mEmitOnTag)
+            mEmitOnTagMask |= tagMaskBit(item.first);
+
         mLevitate = JsonUtils::asBool(root[PhysicsModel::LEVITATE_ATTRIBUTE], PhysicsModel::DEFAULT_MODEL_LEVITATE);
 
+        if(nullptr != mManager)
+            mManager->invalidateStepForcedModels();
+
         // agentTags
         allWasFine &= deserializeTags(root);
 
@@ -419,155 +457,107 @@ namespace Steel
 
     void PhysicsModel::update(float timestep, PhysicsModelManager *manager)
     {
-        if(mIsGhost && mEmitOnTag.size())
-            collisionCheck(manager);
-
         if(static_cast<RigidBodyStateWrapper *>(mBody->getMotionState())->poolTransform())
         {
+            // what moved is the OgreModel's node, which holds the saved transform
+            Agent *agent = static_cast<Agent *>(mBody->getUserPointer());
+            OgreModel *omodel = nullptr == agent ? nullptr : agent->ogreModel();
+
+            if(nullptr != omodel)
+                omodel->markDirty();
+
             if(INVALID_SIGNAL != mSignals.tranformed)
                 emit(mSignals.tranformed);
         }
-
-        if(PhysicsModel::DEFAULT_MODEL_KEEP_VERTICAL_FACTOR != mKeepVerticalFactor)
-        {
-            Ogre::Vector3 t = (rotation() * Ogre::Vector3::UNIT_Y).crossProduct(Ogre::Vector3::UNIT_Y);
-            applyTorqueImpulse(t * timestep * mKeepVerticalFactor);
-        }
-
-        if(mLevitate)
-            applyCentralForce(Ogre::Vector3::UNIT_Y * mMass);
     }
 
-    void PhysicsModel::setUserPointer(Agent *agent)
+    void PhysicsModel::saveState(PhysicsSnapshot &snapshot) const
     {
-        if(nullptr != mBody)
-            mBody->setUserPointer(agent);
+        if(nullptr == mBody)
+            return;
 
-        if(nullptr != mGhostObject);
+        snapshot.bodies().emplace_back();
+        PhysicsSnapshot::BodyRecord &record = snapshot.bodies().back();
+        record.mid = mId;
+        PhysicsSnapshot::saveBody(mBody, record);
+        record.isKinematics = mIsKinematics ? 1 : 0;
+        record.isSelected = mIsSelected ? 1 : 0;
+        record.stackDepth = (u16) mStates.size();
 
-//             mGhostObject->setUserPointer(agent);
+        for(State const & state : mStates)
+            snapshot.stacks().push_back({state.bodyCollisionFlags, (u8)(state.isKinematics ? 1 : 0), (u8)(state.isSelected ? 1 : 0)});
     }
 
-    void PhysicsModel::collisionCheck(PhysicsModelManager *manager)
+    void PhysicsModel::restoreState(PhysicsSnapshot::BodyRecord const &record, PhysicsSnapshot::StackRecord const *stack)
     {
-        std::set<AgentId> currentlyCollidingAgents;
+        if(nullptr == mBody)
+            return;
 
-        btManifoldArray manifoldArray;
-        btBroadphasePairArray &pairArray = mGhostObject->getOverlappingPairCache()->getOverlappingPairArray();
-        int numPairs = pairArray.size();
+        // switching moves the body in and out of the world, only do it when needed
+        if((0 != record.isKinematics) != mIsKinematics)
+            mIsKinematics ? toRigidBody() : toKinematics();
 
-        for(int i = 0; i < numPairs; i++)
-        {
-            manifoldArray.clear();
+        PhysicsSnapshot::restoreBody(mBody, record);
+        mBody->getMotionState()->setWorldTransform(mBody->getWorldTransform());
 
-            const btBroadphasePair &pair = pairArray[i];
+        if(nullptr != mGhostObject)
+            mGhostObject->setWorldTransform(mBody->getWorldTransform());
 
-            //unless we manually perform collision detection on this pair, the contacts are in the dynamics world paircache:
-            btBroadphasePair *collisionPair = mWorld->getPairCache()->findPair(pair.m_pProxy0, pair.m_pProxy1);
+        mIsSelected = 0 != record.isSelected;
 
-            if(!collisionPair)
-                continue;
+        mStates.clear();
 
-            if(collisionPair->m_algorithm)
-                collisionPair->m_algorithm->getAllContactManifolds(manifoldArray);
+        for(u16 i = 0; i < record.stackDepth; ++i)
+            mStates.push_back({0 != stack[i].isKinematics, stack[i].bodyCollisionFlags, 0 != stack[i].isSelected});
+    }
 
-            for(int j = 0; j < manifoldArray.size(); j++)
-            {
-                btPersistentManifold *manifold = manifoldArray[j];
+    void PhysicsModel::mirrorStepForces(StepForcesBatch &batch) const
+    {
+        if(nullptr == mBody)
+            return;
 
-//                 btScalar directionSign = manifold->getBody0() == mGhostObject ? btScalar(-1.0) : btScalar(1.0);
-                for(int p = 0; p < manifold->getNumContacts(); p++)
-                {
-                    const btManifoldPoint &pt = manifold->getContactPoint(p);
+        // forces are only cleared once all substeps of a frame are done, hence the impulses
+        float const keepVertical = DEFAULT_MODEL_KEEP_VERTICAL_FACTOR != mKeepVerticalFactor ? mKeepVerticalFactor * mRotationFactor : .0f;
+        batch.add(mBody, keepVertical, mLevitate ? mMass : .0f);
+    }
 
-                    if(pt.getDistance() < 0.f)
-                    {
-                        const btCollisionObject *otherBody = manifold->getBody0();
+    void PhysicsModel::setUserPointer(Agent *agent)
+    {
+        if(nullptr != mBody)
+            mBody->setUserPointer(agent);
 
-                        if(otherBody == mGhostObject || otherBody == mBody)
-                            otherBody = manifold->getBody1();
+        if(nullptr != mGhostObject)
+            mGhostObject->setUserPointer(agent);
+    }
 
+    void PhysicsModel::onContactEnter(Agent *other)
+    {
+        if(!emitsOnContact() || nullptr == other)
+            return;
 
-                        Agent *otherAgent = static_cast<Agent *>(otherBody->getUserPointer());
+        auto const otherTags = other->tags();
+        u64 otherMask = 0;
 
-                        if(nullptr != otherAgent && otherAgent->physicsModel() != this)
-                        {
-                            if(0)
-                                Debug::log("agent ")(((Agent *)mGhostObject->getUserPointer())->id())
-                                (" with physics model ")(((Agent *)mGhostObject->getUserPointer())->physicsModelId())
-                                (" collides with agent ")(otherAgent->id())
-                                (" with physics model ")(otherAgent->physicsModelId()).endl();
+        for(auto const & tag : otherTags)
+            otherMask |= tagMaskBit(tag);
 
-                            currentlyCollidingAgents.insert(otherAgent->id());
-                        }
+        // cheap rejection, the mask may have false positives but no false negatives
+        if(0 == (otherMask & mEmitOnTagMask))
+            return;
 
-//                         const btVector3& ptA = pt.getPositionWorldOnA();
-//                         const btVector3& ptB = pt.getPositionWorldOnB();
-//                         const btVector3& normalOnB = pt.m_normalWorldOnB;
-                    }
-                }
-            }
-        }
+        // collect signals, so that one mapped to several tags of other is emitted once
+        std::set<Signal> signals;
 
-        if(currentlyCollidingAgents.size())
+        for(auto const & tag : otherTags)
         {
-            // determine newly colliding agents
-            std::set<AgentId> newlyColliding;
-
-            if(mCollidingAgents.size())
-            {
-                std::set_difference(currentlyCollidingAgents.begin(), currentlyCollidingAgents.end(),
-                                    mCollidingAgents.begin(), mCollidingAgents.end(),
-                                    std::inserter(newlyColliding, newlyColliding.end()));
-            }
-            else
-            {
-                newlyColliding.insert(currentlyCollidingAgents.begin(), currentlyCollidingAgents.end());
-            }
-
-            if(newlyColliding.size())
-            {
-                // collect tags
-                std::set<Tag> tagsMet;
+            auto toEmit_it = mEmitOnTag.find(tag);
 
-                for(auto const & aid : newlyColliding)
-                {
-                    Agent *agent = manager->level()->agentMan()->getAgent(aid);
-
-                    if(nullptr == agent)
-                        continue;
-
-                    auto _tags = agent->tags();
-                    tagsMet.insert(_tags.begin(), _tags.end());
-                }
-
-                // collect signals
-                std::set<Signal> signals;
-
-                for(auto const & tag : tagsMet)
-                {
-                    auto toEmit_it = mEmitOnTag.find(tag);
-
-//                     Tag _tag=toEmit_it->first;
-//                     std::set<Tag> _signals=toEmit_it->second;
-//                     Debug::log(_tag).endl()(_signals).endl()(mEmitOnTag).endl();
-                    if(mEmitOnTag.end() != toEmit_it)
-                        signals.insert(toEmit_it->second.begin(), toEmit_it->second.end());
-                }
-
-                // emit signals
-                for(auto const & signal : signals)
-                    emit(signal);
-
-                // register newly colliding as currently colliding
-                mCollidingAgents.clear();
-                mCollidingAgents.insert(currentlyCollidingAgents.begin(), currentlyCollidingAgents.end());
-            }
-        }
-        else
-        {
-            mCollidingAgents.clear();
+            if(mEmitOnTag.end() != toEmit_it)
+                signals.insert(toEmit_it->second.begin(), toEmit_it->second.end());
         }
+
+        for(auto const & signal : signals)
+            emit(signal);
     }
 
     void PhysicsModel::toJson(Json::Value &node)
@@ -639,13 +629,13 @@ namespace Steel
     {
         if(!mStates.empty())
         {
-            State state = mStates.top();
+            State state = mStates.back();
 
             if(state.isKinematics != mIsKinematics)
                 mIsKinematics ? toRigidBody() : toKinematics();
 
             mBody->setCollisionFlags(state.bodyCollisionFlags);
-            mStates.pop();
+            mStates.pop_back();
         }
 
         return mIsKinematics;
@@ -653,11 +643,13 @@ namespace Steel
 
     void PhysicsModel::pushState()
     {
-        mStates.push( {mIsKinematics, mBody->getCollisionFlags(), mIsSelected});
+        mStates.push_back( {mIsKinematics, mBody->getCollisionFlags(), mIsSelected});
     }
 
     void PhysicsModel::setPosition(const Ogre::Vector3 &pos)
     {
+        markDirty();
+
         bool switchBack = false;
 
         if(!mIsKinematics && (switchBack = true))
@@ -678,6 +670,8 @@ namespace Steel
 
     void PhysicsModel::move(const Ogre::Vector3 &dpos)
     {
+        markDirty();
+
         bool switchBack = false;
 
         if(!mIsKinematics && (switchBack = true))
@@ -711,6 +705,7 @@ namespace Steel
         if(nullptr == mBody || q.isNaN() || q == Ogre::Quaternion::ZERO)
             return;
 
+        markDirty();
         bool switchBack = false;
 
         if(!mIsKinematics && (switchBack = true))
@@ -746,6 +741,7 @@ namespace Steel
         if(nullptr == mBody || q.isNaN() || q == Ogre::Quaternion::ZERO)
             return;
 
+        markDirty();
         bool switchBack = false;
 
         if(!mIsKinematics && (switchBack = true))
@@ -769,6 +765,8 @@ namespace Steel
         if(nullptr == mBody)
             return;
 
+        // a sleeping body ignores forces
+        mBody->activate();
         mBody->applyTorque(BtOgre::Convert::toBullet(tq)*mRotationFactor);
     }
 
@@ -777,6 +775,8 @@ namespace Steel
         if(nullptr == mBody)
             return;
 
+        // a sleeping body ignores forces
+        mBody->activate();
         mBody->applyTorqueImpulse(BtOgre::Convert::toBullet(tq)*mRotationFactor);
     }
 
@@ -785,6 +785,8 @@ namespace Steel
         if(nullptr == mBody)
             return;
 
+        // a sleeping body ignores forces
+        mBody->activate();
         mBody->applyCentralImpulse(BtOgre::Convert::toBullet(f));
     }
 
@@ -793,6 +795,8 @@ namespace Steel
         if(nullptr == mBody)
             return;
 
+        // a sleeping body ignores forces
+        mBody->activate();
         mBody->applyCentralForce(BtOgre::Convert::toBullet(f));
     }
 
@@ -806,12 +810,52 @@ namespace Steel
 
     void PhysicsModel::rescale(Ogre::Vector3 const &sca)
     {
-        mBody->getCollisionShape()->setLocalScaling(mBody->getCollisionShape()->getLocalScaling() * BtOgre::Convert::toBullet(sca));
+        if(nullptr == mBody)
+            return;
+
+        markDirty();
+        setScale(mManager->shapeScale(mBody->getCollisionShape()) * sca);
     }
 
     void PhysicsModel::setScale(Ogre::Vector3 const &sca)
     {
-        mBody->getCollisionShape()->setLocalScaling(BtOgre::Convert::toBullet(sca));
+        if(nullptr == mBody)
+            return;
+
+        markDirty();
+        // shapes are shared, scaling one means using another one
+        btCollisionShape *shape = mManager->acquireShape(mBody->getCollisionShape(), sca);
+
+        if(nullptr != shape)
+            swapShape(shape);
+    }
+
+    void PhysicsModel::swapShape(btCollisionShape *shape)
+    {
+        btCollisionShape *previous = mBody->getCollisionShape();
+
+        if(shape == previous)
+        {
+            mManager->releaseShape(shape);
+            return;
+        }
+
+        // bullet does not like shapes changing under bodies it knows of
+        int const activationState = mBody->getActivationState();
+        removeFromWorld();
+        mBody->setCollisionShape(shape);
+
+        btVector3 inertia(.0f, .0f, .0f);
+        shape->calculateLocalInertia(mMass, inertia);
+        mBody->setMassProps(mMass, inertia);
+        mBody->updateInertiaTensor();
+        addToWorld();
+        mBody->forceActivationState(activationState);
+
+        if(nullptr != mGhostObject)
+            mGhostObject->setCollisionShape(shape);
+
+        mManager->releaseShape(previous);
     }
 
     Ogre::Vector3 PhysicsModel::velocity()
@@ -835,50 +879,10 @@ namespace Steel
         mBody->setActivationState(DISABLE_DEACTIVATION);
     }
 
-    btCollisionShape *PhysicsModel::createShapeForEntity(OgreModel *const omodel, BoundingShape requestedShape, btVector3 &inertia)
-    {
-        if(nullptr == omodel)
-        {
-            Debug::error(STEEL_METH_INTRO, "cannot create shape for null ogre model. Returning nullptr.").endl();
-            return nullptr;
-        }
-
-        if(nullptr == omodel->entity())
-        {
-            Debug::error(STEEL_METH_INTRO, "cannot create shape for null ogre model entity. Returning nullptr.").endl();
-            return nullptr;
-        }
-
-        BtOgre::StaticMeshToShapeConverter converter(omodel->entity());
-        btCollisionShape *shape = nullptr;
-
-        switch(requestedShape)
-        {
-            case BoundingShape::BOX:
-                shape = converter.createBox();
-                break;
-
-            case BoundingShape::CONVEXHULL:
-                shape = converter.createConvex();
-                break;
-
-            case BoundingShape::SPHERE:
-                shape = converter.createSphere();
-                break;
-
-            case BoundingShape::TRIMESH:
-                shape = converter.createTrimesh();
-                break;
-        }
-
-        if(nullptr != shape)
-            shape->calculateLocalInertia(mMass, inertia);
-
-        return shape;
-    }
-
     void PhysicsModel::setShape(OgreModel *const omodel, BoundingShape requestedShape)
     {
+        markDirty();
+
         bool isGhostSave = mIsGhost;
         auto collisionFlagsSave = mBody->getCollisionFlags();
         bool isKinematicsSave = mIsKinematics;
@@ -903,9 +907,11 @@ namespace Steel
         if(nullptr == mBody)
             return;
 
+        markDirty();
         if(mass != mMass)
         {
             mMass = mass;
+            mManager->invalidateStepForcedModels();
             btCollisionShape *const shape = mBody->getCollisionShape();
 
             btVector3 inertia(.0f, .0f, .0f);
@@ -1,16 +1,37 @@
 #include "models/PhysicsModelManager.h"
 
+#include <algorithm>
+#include <thread>
+#include <tuple>
+
+#include <OgreTimer.h>
+
 #include <bullet/BulletDynamics/Dynamics/btDynamicsWorld.h>
 #include <bullet/BulletCollision/CollisionDispatch/btGhostObject.h>
 #include <bullet/BulletCollision/BroadphaseCollision/btOverlappingPairCache.h>
+#include <bullet/BulletCollision/CollisionDispatch/btCollisionDispatcher.h>
+#include <bullet/BulletCollision/NarrowPhaseCollision/btPersistentManifold.h>
+#include <bullet/BulletCollision/CollisionShapes/btBoxShape.h>
+#include <bullet/BulletCollision/CollisionShapes/btSphereShape.h>
+#include <bullet/BulletCollision/CollisionShapes/btBvhTriangleMeshShape.h>
+#include <bullet/BulletCollision/CollisionShapes/btConvexHullShape.h>
+#include <bullet/BulletCollision/CollisionShapes/btScaledBvhTriangleMeshShape.h>
+#include <bullet/BulletCollision/CollisionShapes/btUniformScalingShape.h>
+#include <bullet/LinearMath/btThreads.h>
+#include <BtOgrePG.h>
 // #include "BulletDynamics/Dynamics/btDynamicsWorld.h"
 // #include "BulletCollision/CollisionDispatch/btGhostObject.h"
 
 #include "Debug.h"
+#include "Engine.h"
 #include "Level.h"
+#include "TagManager.h"
 #include "models/Agent.h"
+#include "models/AgentManager.h"
 #include "models/OgreModel.h"
 #include "models/OgreModelManager.h"
+#include "terrain/TerrainPhysicsManager.h"
+#include "tests/UnitTestManager.h"
 
 
 extern ContactAddedCallback gContactAddedCallback;
@@ -18,20 +39,156 @@ extern ContactDestroyedCallback gContactDestroyedCallback;
 
 namespace Steel
 {
+    namespace
+    {
+        /// Query filter: ghosts never block queries, and a valid tag restricts hits to agents bearing it.
+        bool acceptsQueryHit(btCollisionObject const *object, Tag filterTag)
+        {
+            if(nullptr != btGhostObject::upcast(object))
+                return false;
+
+            if(INVALID_TAG == filterTag)
+                return true;
+
+            Agent *agent = static_cast<Agent *>(object->getUserPointer());
+            return nullptr != agent && agent->isTagged(filterTag);
+        }
+
+        class FilteredRayCallback: public btCollisionWorld::ClosestRayResultCallback
+        {
+        public:
+            FilteredRayCallback(btVector3 const &from, btVector3 const &to, Tag filterTag):
+                btCollisionWorld::ClosestRayResultCallback(from, to), mFilterTag(filterTag) {}
+
+            virtual bool needsCollision(btBroadphaseProxy *proxy) const
+            {
+                return btCollisionWorld::ClosestRayResultCallback::needsCollision(proxy)
+                       && acceptsQueryHit(static_cast<btCollisionObject const *>(proxy->m_clientObject), mFilterTag);
+            }
+
+            Tag mFilterTag;
+        };
+
+        class FilteredSweepCallback: public btCollisionWorld::ClosestConvexResultCallback
+        {
+        public:
+            FilteredSweepCallback(btVector3 const &from, btVector3 const &to, Tag filterTag):
+                btCollisionWorld::ClosestConvexResultCallback(from, to), mFilterTag(filterTag) {}
+
+            virtual bool needsCollision(btBroadphaseProxy *proxy) const
+            {
+                return btCollisionWorld::ClosestConvexResultCallback::needsCollision(proxy)
+                       && acceptsQueryHit(static_cast<btCollisionObject const *>(proxy->m_clientObject), mFilterTag);
+            }
+
+            Tag mFilterTag;
+        };
+
+        /// Casts a range of queries, on whatever thread btParallelFor gives it.
+        class QueriesLoop: public btIParallelForBody
+        {
+        public:
+            QueriesLoop(btCollisionWorld *world, std::vector<PhysicsModelManager::Query> const &queries,
+                        std::vector<PhysicsModelManager::QueryHit> &results, Tag filterTag):
+                mWorld(world), mQueries(queries), mResults(results), mFilterTag(filterTag) {}
+
+            virtual void forLoop(int begin, int end) const
+            {
+                for(int i = begin; i < end; ++i)
+                    cast(mQueries[i], mResults[i]);
+            }
+
+            void cast(PhysicsModelManager::Query const &query, PhysicsModelManager::QueryHit &hit) const
+            {
+                btVector3 const from = BtOgre::Convert::toBullet(query.from), to = BtOgre::Convert::toBullet(query.to);
+                btCollisionObject const *object = nullptr;
+                hit.fraction = 1.f;
+
+                if(query.radius > .0f && from != to)
+                {
+                    btSphereShape sphere(query.radius);
+                    btTransform fromTr(btQuaternion::getIdentity(), from), toTr(btQuaternion::getIdentity(), to);
+                    FilteredSweepCallback callback(from, to, mFilterTag);
+                    mWorld->convexSweepTest(&sphere, fromTr, toTr, callback);
+
+                    if(callback.hasHit())
+                    {
+                        object = callback.m_hitCollisionObject;
+                        hit.point = BtOgre::Convert::toOgre(callback.m_hitPointWorld);
+                        hit.normal = BtOgre::Convert::toOgre(callback.m_hitNormalWorld);
+                        hit.fraction = callback.m_closestHitFraction;
+                    }
+                }
+                else
+                {
+                    FilteredRayCallback callback(from, to, mFilterTag);
+                    mWorld->rayTest(from, to, callback);
+
+                    if(callback.hasHit())
+                    {
+                        object = callback.m_collisionObject;
+                        hit.point = BtOgre::Convert::toOgre(callback.m_hitPointWorld);
+                        hit.normal = BtOgre::Convert::toOgre(callback.m_hitNormalWorld);
+                        hit.fraction = callback.m_closestHitFraction;
+                    }
+                }
+
+                Agent *agent = nullptr == object ? nullptr : static_cast<Agent *>(object->getUserPointer());
+                hit.aid = nullptr == agent ? INVALID_ID : agent->id();
+
+                if(!hit.hasHit())
+                    hit.point = hit.normal = Ogre::Vector3::ZERO;
+            }
+
+            btCollisionWorld *mWorld;
+            std::vector<PhysicsModelManager::Query> const &mQueries;
+            std::vector<PhysicsModelManager::QueryHit> &mResults;
+            Tag mFilterTag;
+        };
+    }
+
     PhysicsModelManager::PhysicsModelManager(Level *level, btDynamicsWorld *world): _ModelManager<PhysicsModel>(level),
-        mWorld(nullptr), mbulletGhostPairCallback(nullptr)
+        mWorld(nullptr), mbulletGhostPairCallback(nullptr),
+        mContacts(), mPreviousContacts(), mContactEvents(),
+        mShapesByKey(), mShapes(), mShapeCooker(),
+        mTransformedModelsQueue(), mTransformedModels(), mStepForces(), mStepForcedModelsDirty(true)
     {
         mWorld = world;
 
         // allows for ghost functionality (hitbox/triggers)
         mbulletGhostPairCallback = new btGhostPairCallback();
         mWorld->getPairCache()->setInternalGhostPairCallback(mbulletGhostPairCallback);
+
+        mLevel->terrainManager()->terrainPhysicsMan()->addPhysicsStepListener(this);
+        mShapeCooker.init(mLevel->engine()->dataDir() / "cache" / "shapes");
     }
 
     PhysicsModelManager::~PhysicsModelManager()
     {
+        mLevel->terrainManager()->terrainPhysicsMan()->removePhysicsStepListener(this);
         STEEL_DELETE(mbulletGhostPairCallback);
 
+        if(mShapes.size())
+        {
+            Debug::warning(STEEL_METH_INTRO, mShapes.size(), " collision shapes still in use, deleting them.").endl();
+
+            // scaled shapes wrap their base: they go first
+            for(auto const & it : mShapes)
+            {
+                if(nullptr != it.second.base)
+                    deleteShape(it.first, it.second.key.boundingShape, false);
+            }
+
+            for(auto const & it : mShapes)
+            {
+                if(nullptr == it.second.base)
+                    deleteShape(it.first, it.second.key.boundingShape, true);
+            }
+
+            mShapes.clear();
+            mShapesByKey.clear();
+        }
+
         if(nullptr != mWorld)
             mWorld = nullptr;
     }
@@ -62,7 +219,8 @@ namespace Steel
         }
 
         OgreModel *omodel = mLevel->ogreModelMan()->at(omid);
-        pmodel->init(mWorld, omodel);
+        pmodel->init(mWorld, omodel, this, pmid);
+        invalidateStepForcedModels();
         pmodel->setUserPointer(agent);
 
         // stop the physics simulation in case the agent is selected
@@ -73,12 +231,518 @@ namespace Steel
 
     void PhysicsModelManager::update(float timestep)
     {
-        // TODO: OPT: use an update list, updated upon model init/cleanup ?
-        for(auto & model : mModels)
+        collectContacts();
+        dispatchContactEvents();
+
+        // only bodies bullet moved since last frame (ie awake ones) queued themselves
+        mTransformedModels.swap(mTransformedModelsQueue);
+        mTransformedModelsQueue.clear();
+
+        for(ModelId const mid : mTransformedModels)
+        {
+            // the model may have been released meanwhile
+            if(mid < mModels.size() && mModels[mid].refCount() > 0)
+                mModels[mid].update(timestep, this);
+        }
+    }
+
+    void PhysicsModelManager::invalidateStepForcedModels()
+    {
+        mStepForcedModelsDirty = true;
+    }
+
+    void PhysicsModelManager::castQueries(std::vector<Query> const &queries, std::vector<QueryHit> &results, Tag filterTag/* = INVALID_TAG*/) const
+    {
+        castQueries(mWorld, queries, results, filterTag);
+    }
+
+    void PhysicsModelManager::castQueries(btCollisionWorld *world, std::vector<Query> const &queries, std::vector<QueryHit> &results,
+                                          Tag filterTag/* = INVALID_TAG*/)
+    {
+        results.resize(queries.size());
+
+        if(queries.empty())
+            return;
+
+        // queries are short, batch them so that scheduling does not dominate
+        int const grainSize = 64;
+        btParallelFor(0, (int) queries.size(), grainSize, QueriesLoop(world, queries, results, filterTag));
+    }
+
+    void PhysicsModelManager::takeSnapshot(PhysicsSnapshot &snapshot) const
+    {
+        snapshot.clear();
+
+        for(auto const & model : mModels)
+        {
+            if(!model.isFree())
+                model.saveState(snapshot);
+        }
+    }
+
+    void PhysicsModelManager::restoreSnapshot(PhysicsSnapshot const &snapshot)
+    {
+        auto const &stacks = snapshot.stacks();
+        size_t stackIndex = 0;
+
+        for(auto const & record : snapshot.bodies())
+        {
+            if(record.mid < mModels.size() && !mModels[record.mid].isFree())
+                mModels[record.mid].restoreState(record, stacks.data() + stackIndex);
+
+            stackIndex += record.stackDepth;
+        }
+
+        // contacts of the restored state are yet to be found, don't report them against the pre-restore ones
+        mContacts.clear();
+    }
+
+    void PhysicsModelManager::collectContacts()
+    {
+        mPreviousContacts.swap(mContacts);
+        mContacts.clear();
+        mContactEvents.clear();
+
+        btDispatcher *dispatcher = mWorld->getDispatcher();
+        int const numManifolds = dispatcher->getNumManifolds();
+
+        for(int i = 0; i < numManifolds; ++i)
+        {
+            btPersistentManifold *manifold = dispatcher->getManifoldByIndexInternal(i);
+            Agent *agent0 = static_cast<Agent *>(manifold->getBody0()->getUserPointer());
+            Agent *agent1 = static_cast<Agent *>(manifold->getBody1()->getUserPointer());
+
+            // terrain, or a model touching its own ghost
+            if(nullptr == agent0 || nullptr == agent1 || agent0 == agent1)
+                continue;
+
+            for(int p = 0; p < manifold->getNumContacts(); ++p)
+            {
+                if(manifold->getContactPoint(p).getDistance() < 0.f)
+                {
+                    AgentId aid0 = agent0->id(), aid1 = agent1->id();
+
+                    if(aid1 < aid0)
+                        std::swap(aid0, aid1);
+
+                    mContacts.push_back(AgentPair(aid0, aid1));
+                    break;
+                }
+            }
+        }
+
+        // body and ghost of a same agent can both touch another agent
+        std::sort(mContacts.begin(), mContacts.end());
+        mContacts.erase(std::unique(mContacts.begin(), mContacts.end()), mContacts.end());
+
+        // merge both sorted lists into events
+        auto current = mContacts.begin(), previous = mPreviousContacts.begin();
+
+        while(mContacts.end() != current || mPreviousContacts.end() != previous)
+        {
+            ContactEvent event;
+
+            if(mPreviousContacts.end() == previous || (mContacts.end() != current && *current < *previous))
+            {
+                event.type = ContactEvent::Type::ENTER;
+                std::tie(event.aid0, event.aid1) = *current++;
+            }
+            else if(mContacts.end() == current || *previous < *current)
+            {
+                event.type = ContactEvent::Type::EXIT;
+                std::tie(event.aid0, event.aid1) = *previous++;
+            }
+            else
+            {
+                event.type = ContactEvent::Type::STAY;
+                std::tie(event.aid0, event.aid1) = *current++;
+                ++previous;
+            }
+
+            mContactEvents.push_back(event);
+        }
+    }
+
+    void PhysicsModelManager::dispatchContactEvents()
+    {
+        AgentManager *agentMan = mLevel->agentMan();
+
+        for(ContactEvent const & event : mContactEvents)
+        {
+            if(ContactEvent::Type::ENTER != event.type)
+                continue;
+
+            Agent *agent0 = agentMan->getAgent(event.aid0);
+            Agent *agent1 = agentMan->getAgent(event.aid1);
+
+            if(nullptr == agent0 || nullptr == agent1)
+                continue;
+
+            PhysicsModel *pmodel0 = agent0->physicsModel(), *pmodel1 = agent1->physicsModel();
+
+            if(nullptr != pmodel0 && pmodel0->emitsOnContact())
+                pmodel0->onContactEnter(agent1);
+
+            if(nullptr != pmodel1 && pmodel1->emitsOnContact())
+                pmodel1->onContactEnter(agent0);
+        }
+    }
+
+    void PhysicsModelManager::onPhysicsStep(float fixedTimestep)
+    {
+        if(mStepForcedModelsDirty)
+        {
+            mStepForces.clear();
+
+            for(auto & model : mModels)
+            {
+                if(model.refCount() > 0 && model.hasStepForces())
+                    model.mirrorStepForces(mStepForces);
+            }
+
+            mStepForcedModelsDirty = false;
+        }
+
+        mStepForces.apply(fixedTimestep);
+    }
+
+    bool PhysicsModelManager::ShapeKey::operator<(ShapeKey const &o) const
+    {
+        return std::tie(mesh, boundingShape, scale.x, scale.y, scale.z) < std::tie(o.mesh, o.boundingShape, o.scale.x, o.scale.y, o.scale.z);
+    }
+
+    btCollisionShape *PhysicsModelManager::acquireShape(OgreModel *omodel, BoundingShape boundingShape, Ogre::Vector3 const &scale)
+    {
+        if(nullptr == omodel || nullptr == omodel->entity())
+        {
+            Debug::error(STEEL_METH_INTRO, "cannot create shape for null ogre model (or entity). Returning nullptr.").endl();
+            return nullptr;
+        }
+
+        Ogre::Entity *entity = omodel->entity();
+        return acquireShape(ShapeKey {entity->getMesh()->getName(), boundingShape, scale}, entity);
+    }
+
+    btCollisionShape *PhysicsModelManager::acquireShape(btCollisionShape *shape, Ogre::Vector3 const &scale)
+    {
+        auto it = mShapes.find(shape);
+
+        if(mShapes.end() == it)
+        {
+            Debug::error(STEEL_METH_INTRO, "shape is not in the cache. Returning nullptr.").endl();
+            return nullptr;
+        }
+
+        // the base shape is alive as long as the given shape is, no need for the entity
+        ShapeKey key = it->second.key;
+        key.scale = scale;
+        return acquireShape(key, nullptr);
+    }
+
+    btCollisionShape *PhysicsModelManager::acquireShape(ShapeKey const &key, Ogre::Entity *entity)
+    {
+        auto it = mShapesByKey.find(key);
+
+        if(mShapesByKey.end() != it)
+        {
+            ++mShapes[it->second].refCount;
+            return it->second;
+        }
+
+        ShapeKey const baseKey {key.mesh, key.boundingShape, Ogre::Vector3::UNIT_SCALE};
+        btCollisionShape *base = nullptr;
+        auto base_it = mShapesByKey.find(baseKey);
+
+        if(mShapesByKey.end() != base_it)
+        {
+            base = base_it->second;
+            ++mShapes[base].refCount;
+        }
+        else
+        {
+            if(nullptr == entity)
+            {
+                Debug::error(STEEL_METH_INTRO, "no entity to build shape of mesh ").quotes(key.mesh)(" from. Returning nullptr.").endl();
+                return nullptr;
+            }
+
+            base = createBaseShape(entity, key.boundingShape);
+
+            if(nullptr == base)
+                return nullptr;
+
+            mShapesByKey[baseKey] = base;
+            mShapes[base] = ShapeEntry {base, 1, nullptr, baseKey};
+        }
+
+        if(Ogre::Vector3::UNIT_SCALE == key.scale)
+            return base;
+
+        // the scaled shape keeps the reference to its base taken above
+        btCollisionShape *scaled = createScaledShape(base, key.boundingShape, key.scale);
+
+        if(nullptr == scaled)
         {
-            if(model.refCount() > 0)
-                model.update(timestep, this);
+            releaseShape(base);
+            return nullptr;
         }
+
+        mShapesByKey[key] = scaled;
+        mShapes[scaled] = ShapeEntry {scaled, 1, base, key};
+        return scaled;
+    }
+
+    void PhysicsModelManager::releaseShape(btCollisionShape *shape)
+    {
+        auto it = mShapes.find(shape);
+
+        if(mShapes.end() == it)
+        {
+            Debug::error(STEEL_METH_INTRO, "shape is not in the cache.").endl();
+            return;
+        }
+
+        ShapeEntry &entry = it->second;
+
+        if(--entry.refCount > 0)
+            return;
+
+        btCollisionShape *base = entry.base;
+        deleteShape(shape, entry.key.boundingShape, nullptr == base);
+        mShapesByKey.erase(entry.key);
+        mShapes.erase(it);
+
+        if(nullptr != base)
+            releaseShape(base);
+    }
+
+    Ogre::Vector3 PhysicsModelManager::shapeScale(btCollisionShape *shape) const
+    {
+        auto it = mShapes.find(shape);
+        return mShapes.end() == it ? Ogre::Vector3::UNIT_SCALE : it->second.key.scale;
+    }
+
+    btCollisionShape *PhysicsModelManager::createBaseShape(Ogre::Entity *entity, BoundingShape boundingShape)
+    {
+        return mShapeCooker.shape(entity->getMesh(), boundingShape);
+    }
+
+    btCollisionShape *PhysicsModelManager::createScaledShape(btCollisionShape *base, BoundingShape boundingShape, Ogre::Vector3 const &scale)
+    {
+        if(BoundingShape::TRIMESH == boundingShape)
+            return new btScaledBvhTriangleMeshShape(static_cast<btBvhTriangleMeshShape *>(base), BtOgre::Convert::toBullet(scale));
+
+        // spheres only scale uniformly anyway (bullet uses the x component)
+        if((scale.x == scale.y && scale.y == scale.z) || BoundingShape::SPHERE == boundingShape)
+            return new btUniformScalingShape(static_cast<btConvexShape *>(base), scale.x);
+
+        // non uniform scaling needs its own convex, but it is still shared by all models at that scale
+        btCollisionShape *shape = nullptr;
+
+        switch(boundingShape)
+        {
+            case BoundingShape::BOX:
+                shape = new btBoxShape(static_cast<btBoxShape *>(base)->getHalfExtentsWithoutMargin());
+                break;
+
+            case BoundingShape::CONVEXHULL:
+            {
+                btConvexHullShape *hull = static_cast<btConvexHullShape *>(base);
+                shape = new btConvexHullShape(&(hull->getUnscaledPoints()->getX()), hull->getNumPoints(), sizeof(btVector3));
+            }
+            break;
+
+            default:
+                break;
+        }
+
+        if(nullptr != shape)
+            shape->setLocalScaling(BtOgre::Convert::toBullet(scale));
+
+        return shape;
+    }
+
+    void PhysicsModelManager::deleteShape(btCollisionShape *shape, BoundingShape boundingShape, bool isBase)
+    {
+        if(isBase)
+            mShapeCooker.deleteShape(shape, boundingShape);
+        else
+            delete shape;
+    }
+
+    /////////////////////////////////////////////////////////////////////////////////////////////////////////////
+    // UNIT TESTS
+    bool utest_PhysicsQueries(UnitTestExecutionContext const *context)
+    {
+        AgentManager *agentMan = context->engine->level()->agentMan();
+        Tag const targetTag = TagManager::instance().toTag("__utest_PhysicsQueries.target");
+
+        // along +x: a ghost of the target at 2, the target at 5, another agent at 10
+        AgentId const targetAid = agentMan->newAgent(), otherAid = agentMan->newAgent();
+        Agent *target = agentMan->getAgent(targetAid), *other = agentMan->getAgent(otherAid);
+        target->tag(targetTag);
+
+        TerrainPhysicsManager::WorldParts parts;
+        TerrainPhysicsManager::buildWorld(parts, 1);
+        btBoxShape box(btVector3(.5f, .5f, .5f));
+
+        auto newBody = [&](float x, Agent * agent)->btRigidBody *
+        {
+            btRigidBody::btRigidBodyConstructionInfo info(0.f, nullptr, &box);
+            info.m_startWorldTransform.setOrigin(btVector3(x, 0.f, 0.f));
+            btRigidBody *body = new btRigidBody(info);
+            body->setUserPointer(agent);
+            parts.world->addRigidBody(body);
+            return body;
+        };
+        btRigidBody *targetBody = newBody(5.f, target), *otherBody = newBody(10.f, other);
+
+        btPairCachingGhostObject *ghost = new btPairCachingGhostObject();
+        ghost->setCollisionShape(&box);
+        ghost->setWorldTransform(btTransform(btQuaternion::getIdentity(), btVector3(2.f, 0.f, 0.f)));
+        ghost->setUserPointer(target);
+        parts.world->addCollisionObject(ghost);
+        parts.world->updateAabbs();
+
+        std::vector<PhysicsModelManager::Query> queries =
+        {
+            {Ogre::Vector3(0.f, 0.f, 0.f), Ogre::Vector3(20.f, 0.f, 0.f), 0.f},
+            {Ogre::Vector3(7.f, 0.f, 0.f), Ogre::Vector3(20.f, 0.f, 0.f), 0.f},
+            {Ogre::Vector3(0.f, 50.f, 0.f), Ogre::Vector3(20.f, 50.f, 0.f), 0.f},
+            // passes above the boxes, but within reach of its radius
+            {Ogre::Vector3(0.f, .8f, 0.f), Ogre::Vector3(20.f, .8f, 0.f), .5f},
+        };
+        std::vector<PhysicsModelManager::QueryHit> hits;
+        bool allWasFine = true;
+
+        PhysicsModelManager::castQueries(parts.world, queries, hits);
+
+        if(hits.size() != queries.size()
+                || !hits[0].hasHit() || targetAid != hits[0].aid || std::abs(hits[0].point.x - 4.5f) > 1e-3f
+                || !hits[1].hasHit() || otherAid != hits[1].aid
+                || hits[2].hasHit() || INVALID_ID != hits[2].aid || 1.f != hits[2].fraction
+                || !hits[3].hasHit() || targetAid != hits[3].aid)
+        {
+            Debug::error(STEEL_METH_INTRO, "unfiltered queries got wrong hits.").endl();
+            allWasFine = false;
+        }
+
+        PhysicsModelManager::castQueries(parts.world, queries, hits, targetTag);
+
+        if(!hits[0].hasHit() || targetAid != hits[0].aid || hits[1].hasHit() || hits[2].hasHit() || targetAid != hits[3].aid)
+        {
+            Debug::error(STEEL_METH_INTRO, "filtered queries got wrong hits.").endl();
+            allWasFine = false;
+        }
+
+        parts.world->removeCollisionObject(ghost);
+        delete ghost;
+
+        for(btRigidBody *body : {targetBody, otherBody})
+        {
+            parts.world->removeRigidBody(body);
+            delete body;
+        }
+
+        TerrainPhysicsManager::destroyWorld(parts);
+        agentMan->deleteAgent(targetAid);
+        agentMan->deleteAgent(otherAid);
+        return allWasFine;
+    }
+
+    bool utest_PhysicsQueriesThroughput(UnitTestExecutionContext const *context)
+    {
+        // rays cast down onto a grid of boxes, one per box and as many sweeps
+        u32 const side = 128, iterations = 10;
+        float const spacing = 2.f;
+
+        u32 maxThreads = TerrainPhysicsManager::DEFAULT_THREAD_COUNT;
+        context->engine->config().getSetting("TerrainPhysicsManager::benchmarkMaxThreadCount", maxThreads, std::thread::hardware_concurrency());
+
+        std::vector<PhysicsModelManager::Query> queries;
+
+        for(u32 x = 0; x < side; ++x)
+        {
+            for(u32 z = 0; z < side; ++z)
+            {
+                Ogre::Vector3 const above(x * spacing + .3f, 10.f, z * spacing - .3f);
+                queries.push_back({above, above - Ogre::Vector3(0.f, 20.f, 0.f), 0.f});
+                queries.push_back({above, above - Ogre::Vector3(0.f, 20.f, 0.f), .4f});
+            }
+        }
+
+        btBoxShape box(btVector3(.5f, .5f, .5f));
+        std::vector<PhysicsModelManager::QueryHit> hits;
+
+        // the task scheduler is global, give it back as we found it
+        btITaskScheduler *const previousScheduler = btGetTaskScheduler();
+        int const previousThreadCount = previousScheduler->getNumThreads();
+        bool allWasFine = true;
+
+        Debug::log(STEEL_METH_INTRO, queries.size(), " queries against ", side * side, " bodies:").endl().indent();
+
+        for(u32 threadCount = 1; threadCount <= std::max(1U, maxThreads); threadCount *= 2)
+        {
+            TerrainPhysicsManager::WorldParts parts;
+
+            if(!TerrainPhysicsManager::buildWorld(parts, threadCount))
+            {
+                TerrainPhysicsManager::destroyWorld(parts);
+                break;
+            }
+
+            if(1 == threadCount)
+                btSetTaskScheduler(btGetSequentialTaskScheduler());
+
+            std::vector<btRigidBody *> bodies;
+
+            for(u32 x = 0; x < side; ++x)
+            {
+                for(u32 z = 0; z < side; ++z)
+                {
+                    btRigidBody::btRigidBodyConstructionInfo info(0.f, nullptr, &box);
+                    info.m_startWorldTransform.setOrigin(btVector3(x * spacing, 0.f, z * spacing));
+                    bodies.push_back(new btRigidBody(info));
+                    parts.world->addRigidBody(bodies.back());
+                }
+            }
+
+            parts.world->updateAabbs();
+            PhysicsModelManager::castQueries(parts.world, queries, hits);
+            Ogre::Timer timer;
+
+            for(u32 i = 0; i < iterations; ++i)
+                PhysicsModelManager::castQueries(parts.world, queries, hits);
+
+            double const ms = timer.getMicroseconds() / 1000. / iterations;
+            Debug::log(parts.threadCount, " thread(s): ", ms, "ms, ", queries.size() / ms / 1000., "M queries/s").endl();
+            // bullet has no more threads to give
+            bool const clamped = parts.threadCount < threadCount;
+
+            for(auto const & hit : hits)
+                allWasFine &= hit.hasHit();
+
+            for(btRigidBody *body : bodies)
+            {
+                parts.world->removeRigidBody(body);
+                delete body;
+            }
+
+            TerrainPhysicsManager::destroyWorld(parts);
+
+            if(clamped)
+                break;
+        }
+
+        Debug::log.unIndent();
+
+        previousScheduler->setNumThreads(previousThreadCount);
+        btSetTaskScheduler(previousScheduler);
+
+        if(!allWasFine)
+            Debug::error(STEEL_METH_INTRO, "some queries missed their box.").endl();
+
+        return allWasFine;
     }
 }
 
@@ -0,0 +1,279 @@
+#include "models/PhysicsSnapshot.h"
+
+#include <OgreTimer.h>
+#include <bullet/BulletDynamics/Dynamics/btRigidBody.h>
+#include <bullet/BulletCollision/CollisionShapes/btSphereShape.h>
+
+#include "Debug.h"
+#include "Engine.h"
+#include "Level.h"
+#include "models/AgentManager.h"
+#include "models/OgreModelManager.h"
+#include "models/PhysicsModelManager.h"
+#include "tests/UnitTestManager.h"
+
+namespace Steel
+{
+    PhysicsSnapshot::PhysicsSnapshot(): mBodies(), mStacks()
+    {
+    }
+
+    void PhysicsSnapshot::clear()
+    {
+        mBodies.clear();
+        mStacks.clear();
+    }
+
+    void PhysicsSnapshot::reserve(size_t bodies, size_t stackEntries/* = 0*/)
+    {
+        mBodies.reserve(bodies);
+        mStacks.reserve(stackEntries);
+    }
+
+    size_t PhysicsSnapshot::byteSize() const
+    {
+        return mBodies.size() * sizeof(BodyRecord) + mStacks.size() * sizeof(StackRecord);
+    }
+
+    void PhysicsSnapshot::saveBody(btRigidBody const *body, BodyRecord &record)
+    {
+        btTransform const &tr = body->getWorldTransform();
+        btVector3 const &origin = tr.getOrigin();
+        btQuaternion const rotation = tr.getRotation();
+        btVector3 const &linear = body->getLinearVelocity();
+        btVector3 const &angular = body->getAngularVelocity();
+
+        record.position[0] = origin.x();
+        record.position[1] = origin.y();
+        record.position[2] = origin.z();
+        record.rotation[0] = rotation.x();
+        record.rotation[1] = rotation.y();
+        record.rotation[2] = rotation.z();
+        record.rotation[3] = rotation.w();
+        record.linearVelocity[0] = linear.x();
+        record.linearVelocity[1] = linear.y();
+        record.linearVelocity[2] = linear.z();
+        record.angularVelocity[0] = angular.x();
+        record.angularVelocity[1] = angular.y();
+        record.angularVelocity[2] = angular.z();
+        record.activationState = body->getActivationState();
+        record.deactivationTime = body->getDeactivationTime();
+        record.collisionFlags = body->getCollisionFlags();
+    }
+
+    void PhysicsSnapshot::restoreBody(btRigidBody *body, BodyRecord const &record)
+    {
+        btTransform const tr(btQuaternion(record.rotation[0], record.rotation[1], record.rotation[2], record.rotation[3]),
+                             btVector3(record.position[0], record.position[1], record.position[2]));
+        btVector3 const linear(record.linearVelocity[0], record.linearVelocity[1], record.linearVelocity[2]);
+        btVector3 const angular(record.angularVelocity[0], record.angularVelocity[1], record.angularVelocity[2]);
+
+        body->setCollisionFlags(record.collisionFlags);
+        // interpolation data too, or the next frame would blend from the pre-restore state
+        body->setCenterOfMassTransform(tr);
+        body->setInterpolationWorldTransform(tr);
+        body->setLinearVelocity(linear);
+        body->setAngularVelocity(angular);
+        body->setInterpolationLinearVelocity(linear);
+        body->setInterpolationAngularVelocity(angular);
+        body->clearForces();
+        body->forceActivationState(record.activationState);
+        body->setDeactivationTime(record.deactivationTime);
+    }
+
+    bool utest_PhysicsSnapshot(UnitTestExecutionContext const *context)
+    {
+        Level *level = context->engine->level();
+        PhysicsModelManager *physicsModelMan = level->physicsModelMan();
+        std::vector<AgentId> aids;
+        std::vector<ModelId> pmids;
+
+        for(u32 i = 0; i < 3; ++i)
+        {
+            AgentId const aid = level->agentMan()->newAgent();
+            ModelId const omid = level->ogreModelMan()->newModel("Prefab_Cube", Ogre::Vector3(i * 10.f, 50.f, 0.f), Ogre::Quaternion::IDENTITY);
+            ModelId const pmid = physicsModelMan->newModel();
+            aids.push_back(aid);
+
+            if(!level->linkAgentToModel(aid, ModelType::OGRE, omid) || !level->linkAgentToModel(aid, ModelType::PHYSICS, pmid))
+            {
+                Debug::error(STEEL_METH_INTRO, "could not build test agent ", aid).endl();
+
+                for(AgentId const & it : aids)
+                    level->agentMan()->deleteAgent(it);
+
+                return false;
+            }
+
+            pmids.push_back(pmid);
+        }
+
+        // models storage may have moved while allocating
+        std::vector<PhysicsModel *> models;
+
+        // prefab bodies are static (mass 0), which velocities would always be 0
+        for(ModelId const & pmid : pmids)
+        {
+            models.push_back(physicsModelMan->at(pmid));
+            models.back()->setMass(2.f);
+        }
+
+        // 0: moving rigid body, 1: kinematics with a 2 states stack (rigid body, then kinematics), 2: moving, scrambled
+        models[0]->applyCentralImpulse(Ogre::Vector3(1.f, 2.f, 3.f));
+        models[0]->applyTorqueImpulse(Ogre::Vector3(0.f, 1.f, 0.f));
+        models[2]->applyCentralImpulse(Ogre::Vector3(-4.f, 0.f, 2.f));
+        models[1]->pushState();
+        models[1]->toKinematics();
+        models[1]->pushState();
+
+        PhysicsSnapshot before, after;
+        physicsModelMan->takeSnapshot(before);
+
+        // what is checked is actually there to be restored
+        Ogre::Vector3 const velocity = models[0]->velocity(), spin = models[0]->angularVelocity();
+        Ogre::Vector3 const otherVelocity = models[2]->velocity();
+
+        if(velocity.isZeroLength() || spin.isZeroLength() || otherVelocity.isZeroLength())
+        {
+            Debug::error(STEEL_METH_INTRO, "impulses did not move the test bodies.").endl();
+
+            for(AgentId const & aid : aids)
+                level->agentMan()->deleteAgent(aid);
+
+            return false;
+        }
+
+        // scramble
+        models[0]->setPosition(Ogre::Vector3(-5.f, -5.f, -5.f));
+        models[0]->applyCentralImpulse(Ogre::Vector3(-10.f, 0.f, 0.f));
+        models[1]->popState();
+        models[1]->popState();
+        models[2]->setPosition(Ogre::Vector3(5.f, 5.f, 5.f));
+        models[2]->applyCentralImpulse(Ogre::Vector3(8.f, 8.f, 8.f));
+        models[2]->toKinematics();
+        models[2]->pushState();
+
+        physicsModelMan->restoreSnapshot(before);
+        physicsModelMan->takeSnapshot(after);
+
+        bool allWasFine = before.bodies().size() == after.bodies().size() && before.stacks().size() == after.stacks().size();
+
+        for(size_t i = 0; allWasFine && i < before.bodies().size(); ++i)
+        {
+            PhysicsSnapshot::BodyRecord const &expected = before.bodies()[i], &actual = after.bodies()[i];
+            allWasFine &= expected.mid == actual.mid && expected.isKinematics == actual.isKinematics
+                          && expected.stackDepth == actual.stackDepth && expected.collisionFlags == actual.collisionFlags;
+
+            for(u32 k = 0; k < 3; ++k)
+            {
+                allWasFine &= std::abs(expected.position[k] - actual.position[k]) < 1e-4f;
+                allWasFine &= std::abs(expected.linearVelocity[k] - actual.linearVelocity[k]) < 1e-4f;
+                allWasFine &= std::abs(expected.angularVelocity[k] - actual.angularVelocity[k]) < 1e-4f;
+            }
+
+            for(u32 k = 0; k < 4; ++k)
+                allWasFine &= std::abs(expected.rotation[k] - actual.rotation[k]) < 1e-4f;
+        }
+
+        // bodies move as they did when captured (positions are compared above)
+        allWasFine &= models[0]->velocity().positionEquals(velocity, 1e-4f) && models[0]->angularVelocity().positionEquals(spin, 1e-4f);
+        allWasFine &= models[2]->velocity().positionEquals(otherVelocity, 1e-4f);
+
+        for(size_t i = 0; allWasFine && i < before.stacks().size(); ++i)
+        {
+            allWasFine &= before.stacks()[i].isKinematics == after.stacks()[i].isKinematics
+                          && before.stacks()[i].bodyCollisionFlags == after.stacks()[i].bodyCollisionFlags;
+        }
+
+        if(!allWasFine)
+            Debug::error(STEEL_METH_INTRO, "restored state differs from the snapshot.").endl();
+
+        // the restored stack unwinds as the original one would have
+        if(!models[1]->popState() || models[1]->popState() || models[2]->popState())
+        {
+            Debug::error(STEEL_METH_INTRO, "states stacks were not restored.").endl();
+            allWasFine = false;
+        }
+
+        for(AgentId const & aid : aids)
+            level->agentMan()->deleteAgent(aid);
+
+        return allWasFine;
+    }
+
+    bool utest_PhysicsSnapshotSpeed(UnitTestExecutionContext const *context)
+    {
+        size_t const count = 10000;
+        u32 const iterations = 100;
+
+        btSphereShape shape(.5f);
+        std::vector<btRigidBody *> bodies;
+
+        for(size_t i = 0; i < count; ++i)
+        {
+            btRigidBody *body = new btRigidBody(1.f, nullptr, &shape);
+            btTransform tr(btQuaternion(btVector3(0, 1, 0), (float) i), btVector3((float) i, 1.f, -(float) i));
+            body->setCenterOfMassTransform(tr);
+            body->setLinearVelocity(btVector3(1.f, (float) i, 0));
+            bodies.push_back(body);
+        }
+
+        PhysicsSnapshot snapshot;
+        snapshot.reserve(count);
+
+        Ogre::Timer timer;
+
+        for(u32 n = 0; n < iterations; ++n)
+        {
+            snapshot.clear();
+
+            for(size_t i = 0; i < count; ++i)
+            {
+                snapshot.bodies().emplace_back();
+                PhysicsSnapshot::BodyRecord &record = snapshot.bodies().back();
+                record.mid = (ModelId) i;
+                PhysicsSnapshot::saveBody(bodies[i], record);
+            }
+        }
+
+        double const snapshotUs = (double) timer.getMicroseconds() / iterations;
+
+        // scramble, then check restore gives everything back
+        for(btRigidBody *body : bodies)
+        {
+            body->setCenterOfMassTransform(btTransform::getIdentity());
+            body->setLinearVelocity(btVector3(0, 0, 0));
+        }
+
+        timer.reset();
+
+        for(u32 n = 0; n < iterations; ++n)
+        {
+            for(auto const & record : snapshot.bodies())
+                PhysicsSnapshot::restoreBody(bodies[record.mid], record);
+        }
+
+        double const restoreUs = (double) timer.getMicroseconds() / iterations;
+
+        bool allWasFine = true;
+
+        for(size_t i = 0; i < count && allWasFine; ++i)
+        {
+            if(bodies[i]->getWorldTransform().getOrigin().distance(btVector3((float) i, 1.f, -(float) i)) > 1e-3f
+                    || bodies[i]->getLinearVelocity().y() != (float) i)
+            {
+                Debug::error(STEEL_METH_INTRO, "body ", i, " was not restored properly.").endl();
+                allWasFine = false;
+            }
+        }
+
+        Debug::log(STEEL_METH_INTRO, count, " bodies (", snapshot.byteSize() / 1024, "KB): snapshot ", snapshotUs,
+                   "us, restore ", restoreUs, "us").endl();
+
+        for(btRigidBody *body : bodies)
+            delete body;
+
+        return allWasFine;
+    }
+}
+// kate: indent-mode cstyle; indent-width 4; replace-tabs on;
@@ -0,0 +1,327 @@
+#include "models/ShapeCooker.h"
+
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+
+#include <OgreMeshManager.h>
+#include <OgreMeshSerializer.h>
+#include <OgreResourceGroupManager.h>
+#include <OgreDataStream.h>
+
+#include <bullet/BulletCollision/CollisionShapes/btBoxShape.h>
+#include <bullet/BulletCollision/CollisionShapes/btBvhTriangleMeshShape.h>
+#include <bullet/BulletCollision/CollisionShapes/btCollisionShape.h>
+#include <bullet/LinearMath/btSerializer.h>
+#include <bullet/BulletWorldImporter/btBulletWorldImporter.h>
+#include <BtOgreGP.h>
+#include <Poco/Path.h>
+
+#include "Debug.h"
+#include "tests/UnitTestManager.h"
+
+namespace Steel
+{
+    ShapeCooker::ShapeCooker(): FileEventListener(),
+        mCacheDir(), mSources(), mImporters()
+    {
+    }
+
+    ShapeCooker::~ShapeCooker()
+    {
+        shutdown();
+    }
+
+    void ShapeCooker::init(File const &cacheDir)
+    {
+        mCacheDir = cacheDir;
+
+        // File::mkdir is not recursive
+        if(!mCacheDir.parentDir().exists())
+            mCacheDir.parentDir().mkdir();
+
+        if(!mCacheDir.exists())
+            mCacheDir.mkdir();
+
+        if(!mCacheDir.exists())
+            Debug::warning(STEEL_METH_INTRO, "could not create shape cache directory ").quotes(mCacheDir)(". Shapes will be rebuilt at each load.").endl();
+    }
+
+    void ShapeCooker::shutdown()
+    {
+        for(auto & entry : mSources)
+            entry.second.file.removeFileListener(this);
+
+        mSources.clear();
+
+        if(mImporters.size())
+            Debug::warning(STEEL_METH_INTRO, mImporters.size(), " cooked shapes still alive.").endl();
+    }
+
+    bool ShapeCooker::isCookable(BoundingShape boundingShape)
+    {
+        // boxes and spheres are cheaper to build than to read
+        return BoundingShape::CONVEXHULL == boundingShape || BoundingShape::TRIMESH == boundingShape;
+    }
+
+    btCollisionShape *ShapeCooker::shape(Ogre::MeshPtr const &mesh, BoundingShape boundingShape)
+    {
+        if(!isCookable(boundingShape))
+            return build(mesh, boundingShape);
+
+        MeshSource *src = source(mesh);
+
+        if(nullptr == src)
+            return build(mesh, boundingShape);
+
+        src->boundingShapes.insert(boundingShape);
+        File const file = cacheFile(mesh->getName(), boundingShape, src->hash);
+        btCollisionShape *shape = load(file);
+
+        if(nullptr != shape)
+            return shape;
+
+        shape = build(mesh, boundingShape);
+
+        if(nullptr != shape)
+            save(shape, file);
+
+        return shape;
+    }
+
+    void ShapeCooker::deleteShape(btCollisionShape *shape, BoundingShape boundingShape)
+    {
+        auto it = mImporters.find(shape);
+
+        if(mImporters.end() != it)
+        {
+            // the importer allocated the shape and its geometry
+            it->second->deleteAllData();
+            delete it->second;
+            mImporters.erase(it);
+            return;
+        }
+
+        // BtOgre allocates the triangle mesh of trimeshes, and leaves it to us
+        if(BoundingShape::TRIMESH == boundingShape)
+        {
+            btStridingMeshInterface *meshInterface = static_cast<btBvhTriangleMeshShape *>(shape)->getMeshInterface();
+            delete shape;
+            delete meshInterface;
+            return;
+        }
+
+        delete shape;
+    }
+
+    void ShapeCooker::onFileChangeEvent(File file)
+    {
+        for(auto & entry : mSources)
+        {
+            MeshSource &src = entry.second;
+
+            if(src.file != file)
+                continue;
+
+            std::vector<char> buffer;
+
+            if(!readFile(src.file, buffer))
+                continue;
+
+            u64 const newHash = hash(buffer);
+
+            if(newHash == src.hash)
+                continue;
+
+            // load the new version aside, shapes in use are left untouched
+            Ogre::String const meshName = entry.first;
+            Ogre::MeshPtr mesh = Ogre::MeshManager::getSingleton().createManual(meshName + ".ShapeCooker", src.group);
+            Ogre::DataStreamPtr stream(new Ogre::MemoryDataStream(buffer.data(), buffer.size(), false, true));
+            Ogre::MeshSerializer().importMesh(stream, mesh.get());
+
+            for(BoundingShape boundingShape : src.boundingShapes)
+            {
+                cacheFile(meshName, boundingShape, src.hash).rm();
+                btCollisionShape *shape = build(mesh, boundingShape);
+
+                if(nullptr == shape)
+                    continue;
+
+                save(shape, cacheFile(meshName, boundingShape, newHash));
+                deleteShape(shape, boundingShape);
+            }
+
+            Ogre::MeshManager::getSingleton().remove(mesh->getHandle());
+            src.hash = newHash;
+            Debug::log(STEEL_METH_INTRO, "recooked shapes of mesh ").quotes(meshName)(". Models in use keep their shapes until reloaded.").endl();
+        }
+    }
+
+    btCollisionShape *ShapeCooker::build(Ogre::MeshPtr const &mesh, BoundingShape boundingShape)
+    {
+        BtOgre::StaticMeshToShapeConverter converter;
+        converter.addMesh(mesh);
+
+        switch(boundingShape)
+        {
+            case BoundingShape::BOX:
+                return converter.createBox();
+
+            case BoundingShape::CONVEXHULL:
+                return converter.createConvex();
+
+            case BoundingShape::SPHERE:
+                return converter.createSphere();
+
+            case BoundingShape::TRIMESH:
+                return converter.createTrimesh();
+        }
+
+        return nullptr;
+    }
+
+    btCollisionShape *ShapeCooker::load(File file)
+    {
+        std::vector<char> buffer;
+
+        if(!file.exists() || !readFile(file, buffer))
+            return nullptr;
+
+        btBulletWorldImporter *importer = new btBulletWorldImporter(nullptr);
+
+        if(!importer->loadFileFromMemory(buffer.data(), (int) buffer.size()) || 0 == importer->getNumCollisionShapes())
+        {
+            Debug::warning(STEEL_METH_INTRO, "could not read cooked shape ").quotes(file)(". Discarding it.").endl();
+            importer->deleteAllData();
+            delete importer;
+            file.rm();
+            return nullptr;
+        }
+
+        btCollisionShape *shape = importer->getCollisionShapeByIndex(0);
+        mImporters.insert(std::make_pair(shape, importer));
+        return shape;
+    }
+
+    bool ShapeCooker::save(btCollisionShape *shape, File const &file)
+    {
+        btDefaultSerializer serializer;
+        serializer.startSerialization();
+        shape->serializeSingleShape(&serializer);
+        serializer.finishSerialization();
+
+        std::ofstream s(file.fullPath().c_str(), std::ios_base::binary | std::ios_base::trunc);
+
+        if(!s.is_open())
+        {
+            Debug::error(STEEL_METH_INTRO, "could not write cooked shape ").quotes(file).endl();
+            return false;
+        }
+
+        s.write((char const *) serializer.getBufferPointer(), serializer.getCurrentBufferSize());
+        return s.good();
+    }
+
+    ShapeCooker::MeshSource *ShapeCooker::source(Ogre::MeshPtr const &mesh)
+    {
+        auto it = mSources.find(mesh->getName());
+
+        if(mSources.end() != it)
+            return &(it->second);
+
+        Ogre::FileInfoListPtr infos = Ogre::ResourceGroupManager::getSingleton().findResourceFileInfo(mesh->getGroup(), mesh->getName());
+
+        if(infos.isNull() || infos->empty() || "FileSystem" != infos->front().archive->getType())
+            return nullptr;
+
+        MeshSource src;
+        src.file = File(infos->front().archive->getName()) / infos->front().filename;
+        src.group = mesh->getGroup();
+
+        std::vector<char> buffer;
+
+        if(!readFile(src.file, buffer))
+            return nullptr;
+
+        src.hash = hash(buffer);
+
+        MeshSource &inserted = mSources.insert(std::make_pair(mesh->getName(), src)).first->second;
+        inserted.file.addFileListener(this);
+        return &inserted;
+    }
+
+    File ShapeCooker::cacheFile(Ogre::String const &meshName, BoundingShape boundingShape, u64 hash) const
+    {
+        Ogre::String name = meshName + "." + toString(boundingShape);
+        // kept in the cache directory itself
+        name = Ogre::StringUtil::replaceAll(name, "::", "_");
+        name = Ogre::StringUtil::replaceAll(name, File::Separator, "_");
+
+        std::ostringstream oss;
+        oss << name << "." << std::hex << hash << ".bullet";
+        return mCacheDir / oss.str();
+    }
+
+    bool ShapeCooker::readFile(File const &file, std::vector<char> &buffer)
+    {
+        std::ifstream s(file.fullPath().c_str(), std::ios_base::binary | std::ios_base::ate);
+
+        if(!s.is_open())
+            return false;
+
+        buffer.resize((size_t) s.tellg());
+        s.seekg(0, std::ios_base::beg);
+        s.read(buffer.data(), buffer.size());
+        return s.good();
+    }
+
+    u64 ShapeCooker::hash(std::vector<char> const &buffer)
+    {
+        u64 h = 14695981039346656037UL;
+
+        for(char c : buffer)
+        {
+            h ^= (u64)(unsigned char) c;
+            h *= 1099511628211UL;
+        }
+
+        return h;
+    }
+
+    bool utest_ShapeCooker(UnitTestExecutionContext const *context)
+    {
+        File const cacheDir = File(Poco::Path::temp()) / "steel_utest_ShapeCooker";
+        ShapeCooker cooker;
+        cooker.init(cacheDir);
+        bool allWasFine = true;
+
+        // meshes from subdirectories of a resource location, or with namespaced names, are cooked in the cache directory
+        File const file = cooker.cacheFile("rocks" + File::Separator + "big::rock.mesh", BoundingShape::CONVEXHULL, 0xabcdefULL);
+        Ogre::String const name = file.fileName();
+
+        if(Ogre::String::npos != name.find(File::Separator) || Ogre::String::npos != name.find("::"))
+        {
+            Debug::error(STEEL_METH_INTRO, "cache file name ", name, " was not flattened.").endl();
+            allWasFine = false;
+        }
+
+        btBoxShape box(btVector3(1.f, 2.f, 3.f));
+        btCollisionShape *loaded = cooker.save(&box, file) ? cooker.load(file) : nullptr;
+
+        if(nullptr == loaded || BOX_SHAPE_PROXYTYPE != loaded->getShapeType())
+        {
+            Debug::error(STEEL_METH_INTRO, "could not cook a shape into ", file).endl();
+            allWasFine = false;
+        }
+
+        if(nullptr != loaded)
+            cooker.deleteShape(loaded, BoundingShape::CONVEXHULL);
+
+        File(file).rm();
+        cooker.shutdown();
+        std::remove(cacheDir.fullPath().c_str());
+        return allWasFine;
+    }
+}
+
+// kate: indent-mode cstyle; indent-width 4; replace-tabs on;
@@ -0,0 +1,214 @@
+#include "models/StepForcesBatch.h"
+
+#if defined(__AVX__) || defined(__SSE__)
+#include <immintrin.h>
+#endif
+
+#include <OgreTimer.h>
+#include <bullet/BulletDynamics/Dynamics/btRigidBody.h>
+#include <bullet/BulletCollision/CollisionShapes/btSphereShape.h>
+
+#include "Debug.h"
+#include "tests/UnitTestManager.h"
+
+namespace Steel
+{
+    StepForcesBatch::StepForcesBatch(): mBodies(), mKeepVertical(), mLift(),
+        mUpX(), mUpZ(), mAwake(), mTorqueX(), mTorqueZ(), mImpulseY()
+    {
+    }
+
+    void StepForcesBatch::clear()
+    {
+        mBodies.clear();
+        mKeepVertical.clear();
+        mLift.clear();
+    }
+
+    void StepForcesBatch::add(btRigidBody *body, float keepVertical, float lift)
+    {
+        mBodies.push_back(body);
+        mKeepVertical.push_back(keepVertical);
+        mLift.push_back(lift);
+    }
+
+    void StepForcesBatch::apply(float fixedTimestep)
+    {
+        size_t const count = mBodies.size();
+
+        if(0 == count)
+            return;
+
+        mUpX.resize(count);
+        mUpZ.resize(count);
+        mAwake.resize(count);
+        mTorqueX.resize(count);
+        mTorqueZ.resize(count);
+        mImpulseY.resize(count);
+
+        for(size_t i = 0; i < count; ++i)
+        {
+            btRigidBody const *body = mBodies[i];
+            // rotation * UNIT_Y
+            btVector3 const up = body->getWorldTransform().getBasis().getColumn(1);
+            mUpX[i] = up.x();
+            mUpZ[i] = up.z();
+            mAwake[i] = body->isActive() ? 1 : 0;
+        }
+
+        computeImpulses(count, fixedTimestep, mUpX.data(), mUpZ.data(), mKeepVertical.data(), mLift.data(),
+                        mTorqueX.data(), mTorqueZ.data(), mImpulseY.data());
+
+        // sleeping bodies are left alone until something wakes them up. Impulses do not wake bodies up either,
+        // which lets resting levitating/vertical bodies fall asleep.
+        for(size_t i = 0; i < count; ++i)
+        {
+            if(0 == mAwake[i])
+                continue;
+
+            btRigidBody *body = mBodies[i];
+
+            if(.0f != mTorqueX[i] || .0f != mTorqueZ[i])
+                body->applyTorqueImpulse(btVector3(mTorqueX[i], .0f, mTorqueZ[i]));
+
+            if(.0f != mImpulseY[i])
+                body->applyCentralImpulse(btVector3(.0f, mImpulseY[i], .0f));
+        }
+    }
+
+    void StepForcesBatch::computeImpulses(size_t count, float dt,
+                                          float const *upX, float const *upZ, float const *keepVertical, float const *lift,
+                                          float *torqueX, float *torqueZ, float *impulseY)
+    {
+        size_t i = 0;
+#if defined(__AVX__)
+        __m256 const dt8 = _mm256_set1_ps(dt);
+        __m256 const zero8 = _mm256_setzero_ps();
+
+        for(; i + 8 <= count; i += 8)
+        {
+            __m256 const k = _mm256_mul_ps(_mm256_loadu_ps(keepVertical + i), dt8);
+            _mm256_storeu_ps(torqueX + i, _mm256_mul_ps(_mm256_sub_ps(zero8, _mm256_loadu_ps(upZ + i)), k));
+            _mm256_storeu_ps(torqueZ + i, _mm256_mul_ps(_mm256_loadu_ps(upX + i), k));
+            _mm256_storeu_ps(impulseY + i, _mm256_mul_ps(_mm256_loadu_ps(lift + i), dt8));
+        }
+
+#endif
+#if defined(__SSE__)
+        __m128 const dt4 = _mm_set1_ps(dt);
+        __m128 const zero4 = _mm_setzero_ps();
+
+        for(; i + 4 <= count; i += 4)
+        {
+            __m128 const k = _mm_mul_ps(_mm_loadu_ps(keepVertical + i), dt4);
+            _mm_storeu_ps(torqueX + i, _mm_mul_ps(_mm_sub_ps(zero4, _mm_loadu_ps(upZ + i)), k));
+            _mm_storeu_ps(torqueZ + i, _mm_mul_ps(_mm_loadu_ps(upX + i), k));
+            _mm_storeu_ps(impulseY + i, _mm_mul_ps(_mm_loadu_ps(lift + i), dt4));
+        }
+
+#endif
+        // tail
+        computeImpulsesScalar(i, count, dt, upX, upZ, keepVertical, lift, torqueX, torqueZ, impulseY);
+    }
+
+    void StepForcesBatch::computeImpulsesScalar(size_t begin, size_t count, float dt,
+            float const *upX, float const *upZ, float const *keepVertical, float const *lift,
+            float *torqueX, float *torqueZ, float *impulseY)
+    {
+        for(size_t i = begin; i < count; ++i)
+        {
+            float const k = keepVertical[i] * dt;
+            torqueX[i] = -upZ[i] * k;
+            torqueZ[i] = upX[i] * k;
+            impulseY[i] = lift[i] * dt;
+        }
+    }
+
+    char const *StepForcesBatch::simdName()
+    {
+#if defined(__AVX__)
+        return "AVX";
+#elif defined(__SSE__)
+        return "SSE";
+#else
+        return "scalar";
+#endif
+    }
+
+    bool utest_StepForcesBatchThroughput(UnitTestExecutionContext const *context)
+    {
+        size_t const count = 10000;
+        u32 const iterations = 200;
+        float const dt = 1.f / 60.f;
+
+        btSphereShape shape(.5f);
+        std::vector<btRigidBody *> bodies;
+        StepForcesBatch batch;
+
+        std::vector<float> upX(count), upZ(count), keep(count), lift(count);
+        std::vector<float> tx(count), tz(count), iy(count), refTx(count), refTz(count), refIy(count);
+
+        for(size_t i = 0; i < count; ++i)
+        {
+            btRigidBody *body = new btRigidBody(1.f, nullptr, &shape);
+            btTransform tr;
+            tr.setIdentity();
+            tr.setRotation(btQuaternion(btVector3(1.f, .0f, 1.f).normalized(), (float) i * .001f));
+            body->setWorldTransform(tr);
+            body->setActivationState(DISABLE_DEACTIVATION);
+            bodies.push_back(body);
+
+            keep[i] = (float)(i % 3);
+            lift[i] = (i % 2) ? 1.f : .0f;
+            batch.add(body, keep[i], lift[i]);
+
+            btVector3 const up = tr.getBasis().getColumn(1);
+            upX[i] = up.x();
+            upZ[i] = up.z();
+        }
+
+        // simd and scalar paths must agree
+        StepForcesBatch::computeImpulses(count, dt, upX.data(), upZ.data(), keep.data(), lift.data(), tx.data(), tz.data(), iy.data());
+        StepForcesBatch::computeImpulsesScalar(0, count, dt, upX.data(), upZ.data(), keep.data(), lift.data(), refTx.data(), refTz.data(), refIy.data());
+
+        bool allWasFine = true;
+
+        for(size_t i = 0; i < count && allWasFine; ++i)
+        {
+            if(tx[i] != refTx[i] || tz[i] != refTz[i] || iy[i] != refIy[i])
+            {
+                Debug::error(STEEL_METH_INTRO, "kernel mismatch at body ", i).endl();
+                allWasFine = false;
+            }
+        }
+
+        Ogre::Timer timer;
+
+        for(u32 n = 0; n < iterations; ++n)
+            StepForcesBatch::computeImpulsesScalar(0, count, dt, upX.data(), upZ.data(), keep.data(), lift.data(), tx.data(), tz.data(), iy.data());
+
+        double const scalarRate = (double) count * iterations / std::max<unsigned long>(1UL, timer.getMicroseconds());
+        timer.reset();
+
+        for(u32 n = 0; n < iterations; ++n)
+            StepForcesBatch::computeImpulses(count, dt, upX.data(), upZ.data(), keep.data(), lift.data(), tx.data(), tz.data(), iy.data());
+
+        double const kernelRate = (double) count * iterations / std::max<unsigned long>(1UL, timer.getMicroseconds());
+        timer.reset();
+
+        for(u32 n = 0; n < iterations; ++n)
+            batch.apply(dt);
+
+        double const batchRate = (double) count * iterations / std::max<unsigned long>(1UL, timer.getMicroseconds());
+
+        Debug::log(STEEL_METH_INTRO, count, " bodies, bodies/us: scalar kernel ", scalarRate,
+                   ", ", StepForcesBatch::simdName(), " kernel ", kernelRate,
+                   ", gather+kernel+apply ", batchRate).endl();
+
+        for(btRigidBody *body : bodies)
+            delete body;
+
+        return allWasFine;
+    }
+}
+// kate: indent-mode cstyle; indent-width 4; replace-tabs on;
@@ -5,12 +5,16 @@
  *      Author: onze
  */
 
+#include <algorithm>
+
 #include "models/_ModelManager.h"
 #include "Debug.h"
 #include "Level.h"
 #include "models/Agent.h"
 #include "models/Model.h"
 #include <tools/JsonUtils.h>
+#include <tools/JsonStreamReader.h>
+#include <tools/JsonStreamWriter.h>
 
 namespace Steel
 {
@@ -20,7 +24,8 @@ namespace Steel
         : ModelManager(),
         mLevel(level), 
         mModels(1), // capacity is doubled each time, therefore it cannot start at 0.
-        mModelsFreeList({0L}) // first model is free
+        mModelsFreeList({0L}), // first model is free
+        mDirtyModels()
     {
         mLevel->registerManager(ManagedModel::staticModelType(), this);
     }
@@ -127,6 +132,9 @@ namespace Steel
                 mModels.resize(mid + 1, M());
         }
 
+        if(INVALID_ID != mid)
+            mModels[mid].setDirtyQueue(&mDirtyModels, mid);
+
         return mid;
     }
 
@@ -192,6 +200,39 @@ namespace Steel
         return ids;
     }
 
+    template<class M>
+    std::vector<ModelId> _ModelManager<M>::fromJson(JsonStreamReader &reader)
+    {
+        std::vector<ModelId> ids;
+
+        // null or invalid, as handled by the tree version
+        if(Json::objectValue != reader.nextType())
+        {
+            Json::Value nodes;
+
+            if(reader.readValue(nodes))
+                ids = fromJson(nodes);
+
+            return ids;
+        }
+
+        Ogre::String key;
+        Json::Value node;
+        reader.beginObject();
+
+        while(reader.nextKey(key) && reader.readValue(node))
+        {
+            ModelId mid = Ogre::StringConverter::parseUnsignedLong(key, INVALID_ID);
+
+            if(!this->fromSingleJson(node, mid))
+                Debug::error(logName())("could not deserialize model ")(mid).endl();
+
+            ids.push_back(mid);
+        }
+
+        return ids;
+    }
+
     template<class M>
     bool _ModelManager<M>::fromSingleJson(Json::Value const &node, ModelId &mid, bool updateModel /*= false*/)
     {
@@ -239,6 +280,54 @@ namespace Steel
         }
     }
 
+    template<class M>
+    void _ModelManager<M>::toJson(JsonStreamWriter &writer, std::list<ModelId> const &modelIds)
+    {
+        auto const models = serializableModels(modelIds);
+
+        // as left untouched by toJson(Json::Value &, ...)
+        if(models.empty())
+        {
+            writer.value(Json::Value());
+            return;
+        }
+
+        writer.beginObject();
+
+        for(auto const & it : models)
+        {
+            Json::Value node(Json::objectValue);
+            at(it.second)->toJson(node);
+            writer.key(it.first);
+            writer.value(node);
+        }
+
+        writer.endObject();
+    }
+
+    template<class M>
+    std::vector<std::pair<Ogre::String, ModelId> > _ModelManager<M>::serializableModels(std::list<ModelId> const &modelIds)
+    {
+        std::vector<std::pair<Ogre::String, ModelId> > models;
+
+        if(0 == mModels.size())
+            return models;
+
+        for(ModelId const & id : modelIds)
+        {
+            ManagedModel *managedModel = at(id);
+
+            if(nullptr == managedModel || managedModel->isFree())
+                continue;
+
+            models.push_back(std::make_pair(Ogre::StringConverter::toString(id), id));
+        }
+
+        std::sort(models.begin(), models.end());
+        models.erase(std::unique(models.begin(), models.end()), models.end());
+        return models;
+    }
+
     template<class M>
     bool _ModelManager<M>::toSingleJson(ModelId mid, Json::Value &value)
     {
@@ -279,6 +368,20 @@ namespace Steel
             decRef(mid);
     }
 
+    template<class M>
+    void _ModelManager<M>::takeDirtyModels(std::vector<ModelId> &ids)
+    {
+        ids.clear();
+        ids.swap(mDirtyModels);
+
+        for(ModelId const mid : ids)
+        {
+            // the model may have been cleared meanwhile
+            if(mid < mModels.size())
+                mModels[mid].clearDirty();
+        }
+    }
+
     template<class M>
     std::set<Tag> _ModelManager<M>::modelTags(ModelId mid)
     {
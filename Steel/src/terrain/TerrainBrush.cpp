@@ -0,0 +1,361 @@
+#include "terrain/TerrainBrush.h"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#if defined(__AVX__) || defined(__SSE__)
+#include <immintrin.h>
+#endif
+
+#include <OgreTerrain.h>
+#include <OgreTimer.h>
+
+#include "Debug.h"
+#include "tests/UnitTestManager.h"
+
+namespace Steel
+{
+    namespace
+    {
+        typedef TerrainManager::RaiseShape RaiseShape;
+        typedef TerrainManager::RaiseMode RaiseMode;
+
+        // Shape polynomials, good enough for a brush over [0, 1] and cheap to vectorize:
+        // cos(pi/2*d) up to x^6 (error < 1e-3), sinh(d) up to d^7 (error < 3e-6).
+        float const HALF_PI = 1.57079632679f;
+
+        template<RaiseShape S>
+        inline float shapeRatio(float d)
+        {
+            switch(S)
+            {
+                case RaiseShape::ROUND:
+                {
+                    float const x = HALF_PI * d, x2 = x * x;
+                    return 1.f + x2 * (-1.f / 2.f + x2 * (1.f / 24.f + x2 * (-1.f / 720.f)));
+                }
+
+                case RaiseShape::SINH:
+                {
+                    float const d2 = d * d;
+                    return 1.f - d * (1.f + d2 * (1.f / 6.f + d2 * (1.f / 120.f + d2 * (1.f / 5040.f))));
+                }
+
+                case RaiseShape::TRANGULAR:
+                    return 1.f - d;
+
+                case RaiseShape::UNIFORM:
+                default:
+                    return 1.f;
+            }
+        }
+
+#if defined(__AVX__) || defined(__SSE__)
+#if defined(__AVX__)
+        typedef __m256 vfloat;
+        int const WIDTH = 8;
+        inline vfloat vset(float f) {return _mm256_set1_ps(f);}
+        inline vfloat vload(float const *p) {return _mm256_loadu_ps(p);}
+        inline void vstore(float *p, vfloat v) {_mm256_storeu_ps(p, v);}
+        inline vfloat vadd(vfloat a, vfloat b) {return _mm256_add_ps(a, b);}
+        inline vfloat vsub(vfloat a, vfloat b) {return _mm256_sub_ps(a, b);}
+        inline vfloat vmul(vfloat a, vfloat b) {return _mm256_mul_ps(a, b);}
+        inline vfloat vsqrt(vfloat a) {return _mm256_sqrt_ps(a);}
+        inline vfloat vmin(vfloat a, vfloat b) {return _mm256_min_ps(a, b);}
+        inline vfloat vmax(vfloat a, vfloat b) {return _mm256_max_ps(a, b);}
+        inline vfloat vless(vfloat a, vfloat b) {return _mm256_cmp_ps(a, b, _CMP_LT_OQ);}
+        /// mask ? a : b
+        inline vfloat vselect(vfloat mask, vfloat a, vfloat b) {return _mm256_blendv_ps(b, a, mask);}
+        inline vfloat vramp(float x0) {return _mm256_add_ps(_mm256_set1_ps(x0), _mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7));}
+#else
+        typedef __m128 vfloat;
+        int const WIDTH = 4;
+        inline vfloat vset(float f) {return _mm_set1_ps(f);}
+        inline vfloat vload(float const *p) {return _mm_loadu_ps(p);}
+        inline void vstore(float *p, vfloat v) {_mm_storeu_ps(p, v);}
+        inline vfloat vadd(vfloat a, vfloat b) {return _mm_add_ps(a, b);}
+        inline vfloat vsub(vfloat a, vfloat b) {return _mm_sub_ps(a, b);}
+        inline vfloat vmul(vfloat a, vfloat b) {return _mm_mul_ps(a, b);}
+        inline vfloat vsqrt(vfloat a) {return _mm_sqrt_ps(a);}
+        inline vfloat vmin(vfloat a, vfloat b) {return _mm_min_ps(a, b);}
+        inline vfloat vmax(vfloat a, vfloat b) {return _mm_max_ps(a, b);}
+        inline vfloat vless(vfloat a, vfloat b) {return _mm_cmplt_ps(a, b);}
+        /// mask ? a : b (no blendv before SSE4.1)
+        inline vfloat vselect(vfloat mask, vfloat a, vfloat b) {return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));}
+        inline vfloat vramp(float x0) {return _mm_add_ps(_mm_set1_ps(x0), _mm_setr_ps(0, 1, 2, 3));}
+#endif
+
+        template<RaiseShape S>
+        inline vfloat shapeRatio(vfloat d)
+        {
+            switch(S)
+            {
+                case RaiseShape::ROUND:
+                {
+                    vfloat const x = vmul(vset(HALF_PI), d), x2 = vmul(x, x);
+                    vfloat r = vadd(vset(1.f / 24.f), vmul(x2, vset(-1.f / 720.f)));
+                    r = vadd(vset(-1.f / 2.f), vmul(x2, r));
+                    return vadd(vset(1.f), vmul(x2, r));
+                }
+
+                case RaiseShape::SINH:
+                {
+                    vfloat const d2 = vmul(d, d);
+                    vfloat r = vadd(vset(1.f / 120.f), vmul(d2, vset(1.f / 5040.f)));
+                    r = vadd(vset(1.f / 6.f), vmul(d2, r));
+                    r = vadd(vset(1.f), vmul(d2, r));
+                    return vsub(vset(1.f), vmul(d, r));
+                }
+
+                case RaiseShape::TRANGULAR:
+                    return vsub(vset(1.f), d);
+
+                case RaiseShape::UNIFORM:
+                default:
+                    return vset(1.f);
+            }
+        }
+#endif
+
+        /// Per stroke constants.
+        class Params
+        {
+        public:
+            float cx, cz, radius, invRadius;
+            /// RELATIVE: h += gain * ratio. ABSOLUTE: h += (target + gain * ratio - h) * pull
+            float gain, target, pull;
+            bool absolute;
+        };
+
+        template<RaiseShape S>
+        inline float brushVertex(float h, float x, float z, Params const &p)
+        {
+            float const dx = x - p.cx, dz = z - p.cz;
+            float const dist = std::sqrt(dx * dx + dz * dz);
+
+            if(!(dist < p.radius))
+                return h;
+
+            float const ratio = shapeRatio<S>(dist * p.invRadius);
+            float const raised = p.absolute ? h + (p.target + p.gain * ratio - h) * p.pull : h + p.gain * ratio;
+            return std::min(std::max(raised, (float) TerrainManager::MIN_TERRAIN_HEIGHT), (float) TerrainManager::MAX_TERRAIN_HEIGHT);
+        }
+
+        template<RaiseShape S>
+        void brushRows(float *heights, long size, Ogre::Rect const &rect, Params const &p)
+        {
+#if defined(__AVX__) || defined(__SSE__)
+            vfloat const cx = vset(p.cx), radius = vset(p.radius), invRadius = vset(p.invRadius);
+            vfloat const gain = vset(p.gain), target = vset(p.target), pull = vset(p.pull);
+            vfloat const minHeight = vset((float) TerrainManager::MIN_TERRAIN_HEIGHT), maxHeight = vset((float) TerrainManager::MAX_TERRAIN_HEIGHT);
+#endif
+
+            for(long z = rect.top; z < rect.bottom; ++z)
+            {
+                float *row = heights + z * size;
+                long x = rect.left;
+#if defined(__AVX__) || defined(__SSE__)
+                float const dz = (float) z - p.cz;
+                vfloat const dz2 = vset(dz * dz);
+
+                for(; x + WIDTH <= rect.right; x += WIDTH)
+                {
+                    vfloat const dx = vsub(vramp((float) x), cx);
+                    vfloat const dist = vsqrt(vadd(vmul(dx, dx), dz2));
+                    vfloat const inside = vless(dist, radius);
+                    vfloat const ratio = shapeRatio<S>(vmul(dist, invRadius));
+                    vfloat const h = vload(row + x);
+                    vfloat raised = p.absolute ? vadd(h, vmul(vsub(vadd(target, vmul(gain, ratio)), h), pull)) : vadd(h, vmul(gain, ratio));
+                    raised = vmin(vmax(raised, minHeight), maxHeight);
+                    vstore(row + x, vselect(inside, raised, h));
+                }
+
+#endif
+
+                for(; x < rect.right; ++x)
+                    row[x] = brushVertex<S>(row[x], (float) x, (float) z, p);
+            }
+        }
+    }
+
+    Ogre::Rect TerrainBrush::apply(float *heights, long size, Stroke const &stroke)
+    {
+        Ogre::Rect rect(std::max(0L, (long) std::floor(stroke.centerX - stroke.radius)),
+                        std::max(0L, (long) std::floor(stroke.centerZ - stroke.radius)),
+                        std::min(size, (long) std::ceil(stroke.centerX + stroke.radius) + 1),
+                        std::min(size, (long) std::ceil(stroke.centerZ + stroke.radius) + 1));
+
+        if(stroke.radius <= .0f || rect.left >= rect.right || rect.top >= rect.bottom)
+            return Ogre::Rect(0, 0, 0, 0);
+
+        Params p;
+        p.cx = stroke.centerX;
+        p.cz = stroke.centerZ;
+        p.radius = stroke.radius;
+        p.invRadius = 1.f / stroke.radius;
+        p.absolute = TerrainManager::RaiseMode::ABSOLUTE == stroke.mode;
+        p.target = stroke.centerHeight;
+        // the absolute uniform brush flattens to the center height, other shapes add the intensity to it
+        p.gain = p.absolute && TerrainManager::RaiseShape::UNIFORM == stroke.shape ? .0f : stroke.intensity;
+        p.pull = 1.f / std::max(25.f - stroke.intensity, .9f);
+
+        switch(stroke.shape)
+        {
+            case RaiseShape::ROUND:
+                brushRows<RaiseShape::ROUND>(heights, size, rect, p);
+                break;
+
+            case RaiseShape::SINH:
+                brushRows<RaiseShape::SINH>(heights, size, rect, p);
+                break;
+
+            case RaiseShape::TRANGULAR:
+                brushRows<RaiseShape::TRANGULAR>(heights, size, rect, p);
+                break;
+
+            case RaiseShape::UNIFORM:
+            default:
+                brushRows<RaiseShape::UNIFORM>(heights, size, rect, p);
+                break;
+        }
+
+        return rect;
+    }
+
+    TerrainBrush::Stroke TerrainBrush::strokeFor(Ogre::Terrain *terrain, Ogre::Vector3 const &center, float intensity, float radius,
+            TerrainManager::RaiseMode mode, TerrainManager::RaiseShape shape)
+    {
+        long const size = terrain->getSize();
+
+        // terrain space is [0, 1] over the slot, vertices are (size-1) units apart
+        Ogre::Vector3 localCenter;
+        terrain->getTerrainPosition(center, &localCenter);
+        float const verticesPerUnit = (size - 1) / terrain->getWorldSize();
+
+        Stroke stroke;
+        stroke.centerX = localCenter.x * (size - 1);
+        stroke.centerZ = localCenter.y * (size - 1);
+        stroke.radius = radius * verticesPerUnit;
+        stroke.centerHeight = center.y;
+        stroke.intensity = intensity;
+        stroke.mode = mode;
+        stroke.shape = shape;
+        return stroke;
+    }
+
+    Ogre::Rect TerrainBrush::merge(Ogre::Rect const &a, Ogre::Rect const &b)
+    {
+        if(a.isNull())
+            return b;
+
+        if(b.isNull())
+            return a;
+
+        return Ogre::Rect(std::min(a.left, b.left), std::min(a.top, b.top), std::max(a.right, b.right), std::max(a.bottom, b.bottom));
+    }
+
+    char const *TerrainBrush::simdName()
+    {
+#if defined(__AVX__)
+        return "AVX";
+#elif defined(__SSE__)
+        return "SSE";
+#else
+        return "scalar";
+#endif
+    }
+
+    bool utest_TerrainBrush(UnitTestExecutionContext const *context)
+    {
+        long const size = TerrainManager::DEFAULT_TERRAIN_SIZE;
+        std::vector<float> heights(size * size), reference(size * size);
+
+        for(long i = 0; i < size * size; ++i)
+            heights[i] = reference[i] = (float)((i * 7) % 13) - 6.f;
+
+        bool allWasFine = true;
+        RaiseShape const shapes[] = {RaiseShape::UNIFORM, RaiseShape::ROUND, RaiseShape::SINH, RaiseShape::TRANGULAR};
+        RaiseMode const modes[] = {RaiseMode::RELATIVE, RaiseMode::ABSOLUTE};
+
+        for(RaiseShape const shape : shapes)
+        {
+            for(RaiseMode const mode : modes)
+            {
+                // off center and partly outside the terrain, to exercise clipping and row tails
+                TerrainBrush::Stroke const stroke = {13.3f, 500.6f, 37.1f, 4.f, 2.5f, mode, shape};
+                Ogre::Rect const rect = TerrainBrush::apply(heights.data(), size, stroke);
+
+                float const pull = 1.f / std::max(25.f - stroke.intensity, .9f);
+                float const gain = RaiseMode::ABSOLUTE == mode && RaiseShape::UNIFORM == shape ? .0f : stroke.intensity;
+
+                for(long z = 0; z < size && allWasFine; ++z)
+                {
+                    for(long x = 0; x < size && allWasFine; ++x)
+                    {
+                        float &h = reference[z * size + x];
+                        float const dist = Ogre::Vector2((float) x, (float) z).distance(Ogre::Vector2(stroke.centerX, stroke.centerZ));
+
+                        if(dist < stroke.radius)
+                        {
+                            float const d = dist / stroke.radius;
+                            float ratio = 1.f;
+
+                            if(RaiseShape::ROUND == shape)
+                                ratio = std::cos(HALF_PI * d);
+                            else if(RaiseShape::SINH == shape)
+                                ratio = 1.f - std::sinh(d);
+                            else if(RaiseShape::TRANGULAR == shape)
+                                ratio = 1.f - d;
+
+                            h = RaiseMode::ABSOLUTE == mode ? h + (stroke.centerHeight + gain * ratio - h) * pull : h + gain * ratio;
+                            h = std::min(std::max(h, (float) TerrainManager::MIN_TERRAIN_HEIGHT), (float) TerrainManager::MAX_TERRAIN_HEIGHT);
+
+                            if(x < rect.left || x >= rect.right || z < rect.top || z >= rect.bottom)
+                            {
+                                Debug::error(STEEL_METH_INTRO, "vertex ", x, ",", z, " out of the returned rect.").endl();
+                                allWasFine = false;
+                            }
+                        }
+
+                        // polynomial shapes
+                        if(std::abs(h - heights[z * size + x]) > 1e-2f)
+                        {
+                            Debug::error(STEEL_METH_INTRO, "height mismatch at ", x, ",", z, ": ", heights[z * size + x], " vs ", h).endl();
+                            allWasFine = false;
+                        }
+
+                        // don't let approximations accumulate through the next strokes
+                        h = heights[z * size + x];
+                    }
+                }
+            }
+        }
+
+        return allWasFine;
+    }
+
+    bool utest_TerrainBrushSpeed(UnitTestExecutionContext const *context)
+    {
+        long const size = TerrainManager::DEFAULT_TERRAIN_SIZE;
+        std::vector<float> heights(size * size);
+
+        for(long i = 0; i < size * size; ++i)
+            heights[i] = (float)((i * 7) % 13) - 6.f;
+
+        // large radius strokes, as in editor terraforming
+        u32 const strokes = 100;
+        Ogre::Timer timer;
+
+        for(u32 i = 0; i < strokes; ++i)
+        {
+            TerrainBrush::Stroke const stroke = {256.f, 256.f, 200.f, .0f, .1f, RaiseMode::RELATIVE, RaiseShape::ROUND};
+            TerrainBrush::apply(heights.data(), size, stroke);
+        }
+
+        Debug::log(STEEL_METH_INTRO, TerrainBrush::simdName(), " kernel, 200 vertices radius stroke: ",
+                   (double) timer.getMicroseconds() / strokes, "us").endl();
+        return true;
+    }
+}
+// kate: indent-mode cstyle; indent-width 4; replace-tabs on;
@@ -0,0 +1,254 @@
+#include "terrain/TerrainEditPipeline.h"
+
+#include <cstring>
+
+#include <OgreTerrain.h>
+
+#include "Debug.h"
+#include "terrain/TerrainManager.h"
+
+namespace Steel
+{
+    TerrainEditPipeline::Job::Job(): terrain(nullptr), size(0), blendMapSize(0), rules(), initialHeights(), strokes()
+    {
+    }
+
+    TerrainEditPipeline::Result::Result(): terrain(nullptr), rect(0, 0, 0, 0), heights(),
+        texels(0, 0, 0, 0), layers(), blends()
+    {
+    }
+
+    TerrainEditPipeline::TerrainEditPipeline(): mPending(), mJobs(), mResults(), mStaging(),
+        mWorker(), mMutex(), mCondition(), mInFlight(false), mDone(false), mMustStop(false)
+    {
+    }
+
+    TerrainEditPipeline::~TerrainEditPipeline()
+    {
+        shutdown();
+    }
+
+    void TerrainEditPipeline::init()
+    {
+        if(mWorker.joinable())
+            return;
+
+        mMustStop = false;
+        mWorker = std::thread(&TerrainEditPipeline::run, this);
+    }
+
+    void TerrainEditPipeline::shutdown()
+    {
+        if(mWorker.joinable())
+        {
+            {
+                std::lock_guard<std::mutex> lock(mMutex);
+                mMustStop = true;
+            }
+            mCondition.notify_all();
+            mWorker.join();
+        }
+
+        mPending.clear();
+        mJobs.clear();
+        mResults.clear();
+        mStaging.clear();
+        mInFlight = mDone = false;
+    }
+
+    void TerrainEditPipeline::queue(Ogre::Terrain *terrain, long blendMapSize, TerrainManager::BlendRules const &rules,
+                                    TerrainBrush::Stroke const &stroke)
+    {
+        Job &job = mPending[terrain];
+
+        if(job.strokes.empty())
+        {
+            job.terrain = terrain;
+            job.size = terrain->getSize();
+            job.blendMapSize = blendMapSize;
+            job.rules = rules;
+        }
+        else
+        {
+            // relative strokes are linear in intensity (up to height clamping): a brush held still adds up
+            TerrainBrush::Stroke &last = job.strokes.back();
+
+            if(TerrainManager::RaiseMode::RELATIVE == stroke.mode && last.mode == stroke.mode && last.shape == stroke.shape
+                    && last.centerX == stroke.centerX && last.centerZ == stroke.centerZ && last.radius == stroke.radius)
+            {
+                last.intensity += stroke.intensity;
+                return;
+            }
+        }
+
+        job.strokes.push_back(stroke);
+    }
+
+    bool TerrainEditPipeline::submit()
+    {
+        if(mPending.empty() || !mWorker.joinable())
+            return false;
+
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+
+            if(mInFlight)
+                return false;
+        }
+
+        // the worker is idle: staging and jobs are ours
+        mJobs.clear();
+        mJobs.reserve(mPending.size());
+
+        for(auto &it : mPending)
+        {
+            Job &job = it.second;
+
+            if(mStaging.end() == mStaging.find(job.terrain))
+            {
+                float const *heights = job.terrain->getHeightData();
+                job.initialHeights.assign(heights, heights + job.size * job.size);
+            }
+
+            mJobs.push_back(std::move(job));
+        }
+
+        mPending.clear();
+
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            mInFlight = true;
+            mDone = false;
+        }
+        mCondition.notify_all();
+        return true;
+    }
+
+    bool TerrainEditPipeline::collect(std::vector<Result> &results, bool wait)
+    {
+        std::unique_lock<std::mutex> lock(mMutex);
+
+        if(!mInFlight)
+            return false;
+
+        if(wait)
+            mCondition.wait(lock, [this] {return mDone;});
+
+        if(!mDone)
+            return false;
+
+        results.swap(mResults);
+        mResults.clear();
+        mJobs.clear();
+        mInFlight = mDone = false;
+        return true;
+    }
+
+    void TerrainEditPipeline::waitIdle()
+    {
+        std::unique_lock<std::mutex> lock(mMutex);
+
+        if(mInFlight)
+            mCondition.wait(lock, [this] {return mDone;});
+    }
+
+    void TerrainEditPipeline::invalidate(Ogre::Terrain *terrain)
+    {
+        waitIdle();
+        mStaging.erase(terrain);
+    }
+
+    void TerrainEditPipeline::invalidateAll()
+    {
+        waitIdle();
+        mStaging.clear();
+    }
+
+    bool TerrainEditPipeline::hasWork() const
+    {
+        if(!mWorker.joinable())
+            return false;
+
+        if(!mPending.empty())
+            return true;
+
+        std::lock_guard<std::mutex> lock(mMutex);
+        return mInFlight;
+    }
+
+    void TerrainEditPipeline::run()
+    {
+        std::unique_lock<std::mutex> lock(mMutex);
+
+        while(true)
+        {
+            mCondition.wait(lock, [this] {return mMustStop || (mInFlight && !mDone);});
+
+            if(mMustStop)
+                break;
+
+            lock.unlock();
+            process();
+            lock.lock();
+
+            mDone = true;
+            mCondition.notify_all();
+        }
+    }
+
+    void TerrainEditPipeline::process()
+    {
+        mResults.clear();
+
+        for(Job &job : mJobs)
+        {
+            std::vector<float> &heights = mStaging[job.terrain];
+
+            if(!job.initialHeights.empty())
+                heights.swap(job.initialHeights);
+
+            if(heights.size() != (size_t)(job.size * job.size))
+            {
+                Debug::error(STEEL_METH_INTRO, "no staging heights for a terrain, skipping its strokes.").endl();
+                continue;
+            }
+
+            Ogre::Rect rect(0, 0, 0, 0);
+
+            for(TerrainBrush::Stroke const & stroke : job.strokes)
+                rect = TerrainBrush::merge(rect, TerrainBrush::apply(heights.data(), job.size, stroke));
+
+            if(rect.isNull())
+                continue;
+
+            mResults.emplace_back();
+            Result &result = mResults.back();
+            result.terrain = job.terrain;
+            result.rect = rect;
+
+            long const width = rect.width();
+            result.heights.resize(width * rect.height());
+
+            for(long z = rect.top; z < rect.bottom; ++z)
+                memcpy(result.heights.data() + (z - rect.top) * width, heights.data() + z * job.size + rect.left, sizeof(float) * width);
+
+            if(!job.rules.empty())
+            {
+                result.texels = TerrainManager::blendMapRect(rect, job.size, job.blendMapSize);
+                size_t const texelCount = result.texels.width() * result.texels.height();
+                result.blends.resize(job.rules.size(), std::vector<float>(texelCount));
+                std::vector<float *> outputs;
+
+                for(size_t i = 0; i < job.rules.size(); ++i)
+                {
+                    result.layers.push_back(job.rules[i].layer);
+                    outputs.push_back(result.blends[i].data());
+                }
+
+                TerrainManager::computeBlendMapsParallel(heights.data(), job.size, job.blendMapSize, result.texels,
+                        job.rules, outputs.data(), result.texels.width());
+            }
+        }
+    }
+}
+// kate: indent-mode cstyle; indent-width 4; replace-tabs on;
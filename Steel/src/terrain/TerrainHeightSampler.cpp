@@ -0,0 +1,796 @@
+#include "terrain/TerrainHeightSampler.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cfloat>
+#include <cstring>
+#include <limits>
+#include <thread>
+
+#include <OgreTimer.h>
+
+#include "Debug.h"
+#include "tests/UnitTestManager.h"
+
+namespace Steel
+{
+    namespace
+    {
+        typedef TerrainHeightSampler::Tile Tile;
+
+        /// Cell of the tile containing (x, z), and position within it.
+        inline float const *locate(Tile const &tile, Ogre::Real x, Ogre::Real z, long &x0, Ogre::Real &tx, Ogre::Real &tz)
+        {
+            Ogre::Real const fx = (x - tile.minX) * tile.verticesPerUnit;
+            Ogre::Real const fz = (tile.maxZ - z) * tile.verticesPerUnit;
+            x0 = std::min((long) fx, tile.size - 2);
+            long const z0 = std::min((long) fz, tile.size - 2);
+            tx = fx - x0;
+            tz = fz - z0;
+            return tile.heights.data() + z0 * tile.size;
+        }
+
+        inline Ogre::Real heightAt(Tile const &tile, Ogre::Real x, Ogre::Real z)
+        {
+            long x0;
+            Ogre::Real tx, tz;
+            float const *row0 = locate(tile, x, z, x0, tx, tz), *row1 = row0 + tile.size;
+            Ogre::Real const h0 = row0[x0] + (row0[x0 + 1] - row0[x0]) * tx;
+            Ogre::Real const h1 = row1[x0] + (row1[x0 + 1] - row1[x0]) * tx;
+            return tile.baseHeight + h0 + (h1 - h0) * tz;
+        }
+
+        inline void sampleAt(Tile const &tile, Ogre::Real x, Ogre::Real z, TerrainHeightSampler::Sample &sample)
+        {
+            long x0;
+            Ogre::Real tx, tz;
+            float const *row0 = locate(tile, x, z, x0, tx, tz), *row1 = row0 + tile.size;
+            Ogre::Real const h00 = row0[x0], h01 = row0[x0 + 1], h10 = row1[x0], h11 = row1[x0 + 1];
+            Ogre::Real const h0 = h00 + (h01 - h00) * tx;
+            Ogre::Real const h1 = h10 + (h11 - h10) * tx;
+            sample.height = tile.baseHeight + h0 + (h1 - h0) * tz;
+
+            // gradient of the bilinear patch, in world units (rows go toward -z)
+            Ogre::Real const dx = ((h01 - h00) * (1.f - tz) + (h11 - h10) * tz) * tile.verticesPerUnit;
+            Ogre::Real const dz = -(h1 - h0) * tile.verticesPerUnit;
+            sample.normal = Ogre::Vector3(-dx, 1.f, -dz).normalisedCopy();
+            sample.slope = Ogre::Math::ATan(Ogre::Math::Sqrt(dx * dx + dz * dz));
+        }
+
+        inline bool contains(Tile const &tile, Ogre::Real x, Ogre::Real z)
+        {
+            return x >= tile.minX && x <= tile.minX + tile.worldSize && z <= tile.maxZ && z >= tile.maxZ - tile.worldSize;
+        }
+
+        /// Recomputes the pyramid over level 0 cells [left, right)x[top, bottom) (rows), and the blocks above them.
+        void updatePyramid(Tile &tile, long left, long top, long right, long bottom)
+        {
+            long const cells = tile.size - 1;
+
+            if(tile.pyramid.empty())
+            {
+                for(long side = cells;; side = (side + 1) / 2)
+                {
+                    tile.pyramid.emplace_back();
+                    TerrainHeightSampler::MinMaxLevel &level = tile.pyramid.back();
+                    level.side = side;
+                    level.minHeights.resize(side * side);
+                    level.maxHeights.resize(side * side);
+
+                    if(1 == side)
+                        break;
+                }
+            }
+
+            left = std::max(0L, left);
+            top = std::max(0L, top);
+            right = std::min(cells, right);
+            bottom = std::min(cells, bottom);
+
+            if(left >= right || top >= bottom)
+                return;
+
+            TerrainHeightSampler::MinMaxLevel &base = tile.pyramid[0];
+
+            for(long j = top; j < bottom; ++j)
+            {
+                float const *row0 = tile.heights.data() + j * tile.size, *row1 = row0 + tile.size;
+
+                for(long i = left; i < right; ++i)
+                {
+                    base.minHeights[j * base.side + i] = std::min(std::min(row0[i], row0[i + 1]), std::min(row1[i], row1[i + 1]));
+                    base.maxHeights[j * base.side + i] = std::max(std::max(row0[i], row0[i + 1]), std::max(row1[i], row1[i + 1]));
+                }
+            }
+
+            for(size_t k = 1; k < tile.pyramid.size(); ++k)
+            {
+                TerrainHeightSampler::MinMaxLevel const &below = tile.pyramid[k - 1];
+                TerrainHeightSampler::MinMaxLevel &level = tile.pyramid[k];
+                left /= 2;
+                top /= 2;
+                right = (right + 1) / 2;
+                bottom = (bottom + 1) / 2;
+
+                for(long j = top; j < bottom; ++j)
+                {
+                    for(long i = left; i < right; ++i)
+                    {
+                        float lo = FLT_MAX, hi = -FLT_MAX;
+
+                        for(long cj = 2 * j; cj < std::min(2 * j + 2, below.side); ++cj)
+                        {
+                            for(long ci = 2 * i; ci < std::min(2 * i + 2, below.side); ++ci)
+                            {
+                                lo = std::min(lo, below.minHeights[cj * below.side + ci]);
+                                hi = std::max(hi, below.maxHeights[cj * below.side + ci]);
+                            }
+                        }
+
+                        level.minHeights[j * level.side + i] = lo;
+                        level.maxHeights[j * level.side + i] = hi;
+                    }
+                }
+            }
+        }
+
+        std::shared_ptr<Tile> makeTile(long x, long y, long size, Ogre::Real worldSize, Ogre::Vector3 const &position, float const *heights)
+        {
+            auto tile = std::make_shared<Tile>();
+            tile->slotX = x;
+            tile->slotY = y;
+            tile->size = size;
+            tile->worldSize = worldSize;
+            tile->minX = position.x - worldSize * .5f;
+            tile->maxZ = position.z + worldSize * .5f;
+            tile->baseHeight = position.y;
+            tile->verticesPerUnit = (size - 1) / worldSize;
+            tile->heights.assign(heights, heights + size * size);
+            updatePyramid(*tile, 0, 0, size - 1, size - 1);
+            return tile;
+        }
+
+        /// A ray in a tile's vertex space: u along columns, v along rows, h above the tile base. Same parameterization.
+        class LocalRay
+        {
+        public:
+            LocalRay(Tile const &tile, Ogre::Ray const &ray)
+            {
+                Ogre::Vector3 const &o = ray.getOrigin(), &d = ray.getDirection();
+                origin[0] = (o.x - tile.minX) * tile.verticesPerUnit;
+                origin[1] = (tile.maxZ - o.z) * tile.verticesPerUnit;
+                origin[2] = o.y - tile.baseHeight;
+                dir[0] = d.x * tile.verticesPerUnit;
+                dir[1] = -d.z * tile.verticesPerUnit;
+                dir[2] = d.y;
+
+                for(int axis = 0; axis < 3; ++axis)
+                    inv[axis] = .0f == dir[axis] ? .0f : 1.f / dir[axis];
+            }
+
+            Ogre::Real origin[3];
+            Ogre::Real dir[3];
+            Ogre::Real inv[3];
+        };
+
+        /// Clips [tMin, tMax] to the part of the ray within the box. Returns false if nothing is left.
+        inline bool clip(LocalRay const &ray, Ogre::Real const *lo, Ogre::Real const *hi, Ogre::Real &tMin, Ogre::Real &tMax)
+        {
+            for(int axis = 0; axis < 3; ++axis)
+            {
+                if(.0f == ray.dir[axis])
+                {
+                    if(ray.origin[axis] < lo[axis] || ray.origin[axis] > hi[axis])
+                        return false;
+
+                    continue;
+                }
+
+                Ogre::Real t0 = (lo[axis] - ray.origin[axis]) * ray.inv[axis];
+                Ogre::Real t1 = (hi[axis] - ray.origin[axis]) * ray.inv[axis];
+
+                if(t0 > t1)
+                    std::swap(t0, t1);
+
+                tMin = std::max(tMin, t0);
+                tMax = std::min(tMax, t1);
+
+                if(tMin > tMax)
+                    return false;
+            }
+
+            return true;
+        }
+
+        /// First t of [tMin, tMax] at which the ray is not above the bilinear patch of cell (i, j).
+        inline bool intersectCell(Tile const &tile, LocalRay const &ray, long i, long j, Ogre::Real tMin, Ogre::Real tMax, Ogre::Real &t)
+        {
+            float const *row0 = tile.heights.data() + j * tile.size + i, *row1 = row0 + tile.size;
+            Ogre::Real const a = row0[0], b = row0[1] - row0[0], c = row1[0] - row0[0], e = row0[0] - row0[1] - row1[0] + row1[1];
+
+            // f(tau) = ray height - patch height, tau counted from tMin (for precision)
+            Ogre::Real const s0 = ray.origin[0] + tMin * ray.dir[0] - i;
+            Ogre::Real const t0 = ray.origin[1] + tMin * ray.dir[1] - j;
+            Ogre::Real const C = ray.origin[2] + tMin * ray.dir[2] - (a + b * s0 + c * t0 + e * s0 * t0);
+
+            if(C <= .0f)
+            {
+                t = tMin;
+                return true;
+            }
+
+            Ogre::Real const A = -e * ray.dir[0] * ray.dir[1];
+            Ogre::Real const B = ray.dir[2] - b * ray.dir[0] - c * ray.dir[1] - e * (s0 * ray.dir[1] + t0 * ray.dir[0]);
+            Ogre::Real root = -1.f;
+
+            if(std::abs(A) < 1e-9f)
+            {
+                if(B < .0f)
+                    root = -C / B;
+            }
+            else
+            {
+                Ogre::Real const disc = B * B - 4.f * A * C;
+
+                if(disc < .0f)
+                    return false;
+
+                // stable roots
+                Ogre::Real const q = -.5f * (B + (B < .0f ? -1.f : 1.f) * std::sqrt(disc));
+                Ogre::Real r0 = q / A, r1 = .0f == q ? r0 : C / q;
+
+                if(r0 > r1)
+                    std::swap(r0, r1);
+
+                root = r0 >= .0f ? r0 : r1;
+            }
+
+            if(root < .0f || root > tMax - tMin)
+                return false;
+
+            t = tMin + root;
+            return true;
+        }
+
+        /// A node of the pyramid.
+        class Block
+        {
+        public:
+            size_t level;
+            long i;
+            long j;
+        };
+
+        /// Nearest intersection of the ray with the tile before tMax, blocks being visited front to back.
+        bool intersectTile(Tile const &tile, Ogre::Ray const &ray, Ogre::Real tMax, Ogre::Real &tHit)
+        {
+            LocalRay const local(tile, ray);
+            long const cells = tile.size - 1;
+            // child visited first, along each axis
+            long const fi = local.dir[0] < .0f ? 1 : 0, fj = local.dir[1] < .0f ? 1 : 0;
+
+            // at most 3 pending siblings per level
+            Block stack[128];
+            int count = 0;
+            stack[count++] = {tile.pyramid.size() - 1, 0, 0};
+            bool found = false;
+
+            while(count > 0)
+            {
+                Block const block = stack[--count];
+                TerrainHeightSampler::MinMaxLevel const &level = tile.pyramid[block.level];
+                long const span = 1L << block.level, index = block.j * level.side + block.i;
+                Ogre::Real const lo[3] = {(Ogre::Real)(block.i * span), (Ogre::Real)(block.j * span), level.minHeights[index]};
+                Ogre::Real const hi[3] = {(Ogre::Real) std::min((block.i + 1) * span, cells), (Ogre::Real) std::min((block.j + 1) * span, cells),
+                                          level.maxHeights[index]
+                                         };
+                Ogre::Real tNear = .0f, tFar = tMax;
+
+                if(!clip(local, lo, hi, tNear, tFar))
+                    continue;
+
+                if(0 == block.level)
+                {
+                    Ogre::Real t;
+
+                    if(intersectCell(tile, local, block.i, block.j, tNear, tFar, t) && t <= tMax)
+                    {
+                        tMax = tHit = t;
+                        found = true;
+                    }
+
+                    continue;
+                }
+
+                // pushed back to front, so that the nearest child is popped first
+                TerrainHeightSampler::MinMaxLevel const &below = tile.pyramid[block.level - 1];
+
+                for(int n = 3; n >= 0; --n)
+                {
+                    long const ci = block.i * 2 + ((n & 1) ? 1 - fi : fi);
+                    long const cj = block.j * 2 + ((n & 2) ? 1 - fj : fj);
+
+                    if(ci < below.side && cj < below.side)
+                        stack[count++] = {block.level - 1, ci, cj};
+                }
+            }
+
+            return found;
+        }
+
+        /// Test fixture: 2x2 wavy slots around the origin. Leaves the last slot's heights in heights.
+        void setTestTiles(TerrainHeightSampler &sampler, long size, Ogre::Real worldSize, std::vector<float> &heights)
+        {
+            heights.resize(size * size);
+
+            for(long slot = 0; slot < 4; ++slot)
+            {
+                for(long i = 0; i < size * size; ++i)
+                    heights[i] = 20.f * std::sin((i % size) * .05f + slot) * std::cos((i / size) * .03f) + slot;
+
+                long const sx = slot % 2, sy = slot / 2;
+                sampler.setTile(sx, sy, size, worldSize, Ogre::Vector3(sx * worldSize, 5.f, -sy * worldSize), heights.data());
+            }
+        }
+    }
+
+    TerrainHeightSampler::Snapshot::Snapshot(): mTiles()
+    {
+    }
+
+    TerrainHeightSampler::Snapshot::Snapshot(std::shared_ptr<Tiles const> const &tiles): mTiles(tiles)
+    {
+    }
+
+    TerrainHeightSampler::Tile const *TerrainHeightSampler::Snapshot::find(Ogre::Real x, Ogre::Real z, Tile const *hint) const
+    {
+        // consecutive positions tend to be over the same tile
+        if(nullptr != hint && contains(*hint, x, z))
+            return hint;
+
+        if(nullptr == mTiles)
+            return nullptr;
+
+        for(auto const & tile : *mTiles)
+        {
+            if(contains(*tile, x, z))
+                return tile.get();
+        }
+
+        return nullptr;
+    }
+
+    bool TerrainHeightSampler::Snapshot::height(Ogre::Real x, Ogre::Real z, Ogre::Real &height) const
+    {
+        Tile const *tile = find(x, z, nullptr);
+
+        if(nullptr == tile)
+            return false;
+
+        height = heightAt(*tile, x, z);
+        return true;
+    }
+
+    bool TerrainHeightSampler::Snapshot::sample(Ogre::Real x, Ogre::Real z, Sample &sample) const
+    {
+        Tile const *tile = find(x, z, nullptr);
+
+        if(nullptr == tile)
+            return false;
+
+        sampleAt(*tile, x, z, sample);
+        return true;
+    }
+
+    size_t TerrainHeightSampler::Snapshot::heights(Ogre::Vector3 const *positions, size_t count, Ogre::Real *heights, Ogre::Real missing) const
+    {
+        size_t hitCount = 0;
+        Tile const *tile = nullptr;
+
+        for(size_t i = 0; i < count; ++i)
+        {
+            Ogre::Vector3 const &pos = positions[i];
+            Tile const *found = find(pos.x, pos.z, tile);
+
+            if(nullptr == found)
+            {
+                heights[i] = missing;
+                continue;
+            }
+
+            tile = found;
+            heights[i] = heightAt(*tile, pos.x, pos.z);
+            ++hitCount;
+        }
+
+        return hitCount;
+    }
+
+    size_t TerrainHeightSampler::Snapshot::samples(Ogre::Vector3 const *positions, size_t count, Sample *samples, bool *hits/* = nullptr*/) const
+    {
+        size_t hitCount = 0;
+        Tile const *tile = nullptr;
+
+        for(size_t i = 0; i < count; ++i)
+        {
+            Ogre::Vector3 const &pos = positions[i];
+            Tile const *found = find(pos.x, pos.z, tile);
+
+            if(nullptr != hits)
+                hits[i] = nullptr != found;
+
+            if(nullptr == found)
+                continue;
+
+            tile = found;
+            sampleAt(*tile, pos.x, pos.z, samples[i]);
+            ++hitCount;
+        }
+
+        return hitCount;
+    }
+
+    bool TerrainHeightSampler::Snapshot::intersectRay(Ogre::Ray const &ray, Ogre::Real maxDistance, Ogre::Vector3 &position) const
+    {
+        if(nullptr == mTiles)
+            return false;
+
+        Ogre::Real tMax = maxDistance > .0f ? maxDistance : std::numeric_limits<Ogre::Real>::max();
+        bool found = false;
+
+        for(auto const & tile : *mTiles)
+        {
+            Ogre::Real t;
+
+            if(intersectTile(*tile, ray, tMax, t))
+            {
+                tMax = t;
+                found = true;
+            }
+        }
+
+        if(found)
+            position = ray.getPoint(tMax);
+
+        return found;
+    }
+
+    size_t TerrainHeightSampler::Snapshot::intersectRays(Ogre::Ray const *rays, size_t count, Ogre::Real maxDistance,
+            Ogre::Vector3 *positions, bool *hits) const
+    {
+        size_t hitCount = 0;
+
+        for(size_t i = 0; i < count; ++i)
+        {
+            hits[i] = intersectRay(rays[i], maxDistance, positions[i]);
+
+            if(hits[i])
+                ++hitCount;
+        }
+
+        return hitCount;
+    }
+
+    TerrainHeightSampler::TerrainHeightSampler(): mMutex(), mTiles(std::make_shared<Tiles>())
+    {
+    }
+
+    TerrainHeightSampler::~TerrainHeightSampler()
+    {
+    }
+
+    TerrainHeightSampler::Snapshot TerrainHeightSampler::snapshot() const
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        return Snapshot(mTiles);
+    }
+
+    bool TerrainHeightSampler::height(Ogre::Real x, Ogre::Real z, Ogre::Real &height) const
+    {
+        return snapshot().height(x, z, height);
+    }
+
+    bool TerrainHeightSampler::sample(Ogre::Real x, Ogre::Real z, Sample &sample) const
+    {
+        return snapshot().sample(x, z, sample);
+    }
+
+    size_t TerrainHeightSampler::heights(Ogre::Vector3 const *positions, size_t count, Ogre::Real *heights, Ogre::Real missing) const
+    {
+        return snapshot().heights(positions, count, heights, missing);
+    }
+
+    bool TerrainHeightSampler::intersectRay(Ogre::Ray const &ray, Ogre::Real maxDistance, Ogre::Vector3 &position) const
+    {
+        return snapshot().intersectRay(ray, maxDistance, position);
+    }
+
+    void TerrainHeightSampler::publish(std::shared_ptr<Tiles const> const &tiles)
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mTiles = tiles;
+    }
+
+    void TerrainHeightSampler::setTile(long x, long y, long size, Ogre::Real worldSize, Ogre::Vector3 const &position, float const *heights)
+    {
+        if(size < 2 || worldSize <= .0f)
+        {
+            Debug::error(STEEL_METH_INTRO, "invalid tile size ", size, " / world size ", worldSize, " for slot ", x, "x", y).endl();
+            return;
+        }
+
+        auto tile = makeTile(x, y, size, worldSize, position, heights);
+
+        // main thread only: the published list is not going to change under our feet
+        Snapshot const current = snapshot();
+        auto tiles = std::make_shared<Tiles>();
+
+        for(auto const & other : *current.mTiles)
+        {
+            if(other->slotX != x || other->slotY != y)
+                tiles->push_back(other);
+        }
+
+        tiles->push_back(tile);
+        publish(tiles);
+    }
+
+    void TerrainHeightSampler::updateTile(long x, long y, float const *heights, Ogre::Rect const &rect)
+    {
+        if(rect.isNull())
+            return;
+
+        Snapshot const current = snapshot();
+        auto tiles = std::make_shared<Tiles>(*current.mTiles);
+
+        for(auto & tile : *tiles)
+        {
+            if(tile->slotX != x || tile->slotY != y)
+                continue;
+
+            // readers may hold the current version
+            auto updated = std::make_shared<Tile>(*tile);
+            long const size = updated->size;
+            long const left = std::max(0L, rect.left), right = std::min(size, rect.right);
+
+            if(left < right)
+            {
+                for(long z = std::max(0L, rect.top); z < std::min(size, rect.bottom); ++z)
+                    memcpy(updated->heights.data() + z * size + left, heights + z * size + left, sizeof(float) * (right - left));
+            }
+
+            // cells around modified vertices
+            updatePyramid(*updated, rect.left - 1, rect.top - 1, rect.right, rect.bottom);
+
+            tile = updated;
+            publish(tiles);
+            return;
+        }
+
+        Debug::warning(STEEL_METH_INTRO, "no tile for slot ", x, "x", y, ", ignoring update.").endl();
+    }
+
+    void TerrainHeightSampler::removeTile(long x, long y)
+    {
+        Snapshot const current = snapshot();
+        auto tiles = std::make_shared<Tiles>();
+
+        for(auto const & tile : *current.mTiles)
+        {
+            if(tile->slotX != x || tile->slotY != y)
+                tiles->push_back(tile);
+        }
+
+        publish(tiles);
+    }
+
+    void TerrainHeightSampler::clear()
+    {
+        publish(std::make_shared<Tiles>());
+    }
+
+    bool utest_TerrainHeightSampler(UnitTestExecutionContext const *context)
+    {
+        long const size = 257;
+        Ogre::Real const worldSize = 256.f;
+        TerrainHeightSampler sampler;
+        std::vector<float> heights;
+        setTestTiles(sampler, size, worldSize, heights);
+
+        TerrainHeightSampler::Snapshot const snapshot = sampler.snapshot();
+        bool allWasFine = true;
+
+        // on vertices, samples are the vertex heights (heights still hold the last slot's)
+        for(long i = 0; i < size * size && allWasFine; i += 37)
+        {
+            long const x = i % size, z = i / size;
+            Ogre::Real const wx = worldSize * .5f + x * worldSize / (size - 1), wz = -worldSize * .5f - z * worldSize / (size - 1);
+            Ogre::Real height = .0f;
+
+            // edges are shared with the neighbour slots
+            if(x == 0 || z == 0)
+                continue;
+
+            if(!snapshot.height(wx, wz, height) || std::abs(height - 5.f - heights[i]) > 1e-3f)
+            {
+                Debug::error(STEEL_METH_INTRO, "bad height at vertex ", x, "x", z, ": ", height, " instead of ", heights[i] + 5.f).endl();
+                allWasFine = false;
+            }
+        }
+
+        // a flat update has a flat normal
+        std::fill(heights.begin(), heights.end(), 1.f);
+        sampler.updateTile(0, 0, heights.data(), Ogre::Rect(0, 0, size, size));
+        TerrainHeightSampler::Sample flat;
+
+        if(!sampler.sample(.0f, .0f, flat) || std::abs(flat.height - 6.f) > 1e-4f || flat.normal.y < .9999f)
+        {
+            Debug::error(STEEL_METH_INTRO, "bad sample after update: ", flat.height, " ", flat.normal).endl();
+            allWasFine = false;
+        }
+
+        return allWasFine;
+    }
+
+    bool utest_TerrainHeightSamplerThroughput(UnitTestExecutionContext const *context)
+    {
+        long const size = 257;
+        Ogre::Real const worldSize = 256.f;
+        TerrainHeightSampler sampler;
+        std::vector<float> heights;
+        setTestTiles(sampler, size, worldSize, heights);
+        bool allWasFine = true;
+
+        // from worker threads, all within the 2x2 slots
+        size_t const count = 1 << 20;
+        std::vector<Ogre::Vector3> positions(count);
+
+        for(size_t i = 0; i < count; ++i)
+            positions[i] = Ogre::Vector3(Ogre::Math::RangeRandom(-worldSize * .5f, worldSize * 1.5f), .0f,
+                                         Ogre::Math::RangeRandom(-worldSize * 1.5f, worldSize * .5f));
+
+        unsigned const threadCount = std::max(1U, std::thread::hardware_concurrency());
+        std::vector<std::vector<Ogre::Real> > results(threadCount, std::vector<Ogre::Real>(count));
+        std::vector<size_t> hits(threadCount, 0);
+        std::vector<std::thread> workers;
+        Ogre::Timer timer;
+
+        for(unsigned t = 0; t < threadCount; ++t)
+        {
+            workers.push_back(std::thread([&, t]()
+            {
+                hits[t] = sampler.snapshot().heights(positions.data(), count, results[t].data(), -1.f);
+            }));
+        }
+
+        for(std::thread & worker : workers)
+            worker.join();
+
+        double const samplesPerUs = (double) count * threadCount / std::max<unsigned long>(1UL, timer.getMicroseconds());
+
+        for(unsigned t = 0; t < threadCount && allWasFine; ++t)
+        {
+            if(hits[t] != count)
+            {
+                Debug::error(STEEL_METH_INTRO, "thread ", t, " missed ", count - hits[t], " positions").endl();
+                allWasFine = false;
+            }
+        }
+
+        Debug::log(STEEL_METH_INTRO, count, " heights on each of ", threadCount, " threads: ", samplesPerUs, " samples/us").endl();
+        return allWasFine;
+    }
+
+    bool utest_TerrainRayPyramid(UnitTestExecutionContext const *context)
+    {
+        long const size = 129;
+        Ogre::Real const worldSize = 128.f;
+        std::vector<float> heights(size * size);
+
+        for(long z = 0; z < size; ++z)
+            for(long x = 0; x < size; ++x)
+                heights[z * size + x] = 10.f * std::sin(x * .2f) * std::cos(z * .13f) + 3.f * std::sin((x + z) * .7f);
+
+        std::shared_ptr<Tile> tile = makeTile(0, 0, size, worldSize, Ogre::Vector3(.0f, 2.f, .0f), heights.data());
+
+        // every cell, in no particular order
+        auto bruteForce = [](Tile const & tile, Ogre::Ray const & ray, Ogre::Real & tHit)
+        {
+            LocalRay const local(tile, ray);
+            TerrainHeightSampler::MinMaxLevel const &base = tile.pyramid[0];
+            bool found = false;
+            tHit = std::numeric_limits<Ogre::Real>::max();
+
+            for(long j = 0; j < base.side; ++j)
+            {
+                for(long i = 0; i < base.side; ++i)
+                {
+                    Ogre::Real const lo[3] = {(Ogre::Real) i, (Ogre::Real) j, base.minHeights[j * base.side + i]};
+                    Ogre::Real const hi[3] = {(Ogre::Real) i + 1, (Ogre::Real) j + 1, base.maxHeights[j * base.side + i]};
+                    Ogre::Real tNear = .0f, tFar = std::numeric_limits<Ogre::Real>::max(), t;
+
+                    if(clip(local, lo, hi, tNear, tFar) && intersectCell(tile, local, i, j, tNear, tFar, t) && t < tHit)
+                    {
+                        tHit = t;
+                        found = true;
+                    }
+                }
+            }
+
+            return found;
+        };
+
+        // from above, down toward random points of (or around) the tile
+        size_t const rayCount = 2000;
+        std::vector<Ogre::Ray> rays;
+
+        for(size_t i = 0; i < rayCount; ++i)
+        {
+            Ogre::Vector3 const origin(Ogre::Math::RangeRandom(-80.f, 80.f), Ogre::Math::RangeRandom(20.f, 60.f), Ogre::Math::RangeRandom(-80.f, 80.f));
+            Ogre::Vector3 const target(Ogre::Math::RangeRandom(-70.f, 70.f), .0f, Ogre::Math::RangeRandom(-70.f, 70.f));
+            rays.push_back(Ogre::Ray(origin, (target - origin).normalisedCopy()));
+        }
+
+        auto check = [&](char const * step)
+        {
+            for(size_t i = 0; i < rayCount; ++i)
+            {
+                Ogre::Real expected = .0f, actual = .0f;
+                bool const expectedHit = bruteForce(*tile, rays[i], expected);
+                bool const actualHit = intersectTile(*tile, rays[i], std::numeric_limits<Ogre::Real>::max(), actual);
+
+                if(expectedHit != actualHit || (expectedHit && std::abs(expected - actual) > 1e-3f))
+                {
+                    Debug::error(STEEL_METH_INTRO, step, ": ray ", i, " hit ", actualHit, " at ", actual,
+                                 " instead of ", expectedHit, " at ", expected).endl();
+                    return false;
+                }
+            }
+
+            return true;
+        };
+
+        if(!check("initial pyramid"))
+            return false;
+
+        // incremental update must match a full rebuild
+        Ogre::Rect const rect(40, 50, 71, 90);
+
+        for(long z = rect.top; z < rect.bottom; ++z)
+            for(long x = rect.left; x < rect.right; ++x)
+                tile->heights[z * size + x] += 15.f;
+
+        updatePyramid(*tile, rect.left - 1, rect.top - 1, rect.right, rect.bottom);
+        std::shared_ptr<Tile> rebuilt = makeTile(0, 0, size, worldSize, Ogre::Vector3(.0f, 2.f, .0f), tile->heights.data());
+
+        for(size_t k = 0; k < tile->pyramid.size(); ++k)
+        {
+            if(tile->pyramid[k].minHeights != rebuilt->pyramid[k].minHeights || tile->pyramid[k].maxHeights != rebuilt->pyramid[k].maxHeights)
+            {
+                Debug::error(STEEL_METH_INTRO, "incrementally updated level ", k, " differs from a rebuilt one").endl();
+                return false;
+            }
+        }
+
+        if(!check("updated pyramid"))
+            return false;
+
+        Ogre::Timer timer;
+        Ogre::Real t;
+
+        for(size_t i = 0; i < rayCount; ++i)
+            bruteForce(*tile, rays[i], t);
+
+        double const bruteForceUs = (double) timer.getMicroseconds() / rayCount;
+        timer.reset();
+
+        for(size_t i = 0; i < rayCount; ++i)
+            intersectTile(*tile, rays[i], std::numeric_limits<Ogre::Real>::max(), t);
+
+        double const pyramidUs = (double) timer.getMicroseconds() / rayCount;
+
+        Debug::log(STEEL_METH_INTRO, size, "^2 tile, per ray: all cells ", bruteForceUs, "us, pyramid ", pyramidUs, "us").endl();
+        return true;
+    }
+}
+// kate: indent-mode cstyle; indent-width 4; replace-tabs on;
@@ -0,0 +1,167 @@
+#include "terrain/TerrainHeightmapWriter.h"
+
+#include <cstdio>
+#include <fstream>
+
+#include <OgreImage.h>
+#include <OgreDataStream.h>
+
+#include "Debug.h"
+#include "terrain/TerrainManager.h"
+#include "tools/File.h"
+
+namespace Steel
+{
+    TerrainHeightmapWriter::TerrainHeightmapWriter(): mWorker(), mMutex(), mCondition(), mJobs(), mDone(),
+        mBusy(false), mMustStop(false)
+    {
+    }
+
+    TerrainHeightmapWriter::~TerrainHeightmapWriter()
+    {
+        shutdown();
+    }
+
+    void TerrainHeightmapWriter::init()
+    {
+        if(mWorker.joinable())
+            return;
+
+        mMustStop = false;
+        mWorker = std::thread(&TerrainHeightmapWriter::run, this);
+    }
+
+    void TerrainHeightmapWriter::shutdown()
+    {
+        if(mWorker.joinable())
+        {
+            // saves are not dropped
+            flush();
+            {
+                std::lock_guard<std::mutex> lock(mMutex);
+                mMustStop = true;
+            }
+            mCondition.notify_all();
+            mWorker.join();
+        }
+
+        mJobs.clear();
+        mDone.clear();
+    }
+
+    void TerrainHeightmapWriter::queue(Job &job)
+    {
+        if(!mWorker.joinable())
+        {
+            Debug::warning(STEEL_METH_INTRO, "worker not running, writing ", job.path, " synchronously.").endl();
+            Done done = {job.key, job.path, job.revision, write(job.path, job.heights.data(), job.side)};
+            mDone.push_back(done);
+            return;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            mJobs.push_back(std::move(job));
+        }
+        mCondition.notify_all();
+    }
+
+    bool TerrainHeightmapWriter::collect(std::vector<Done> &done)
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+
+        if(mDone.empty())
+            return false;
+
+        done.insert(done.end(), mDone.begin(), mDone.end());
+        mDone.clear();
+        return true;
+    }
+
+    void TerrainHeightmapWriter::flush()
+    {
+        std::unique_lock<std::mutex> lock(mMutex);
+        mCondition.wait(lock, [this] {return mJobs.empty() && !mBusy;});
+    }
+
+    void TerrainHeightmapWriter::run()
+    {
+        std::unique_lock<std::mutex> lock(mMutex);
+
+        while(true)
+        {
+            mCondition.wait(lock, [this] {return mMustStop || !mJobs.empty();});
+
+            if(mJobs.empty())
+                break;
+
+            Job job = std::move(mJobs.front());
+            mJobs.pop_front();
+            mBusy = true;
+
+            lock.unlock();
+            bool const success = write(job.path, job.heights.data(), job.side);
+            lock.lock();
+
+            Done done = {job.key, job.path, job.revision, success};
+            mDone.push_back(done);
+            mBusy = false;
+            mCondition.notify_all();
+        }
+    }
+
+    bool TerrainHeightmapWriter::write(Ogre::String const &path, float const *heights, size_t side)
+    {
+        // heightmap is 16bpp greyscale
+        std::vector<short> pixels(side * side);
+
+        for(size_t i = 0; i < side * side; ++i)
+            pixels[i] = static_cast<short>(heights[i]);
+
+        // make it an image for easy encoding
+        Ogre::DataStreamPtr pixelStream(OGRE_NEW Ogre::MemoryDataStream(pixels.data(), pixels.size() * sizeof(short)));
+        Ogre::Image img;
+        img.loadRawData(pixelStream, side, side, 1, Ogre::PixelFormat::PF_SHORT_L);
+        Ogre::DataStreamPtr encoded;
+        {
+            std::lock_guard<std::mutex> lock(TerrainManager::imageCodecMutex());
+            encoded = img.encode(File(path).extension());
+        }
+
+        if(encoded.isNull())
+        {
+            Debug::error(STEEL_METH_INTRO, "could not encode ", path).endl();
+            return false;
+        }
+
+        Ogre::String const tmpPath = path + ".tmp";
+        {
+            std::ofstream file(tmpPath.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+
+            if(!file.is_open())
+            {
+                Debug::error(STEEL_METH_INTRO, "could not open ", tmpPath, " for writing.").endl();
+                return false;
+            }
+
+            Ogre::String const bytes = encoded->getAsString();
+            file.write(bytes.data(), bytes.size());
+
+            if(!file.good())
+            {
+                Debug::error(STEEL_METH_INTRO, "could not write ", tmpPath).endl();
+                return false;
+            }
+        }
+
+        if(0 != std::rename(tmpPath.c_str(), path.c_str()))
+        {
+            Debug::error(STEEL_METH_INTRO, "could not rename ", tmpPath, " to ", path).endl();
+            std::remove(tmpPath.c_str());
+            return false;
+        }
+
+        return true;
+    }
+}
+// kate: indent-mode cstyle; indent-width 4; replace-tabs on;
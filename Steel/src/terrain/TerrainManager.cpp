@@ -1,27 +1,64 @@
 #include "terrain/TerrainManager.h"
 
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <thread>
+
+#include <OgreTimer.h>
+
 #include <OgreTerrain.h>
 #include <OgreTerrainGroup.h>
 #include <OgreRoot.h>
 #include <OgreImage.h>
+#include <OgreSceneNode.h>
 
 #include "steeltypes.h"
 #include "Debug.h"
+#include "terrain/TerrainBrush.h"
+#include "terrain/TerrainEditPipeline.h"
+#include "terrain/TerrainHeightSampler.h"
+#include "terrain/TerrainHeightmapWriter.h"
+#include "terrain/TerrainPager.h"
 #include "terrain/TerrainManagerEventListener.h"
 #include "terrain/TerrainPhysicsManager.h"
 // #include "terrain/TerrainMaterialGenerator.h"
 #include "tools/JsonUtils.h"
 #include "tools/StringUtils.h"
+#include "Camera.h"
+#include "Engine.h"
 #include "Level.h"
+#include "tests/UnitTestManager.h"
 
 namespace Steel
 {
+    namespace
+    {
+        /// Below this many texels, blendmaps are evaluated on the calling thread only.
+        long const MIN_PARALLEL_BLEND_TEXELS = 64 * 1024;
+        /// Smallest band of texel rows given to a thread.
+        long const MIN_BLEND_BAND_ROWS = 32;
+
+        /// Test fixture: wavy heights over a size x size terrain.
+        std::vector<float> blendMapTestHeights(long size)
+        {
+            std::vector<float> heights(size * size);
+
+            for(long z = 0; z < size; ++z)
+                for(long x = 0; x < size; ++x)
+                    heights[z * size + x] = 30.f * std::sin(x * .031f) * std::cos(z * .017f) + 12.f;
+
+            return heights;
+        }
+    }
 
     TerrainManager::TerrainManager(): Ogre::FrameListener(),
         mLevel(nullptr), mSceneManager(nullptr), mResourceGroupName("TerrainManager-defaultResourceGroup-name"),
         mLoadingState(LoadingState::INIT), mListeners(std::set<TerrainManagerEventListener *>()),
         mTerrainGlobals(nullptr), mTerrainGroup(nullptr), mTerrainsImported(false),
-        mPath(StringUtils::BLANK), mTerrainPhysicsMan(nullptr)
+        mPath(StringUtils::BLANK), mTerrainPhysicsMan(nullptr), mEditPipeline(nullptr), mEditedTerrains(), mPager(nullptr), mHeightSampler(nullptr),
+        mHeightmapWriter(nullptr), mHeightmapFiles(),
+        mBlendRules(defaultBlendRules())
         //, mTerrainMaterialGenerator(nullptr)
     {
     }
@@ -30,7 +67,9 @@ namespace Steel
         mLevel(o.mLevel), mSceneManager(o.mSceneManager), mResourceGroupName(o.mResourceGroupName),
         mLoadingState(o.mLoadingState), mListeners(o.mListeners),
         mTerrainGlobals(o.mTerrainGlobals), mTerrainGroup(o.mTerrainGroup), mTerrainsImported(o.mTerrainsImported),
-        mPath(o.mPath), mTerrainPhysicsMan(o.mTerrainPhysicsMan)
+        mPath(o.mPath), mTerrainPhysicsMan(o.mTerrainPhysicsMan), mEditPipeline(o.mEditPipeline), mEditedTerrains(o.mEditedTerrains), mPager(o.mPager), mHeightSampler(o.mHeightSampler),
+        mHeightmapWriter(o.mHeightmapWriter), mHeightmapFiles(o.mHeightmapFiles),
+        mBlendRules(o.mBlendRules)
         //, mTerrainMaterialGenerator(new TerrainMaterialGenerator(*o.mTerrainMaterialGenerator))
     {
     }
@@ -86,6 +125,36 @@ namespace Steel
 //             mTerrainMaterialGenerator = nullptr;
 //         }
 
+        // before terrains go away
+        if(nullptr != mPager)
+        {
+            delete mPager;
+            mPager = nullptr;
+        }
+
+        if(nullptr != mEditPipeline)
+        {
+            delete mEditPipeline;
+            mEditPipeline = nullptr;
+        }
+
+        mEditedTerrains.clear();
+
+        if(nullptr != mHeightSampler)
+        {
+            delete mHeightSampler;
+            mHeightSampler = nullptr;
+        }
+
+        // waits for pending heightmap writes
+        if(nullptr != mHeightmapWriter)
+        {
+            delete mHeightmapWriter;
+            mHeightmapWriter = nullptr;
+        }
+
+        mHeightmapFiles.clear();
+
         if(nullptr != mTerrainPhysicsMan)
         {
             delete mTerrainPhysicsMan;
@@ -183,6 +252,12 @@ namespace Steel
         mTerrainGroup->setOrigin(Ogre::Vector3::ZERO);
 
         mTerrainPhysicsMan = new TerrainPhysicsManager(this);
+        mEditPipeline = new TerrainEditPipeline();
+        mEditPipeline->init();
+        mPager = new TerrainPager();
+        mHeightSampler = new TerrainHeightSampler();
+        mHeightmapWriter = new TerrainHeightmapWriter();
+        mHeightmapWriter->init();
 
         // default terrain
 //         Ogre::ColourValue ambient=Ogre::ColourValue::White;
@@ -226,7 +301,72 @@ namespace Steel
 
         root["defaultTerrain"] = defaultsValue;
 
+        for(BlendRule const & rule : mBlendRules)
+        {
+            Json::Value ruleValue;
+            ruleValue["layer"] = JsonUtils::toJson((int) rule.layer);
+            ruleValue["minHeight"] = JsonUtils::toJson(rule.minHeight);
+            ruleValue["fadeDistance"] = JsonUtils::toJson(rule.fadeDistance);
+            root["blendRules"].append(ruleValue);
+        }
+
         // actual terrains
+        if(mPager->enabled())
+        {
+            // slots not loaded at the moment are written from their definition
+            for(auto const & it : mPager->slots())
+            {
+                TerrainPager::Slot const &slot = it.second;
+                long const x = slot.data.slot_x, y = slot.data.slot_y;
+                Ogre::String heightmapPath = slot.data.heightmapPath;
+                Ogre::Terrain *terrain = TerrainPager::SlotState::LOADED == slot.state ? mTerrainGroup->getTerrain(x, y) : nullptr;
+
+                if(nullptr != terrain)
+                {
+                    root["terrainSlots"].append(terrainSlotToJson(x, y, terrain, heightmapPath));
+                    continue;
+                }
+
+                // unsaved edits of an unloaded slot
+                if(!slot.heights.empty())
+                    heightmapPath = saveHeightmap(x, y, slot.heights.data(), slot.data.size);
+                // heightmap loaded from another level's directory
+                else if(!heightmapPath.empty() && heightmapPath != heightmapPathOf(x, y))
+                {
+                    float *heights = readHeightmap(heightmapPath, slot.data.size);
+
+                    if(nullptr == heights)
+                        Debug::error(STEEL_METH_INTRO, "could not read heightmap ", heightmapPath, " of slot ", x, "x", y).endl();
+                    else
+                    {
+                        heightmapPath = saveHeightmap(x, y, heights, slot.data.size);
+                        OGRE_FREE(heights, Ogre::MEMCATEGORY_GEOMETRY);
+                    }
+                }
+
+                Json::Value terrainValue;
+                terrainValue["slotPosition"] = JsonUtils::toJson(Ogre::Vector2(static_cast<float>(x), static_cast<float>(y)));
+                terrainValue["heightmapPath"] = heightmapPath;
+                terrainValue["size"] = JsonUtils::toJson(slot.data.size);
+                terrainValue["worldSize"] = JsonUtils::toJson(slot.data.worldSize);
+
+                for(auto const & layer : slot.data.layerList)
+                {
+                    Json::Value layerValue;
+                    layerValue["worldSize"] = layer.worldSize;
+
+                    for(auto const & textureName : layer.textureNames)
+                        layerValue["textureNames"].append(Json::Value(textureName.c_str()));
+
+                    terrainValue["layerList"].append(layerValue);
+                }
+
+                root["terrainSlots"].append(terrainValue);
+            }
+
+            return root;
+        }
+
         Ogre::TerrainGroup::TerrainIterator it = mTerrainGroup->getTerrainIterator();
 
         while(it.hasMoreElements())
@@ -242,45 +382,171 @@ namespace Steel
                 continue;
             }
 
-            Json::Value terrainValue;
-            terrainValue["slotPosition"] = JsonUtils::toJson(Ogre::Vector2(static_cast<float>(slot->x), static_cast<float>(slot->y)));
-
             Ogre::String heightmapPath = StringUtils::BLANK;
-            saveTerrainHeightmapAs(slot->x, slot->y, terrain, heightmapPath);
-            terrainValue["heightmapPath"] = heightmapPath;
+            root["terrainSlots"].append(terrainSlotToJson(slot->x, slot->y, terrain, heightmapPath));
+        }
 
-            terrainValue["size"] = JsonUtils::toJson(terrain->getSize());
-            terrainValue["worldSize"] = JsonUtils::toJson(terrain->getWorldSize());
+        return root;
+    }
 
-            serializeLayerList(terrain, terrainValue["layerList"]);
+    Json::Value TerrainManager::terrainSlotToJson(long x, long y, Ogre::Terrain *terrain, Ogre::String &heightmapPath)
+    {
+        Json::Value terrainValue;
+        terrainValue["slotPosition"] = JsonUtils::toJson(Ogre::Vector2(static_cast<float>(x), static_cast<float>(y)));
 
-            root["terrainSlots"].append(terrainValue);
-        }
+        heightmapPath = saveHeightmap(x, y, terrain->getHeightData(), terrain->getSize());
+        terrainValue["heightmapPath"] = heightmapPath;
 
-        return root;
+        terrainValue["size"] = JsonUtils::toJson(terrain->getSize());
+        terrainValue["worldSize"] = JsonUtils::toJson(terrain->getWorldSize());
+
+        serializeLayerList(terrain, terrainValue["layerList"]);
+        return terrainValue;
     }
 
     void TerrainManager::saveTerrainHeightmapAs(long int x, long int y, Ogre::Terrain *instance,
             Ogre::String &heightmapPath)
     {
-        // get data
-        float *heights_init = instance->getHeightData();
-        size_t side = instance->getSize();
+        saveTerrainHeightmapAs(x, y, instance->getHeightData(), instance->getSize(), heightmapPath);
+    }
 
-        // heightmap is 16bpp greyscale
-        short *heights = new short[side * side];
+    void TerrainManager::saveTerrainHeightmapAs(long int x, long int y, float const *heights_init, size_t side,
+            Ogre::String &heightmapPath)
+    {
+        heightmapPath = heightmapPathOf(x, y);
+        TerrainHeightmapWriter::write(heightmapPath, heights_init, side);
+    }
 
-        for(size_t i = 0; i < side * side; ++i)
-            heights[i] = static_cast<short>(heights_init[i]);
+    Ogre::String TerrainManager::heightmapPathOf(long x, long y) const
+    {
+        Ogre::String filename = "heightmap_" + Ogre::StringConverter::toString(x) + "_" + Ogre::StringConverter::toString(y) + ".png";
+        return mPath.subfile(filename).fullPath();
+    }
 
-        Ogre::DataStreamPtr streamPtr(OGRE_NEW Ogre::MemoryDataStream(heights, side * side * sizeof(short)));
+    void TerrainManager::resetHeightmapFile(long x, long y, Ogre::String const &path)
+    {
+        HeightmapFile &file = mHeightmapFiles[SlotKey(x, y)];
+        file.path = path;
+        // flat slots have no file yet
+        file.revision = path.empty() ? 1 : 0;
+        file.queuedRevision = file.savedRevision = 0;
+    }
+
+    Ogre::String TerrainManager::saveHeightmap(long x, long y, float const *heights, size_t side)
+    {
+        auto it = mHeightmapFiles.find(SlotKey(x, y));
+
+        if(mHeightmapFiles.end() == it)
+        {
+            resetHeightmapFile(x, y, StringUtils::BLANK);
+            it = mHeightmapFiles.find(SlotKey(x, y));
+        }
+
+        HeightmapFile &file = it->second;
+        Ogre::String const path = heightmapPathOf(x, y);
+
+        // a file loaded from elsewhere (another level's directory) is copied over, even if unchanged
+        if(file.path == path && file.queuedRevision == file.revision)
+            return file.path;
+
+        file.path = path;
+        file.queuedRevision = file.revision;
+
+        TerrainHeightmapWriter::Job job;
+        job.key = it->first;
+        job.path = file.path;
+        job.heights.assign(heights, heights + side * side);
+        job.side = side;
+        job.revision = file.revision;
+        mHeightmapWriter->queue(job);
+        return file.path;
+    }
+
+    void TerrainManager::collectHeightmapWrites()
+    {
+        std::vector<TerrainHeightmapWriter::Done> writes;
+
+        if(nullptr == mHeightmapWriter || !mHeightmapWriter->collect(writes))
+            return;
+
+        for(TerrainHeightmapWriter::Done const & done : writes)
+        {
+            auto it = mHeightmapFiles.find(done.key);
+
+            if(mHeightmapFiles.end() == it)
+                continue;
+
+            HeightmapFile &file = it->second;
+
+            if(!done.success)
+            {
+                // next save retries
+                Debug::error(STEEL_METH_INTRO, "heightmap of slot ", done.key.first, "x", done.key.second, " could not be saved to ",
+                             done.path).endl();
+                file.queuedRevision = file.savedRevision;
+                file.path = StringUtils::BLANK;
+                continue;
+            }
+
+            file.savedRevision = std::max(file.savedRevision, done.revision);
+
+            // in memory heights of unloaded slots can go
+            if(mPager->enabled() && file.savedRevision == file.revision)
+                mPager->onHeightmapSaved(done.key, file.path);
+        }
+    }
+
+    float *TerrainManager::readHeightmap(Ogre::String const &filepath, int size)
+    {
+        if(filepath.empty())
+            return nullptr;
+
+        std::ifstream stream(filepath.c_str(), std::ios::in | std::ios::binary);
+
+        if(!stream.is_open())
+            return nullptr;
+
+        stream.seekg(0, std::ios::end);
+        size_t const length = (size_t) stream.tellg();
+        stream.seekg(0, std::ios::beg);
+
+        // freed with the stream
+        Ogre::uchar *buffer = OGRE_ALLOC_T(Ogre::uchar, length, Ogre::MEMCATEGORY_GENERAL);
+        stream.read(reinterpret_cast<char *>(buffer), length);
+        Ogre::DataStreamPtr dataStream(OGRE_NEW Ogre::MemoryDataStream(buffer, length, true));
 
-        // make it an image for easy saving
         Ogre::Image img;
-        img.loadRawData(streamPtr, side, side, 1, Ogre::PixelFormat::PF_SHORT_L);
-        Ogre::String filename = "heightmap_" + Ogre::StringConverter::toString(x) + "_" + Ogre::StringConverter::toString(y) + ".png";
-        heightmapPath = mPath.subfile(filename).fullPath();
-        img.save(heightmapPath);
+        {
+            std::lock_guard<std::mutex> lock(imageCodecMutex());
+            img.load(dataStream, File(filepath).extension());
+        }
+
+        int const resolution = size * size;
+
+        if((int)(img.getWidth() * img.getHeight()) != resolution)
+            return nullptr;
+
+        short const *img_data = reinterpret_cast<short const *>(img.getData());
+        float *heights = OGRE_ALLOC_T(float, resolution, Ogre::MEMCATEGORY_GEOMETRY);
+
+        for(int i = 0; i < resolution; ++i)
+            heights[i] = static_cast<float>(img_data[i]);
+
+        return heights;
+    }
+
+    std::mutex &TerrainManager::imageCodecMutex()
+    {
+        static std::mutex mutex;
+        return mutex;
+    }
+
+    float *TerrainManager::flatHeightmap(int size)
+    {
+        // as loadTerrainHeightmapFrom
+        float *heights = OGRE_ALLOC_T(float, size * size, Ogre::MEMCATEGORY_GEOMETRY);
+        std::fill(heights, heights + size * size, 1.f);
+        return heights;
     }
 
     float *TerrainManager::loadTerrainHeightmapFrom(Ogre::String filepath, int size)
@@ -293,7 +559,10 @@ namespace Steel
 
         if(use_file)
         {
-            img.load(filepath, mTerrainGroup->getResourceGroup());
+            {
+                std::lock_guard<std::mutex> lock(imageCodecMutex());
+                img.load(filepath, mTerrainGroup->getResourceGroup());
+            }
             resolution = img.getWidth() * img.getHeight();
             Debug::log(intro)("format is ")(Ogre::PixelUtil::getFormatName(img.getFormat()));
             Debug::log(" depth: ")(img.getDepth());
@@ -437,6 +706,10 @@ namespace Steel
         Ogre::String intro = "TerrainManager::fromJSon(): ";
         Json::Value value;
 
+        // heightmaps about to be read may still be being written
+        mHeightmapWriter->flush();
+        collectHeightmapWrites();
+
         //         Ogre::Vector3 lightDir(.2f, -.5f, .3f);
 
         Ogre::ColourValue ambient = Ogre::ColourValue::White;
@@ -515,6 +788,38 @@ namespace Steel
             deserializeLayerList(defaultTerrain["layerList"], defaultImp.layerList);
         }
 
+        // blendmap rules
+        mBlendRules = defaultBlendRules();
+        Json::Value blendRulesValue = root["blendRules"];
+
+        if(!blendRulesValue.isNull())
+        {
+            if(!blendRulesValue.isConvertibleTo(Json::arrayValue))
+                Debug::warning(intro)("key 'blendRules' can't be converted to an array. Using defaults.").endl();
+            else
+            {
+                mBlendRules.clear();
+
+                for(Json::ValueIterator it = blendRulesValue.begin(); it != blendRulesValue.end(); ++it)
+                {
+                    Json::Value ruleValue = *it;
+                    int const layer = ruleValue["layer"].isNull() ? -1 : Ogre::StringConverter::parseInt(ruleValue["layer"].asString(), -1);
+
+                    if(layer < 1 || layer > 255)
+                    {
+                        Debug::warning(intro)("invalid blendmap rule layer, skipping rule:").endl()(ruleValue.toStyledString()).endl();
+                        continue;
+                    }
+
+                    BlendRule rule;
+                    rule.layer = (Ogre::uint8) layer;
+                    rule.minHeight = ruleValue["minHeight"].isNull() ? .0f : Ogre::StringConverter::parseReal(ruleValue["minHeight"].asString());
+                    rule.fadeDistance = ruleValue["fadeDistance"].isNull() ? .0f : Ogre::StringConverter::parseReal(ruleValue["fadeDistance"].asString());
+                    mBlendRules.push_back(rule);
+                }
+            }
+        }
+
         // terrains
         std::list<TerrainSlotData> terrainSlots;
         Json::Value terrainSlotsValue = root["terrainSlots"];
@@ -559,6 +864,12 @@ namespace Steel
 
     void TerrainManager::addTerrainSlot(TerrainManager::TerrainSlotData slot)
     {
+        if(mPager->enabled())
+        {
+            mPager->addSlot(slot);
+            return;
+        }
+
         defineTerrain(slot);
         updateTerrains();
     }
@@ -616,17 +927,40 @@ namespace Steel
 
         if(terrainSlots.size() == 0)
             Debug::warning("TerrainManager::build(): terrainSlots has size 0. Level has no terrain !").endl();
-        else
+
+        mPager->init(this, mLevel->engine()->config());
+
+        if(mPager->enabled())
+        {
+            // only slots around the camera are loaded now, the rest follows it
             for(auto it = terrainSlots.begin(); it != terrainSlots.end(); ++it)
-                defineTerrain(*it);
+                mPager->addSlot(*it);
+
+            mLoadingState = LoadingState::INIT;
+            mTerrainsImported = true;
+            Ogre::Root::getSingletonPtr()->addFrameListener(this);
+            mPager->update(pagingPosition(), true);
+            mTerrainGroup->freeTemporaryResources();
+            return;
+        }
+
+        for(auto it = terrainSlots.begin(); it != terrainSlots.end(); ++it)
+            defineTerrain(*it);
 
         updateTerrains();
     }
 
+    Ogre::Vector3 TerrainManager::pagingPosition()
+    {
+        Camera *camera = mLevel->camera();
+        return nullptr == camera ? Ogre::Vector3::ZERO : camera->camNode()->_getDerivedPosition();
+    }
+
     void TerrainManager::defineTerrain(TerrainSlotData &terrainSlotData)
     {
         long x = terrainSlotData.slot_x;
         long y = terrainSlotData.slot_y;
+        resetHeightmapFile(x, y, terrainSlotData.heightmapPath);
         Ogre::String filename = mTerrainGroup->generateFilename(x, y);
 
         if(Ogre::ResourceGroupManager::getSingleton().resourceExists(mTerrainGroup->getResourceGroup(), filename))
@@ -688,11 +1022,20 @@ namespace Steel
 
     void TerrainManager::update(float timestep)
     {
+        // before the physics step, so that terrains under moving bodies are there
+        if(mPager->enabled())
+            mPager->update(pagingPosition());
+
         mTerrainPhysicsMan->update(timestep);
+        collectHeightmapWrites();
     }
 
     void TerrainManager::updateTerrains()
     {
+        // terrains are (re)loaded: staged heights are stale
+        if(nullptr != mEditPipeline)
+            mEditPipeline->invalidateAll();
+
         mLoadingState = LoadingState::INIT;
         Ogre::Root::getSingletonPtr()->addFrameListener(this);
         // sync load since we want everything in place when we start
@@ -706,6 +1049,7 @@ namespace Steel
             {
                 Ogre::Terrain *terrain = ti.getNext()->instance;
                 updateBlendMaps(terrain);
+                updateHeightSampler(terrain);
 
                 if(nullptr == mTerrainPhysicsMan->getTerrainFor(terrain))
                     mTerrainPhysicsMan->createTerrainFor(terrain);
@@ -715,7 +1059,38 @@ namespace Steel
         mTerrainGroup->freeTemporaryResources();
     }
 
+    TerrainManager::BlendRules TerrainManager::defaultBlendRules()
+    {
+        BlendRules rules;
+        rules.push_back({1, 15.f, 10.f});
+        rules.push_back({2, 15.f, .0f});
+        return rules;
+    }
+
+    TerrainManager::BlendRules TerrainManager::blendRulesFor(Ogre::Terrain *terrain) const
+    {
+        BlendRules rules;
+
+        // steel terrains (less than 3 layers) are not rule blended
+        if(terrain->getLayerCount() < 3)
+            return rules;
+
+        for(BlendRule const & rule : mBlendRules)
+        {
+            if(rule.layer < terrain->getLayerCount())
+                rules.push_back(rule);
+        }
+
+        return rules;
+    }
+
     void TerrainManager::updateBlendMaps(Ogre::Terrain *terrain)
+    {
+        long const size = terrain->getSize();
+        updateBlendMaps(terrain, Ogre::Rect(0, 0, size, size));
+    }
+
+    void TerrainManager::updateBlendMaps(Ogre::Terrain *terrain, Ogre::Rect const &vertices)
     {
         if(terrain->getLayerCount() < 3)
         {
@@ -728,44 +1103,125 @@ namespace Steel
 //             pass->setVertexProgram("triPlanarMaterial1_vs");
 //             pass->setFragmentProgram("triPlanarMaterial1_ps");
 //             mat->_dirtyState();
+            return;
         }
-        else
+
+        // prebaked blended terrains
+        BlendRules const rules = blendRulesFor(terrain);
+        long const blendMapSize = terrain->getLayerBlendMapSize();
+        Ogre::Rect const texels = blendMapRect(vertices, terrain->getSize(), blendMapSize);
+
+        if(rules.empty() || texels.isNull())
+            return;
+
+        // evaluated in place
+        std::vector<float *> outputs;
+
+        for(BlendRule const & rule : rules)
+            outputs.push_back(terrain->getLayerBlendMap(rule.layer)->getBlendPointer() + texels.top * blendMapSize + texels.left);
+
+        computeBlendMapsParallel(terrain->getHeightData(), terrain->getSize(), blendMapSize, texels, rules, outputs.data(), blendMapSize);
+
+        // only the texels computed are uploaded
+        for(BlendRule const & rule : rules)
+        {
+            Ogre::TerrainLayerBlendMap *blendMap = terrain->getLayerBlendMap(rule.layer);
+            blendMap->dirtyRect(texels);
+            blendMap->update();
+        }
+    }
+
+    void TerrainManager::computeBlendMaps(float const *heights, long size, long blendMapSize, Ogre::Rect const &texels,
+                                          BlendRules const &rules, float *const *outputs, long stride)
+    {
+        Ogre::Real const texelToVertex = (Ogre::Real)(size - 1) / (blendMapSize - 1);
+        size_t const ruleCount = rules.size();
+
+        for(long y = texels.top; y < texels.bottom; ++y)
         {
-            // prebaked blended terrains
-
-            //TODO: load this through serialization (no editing included, but fast reload would be nice)
-            Ogre::TerrainLayerBlendMap *blendMap0 = terrain->getLayerBlendMap(1);
-            Ogre::TerrainLayerBlendMap *blendMap1 = terrain->getLayerBlendMap(2);
-            Ogre::Real minHeight0 = 15;
-            Ogre::Real fadeDist0 = 10;
-            Ogre::Real minHeight1 = 15;
-            Ogre::Real fadeDist1 = 0;
-            float *pBlend0 = blendMap0->getBlendPointer();
-            float *pBlend1 = blendMap1->getBlendPointer();
-
-            for(Ogre::uint16 y = 0; y < terrain->getLayerBlendMapSize(); ++y)
+            // image space goes down, terrain space (and height rows) go up
+            Ogre::Real const fz = (blendMapSize - 1 - y) * texelToVertex;
+            long const z0 = std::min((long) fz, size - 2);
+            Ogre::Real const tz = fz - z0;
+            float const *row0 = heights + z0 * size, *row1 = row0 + size;
+            long const offset = (y - texels.top) * stride - texels.left;
+
+            for(long x = texels.left; x < texels.right; ++x)
             {
-                for(Ogre::uint16 x = 0; x < terrain->getLayerBlendMapSize(); ++x)
+                Ogre::Real const fx = x * texelToVertex;
+                long const x0 = std::min((long) fx, size - 2);
+                Ogre::Real const tx = fx - x0;
+
+                // bilinear height
+                Ogre::Real const h0 = row0[x0] + (row0[x0 + 1] - row0[x0]) * tx;
+                Ogre::Real const h1 = row1[x0] + (row1[x0 + 1] - row1[x0]) * tx;
+                Ogre::Real const height = h0 + (h1 - h0) * tz;
+
+                for(size_t i = 0; i < ruleCount; ++i)
                 {
-                    Ogre::Real tx, ty;
+                    BlendRule const &rule = rules[i];
+                    Ogre::Real val;
 
-                    blendMap0->convertImageToTerrainSpace(x, y, &tx, &ty);
-                    Ogre::Real height = terrain->getHeightAtTerrainPosition(tx, ty);
-                    Ogre::Real val = (height - minHeight0) / fadeDist0;
-                    val = Ogre::Math::Clamp(val, (Ogre::Real) 0, (Ogre::Real) 1);
-                    *pBlend0++ = val;
+                    if(rule.fadeDistance > .0f)
+                        val = Ogre::Math::Clamp((height - rule.minHeight) / rule.fadeDistance, (Ogre::Real) 0, (Ogre::Real) 1);
+                    else
+                        val = height > rule.minHeight ? 1.f : .0f;
 
-                    val = (height - minHeight1) / fadeDist1;
-                    val = Ogre::Math::Clamp(val, (Ogre::Real) 0, (Ogre::Real) 1);
-                    *pBlend1++ = val;
+                    outputs[i][offset + x] = val;
                 }
             }
+        }
+    }
+
+    void TerrainManager::computeBlendMapsParallel(float const *heights, long size, long blendMapSize, Ogre::Rect const &texels,
+            BlendRules const &rules, float *const *outputs, long stride)
+    {
+        long const rows = texels.height();
+        long const bands = std::min<long>(std::max(1U, std::thread::hardware_concurrency()), rows / MIN_BLEND_BAND_ROWS);
+
+        if(bands < 2 || texels.width() * rows < MIN_PARALLEL_BLEND_TEXELS)
+        {
+            computeBlendMaps(heights, size, blendMapSize, texels, rules, outputs, stride);
+            return;
+        }
+
+        // bands write disjoint rows of the outputs; the last one is done by the calling thread
+        std::vector<std::vector<float *> > bandOutputs(bands);
+        std::vector<std::thread> workers;
+
+        for(long band = 0; band < bands; ++band)
+        {
+            long const top = texels.top + rows * band / bands;
+            long const bottom = texels.top + rows * (band + 1) / bands;
+
+            for(size_t i = 0; i < rules.size(); ++i)
+                bandOutputs[band].push_back(outputs[i] + (top - texels.top) * stride);
 
-            blendMap0->dirty();
-            blendMap1->dirty();
-            blendMap0->update();
-            blendMap1->update();
+            Ogre::Rect const bandTexels(texels.left, top, texels.right, bottom);
+
+            if(band + 1 < bands)
+                workers.push_back(std::thread(&TerrainManager::computeBlendMaps, heights, size, blendMapSize, bandTexels,
+                                              std::cref(rules), bandOutputs[band].data(), stride));
+            else
+                computeBlendMaps(heights, size, blendMapSize, bandTexels, rules, bandOutputs[band].data(), stride);
         }
+
+        for(std::thread & worker : workers)
+            worker.join();
+    }
+
+    Ogre::Rect TerrainManager::blendMapRect(Ogre::Rect const &vertices, long size, long blendMapSize)
+    {
+        if(vertices.isNull())
+            return Ogre::Rect(0, 0, 0, 0);
+
+        // texels interpolate heights of their neighbour vertices: one texel margin
+        Ogre::Real const vertexToTexel = (Ogre::Real)(blendMapSize - 1) / (size - 1);
+        long const flip = blendMapSize - 1;
+        return Ogre::Rect(std::max(0L, (long) std::floor(vertices.left * vertexToTexel) - 1),
+                          std::max(0L, flip - (long) std::ceil((vertices.bottom - 1) * vertexToTexel) - 1),
+                          std::min(blendMapSize, (long) std::ceil((vertices.right - 1) * vertexToTexel) + 2),
+                          std::min(blendMapSize, flip - (long) std::floor(vertices.top * vertexToTexel) + 2));
     }
 
     void TerrainManager::updateHeightmap(Ogre::Terrain *terrain)
@@ -773,6 +1229,67 @@ namespace Steel
         mTerrainPhysicsMan->updateHeightmap(terrain);
     }
 
+    void TerrainManager::loadTerrainSlot(TerrainSlotData const &slot, float *heights, bool blocking)
+    {
+        // a reload keeps track of edits made before the slot was unloaded
+        if(mHeightmapFiles.end() == mHeightmapFiles.find(SlotKey(slot.slot_x, slot.slot_y)))
+            resetHeightmapFile(slot.slot_x, slot.slot_y, slot.heightmapPath);
+
+        Ogre::Terrain::ImportData idata;
+        idata.inputFloat = heights;
+        // hence the OGRE_ALLOC_T allocation
+        idata.deleteInputData = true;
+
+        idata.inputBias = 0.f;
+        idata.terrainSize = slot.size;
+        idata.worldSize = slot.worldSize;
+        idata.layerDeclaration = mTerrainGroup->getDefaultImportSettings().layerDeclaration;
+        idata.layerList.assign(slot.layerList.begin(), slot.layerList.end());
+
+        if(mTerrainGroup->getTerrain(slot.slot_x, slot.slot_y) != nullptr)
+            mTerrainGroup->removeTerrain(slot.slot_x, slot.slot_y);
+
+        mTerrainGroup->defineTerrain(slot.slot_x, slot.slot_y, &idata);
+        // asynchronous loads are prepared in Ogre's work queue
+        mTerrainGroup->loadTerrain(slot.slot_x, slot.slot_y, blocking);
+    }
+
+    void TerrainManager::onPagedTerrainLoaded(Ogre::Terrain *terrain)
+    {
+        updateBlendMaps(terrain);
+        updateHeightSampler(terrain);
+    }
+
+    void TerrainManager::updateHeightSampler(Ogre::Terrain *terrain)
+    {
+        long x = 0, y = 0;
+        mTerrainGroup->convertWorldPositionToTerrainSlot(terrain->getPosition(), &x, &y);
+        mHeightSampler->setTile(x, y, terrain->getSize(), terrain->getWorldSize(), terrain->getPosition(), terrain->getHeightData());
+    }
+
+    void TerrainManager::releaseTerrainEdits(Ogre::Terrain *terrain)
+    {
+        if(mEditPipeline->hasWork())
+            publishTerrainEdits(true);
+
+        mEditPipeline->invalidate(terrain);
+        mEditedTerrains.erase(terrain);
+    }
+
+    void TerrainManager::removeTerrainSlot(long x, long y)
+    {
+        Ogre::Terrain *terrain = mTerrainGroup->getTerrain(x, y);
+
+        if(nullptr == terrain)
+            return;
+
+        if(nullptr != mTerrainPhysicsMan->getTerrainFor(terrain))
+            mTerrainPhysicsMan->removeTerrainFor(terrain);
+
+        mHeightSampler->removeTile(x, y);
+        mTerrainGroup->removeTerrain(x, y);
+    }
+
     bool TerrainManager::frameRenderingQueued(const Ogre::FrameEvent &evt)
     {
         bool verbose = false;
@@ -859,22 +1376,19 @@ namespace Steel
     {
         Ogre::TerrainGroup::RayResult result(false, nullptr, Ogre::Vector3::ZERO);
 
-        if(mTerrainGroup != nullptr)
-        {
-            result = mTerrainGroup->rayIntersects(ray);
-            result.terrain = nullptr;
-        }
+        // min/max pyramid march, rather than Ogre's per triangle walk
+        if(mHeightSampler != nullptr)
+            result.hit = mHeightSampler->intersectRay(ray, .0f, result.position);
 
         return result;
     }
 
-    Ogre::TerrainGroup::TerrainList TerrainManager::raiseTerrainAt(Ogre::Vector3 terraCenter,
+    TerrainManager::TerrainEdits TerrainManager::raiseTerrainAt(Ogre::Vector3 terraCenter,
             Ogre::Real intensity,
             Ogre::Real radius,
             TerrainManager::RaiseMode rmode,
             TerrainManager::RaiseShape rshape)
     {
-        std::set<Ogre::Vector2> tIds;
         //         Debug::log("TerrainManager::raiseTerrainAt(terraCenter=")(terraCenter)(", intensity=")(intensity)(", radius=")(radius)(")").endl();
 
         // retrieve a list of all slots involved in the operation. This is done by getting all slots
@@ -884,111 +1398,145 @@ namespace Steel
         Ogre::TerrainGroup::TerrainList terrains;
         mTerrainGroup->boxIntersects(box, &terrains);
 
-        // now, for each of them, get all vertices in the sphere and move them up/down.
-        // for reference, we work as much as possible in local coordinates
-        Ogre::Vector2 terraPos(terraCenter.x, terraCenter.z);
+        TerrainEdits edits;
 
+        // background strokes come first, and their staged heights will not match anymore
+        if(mEditPipeline->hasWork())
+            publishTerrainEdits(true);
+
+        // now, for each of them, move vertices within the brush up/down.
+        // for reference, we work as much as possible in local coordinates (vertex units)
         for(auto it = terrains.begin(); it != terrains.end(); ++it)
         {
             Ogre::Terrain *terrain = *it;
-            Ogre::uint16 size = terrain->getSize();
+            TerrainBrush::Stroke const stroke = TerrainBrush::strokeFor(terrain, terraCenter, intensity, radius, rmode, rshape);
 
-            Ogre::Vector3 localTerraCenter3;
-            terrain->getTerrainPosition(terraCenter, &localTerraCenter3);
+            //The list of floats wil be interpreted such that the first row in the array equates to the bottom row of vertices
+            Ogre::Rect const rect = TerrainBrush::apply(terrain->getHeightData(), terrain->getSize(), stroke);
 
-            // distance between 2 tiles ? (tile \in terrain \in terrainGroup)
+            if(rect.isNull())
+                continue;
 
-            Ogre::Vector2 localTerraCenter2 = Ogre::Vector2(localTerraCenter3.x, localTerraCenter3.y) * size;
+            mEditPipeline->invalidate(terrain);
+            onHeightsModified(terrain, rect);
+            updateBlendMaps(terrain, rect);
+            edits.push_back({terrain, rect});
+        }
 
-            Ogre::Vector3 local_radius3;
-            terrain->getTerrainPosition(Ogre::Vector3(radius * size, .0f, .0f), &local_radius3);
-            Ogre::Real local_radius = local_radius3.x;
+        return edits;
+    }
 
-            //The list of floats wil be interpreted such that the first row in the array equates to the bottom row of vertices
-            float *heights = terrain->getHeightData();
-            int minx = size, maxx = 0, minz = size, maxz = 0;
+    void TerrainManager::onHeightsModified(Ogre::Terrain *terrain, Ogre::Rect const &rect)
+    {
+        if(mPager->enabled())
+            mPager->onTerrainModified(terrain);
 
-            for(int i = 0; i < size * size; ++i)
-            {
-                int x = i % size, z = i / size;
-                Ogre::Vector2 vertexPos = Ogre::Vector2(x, z);
-                auto dist = vertexPos.distance(localTerraCenter2);
+        terrain->dirtyRect(rect);
+        terrain->update(false);
 
-                if(dist < local_radius)
-                {
-                    minx = minx < x ? minx : x;
-                    maxx = maxx > x ? maxx : x;
-                    minz = minz < z ? minz : z;
-                    maxz = maxz > z ? maxz : z;
-                    float ratio;
+        if(LoadingState::BUILDING != mLoadingState)
+        {
+            mLoadingState = LoadingState::INIT;
+            mTerrainsImported = true;
+            Ogre::Root::getSingletonPtr()->addFrameListener(this);
+        }
 
-                    switch(rshape)
-                    {
-                        case RaiseShape::ROUND:
-                            // 1 at the center, 0 at max dist
-                            ratio = std::cos(3.14 / 2. * dist / local_radius);
+        mTerrainPhysicsMan->updateHeightmap(terrain, rect);
 
-                            if(rmode == RaiseMode::RELATIVE)
-                                heights[i] += intensity * ratio;
-                            else if(rmode == RaiseMode::ABSOLUTE)
-                                heights[i] += ((terraCenter.y + intensity * ratio) - heights[i]) / (25.f - intensity > .9f ? 25.f - intensity : .9f);
+        long x = 0, y = 0;
+        mTerrainGroup->convertWorldPositionToTerrainSlot(terrain->getPosition(), &x, &y);
+        mHeightSampler->updateTile(x, y, terrain->getHeightData(), rect);
 
-                            break;
+        auto it = mHeightmapFiles.find(SlotKey(x, y));
 
-                        case RaiseShape::SINH:
-                            //
-                            ratio = 1.f - std::sinh(dist / local_radius);
+        if(mHeightmapFiles.end() == it)
+            resetHeightmapFile(x, y, StringUtils::BLANK);
+        else
+            ++it->second.revision;
+    }
 
-                            if(rmode == RaiseMode::RELATIVE)
-                                heights[i] += intensity * ratio;
-                            else if(rmode == RaiseMode::ABSOLUTE)
-                                heights[i] += ((terraCenter.y + intensity * ratio) - heights[i]) / (25.f - intensity > .9f ? 25.f - intensity : .9f);
+    void TerrainManager::queueRaiseTerrainAt(Ogre::Vector3 terraCenter,
+            Ogre::Real intensity,
+            Ogre::Real radius,
+            TerrainManager::RaiseMode rmode,
+            TerrainManager::RaiseShape rshape)
+    {
+        auto diff = Ogre::Vector3::UNIT_SCALE * radius;
+        Ogre::AxisAlignedBox box(terraCenter - diff, terraCenter + diff);
+        Ogre::TerrainGroup::TerrainList terrains;
+        mTerrainGroup->boxIntersects(box, &terrains);
 
-                            break;
+        for(Ogre::Terrain *terrain : terrains)
+        {
+            mEditPipeline->queue(terrain, terrain->getLayerBlendMapSize(), blendRulesFor(terrain), TerrainBrush::strokeFor(terrain, terraCenter, intensity, radius, rmode, rshape));
+        }
+    }
 
-                        case RaiseShape::TRANGULAR:
-                            // 1 at the center, 0 at max dist
-                            ratio = 1.f - dist / local_radius;
+    void TerrainManager::syncTerrainEdits()
+    {
+        if(nullptr != mEditPipeline && mEditPipeline->hasWork())
+            publishTerrainEdits(false);
+    }
 
-                            if(rmode == RaiseMode::RELATIVE)
-                                heights[i] += intensity * ratio;
-                            else if(rmode == RaiseMode::ABSOLUTE)
-                                heights[i] += ((terraCenter.y + intensity * ratio) - heights[i]) / (25.f - intensity > .9f ? 25.f - intensity : .9f);
+    std::set<Ogre::Terrain *> TerrainManager::flushTerrainEdits()
+    {
+        if(nullptr != mEditPipeline)
+        {
+            // results of the in flight submission, then whatever was pending behind it
+            while(mEditPipeline->hasWork())
+                publishTerrainEdits(true);
+        }
 
-                            break;
+        std::set<Ogre::Terrain *> edited;
+        edited.swap(mEditedTerrains);
+        return edited;
+    }
 
-                        case RaiseShape::UNIFORM:
-                        default:
-                            if(rmode == RaiseMode::RELATIVE)
-                                heights[i] += intensity;
-                            else if(rmode == RaiseMode::ABSOLUTE)
-                                heights[i] += (terraCenter.y - heights[i]) / (25.f - intensity > .9f ? 25.f - intensity : .9f);
+    void TerrainManager::publishTerrainEdits(bool wait)
+    {
+        std::vector<TerrainEditPipeline::Result> results;
 
-                            break;
-                    }
+        if(mEditPipeline->collect(results, wait))
+        {
+            for(TerrainEditPipeline::Result const & result : results)
+            {
+                Ogre::Terrain *terrain = result.terrain;
+                long const size = terrain->getSize();
+                long const width = result.rect.width();
+                float *heights = terrain->getHeightData();
 
-                    heights[i] = heights[i] < TerrainManager::MIN_TERRAIN_HEIGHT ? TerrainManager::MIN_TERRAIN_HEIGHT : heights[i];
-                    heights[i] = heights[i] > TerrainManager::MAX_TERRAIN_HEIGHT ? TerrainManager::MAX_TERRAIN_HEIGHT : heights[i];
-                }
-            }
+                for(long z = result.rect.top; z < result.rect.bottom; ++z)
+                    memcpy(heights + z * size + result.rect.left, result.heights.data() + (z - result.rect.top) * width, sizeof(float) * width);
 
-            if(minx < maxx && minz < maxz)
-            {
-                terrain->dirtyRect(Ogre::Rect(minx, minz, maxx, maxz));
-                terrain->update(false);
+                onHeightsModified(terrain, result.rect);
 
-                if(LoadingState::BUILDING != mLoadingState)
+                if(!result.texels.isNull())
                 {
-                    mLoadingState = LoadingState::INIT;
-                    mTerrainsImported = true;
-                    Ogre::Root::getSingletonPtr()->addFrameListener(this);
+                    long const blendMapSize = terrain->getLayerBlendMapSize();
+                    long const texelsWidth = result.texels.width();
+
+                    for(size_t i = 0; i < result.layers.size(); ++i)
+                    {
+                        if(result.layers[i] >= terrain->getLayerCount())
+                            continue;
+
+                        Ogre::TerrainLayerBlendMap *blendMap = terrain->getLayerBlendMap(result.layers[i]);
+                        float *blend = blendMap->getBlendPointer();
+
+                        for(long y = result.texels.top; y < result.texels.bottom; ++y)
+                            memcpy(blend + y * blendMapSize + result.texels.left,
+                                   result.blends[i].data() + (y - result.texels.top) * texelsWidth, sizeof(float) * texelsWidth);
+
+                        blendMap->dirtyRect(result.texels);
+                        blendMap->update();
+                    }
                 }
 
-                mTerrainPhysicsMan->updateHeightmap(terrain);
+                mEditedTerrains.insert(terrain);
             }
         }
 
-        return terrains;
+        mEditPipeline->submit();
     }
 
     TerrainManager::TerrainSlotData::TerrainSlotData():
@@ -1046,7 +1594,94 @@ namespace Steel
         return it.begin() != it.end();
     }
 
+    bool utest_BlendMapRules(UnitTestExecutionContext const *context)
+    {
+        long const size = 257, blendMapSize = 512;
+        std::vector<float> const heights = blendMapTestHeights(size);
+
+        TerrainManager::BlendRules const rules = TerrainManager::defaultBlendRules();
+        size_t const texelCount = blendMapSize * blendMapSize;
+        Ogre::Rect const all(0, 0, blendMapSize, blendMapSize);
+
+        std::vector<std::vector<float> > serial(rules.size(), std::vector<float>(texelCount));
+        std::vector<std::vector<float> > banded(rules.size(), std::vector<float>(texelCount, -1.f));
+        std::vector<float *> serialOutputs, bandedOutputs;
+
+        for(size_t i = 0; i < rules.size(); ++i)
+        {
+            serialOutputs.push_back(serial[i].data());
+            bandedOutputs.push_back(banded[i].data());
+        }
+
+        TerrainManager::computeBlendMaps(heights.data(), size, blendMapSize, all, rules, serialOutputs.data(), blendMapSize);
+        TerrainManager::computeBlendMapsParallel(heights.data(), size, blendMapSize, all, rules, bandedOutputs.data(), blendMapSize);
+
+        if(serial != banded)
+        {
+            Debug::error(STEEL_METH_INTRO, "banded evaluation differs from the serial one.").endl();
+            return false;
+        }
+
+        // a brush sized area, written in place into the full maps
+        Ogre::Rect const texels = TerrainManager::blendMapRect(Ogre::Rect(100, 155, 121, 176), size, blendMapSize);
+        std::vector<float *> rectOutputs;
+
+        for(size_t i = 0; i < rules.size(); ++i)
+        {
+            for(long y = texels.top; y < texels.bottom; ++y)
+                std::fill(banded[i].begin() + y * blendMapSize + texels.left, banded[i].begin() + y * blendMapSize + texels.right, -1.f);
+
+            rectOutputs.push_back(banded[i].data() + texels.top * blendMapSize + texels.left);
+        }
+
+        TerrainManager::computeBlendMapsParallel(heights.data(), size, blendMapSize, texels, rules, rectOutputs.data(), blendMapSize);
 
+        if(serial != banded)
+        {
+            Debug::error(STEEL_METH_INTRO, "sub-rectangle evaluation differs from the full one.").endl();
+            return false;
+        }
+
+        return true;
+    }
+
+    bool utest_BlendMapRulesSpeed(UnitTestExecutionContext const *context)
+    {
+        long const size = 513, blendMapSize = 1024;
+        std::vector<float> const heights = blendMapTestHeights(size);
+
+        TerrainManager::BlendRules const rules = TerrainManager::defaultBlendRules();
+        size_t const texelCount = blendMapSize * blendMapSize;
+        Ogre::Rect const all(0, 0, blendMapSize, blendMapSize);
+
+        std::vector<std::vector<float> > maps(rules.size(), std::vector<float>(texelCount));
+        std::vector<float *> outputs;
+
+        for(size_t i = 0; i < rules.size(); ++i)
+            outputs.push_back(maps[i].data());
+
+        Ogre::Timer timer;
+        TerrainManager::computeBlendMaps(heights.data(), size, blendMapSize, all, rules, outputs.data(), blendMapSize);
+        unsigned long const serialUs = timer.getMicroseconds();
+        timer.reset();
+        TerrainManager::computeBlendMapsParallel(heights.data(), size, blendMapSize, all, rules, outputs.data(), blendMapSize);
+        unsigned long const bandedUs = timer.getMicroseconds();
+
+        // a brush sized area, written in place into the full maps
+        Ogre::Rect const texels = TerrainManager::blendMapRect(Ogre::Rect(200, 310, 241, 351), size, blendMapSize);
+        std::vector<float *> rectOutputs;
+
+        for(size_t i = 0; i < rules.size(); ++i)
+            rectOutputs.push_back(maps[i].data() + texels.top * blendMapSize + texels.left);
+
+        timer.reset();
+        TerrainManager::computeBlendMapsParallel(heights.data(), size, blendMapSize, texels, rules, rectOutputs.data(), blendMapSize);
+        unsigned long const rectUs = timer.getMicroseconds();
+
+        Debug::log(STEEL_METH_INTRO, blendMapSize, "^2 texels, ", rules.size(), " rules: serial ", serialUs, "us, banded ", bandedUs,
+                   "us, ", texels.width(), "x", texels.height(), " texels ", rectUs, "us").endl();
+        return true;
+    }
 }
 // kate: indent-mode cstyle; indent-width 4; replace-tabs on; 
 
@@ -0,0 +1,435 @@
+#include "terrain/TerrainPager.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include <OgreStringConverter.h>
+#include <OgreTerrain.h>
+#include <OgreTerrainGroup.h>
+#include <OgreTimer.h>
+
+#include "Debug.h"
+#include "Engine.h"
+#include "Level.h"
+#include "terrain/TerrainPhysicsManager.h"
+#include "tools/ConfigFile.h"
+#include "tests/UnitTestManager.h"
+
+namespace Steel
+{
+    const Ogre::String TerrainPager::LOAD_DISTANCE_SETTING = "TerrainPager::loadDistance";
+    const float TerrainPager::DEFAULT_LOAD_DISTANCE = .0f;
+    const Ogre::String TerrainPager::PHYSICS_DISTANCE_SETTING = "TerrainPager::physicsDistance";
+    const float TerrainPager::DEFAULT_PHYSICS_DISTANCE = (float) TerrainManager::DEFAULT_WORLD_SIZE;
+    const Ogre::String TerrainPager::HYSTERESIS_SETTING = "TerrainPager::hysteresis";
+    const float TerrainPager::DEFAULT_HYSTERESIS = 1.25f;
+    const Ogre::String TerrainPager::THREAD_COUNT_SETTING = "TerrainPager::threadCount";
+    const u32 TerrainPager::DEFAULT_THREAD_COUNT = 2;
+
+    TerrainPager::Slot::Slot(): data(), state(SlotState::UNLOADED), readHeights(nullptr), heights(),
+        modified(false), physicsAttached(false)
+    {
+    }
+
+    TerrainPager::TerrainPager(): mTerrainMan(nullptr), mSlots(),
+        mLoadDistance(DEFAULT_LOAD_DISTANCE), mPhysicsDistance(DEFAULT_PHYSICS_DISTANCE), mHysteresis(DEFAULT_HYSTERESIS),
+        mWorkers(), mMutex(), mCondition(), mRequests(), mResults(), mMustStop(false)
+    {
+    }
+
+    TerrainPager::~TerrainPager()
+    {
+        shutdown();
+    }
+
+    void TerrainPager::init(TerrainManager *terrainMan, ConfigFile const &config)
+    {
+        shutdown();
+        mTerrainMan = terrainMan;
+
+        config.getSetting(TerrainPager::LOAD_DISTANCE_SETTING, mLoadDistance, DEFAULT_LOAD_DISTANCE);
+        config.getSetting(TerrainPager::PHYSICS_DISTANCE_SETTING, mPhysicsDistance, DEFAULT_PHYSICS_DISTANCE);
+        config.getSetting(TerrainPager::HYSTERESIS_SETTING, mHysteresis, DEFAULT_HYSTERESIS);
+
+        if(mHysteresis < 1.f)
+        {
+            Debug::warning(STEEL_METH_INTRO, "hysteresis must be at least 1, got ", mHysteresis, ". Using ", DEFAULT_HYSTERESIS).endl();
+            mHysteresis = DEFAULT_HYSTERESIS;
+        }
+
+        if(!enabled())
+            return;
+
+        u32 threadCount;
+        config.getSetting(TerrainPager::THREAD_COUNT_SETTING, threadCount, DEFAULT_THREAD_COUNT);
+        threadCount = std::max(1U, threadCount);
+        mMustStop = false;
+
+        for(u32 i = 0; i < threadCount; ++i)
+            mWorkers.push_back(std::thread(&TerrainPager::run, this));
+    }
+
+    void TerrainPager::shutdown()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            mMustStop = true;
+        }
+        mCondition.notify_all();
+
+        for(std::thread & worker : mWorkers)
+            worker.join();
+
+        mWorkers.clear();
+        mRequests.clear();
+
+        for(ReadResult const & result : mResults)
+        {
+            if(nullptr != result.heights)
+                OGRE_FREE(result.heights, Ogre::MEMCATEGORY_GEOMETRY);
+        }
+
+        mResults.clear();
+
+        for(auto & it : mSlots)
+        {
+            if(nullptr != it.second.readHeights)
+                OGRE_FREE(it.second.readHeights, Ogre::MEMCATEGORY_GEOMETRY);
+        }
+
+        mSlots.clear();
+        mLoadDistance = DEFAULT_LOAD_DISTANCE;
+    }
+
+    void TerrainPager::addSlot(TerrainManager::TerrainSlotData const &data)
+    {
+        Slot &slot = mSlots[SlotKey(data.slot_x, data.slot_y)];
+
+        if(SlotState::UNLOADED != slot.state)
+        {
+            Debug::error(STEEL_METH_INTRO, "slot ", data.slot_x, "x", data.slot_y, " is already in use. Skipping.").endl();
+            return;
+        }
+
+        slot.data = data;
+        slot.heights.clear();
+        slot.modified = false;
+    }
+
+    void TerrainPager::onTerrainModified(Ogre::Terrain *terrain)
+    {
+        Ogre::TerrainGroup *group = mTerrainMan->terrainGroup();
+
+        for(auto & it : mSlots)
+        {
+            if(SlotState::LOADED == it.second.state && group->getTerrain(it.first.first, it.first.second) == terrain)
+            {
+                it.second.modified = true;
+                return;
+            }
+        }
+    }
+
+    void TerrainPager::onHeightmapSaved(SlotKey const &key, Ogre::String const &heightmapPath)
+    {
+        auto it = mSlots.find(key);
+
+        if(mSlots.end() == it)
+            return;
+
+        Slot &slot = it->second;
+        slot.data.heightmapPath = heightmapPath;
+        slot.heights.clear();
+        slot.heights.shrink_to_fit();
+        slot.modified = false;
+    }
+
+    float TerrainPager::distanceTo(Slot const &slot, Ogre::Vector3 const &position) const
+    {
+        Ogre::Vector3 center;
+        mTerrainMan->terrainGroup()->convertTerrainSlotToWorldPosition(slot.data.slot_x, slot.data.slot_y, &center);
+        float const half = slot.data.worldSize / 2.f;
+        float const dx = std::max(.0f, std::abs(position.x - center.x) - half);
+        float const dz = std::max(.0f, std::abs(position.z - center.z) - half);
+        return std::sqrt(dx * dx + dz * dz);
+    }
+
+    void TerrainPager::update(Ogre::Vector3 const &position, bool blocking/* = false*/)
+    {
+        if(!enabled())
+            return;
+
+        std::vector<ReadResult> results;
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            results.swap(mResults);
+        }
+
+        for(ReadResult const & result : results)
+        {
+            auto it = mSlots.find(result.key);
+
+            // slot went out of range meanwhile
+            if(mSlots.end() == it || SlotState::READING != it->second.state)
+            {
+                if(nullptr != result.heights)
+                    OGRE_FREE(result.heights, Ogre::MEMCATEGORY_GEOMETRY);
+
+                continue;
+            }
+
+            Slot &slot = it->second;
+
+            if(nullptr == result.heights)
+            {
+                Debug::error(STEEL_METH_INTRO, "could not read heightmap ", slot.data.heightmapPath, " of slot ",
+                             slot.data.slot_x, "x", slot.data.slot_y, ", using height 0.").endl();
+                slot.readHeights = TerrainManager::flatHeightmap(slot.data.size);
+            }
+            else
+                slot.readHeights = result.heights;
+
+            slot.state = SlotState::READ;
+        }
+
+        float const unloadDistance = mLoadDistance * mHysteresis;
+
+        for(auto & it : mSlots)
+        {
+            Slot &slot = it.second;
+            float const distance = distanceTo(slot, position);
+
+            switch(slot.state)
+            {
+                case SlotState::UNLOADED:
+                    if(distance < mLoadDistance)
+                    {
+                        if(blocking || !slot.heights.empty())
+                        {
+                            readNow(slot);
+                            load(slot, blocking);
+                        }
+                        else
+                            requestRead(slot);
+                    }
+
+                    break;
+
+                case SlotState::READING:
+                    if(distance > unloadDistance)
+                    {
+                        slot.state = SlotState::UNLOADED;
+                        std::lock_guard<std::mutex> lock(mMutex);
+                        auto const key = it.first;
+                        mRequests.erase(std::remove_if(mRequests.begin(), mRequests.end(),
+                                                       [&key](ReadRequest const & r) {return r.key == key;}), mRequests.end());
+                    }
+
+                    break;
+
+                case SlotState::READ:
+                    if(distance > unloadDistance)
+                    {
+                        OGRE_FREE(slot.readHeights, Ogre::MEMCATEGORY_GEOMETRY);
+                        slot.readHeights = nullptr;
+                        slot.state = SlotState::UNLOADED;
+                    }
+                    else
+                        load(slot, blocking);
+
+                    break;
+
+                case SlotState::LOADING:
+                {
+                    // Ogre prepares in the background and loads in its own main thread response
+                    Ogre::Terrain *terrain = mTerrainMan->terrainGroup()->getTerrain(slot.data.slot_x, slot.data.slot_y);
+
+                    if(nullptr != terrain && terrain->isLoaded())
+                    {
+                        slot.state = SlotState::LOADED;
+                        mTerrainMan->onPagedTerrainLoaded(terrain);
+                    }
+
+                    break;
+                }
+
+                case SlotState::LOADED:
+                    break;
+            }
+
+            if(SlotState::LOADED != slot.state)
+                continue;
+
+            if(distance > unloadDistance)
+            {
+                unload(slot);
+                continue;
+            }
+
+            Ogre::Terrain *terrain = mTerrainMan->terrainGroup()->getTerrain(slot.data.slot_x, slot.data.slot_y);
+            TerrainPhysicsManager *physics = mTerrainMan->terrainPhysicsMan();
+
+            if(!slot.physicsAttached && distance < mPhysicsDistance)
+                slot.physicsAttached = physics->activateTerrainFor(terrain);
+            else if(slot.physicsAttached && distance > mPhysicsDistance * mHysteresis)
+                slot.physicsAttached = !physics->deactivateTerrainFor(terrain);
+        }
+    }
+
+    void TerrainPager::readNow(Slot &slot)
+    {
+        if(!slot.heights.empty())
+        {
+            // unsaved modifications
+            slot.readHeights = OGRE_ALLOC_T(float, slot.heights.size(), Ogre::MEMCATEGORY_GEOMETRY);
+            memcpy(slot.readHeights, slot.heights.data(), sizeof(float) * slot.heights.size());
+        }
+        else
+        {
+            slot.readHeights = TerrainManager::readHeightmap(slot.data.heightmapPath, slot.data.size);
+
+            if(nullptr == slot.readHeights)
+            {
+                Debug::error(STEEL_METH_INTRO, "could not read heightmap ", slot.data.heightmapPath, " of slot ",
+                             slot.data.slot_x, "x", slot.data.slot_y, ", using height 0.").endl();
+                slot.readHeights = TerrainManager::flatHeightmap(slot.data.size);
+            }
+        }
+
+        slot.state = SlotState::READ;
+    }
+
+    void TerrainPager::requestRead(Slot &slot)
+    {
+        slot.state = SlotState::READING;
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            mRequests.push_back({SlotKey(slot.data.slot_x, slot.data.slot_y), slot.data.heightmapPath, slot.data.size});
+        }
+        mCondition.notify_one();
+    }
+
+    void TerrainPager::load(Slot &slot, bool blocking)
+    {
+        // ownership goes to Ogre
+        mTerrainMan->loadTerrainSlot(slot.data, slot.readHeights, blocking);
+        slot.readHeights = nullptr;
+        slot.heights.clear();
+        slot.heights.shrink_to_fit();
+        slot.state = SlotState::LOADING;
+
+        if(blocking)
+        {
+            Ogre::Terrain *terrain = mTerrainMan->terrainGroup()->getTerrain(slot.data.slot_x, slot.data.slot_y);
+
+            if(nullptr != terrain && terrain->isLoaded())
+            {
+                slot.state = SlotState::LOADED;
+                mTerrainMan->onPagedTerrainLoaded(terrain);
+            }
+        }
+    }
+
+    void TerrainPager::unload(Slot &slot)
+    {
+        Ogre::Terrain *terrain = mTerrainMan->terrainGroup()->getTerrain(slot.data.slot_x, slot.data.slot_y);
+
+        if(nullptr != terrain)
+        {
+            // may publish pending edits, hence flag the terrain as modified
+            mTerrainMan->releaseTerrainEdits(terrain);
+
+            if(slot.modified)
+            {
+                long const count = (long) terrain->getSize() * terrain->getSize();
+                slot.heights.assign(terrain->getHeightData(), terrain->getHeightData() + count);
+            }
+        }
+
+        mTerrainMan->removeTerrainSlot(slot.data.slot_x, slot.data.slot_y);
+        slot.state = SlotState::UNLOADED;
+        slot.physicsAttached = false;
+    }
+
+    void TerrainPager::run()
+    {
+        std::unique_lock<std::mutex> lock(mMutex);
+
+        while(true)
+        {
+            mCondition.wait(lock, [this] {return mMustStop || !mRequests.empty();});
+
+            if(mMustStop)
+                break;
+
+            ReadRequest request = mRequests.front();
+            mRequests.pop_front();
+
+            lock.unlock();
+            float *heights = TerrainManager::readHeightmap(request.path, request.size);
+            lock.lock();
+
+            mResults.push_back({request.key, heights});
+        }
+    }
+
+    bool utest_TerrainPagerStartup(UnitTestExecutionContext const *context)
+    {
+        // with paging, level start time should depend on the load distance, not on the number of slots
+        ConfigFile &config = context->engine->config();
+        float previousLoadDistance;
+        config.getSetting(TerrainPager::LOAD_DISTANCE_SETTING, previousLoadDistance, TerrainPager::DEFAULT_LOAD_DISTANCE);
+
+        if(previousLoadDistance <= .0f)
+            config.setSetting(TerrainPager::LOAD_DISTANCE_SETTING, Json::Value((float) TerrainManager::DEFAULT_WORLD_SIZE));
+
+        long const sides[2] = {2, 16};
+        double startTimes[2] = {.0, .0};
+        bool success = true;
+
+        Debug::log(STEEL_METH_INTRO, "paged level start, flat slots:").endl().indent();
+
+        for(size_t i = 0; i < 2; ++i)
+        {
+            long const side = sides[i];
+            Level *level = context->engine->createLevel("utest_TerrainPagerStartup_" + Ogre::StringConverter::toString(side));
+
+            std::list<TerrainManager::TerrainSlotData> slots;
+
+            for(long x = -side / 2; x < side - side / 2; ++x)
+                for(long y = -side / 2; y < side - side / 2; ++y)
+                    slots.push_back(TerrainManager::TerrainSlotData(x, y));
+
+            Ogre::Timer timer;
+            level->terrainManager()->build(Ogre::ColourValue::White, Ogre::Vector3::NEGATIVE_UNIT_Y, Ogre::ColourValue::White,
+                                           Ogre::ColourValue::Black, Ogre::Terrain::ImportData(), slots);
+            startTimes[i] = timer.getMicroseconds() / 1000.;
+
+            size_t loaded = 0;
+
+            for(auto const & it : level->terrainManager()->pager()->slots())
+            {
+                if(TerrainPager::SlotState::LOADED == it.second.state)
+                    ++loaded;
+            }
+
+            Debug::log(side, "x", side, " slots: ", startTimes[i], "ms, ", loaded, " loaded").endl();
+
+            // the big grid must not be loaded entirely, or paging did not happen
+            if(0 == loaded || (i > 0 && loaded == (size_t)(side * side)))
+            {
+                Debug::error(STEEL_METH_INTRO, loaded, " slots loaded out of ", side * side).endl();
+                success = false;
+            }
+
+            delete level;
+        }
+
+        Debug::log("16x16/2x2 start time ratio: ", startTimes[1] / std::max(startTimes[0], 1e-3)).endl().unIndent();
+
+        config.setSetting(TerrainPager::LOAD_DISTANCE_SETTING, Json::Value(previousLoadDistance));
+        return success;
+    }
+}
+// kate: indent-mode cstyle; indent-width 4; replace-tabs on;
@@ -1,20 +1,148 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <thread>
+
 #include <BtOgreGP.h>
 #include <BtOgrePG.h>
 #include <BtOgreExtras.h>
 #include <bullet/BulletCollision/CollisionShapes/btHeightfieldTerrainShape.h>
 #include <bullet/BulletCollision/BroadphaseCollision/btBroadphaseProxy.h>
+#include <bullet/BulletCollision/CollisionDispatch/btCollisionDispatcherMt.h>
+#include <bullet/BulletDynamics/Dynamics/btDiscreteDynamicsWorldMt.h>
+#include <bullet/BulletDynamics/ConstraintSolver/btSequentialImpulseConstraintSolverMt.h>
+#include <bullet/LinearMath/btThreads.h>
 #include <OgreTerrain.h>
 
 #include "Debug.h"
+#include "Engine.h"
 #include "terrain/TerrainPhysicsManager.h"
 #include "terrain/TerrainManager.h"
 #include "Level.h"
+#include "tests/UnitTestManager.h"
+#include "tools/ConfigFile.h"
 
 
 namespace Steel
 {
+    const Ogre::String TerrainPhysicsManager::FIXED_TIMESTEP_SETTING = "TerrainPhysicsManager::fixedTimestep";
+    const float TerrainPhysicsManager::DEFAULT_FIXED_TIMESTEP = 1.f / 60.f;
+    const Ogre::String TerrainPhysicsManager::MAX_SUBSTEPS_SETTING = "TerrainPhysicsManager::maxSubsteps";
+    const u32 TerrainPhysicsManager::DEFAULT_MAX_SUBSTEPS = 5;
+    const Ogre::String TerrainPhysicsManager::THREAD_COUNT_SETTING = "TerrainPhysicsManager::threadCount";
+    const u32 TerrainPhysicsManager::DEFAULT_THREAD_COUNT = 1;
+
+    btITaskScheduler *TerrainPhysicsManager::sTaskScheduler = nullptr;
+
+    const Ogre::String TerrainPhysicsManager::QUANTIZED_HEIGHTFIELDS_SETTING = "TerrainPhysicsManager::quantizedHeightfields";
+    const bool TerrainPhysicsManager::DEFAULT_QUANTIZED_HEIGHTFIELDS = false;
+
+    class TerrainPhysicsManager::HeightfieldShape: public btHeightfieldTerrainShape
+    {
+    public:
+        HeightfieldShape(int side, float *data, float minHeight, float maxHeight):
+            btHeightfieldTerrainShape(side, side, data, 1.f, minHeight, maxHeight, 1, PHY_FLOAT, false)
+        {
+        }
+
+        /// Heights are data*heightScale, local to the body (the range is expected to be centered on 0).
+        HeightfieldShape(int side, short *data, float heightScale, float minHeight, float maxHeight):
+            btHeightfieldTerrainShape(side, side, data, heightScale, minHeight, maxHeight, 1, PHY_SHORT, false)
+        {
+        }
+
+        void setHeightRange(float minHeight, float maxHeight)
+        {
+            // as in btHeightfieldTerrainShape::initialize, for an up axis of 1
+            m_minHeight = minHeight;
+            m_maxHeight = maxHeight;
+            m_localAabbMin.setValue(0, minHeight, 0);
+            m_localAabbMax.setValue(m_width, maxHeight, m_length);
+            m_localOrigin = btScalar(.5f) * (m_localAabbMin + m_localAabbMax);
+        }
+
+        void setHeightScale(float heightScale)
+        {
+            m_heightScale = heightScale;
+        }
+
+        /// Height of a vertex as bullet sees it, before local origin offset.
+        float rawHeight(int x, int z) const
+        {
+            return getRawHeightFieldValue(x, z);
+        }
+    };
+
+    namespace
+    {
+        /// Quantized heights use [-QUANTIZED_HALF_RANGE, QUANTIZED_HALF_RANGE].
+        float const QUANTIZED_HALF_RANGE = 32767.f;
+
+        /// Height of a quantization step over a range.
+        inline float quantizationScale(float minHeight, float maxHeight)
+        {
+            return (maxHeight - minHeight) / (2.f * QUANTIZED_HALF_RANGE);
+        }
+
+        /// Quantization range around heights: edits up to that much do not require requantizing the whole slot.
+        inline void padQuantizationRange(float &minHeight, float &maxHeight)
+        {
+            float const pad = std::max(1.f, .125f * (maxHeight - minHeight));
+            minHeight -= pad;
+            maxHeight += pad;
+        }
+
+        /// Min and max heights over a rectangle of a size*size array.
+        void heightRange(float const *heights, long side, Ogre::Rect const &rect, float &minHeight, float &maxHeight)
+        {
+            minHeight = std::numeric_limits<float>::max();
+            maxHeight = -std::numeric_limits<float>::max();
+
+            for(long z = rect.top; z < rect.bottom; ++z)
+            {
+                float const *row = heights + side * z;
+
+                for(long x = rect.left; x < rect.right; ++x)
+                {
+                    minHeight = std::min(minHeight, row[x]);
+                    maxHeight = std::max(maxHeight, row[x]);
+                }
+            }
+        }
+
+        // We need to mirror the ogre-height-data along the z axis
+        // This is related to how Ogre and Bullet differ in heighmap storing
+
+        void copyRows(float const *heights, float *dst, long side, Ogre::Rect const &rect)
+        {
+            for(long z = rect.top; z < rect.bottom; ++z)
+                memcpy(dst + side * (side - z - 1) + rect.left, heights + side * z + rect.left, sizeof(float) * (rect.right - rect.left));
+        }
+
+        /// Stores round((h - mid) / scale), mid being the middle of the quantization range.
+        void quantizeRows(float const *heights, short *dst, long side, Ogre::Rect const &rect, float minHeight, float maxHeight)
+        {
+            float const mid = .5f * (minHeight + maxHeight);
+            float const invScale = 1.f / quantizationScale(minHeight, maxHeight);
+
+            for(long z = rect.top; z < rect.bottom; ++z)
+            {
+                float const *srcRow = heights + side * z;
+                short *dstRow = dst + side * (side - z - 1);
+
+                for(long x = rect.left; x < rect.right; ++x)
+                {
+                    float const q = std::round((srcRow[x] - mid) * invScale);
+                    dstRow[x] = (short) std::min(std::max(q, -QUANTIZED_HALF_RANGE), QUANTIZED_HALF_RANGE);
+                }
+            }
+        }
+    }
+
     TerrainPhysicsManager::TerrainPhysics::TerrainPhysics():
-        mHeightfieldData(nullptr), mTerrainShape(nullptr), mMotionState(nullptr), mBody(nullptr)
+        mHeightfieldData(nullptr), mQuantizedData(nullptr), mTerrainShape(nullptr), mMotionState(nullptr), mBody(nullptr),
+        mMinHeight(.0f), mMaxHeight(.0f)
     {
     }
 
@@ -23,11 +151,13 @@ namespace Steel
     }
 
     void TerrainPhysicsManager::TerrainPhysics::init(float *heightfieldData,
-            btHeightfieldTerrainShape *terrainShape,
+            short *quantizedData,
+            HeightfieldShape *terrainShape,
             btDefaultMotionState *motionState,
             btRigidBody *body)
     {
         mHeightfieldData = heightfieldData;
+        mQuantizedData = quantizedData;
         mTerrainShape = terrainShape;
         mMotionState = motionState;
         mBody = body;
@@ -37,26 +167,27 @@ namespace Steel
     {
         if(nullptr != mBody)
         {
-            // destroy rigid body
-            {
+            // deactivated terrains are not in the world
+            if(mBody->isInWorld())
                 world->removeRigidBody(mBody);
 
-                btCollisionShape *shape = mBody->getCollisionShape();
-
-                if(nullptr != shape)
-                    delete shape;
+            STEEL_DELETE(mBody);
+        }
 
-                // not supposed to have one. This is a terrain after all...
-                btMotionState *motionState = mBody->getMotionState();
+        // the body owns neither its shape nor its motion state
+        STEEL_DELETE(mMotionState);
+        STEEL_DELETE(mTerrainShape);
 
-                if(nullptr != motionState)
-                    delete motionState;
+        if(nullptr != mHeightfieldData)
+        {
+            delete[] mHeightfieldData;
+            mHeightfieldData = nullptr;
+        }
 
-                STEEL_DELETE(mBody);
-            }
-            STEEL_DELETE(mMotionState);
-            STEEL_DELETE(mTerrainShape);
-            STEEL_DELETE(mHeightfieldData);
+        if(nullptr != mQuantizedData)
+        {
+            delete[] mQuantizedData;
+            mQuantizedData = nullptr;
         }
     }
 
@@ -65,21 +196,22 @@ namespace Steel
     TerrainPhysicsManager::TerrainPhysicsManager(TerrainManager *terrainMan):
         TerrainManagerEventListener(), Ogre::FrameListener(),
         mTerrainMan(nullptr), mTerrains(std::map<Ogre::Terrain *, TerrainPhysics *>()),
-        mWorld(nullptr), mSolver(nullptr), mDispatcher(nullptr), mCollisionConfig(nullptr), mBroadphase(nullptr),
-        mDebugDrawer(nullptr)
+        mWorld(nullptr), mWorldParts(),
+        mDebugDrawer(nullptr),
+        mFixedTimestep(DEFAULT_FIXED_TIMESTEP), mMaxSubsteps(DEFAULT_MAX_SUBSTEPS), mStepStats(), mStepListeners(),
+        mQuantizedHeightfields(DEFAULT_QUANTIZED_HEIGHTFIELDS)
     {
         mTerrainMan = terrainMan;
-        // http://www.bulletphysics.org/Bullet/phpBB3/viewtopic.php?p=16731#p16731
-        // Use the btDbvtBroadphase instead of btAxisSweep3 to increase performance of adding/removing to the world
-        mBroadphase = new btAxisSweep3(btVector3(-10000, -10000, -10000), btVector3(10000, 10000, 10000), 1024);
-//         mBroadphase=new btDbvtBroadphase();
-        mCollisionConfig = new btDefaultCollisionConfiguration();
-        mDispatcher = new btCollisionDispatcher(mCollisionConfig);
-        mSolver = new btSequentialImpulseConstraintSolver();
 
+        u32 threadCount;
+        mTerrainMan->level()->engine()->config().getSetting(TerrainPhysicsManager::THREAD_COUNT_SETTING, threadCount, DEFAULT_THREAD_COUNT);
+        mTerrainMan->level()->engine()->config().getSetting(TerrainPhysicsManager::QUANTIZED_HEIGHTFIELDS_SETTING, mQuantizedHeightfields,
+                DEFAULT_QUANTIZED_HEIGHTFIELDS);
+        buildWorld(mWorldParts, threadCount);
+        mWorld = mWorldParts.world;
 
-        mWorld = new btDiscreteDynamicsWorld(mDispatcher, mBroadphase, mSolver, mCollisionConfig);
         mWorld->setGravity(BtOgre::Convert::toBullet(mTerrainMan->level()->gravity()));
+        mWorld->setInternalTickCallback(&TerrainPhysicsManager::preTickCallback, this, true);
 
         terrainMan->addTerrainManagerEventListener(this);
 
@@ -94,6 +226,120 @@ namespace Steel
             mWorld->setGravity(BtOgre::Convert::toBullet(gravity));
     }
 
+    bool TerrainPhysicsManager::buildWorld(WorldParts &parts, u32 threadCount)
+    {
+        bool multithreaded = threadCount > 1;
+
+        if(multithreaded)
+        {
+            if(nullptr == sTaskScheduler)
+                sTaskScheduler = btCreateDefaultTaskScheduler();
+
+            if(nullptr == sTaskScheduler)
+            {
+                Debug::warning(STEEL_METH_INTRO, "bullet was built without thread support, using a serial world instead of ",
+                               threadCount, " threads.").endl();
+                multithreaded = false;
+            }
+        }
+
+        // http://www.bulletphysics.org/Bullet/phpBB3/viewtopic.php?p=16731#p16731
+        // btDbvtBroadphase is faster to add to/remove from than btAxisSweep3, and has no fixed number of handles
+        // (a 1024 handles sweep overflows, unchecked in release builds, past 1024 bodies).
+        parts.broadphase = new btDbvtBroadphase();
+        parts.threadCount = 1;
+
+        if(multithreaded)
+        {
+            threadCount = std::min(threadCount, (u32) sTaskScheduler->getMaxNumThreads());
+            sTaskScheduler->setNumThreads((int) threadCount);
+            parts.threadCount = threadCount;
+            btSetTaskScheduler(sTaskScheduler);
+
+            // pools are shared between threads, make them large enough not to fall back on the (locked) heap
+            btDefaultCollisionConstructionInfo cci;
+            cci.m_defaultMaxPersistentManifoldPoolSize = 80000;
+            cci.m_defaultMaxCollisionAlgorithmPoolSize = 80000;
+            parts.collisionConfig = new btDefaultCollisionConfiguration(cci);
+            parts.dispatcher = new btCollisionDispatcherMt(parts.collisionConfig, 40);
+            parts.solverPool = new btConstraintSolverPoolMt((int) threadCount);
+            parts.solver = new btSequentialImpulseConstraintSolverMt();
+            parts.world = new btDiscreteDynamicsWorldMt(parts.dispatcher, parts.broadphase, parts.solverPool, parts.solver, parts.collisionConfig);
+            Debug::log(STEEL_METH_INTRO, "physics world running on ", threadCount, " threads.").endl();
+        }
+        else
+        {
+            parts.collisionConfig = new btDefaultCollisionConfiguration();
+            parts.dispatcher = new btCollisionDispatcher(parts.collisionConfig);
+            parts.solver = new btSequentialImpulseConstraintSolver();
+            parts.world = new btDiscreteDynamicsWorld(parts.dispatcher, parts.broadphase, parts.solver, parts.collisionConfig);
+        }
+
+        return multithreaded || threadCount <= 1;
+    }
+
+    void TerrainPhysicsManager::destroyWorld(WorldParts &parts)
+    {
+        STEEL_DELETE(parts.world);
+        STEEL_DELETE(parts.solver);
+        STEEL_DELETE(parts.solverPool);
+        STEEL_DELETE(parts.dispatcher);
+        STEEL_DELETE(parts.broadphase);
+        STEEL_DELETE(parts.collisionConfig);
+    }
+
+    void TerrainPhysicsManager::loadConfig(ConfigFile const &config)
+    {
+        float fixedTimestep;
+        config.getSetting(TerrainPhysicsManager::FIXED_TIMESTEP_SETTING, fixedTimestep, DEFAULT_FIXED_TIMESTEP);
+        setFixedTimestep(fixedTimestep);
+
+        u32 maxSubsteps;
+        config.getSetting(TerrainPhysicsManager::MAX_SUBSTEPS_SETTING, maxSubsteps, DEFAULT_MAX_SUBSTEPS);
+        setMaxSubsteps(maxSubsteps);
+    }
+
+    void TerrainPhysicsManager::setFixedTimestep(float value)
+    {
+        if(value <= .0f)
+        {
+            Debug::warning(STEEL_METH_INTRO, "invalid fixed timestep ", value, ", using ", DEFAULT_FIXED_TIMESTEP, " instead.").endl();
+            value = DEFAULT_FIXED_TIMESTEP;
+        }
+
+        mFixedTimestep = value;
+    }
+
+    void TerrainPhysicsManager::setMaxSubsteps(u32 value)
+    {
+        // 0 would make bullet switch to variable timestep
+        if(0 == value)
+        {
+            Debug::warning(STEEL_METH_INTRO, "max substeps can't be 0, using 1 instead.").endl();
+            value = 1;
+        }
+
+        mMaxSubsteps = value;
+    }
+
+    void TerrainPhysicsManager::addPhysicsStepListener(PhysicsStepListener *listener)
+    {
+        mStepListeners.insert(listener);
+    }
+
+    void TerrainPhysicsManager::removePhysicsStepListener(PhysicsStepListener *listener)
+    {
+        mStepListeners.erase(listener);
+    }
+
+    void TerrainPhysicsManager::preTickCallback(btDynamicsWorld *world, btScalar timeStep)
+    {
+        TerrainPhysicsManager *self = static_cast<TerrainPhysicsManager *>(world->getWorldUserInfo());
+
+        for(PhysicsStepListener *listener : self->mStepListeners)
+            listener->onPhysicsStep((float) timeStep);
+    }
+
     TerrainPhysicsManager::TerrainPhysicsManager(const TerrainPhysicsManager &o)
     {
         Debug::error("not implemented").endl().breakHere();
@@ -135,16 +381,8 @@ namespace Steel
                 delete obj;
             }
 
-            delete mWorld;
-            delete mSolver;
-            delete mDispatcher;
-            delete mBroadphase;
-            delete mCollisionConfig;
+            destroyWorld(mWorldParts);
             mWorld = nullptr;
-            mSolver = nullptr;
-            mDispatcher = nullptr;
-            mBroadphase = nullptr;
-            mCollisionConfig = nullptr;
         }
 
         mTerrainMan = nullptr;
@@ -211,41 +449,47 @@ namespace Steel
 
         // some const
         int side = ogreTerrain->getSize();
-        auto minHeight = ogreTerrain->getMinHeight(), maxHeight = ogreTerrain->getMaxHeight();
         float metersBetweenVertices = ogreTerrain->getWorldSize() / (ogreTerrain->getSize() - 1);
 
         // create and save the new terrain
         terrain = new TerrainPhysics();
         mTerrains[ogreTerrain] = terrain;
+        terrain->mMinHeight = ogreTerrain->getMinHeight();
+        terrain->mMaxHeight = ogreTerrain->getMaxHeight();
 
         // give it a bullet representation
-        btTransform transform = getOgreTerrainTransform(ogreTerrain);
+        float *shapeData = nullptr;
+        short *quantizedData = nullptr;
+        HeightfieldShape *shape = nullptr;
+
+        if(mQuantizedHeightfields)
+        {
+            padQuantizationRange(terrain->mMinHeight, terrain->mMaxHeight);
+            float const halfRange = .5f * (terrain->mMaxHeight - terrain->mMinHeight);
+            quantizedData = new short[side * side];
+            shape = new HeightfieldShape(side, quantizedData, quantizationScale(terrain->mMinHeight, terrain->mMaxHeight), -halfRange, halfRange);
+        }
+        else
+        {
+            shapeData = new float[side * side];
+            shape = new HeightfieldShape(side, shapeData, terrain->mMinHeight, terrain->mMaxHeight);
+        }
+
+        shape->setUseDiamondSubdivision(true);
+        shape->setLocalScaling(btVector3(metersBetweenVertices, 1.f, metersBetweenVertices));
+        btDefaultMotionState *motionState = new btDefaultMotionState(terrainTransform(ogreTerrain, terrain));
+
         btScalar mass(0.);
         btVector3 localInertia(0, 0, 0);
-        btRigidBody::btRigidBodyConstructionInfo rbInfo(mass,
-                terrain->mMotionState,
-                terrain->mTerrainShape,
-                localInertia);
-
-        float *shapeData = new float[side * side];
-        terrain->init(shapeData,
-                      new btHeightfieldTerrainShape(side, side,
-                              shapeData,
-                              1.f,
-                              minHeight, maxHeight,
-                              1, PHY_FLOAT, false),
-                      new btDefaultMotionState(transform),
-                      new btRigidBody(rbInfo)
-                     );
-        terrain->mTerrainShape->setUseDiamondSubdivision(true);
-        terrain->mTerrainShape->setLocalScaling(btVector3(metersBetweenVertices, 1.f, metersBetweenVertices));
+        btRigidBody::btRigidBodyConstructionInfo rbInfo(mass, motionState, shape, localInertia);
+        terrain->init(shapeData, quantizedData, shape, motionState, new btRigidBody(rbInfo));
+
         auto flags = btCollisionObject::CF_STATIC_OBJECT | btCollisionObject::CF_DISABLE_VISUALIZE_OBJECT;
         terrain->mBody->setCollisionFlags(terrain->mBody->getCollisionFlags() | flags);
 
-        updateHeightmap(ogreTerrain, terrain);
-
         //add the body to the dynamics world
         mWorld->addRigidBody(terrain->mBody);
+        updateHeightmap(ogreTerrain, terrain, Ogre::Rect(0, 0, side, side));
         return true;
     }
 
@@ -262,48 +506,104 @@ namespace Steel
         return transform;
     }
 
+    btTransform TerrainPhysicsManager::terrainTransform(Ogre::Terrain *oterrain, TerrainPhysics *pterrain)
+    {
+        btTransform transform;
+        transform.setIdentity();
+        // set origin to middle of heightfield
+        Ogre::Vector3 pos = oterrain->getPosition();
+        pos.y = (pterrain->mMaxHeight + pterrain->mMinHeight) / 2.f;
+        transform.setOrigin(BtOgre::Convert::toBullet(pos));
+        return transform;
+    }
+
     void TerrainPhysicsManager::updateHeightmap(Ogre::Terrain *oterrain)
+    {
+        long const side = oterrain->getSize();
+        updateHeightmap(oterrain, Ogre::Rect(0, 0, side, side));
+    }
+
+    void TerrainPhysicsManager::updateHeightmap(Ogre::Terrain *oterrain, Ogre::Rect const &rect)
     {
         TerrainPhysics *pterrain = getTerrainFor(oterrain);
 
         if(nullptr != pterrain)
-            updateHeightmap(oterrain, pterrain);
+            updateHeightmap(oterrain, pterrain, rect);
     }
 
-    void TerrainPhysicsManager::updateHeightmap(Ogre::Terrain *oterrain, TerrainPhysics *pterrain)
+    namespace
     {
-        // We need to mirror the ogre-height-data along the z axis
-        // This is related to how Ogre and Bullet differ in heighmap storing
+        /// Wakes up objects which broadphase AABB overlaps a box.
+        class WakeUpCallback: public btBroadphaseAabbCallback
+        {
+        public:
+            virtual bool process(const btBroadphaseProxy *proxy)
+            {
+                static_cast<btCollisionObject *>(proxy->m_clientObject)->activate(true);
+                return true;
+            }
+        };
+    }
 
-        auto minHeight = oterrain->getMinHeight(), maxHeight = oterrain->getMaxHeight();
-        int side = oterrain->getSize();
+    void TerrainPhysicsManager::updateHeightmap(Ogre::Terrain *oterrain, TerrainPhysics *pterrain, Ogre::Rect const &dirtyRect)
+    {
+        long const side = oterrain->getSize();
+        Ogre::Rect const rect(std::max(0L, dirtyRect.left), std::max(0L, dirtyRect.top),
+                              std::min(side, dirtyRect.right), std::min(side, dirtyRect.bottom));
+
+        if(rect.left >= rect.right || rect.top >= rect.bottom)
+            return;
 
-        float *physicsData = pterrain->mHeightfieldData;
-        float *pTerrainHeightData = oterrain->getHeightData();
+        float const *pTerrainHeightData = oterrain->getHeightData();
+        float rectMinHeight, rectMaxHeight;
+        heightRange(pTerrainHeightData, side, rect, rectMinHeight, rectMaxHeight);
+        Ogre::Rect copyRect = rect;
 
-        for(int i = 0; i < side; ++i)
+        // the shape is centered on its height range: moving it moves the body origin
+        if(rectMinHeight < pterrain->mMinHeight || rectMaxHeight > pterrain->mMaxHeight)
         {
-            memcpy(physicsData + side * i,
-                   pTerrainHeightData + side * (side - i - 1),
-                   sizeof(float) * (side));
-        }
+            pterrain->mMinHeight = std::min(pterrain->mMinHeight, rectMinHeight);
+            pterrain->mMaxHeight = std::max(pterrain->mMaxHeight, rectMaxHeight);
 
-        // set origin to middle of heightfield
-        btTransform transform;
-        transform.setIdentity();
-        Ogre::Vector3 pos = oterrain->getPosition();
-        pos.y = (maxHeight + minHeight) / 2.f;
-        transform.setOrigin(BtOgre::Convert::toBullet(pos));
-        transform.setRotation(BtOgre::Convert::toBullet(Ogre::Quaternion::IDENTITY));
-        pterrain->mMotionState->setWorldTransform(transform);
+            if(nullptr != pterrain->mQuantizedData)
+            {
+                // new quantization: all values change
+                padQuantizationRange(pterrain->mMinHeight, pterrain->mMaxHeight);
+                float const halfRange = .5f * (pterrain->mMaxHeight - pterrain->mMinHeight);
+                pterrain->mTerrainShape->setHeightScale(quantizationScale(pterrain->mMinHeight, pterrain->mMaxHeight));
+                pterrain->mTerrainShape->setHeightRange(-halfRange, halfRange);
+                copyRect = Ogre::Rect(0, 0, side, side);
+            }
+            else
+                pterrain->mTerrainShape->setHeightRange(pterrain->mMinHeight, pterrain->mMaxHeight);
 
-        // wake up rigbodies in the area
-        pterrain->mBody->activate(true);
-        auto objects = mWorld->getCollisionObjectArray();
+            btTransform const transform = terrainTransform(oterrain, pterrain);
+            pterrain->mMotionState->setWorldTransform(transform);
+            pterrain->mBody->setWorldTransform(transform);
+        }
 
-        for(auto i = 0; i < objects.size(); ++i)
-            objects[i]->activate(true);
+        if(nullptr != pterrain->mQuantizedData)
+            quantizeRows(pTerrainHeightData, pterrain->mQuantizedData, side, copyRect, pterrain->mMinHeight, pterrain->mMaxHeight);
+        else
+            copyRows(pTerrainHeightData, pterrain->mHeightfieldData, side, copyRect);
+
+        // detached terrain: nothing collides with it
+        if(!pterrain->mBody->isInWorld())
+            return;
+
+        mWorld->updateSingleAabb(pterrain->mBody);
+
+        // wake up rigbodies above the modified area
+        float const spacing = oterrain->getWorldSize() / (side - 1);
+        float const halfSide = (side - 1) / 2.f;
+        Ogre::Vector3 const pos = oterrain->getPosition();
+        // ogre rows go along -z
+        btVector3 const aabbMin(pos.x + (rect.left - halfSide) * spacing, pterrain->mMinHeight - 1.f, pos.z + (halfSide - (rect.bottom - 1)) * spacing);
+        btVector3 const aabbMax(pos.x + (rect.right - 1 - halfSide) * spacing, pterrain->mMaxHeight + 1.f, pos.z + (halfSide - rect.top) * spacing);
+        WakeUpCallback callback;
+        mWorld->getBroadphase()->aabbTest(aabbMin, aabbMax, callback);
     }
+
     bool TerrainPhysicsManager::removeTerrainFor(Ogre::Terrain *ogreTerrain)
     {
         auto it = mTerrains.find(ogreTerrain);
@@ -323,18 +623,53 @@ namespace Steel
 
     bool TerrainPhysicsManager::activateTerrainFor(Ogre::Terrain *ogreTerrain)
     {
+        TerrainPhysics *terrain = getTerrainFor(ogreTerrain);
+
+        if(nullptr == terrain)
+            return createTerrainFor(ogreTerrain);
+
+        if(!terrain->mBody->isInWorld())
+        {
+            // heights may have been modified while detached
+            mWorld->addRigidBody(terrain->mBody);
+            long const side = ogreTerrain->getSize();
+            updateHeightmap(ogreTerrain, terrain, Ogre::Rect(0, 0, side, side));
+        }
+
         return true;
     }
 
     bool TerrainPhysicsManager::deactivateTerrainFor(Ogre::Terrain *ogreTerrain)
     {
+        TerrainPhysics *terrain = getTerrainFor(ogreTerrain);
+
+        if(nullptr == terrain)
+        {
+            Debug::error(STEEL_METH_INTRO, "no such TerrainPhysics. Aborted.").endl();
+            return false;
+        }
+
+        if(terrain->mBody->isInWorld())
+            mWorld->removeRigidBody(terrain->mBody);
+
         return true;
     }
 
     void TerrainPhysicsManager::update(float timestep)
     {
-        if(nullptr != mWorld)
-            mWorld->stepSimulation(timestep, 10);
+        if(nullptr == mWorld)
+            return;
+
+        // bullet accumulates time and runs as many fixed substeps as it can, up to mMaxSubsteps.
+        // Time that does not fit is dropped. Motion states get interpolated transforms.
+        u32 const substeps = (u32) mWorld->stepSimulation(timestep, (int) mMaxSubsteps, mFixedTimestep);
+        u32 const runSubsteps = std::min(substeps, mMaxSubsteps);
+
+        mStepStats.lastSubsteps = runSubsteps;
+        mStepStats.peakSubsteps = std::max(mStepStats.peakSubsteps, runSubsteps);
+        mStepStats.totalSubsteps += runSubsteps;
+        mStepStats.droppedSubsteps += substeps - runSubsteps;
+        ++mStepStats.updateCount;
     }
 
     bool TerrainPhysicsManager::frameRenderingQueued(const Ogre::FrameEvent &evt)
@@ -353,5 +688,142 @@ namespace Steel
         return true;
     }
 
+    /////////////////////////////////////////////////////////////////////////////////////////////////////////////
+    // UNIT TESTS
+    bool utest_PhysicsThreadScaling(UnitTestExecutionContext const *context)
+    {
+        // fixed scene, so that runs can be compared: a grid of boxes falling on a plane and piling up.
+        u32 const side = 24, layers = 4;
+        u32 const warmupSteps = 60, measuredSteps = 300;
+        float const timestep = 1.f / 60.f;
+
+        u32 maxThreads = TerrainPhysicsManager::DEFAULT_THREAD_COUNT;
+        context->engine->config().getSetting("TerrainPhysicsManager::benchmarkMaxThreadCount", maxThreads, std::thread::hardware_concurrency());
+
+        btStaticPlaneShape groundShape(btVector3(0, 1, 0), 0);
+        btBoxShape boxShape(btVector3(.5f, .5f, .5f));
+        btVector3 boxInertia(0, 0, 0);
+        boxShape.calculateLocalInertia(1.f, boxInertia);
+
+        // the task scheduler is global, give it back as we found it
+        btITaskScheduler *const previousScheduler = btGetTaskScheduler();
+        int const previousThreadCount = previousScheduler->getNumThreads();
+
+        Debug::log(STEEL_METH_INTRO, side * side * layers, " bodies, ", measuredSteps, " steps:").endl().indent();
+
+        for(u32 threadCount = 1; threadCount <= std::max(1U, maxThreads); threadCount *= 2)
+        {
+            TerrainPhysicsManager::WorldParts parts;
+
+            if(!TerrainPhysicsManager::buildWorld(parts, threadCount))
+            {
+                TerrainPhysicsManager::destroyWorld(parts);
+                break;
+            }
+
+            parts.world->setGravity(btVector3(0, -9.81f, 0));
+
+            std::vector<btRigidBody *> bodies;
+            bodies.push_back(new btRigidBody(btRigidBody::btRigidBodyConstructionInfo(0.f, nullptr, &groundShape)));
+
+            for(u32 y = 0; y < layers; ++y)
+                for(u32 x = 0; x < side; ++x)
+                    for(u32 z = 0; z < side; ++z)
+                    {
+                        btRigidBody::btRigidBodyConstructionInfo info(1.f, nullptr, &boxShape, boxInertia);
+                        // slight offset per layer so that piles topple
+                        info.m_startWorldTransform.setOrigin(btVector3(x * 1.1f + y * .2f, 1.f + y * 1.5f, z * 1.1f + y * .2f));
+                        bodies.push_back(new btRigidBody(info));
+                    }
+
+            for(btRigidBody *body : bodies)
+                parts.world->addRigidBody(body);
+
+            for(u32 i = 0; i < warmupSteps; ++i)
+                parts.world->stepSimulation(timestep, 1, timestep);
+
+            Ogre::Timer timer;
+
+            for(u32 i = 0; i < measuredSteps; ++i)
+                parts.world->stepSimulation(timestep, 1, timestep);
+
+            double const msPerStep = timer.getMicroseconds() / 1000. / measuredSteps;
+            Debug::log(parts.threadCount, " thread(s): ", msPerStep, "ms/step").endl();
+            // bullet has no more threads to give
+            bool const clamped = parts.threadCount < threadCount;
+
+            for(btRigidBody *body : bodies)
+            {
+                parts.world->removeRigidBody(body);
+                delete body;
+            }
+
+            TerrainPhysicsManager::destroyWorld(parts);
+
+            if(clamped)
+                break;
+        }
+
+        Debug::log.unIndent();
+
+        previousScheduler->setNumThreads(previousThreadCount);
+        btSetTaskScheduler(previousScheduler);
+        return true;
+    }
+
+
+    bool utest_QuantizedHeightfield(UnitTestExecutionContext const *context)
+    {
+        long const side = 129;
+        std::vector<float> heights(side * side);
+
+        for(long i = 0; i < side * side; ++i)
+            heights[i] = 40.f * std::sin(i * .37f) + .013f * (i % 97) - 100.f;
+
+        Ogre::Rect const all(0, 0, side, side);
+        float minHeight, maxHeight;
+        heightRange(heights.data(), side, all, minHeight, maxHeight);
+        padQuantizationRange(minHeight, maxHeight);
+
+        std::vector<short> quantized(side * side);
+        float const halfRange = .5f * (maxHeight - minHeight), mid = .5f * (minHeight + maxHeight);
+        TerrainPhysicsManager::HeightfieldShape shape(side, quantized.data(), quantizationScale(minHeight, maxHeight), -halfRange, halfRange);
+        quantizeRows(heights.data(), quantized.data(), side, all, minHeight, maxHeight);
+
+        // rounding: half a step, plus float precision at these heights
+        float const maxError = .5f * quantizationScale(minHeight, maxHeight) + 1e-4f;
+        auto check = [&](char const * step)
+        {
+            for(long z = 0; z < side; ++z)
+            {
+                for(long x = 0; x < side; ++x)
+                {
+                    // bullet rows are mirrored
+                    float const error = std::abs(shape.rawHeight(x, side - 1 - z) + mid - heights[z * side + x]);
+
+                    if(error > maxError)
+                    {
+                        Debug::error(STEEL_METH_INTRO, step, ": error of ", error, " at ", x, "x", z, ", max is ", maxError).endl();
+                        return false;
+                    }
+                }
+            }
+
+            return true;
+        };
+
+        if(!check("initial quantization"))
+            return false;
+
+        // within range: only the rectangle is requantized
+        Ogre::Rect const rect(17, 30, 61, 45);
+
+        for(long z = rect.top; z < rect.bottom; ++z)
+            for(long x = rect.left; x < rect.right; ++x)
+                heights[z * side + x] += 3.3f;
+
+        quantizeRows(heights.data(), quantized.data(), side, rect, minHeight, maxHeight);
+        return check("dirty rectangle");
+    }
 }
 // kate: indent-mode cstyle; indent-width 4; replace-tabs on; 
@@ -1,14 +1,30 @@
 #include "tests/UnitTestManager.h"
 #include <Debug.h>
+#include "Level.h"
 
 #include "InputSystem/InputBuffer.h"
 #include <InputSystem/Action.h>
 #include <InputSystem/ActionCombo.h>
+#include "tools/BinaryLevelFile.h"
 #include "tools/ConfigFile.h"
+#include "tools/JsonRecordPrefetcher.h"
+#include "tools/JsonStreamReader.h"
+#include "tools/JsonStreamWriter.h"
+#include "tools/LevelJournal.h"
+#include "tools/LevelSnapshotWriter.h"
 #include "tools/StringUtils.h"
 #include "BT/BTShapeManager.h"
 #include "BT/BTStateStream.h"
 #include "models/BTModel.h"
+#include "models/PhysicsModelManager.h"
+#include "models/PhysicsSnapshot.h"
+#include "models/ShapeCooker.h"
+#include "models/StepForcesBatch.h"
+#include "terrain/TerrainBrush.h"
+#include "terrain/TerrainHeightSampler.h"
+#include "terrain/TerrainManager.h"
+#include "terrain/TerrainPager.h"
+#include "terrain/TerrainPhysicsManager.h"
 
 namespace Steel
 {
@@ -31,8 +47,41 @@ namespace Steel
         addTest(&utest_InputBufferMain, "Steel.init", "InputBuffer");
         addTest(&utest_BTShapeStream, "Steel.init", "BTShapeStream");
         addTest(&utest_BTStateStream, "Steel.init", "BTStateStream");
+        addTest(&utest_TerrainBrush, "Steel.init", "TerrainBrush");
+        addTest(&utest_PhysicsQueries, "Steel.init", "PhysicsQueries");
+        addTest(&utest_PhysicsSnapshot, "Steel.init", "PhysicsSnapshot");
+        addTest(&utest_ShapeCooker, "Steel.init", "ShapeCooker");
+        addTest(&utest_QuantizedHeightfield, "Steel.init", "QuantizedHeightfield");
+        addTest(&utest_BlendMapRules, "Steel.init", "BlendMapRules");
+        addTest(&utest_TerrainHeightSampler, "Steel.init", "TerrainHeightSampler");
+        addTest(&utest_TerrainRayPyramid, "Steel.init", "TerrainRayPyramid");
+        addTest(&utest_BinaryLevelFile, "Steel.init", "BinaryLevelFile");
+        addTest(&utest_JsonStreamWriter, "Steel.init", "JsonStreamWriter");
+        addTest(&utest_JsonStreamReader, "Steel.init", "JsonStreamReader");
+        addTest(&utest_JsonRecordPrefetcher, "Steel.init", "JsonRecordPrefetcher");
+        addTest(&utest_LevelSnapshotWriter, "Steel.init", "LevelSnapshotWriter");
+        addTest(&utest_LevelJournal, "Steel.init", "LevelJournal");
+        addTest(&utest_LevelDirtyTracking, "Steel.init", "LevelDirtyTracking");
         
         addTest(&utest_BTrees, "Steel.debugLevel", "BTrees");
+
+        // not run at init, see Engine command "utests"
+        addTest(&utest_PhysicsThreadScaling, "Steel.benchmark", "PhysicsThreadScaling");
+        addTest(&utest_StepForcesBatchThroughput, "Steel.benchmark", "StepForcesBatchThroughput");
+        addTest(&utest_PhysicsQueriesThroughput, "Steel.benchmark", "PhysicsQueriesThroughput");
+        addTest(&utest_PhysicsSnapshotSpeed, "Steel.benchmark", "PhysicsSnapshotSpeed");
+        addTest(&utest_TerrainHeightSamplerThroughput, "Steel.benchmark", "TerrainHeightSamplerThroughput");
+        addTest(&utest_TerrainPagerStartup, "Steel.benchmark", "TerrainPagerStartup");
+        addTest(&utest_TerrainBrushSpeed, "Steel.benchmark", "TerrainBrushSpeed");
+        addTest(&utest_BlendMapRulesSpeed, "Steel.benchmark", "BlendMapRulesSpeed");
+        addTest(&utest_BinaryLevelFileSpeed, "Steel.benchmark", "BinaryLevelFileSpeed");
+        addTest(&utest_JsonStreamWriterSpeed, "Steel.benchmark", "JsonStreamWriterSpeed");
+        addTest(&utest_JsonStreamReaderSpeed, "Steel.benchmark", "JsonStreamReaderSpeed");
+        addTest(&utest_JsonRecordPrefetcherSpeed, "Steel.benchmark", "JsonRecordPrefetcherSpeed");
+        addTest(&utest_LevelSnapshotWriterSpeed, "Steel.benchmark", "LevelSnapshotWriterSpeed");
+        addTest(&utest_LevelJournalSpeed, "Steel.benchmark", "LevelJournalSpeed");
+        addTest(&utest_LevelIncrementalSaveSpeed, "Steel.benchmark", "LevelIncrementalSaveSpeed");
+        addTest(&utest_LevelAutosaveSpeed, "Steel.benchmark", "LevelAutosaveSpeed");
     }
 
     UnitTestManager::~UnitTestManager()
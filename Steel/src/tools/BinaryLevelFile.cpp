@@ -0,0 +1,1307 @@
+#include "tools/BinaryLevelFile.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <OgreTimer.h>
+#include <Poco/Path.h>
+
+#include "Debug.h"
+#include "tools/JsonUtils.h"
+#include "tools/StringUtils.h"
+#include "tests/UnitTestManager.h"
+
+namespace Steel
+{
+    u32 const BinaryLevelFile::MAGIC = 0x424c5453; // "STLB"
+    u32 const BinaryLevelFile::VERSION = 3;
+
+    char const *const BinaryLevelFile::LEVEL_SECTION = "level";
+    char const *const BinaryLevelFile::AGENTS_SECTION = "agents";
+    char const *const BinaryLevelFile::MANAGERS_SECTION_PREFIX = "managers/";
+
+    namespace
+    {
+        /// Level root keys split into their own sections (see Level::AGENTS_ATTRIBUTE and Level::MANAGERS_ATTRIBUTE).
+        char const *const AGENTS_KEY = "agents";
+        char const *const MANAGERS_KEY = "managers";
+
+        u32 const BYTE_ORDER_MARKER = 0x01020304;
+        size_t const HEADER_SIZE = 4 * sizeof(u32);
+        size_t const SECTION_ENTRY_SIZE = 2 * sizeof(u32) + 3 * sizeof(u64);
+        size_t const RECORD_ENTRY_SIZE = 3 * sizeof(u64);
+        /// Deeper values are considered corrupted (keeps decoding off the end of the stack).
+        u32 const MAX_DEPTH = 256;
+        /// Files of that version have generic records only.
+        u32 const UNTYPED_RECORDS_VERSION = 1;
+
+        enum ValueTag : u8
+        {
+            NULL_TAG = 0,
+            FALSE_TAG,
+            TRUE_TAG,
+            INT_TAG,
+            UINT_TAG,
+            REAL_TAG,
+            STRING_TAG,
+            ARRAY_TAG,
+            OBJECT_TAG
+        };
+
+        template<class T>
+        void put(std::string &bytes, T value)
+        {
+            bytes.append(reinterpret_cast<char const *>(&value), sizeof(T));
+        }
+
+        template<class T>
+        void putAt(std::string &bytes, size_t pos, T value)
+        {
+            memcpy(&bytes[pos], &value, sizeof(T));
+        }
+
+        void putString(std::string &bytes, std::string const &s)
+        {
+            put<u32>(bytes, (u32) s.size());
+            bytes.append(s);
+        }
+
+        void encode(Json::Value const &value, std::string &bytes)
+        {
+            switch(value.type())
+            {
+                case Json::nullValue:
+                    put<u8>(bytes, NULL_TAG);
+                    break;
+
+                case Json::booleanValue:
+                    put<u8>(bytes, value.asBool() ? TRUE_TAG : FALSE_TAG);
+                    break;
+
+                case Json::intValue:
+                    put<u8>(bytes, INT_TAG);
+                    put<s64>(bytes, (s64) value.asLargestInt());
+                    break;
+
+                case Json::uintValue:
+                    put<u8>(bytes, UINT_TAG);
+                    put<u64>(bytes, (u64) value.asLargestUInt());
+                    break;
+
+                case Json::realValue:
+                    put<u8>(bytes, REAL_TAG);
+                    put<double>(bytes, value.asDouble());
+                    break;
+
+                case Json::stringValue:
+                    put<u8>(bytes, STRING_TAG);
+                    putString(bytes, value.asString());
+                    break;
+
+                case Json::arrayValue:
+                    put<u8>(bytes, ARRAY_TAG);
+                    put<u32>(bytes, value.size());
+
+                    for(Json::ArrayIndex i = 0; i < value.size(); ++i)
+                        encode(value[i], bytes);
+
+                    break;
+
+                case Json::objectValue:
+                    put<u8>(bytes, OBJECT_TAG);
+                    put<u32>(bytes, value.size());
+
+                    for(Json::ValueConstIterator it = value.begin(); it != value.end(); ++it)
+                    {
+                        putString(bytes, it.memberName());
+                        encode(*it, bytes);
+                    }
+
+                    break;
+            }
+        }
+
+        /// Values of another form, or that would not format back the same way, are kept as generic values.
+        enum class FieldType : u8
+        {
+            /// Model id, as a decimal string or an unsigned int. Stored as u64.
+            ID = 0,
+            /// "x y z", stored as 3 f32.
+            VECTOR3,
+            /// "w x y z", stored as 4 f32.
+            QUATERNION,
+            /// Real number or numeric string, stored as f64.
+            REAL,
+            /// Bool or "true"/"false", stored as u8.
+            BOOL
+        };
+
+        size_t fieldSize(FieldType type)
+        {
+            switch(type)
+            {
+                case FieldType::ID:
+                    return sizeof(u64);
+
+                case FieldType::VECTOR3:
+                    return 3 * sizeof(f32);
+
+                case FieldType::QUATERNION:
+                    return 4 * sizeof(f32);
+
+                case FieldType::REAL:
+                    return sizeof(f64);
+
+                case FieldType::BOOL:
+                    return sizeof(u8);
+            }
+
+            return 0;
+        }
+
+        /// Parses exactly count space separated reals.
+        bool parseReals(std::string const &s, size_t count, f32 *reals)
+        {
+            char const *pos = s.c_str();
+
+            for(size_t i = 0; i < count; ++i)
+            {
+                char *end = nullptr;
+                reals[i] = std::strtof(pos, &end);
+
+                if(end == pos || (i + 1 < count && ' ' != *end))
+                    return false;
+
+                pos = end;
+            }
+
+            return '\0' == *pos;
+        }
+
+        /// Space separated, as Ogre::StringConverter formats them (6 significant digits).
+        template<class T>
+        std::string formatReals(T const *reals, size_t count)
+        {
+            std::string s;
+            char buffer[32];
+
+            for(size_t i = 0; i < count; ++i)
+            {
+                int const size = snprintf(buffer, sizeof(buffer), "%g", (double) reals[i]);
+
+                if(i > 0)
+                    s += ' ';
+
+                s.append(buffer, (size_t) std::max(0, size));
+            }
+
+            return s;
+        }
+
+        /// Bounds checked decoding over a byte range.
+        class Reader
+        {
+        public:
+            Reader(char const *begin, char const *end): mPos(begin), mEnd(end), mOk(true) {}
+
+            template<class T>
+            T get()
+            {
+                T value = T();
+
+                if(!mOk || (size_t)(mEnd - mPos) < sizeof(T))
+                {
+                    mOk = false;
+                    return value;
+                }
+
+                memcpy(&value, mPos, sizeof(T));
+                mPos += sizeof(T);
+                return value;
+            }
+
+            bool getString(std::string &s)
+            {
+                u32 const size = get<u32>();
+
+                if(!mOk || (size_t)(mEnd - mPos) < size)
+                    return mOk = false;
+
+                s.assign(mPos, size);
+                mPos += size;
+                return true;
+            }
+
+            bool decode(Json::Value &value, u32 depth = 0)
+            {
+                if(depth > MAX_DEPTH)
+                    return mOk = false;
+
+                switch(get<u8>())
+                {
+                    case NULL_TAG:
+                        value = Json::Value();
+                        break;
+
+                    case FALSE_TAG:
+                        value = Json::Value(false);
+                        break;
+
+                    case TRUE_TAG:
+                        value = Json::Value(true);
+                        break;
+
+                    case INT_TAG:
+                        value = Json::Value((Json::Value::LargestInt) get<s64>());
+                        break;
+
+                    case UINT_TAG:
+                        value = Json::Value((Json::Value::LargestUInt) get<u64>());
+                        break;
+
+                    case REAL_TAG:
+                        value = Json::Value(get<double>());
+                        break;
+
+                    case STRING_TAG:
+                    {
+                        std::string s;
+
+                        if(getString(s))
+                            value = Json::Value(s);
+
+                        break;
+                    }
+
+                    case ARRAY_TAG:
+                    {
+                        u32 const size = get<u32>();
+
+                        // each item takes at least a byte
+                        if(!mOk || (size_t)(mEnd - mPos) < size)
+                            return mOk = false;
+
+                        value = Json::Value(Json::arrayValue);
+
+                        if(size > 0)
+                            value.resize(size);
+
+                        for(u32 i = 0; i < size && mOk; ++i)
+                            decode(value[i], depth + 1);
+
+                        break;
+                    }
+
+                    case OBJECT_TAG:
+                    {
+                        u32 const size = get<u32>();
+                        value = Json::Value(Json::objectValue);
+                        std::string key;
+
+                        for(u32 i = 0; i < size && mOk; ++i)
+                        {
+                            if(getString(key))
+                                decode(value[key], depth + 1);
+                        }
+
+                        break;
+                    }
+
+                    default:
+                        mOk = false;
+                }
+
+                return mOk;
+            }
+
+            inline bool ok() const {return mOk;}
+
+        private:
+            char const *mPos;
+            char const *mEnd;
+            bool mOk;
+        };
+
+        /// Parses a record key. Only keys that format back the same way are ids, so that conversions are lossless.
+        bool parseId(std::string const &key, u64 &id)
+        {
+            if(key.empty() || key.size() > 20 || (key.size() > 1 && '0' == key[0]))
+                return false;
+
+            for(char c : key)
+            {
+                if(c < '0' || c > '9')
+                    return false;
+            }
+
+            id = std::strtoull(key.c_str(), nullptr, 10);
+            return std::to_string(id) == key;
+        }
+
+        bool isKeyedByIds(Json::Value const &value)
+        {
+            if(!value.isObject())
+                return false;
+
+            u64 id;
+
+            for(Json::ValueConstIterator it = value.begin(); it != value.end(); ++it)
+            {
+                if(!parseId(it.memberName(), id))
+                    return false;
+            }
+
+            return true;
+        }
+    }
+
+    class BinaryLevelFile::RecordLayout
+    {
+    public:
+        class Field
+        {
+        public:
+            Ogre::String key;
+            FieldType type;
+            /// From the start of the record.
+            size_t offset;
+        };
+
+        RecordLayout(std::vector<std::pair<Ogre::String, FieldType> > const &fieldTypes): fields(), size(2 * sizeof(u32))
+        {
+            for(auto const & field : fieldTypes)
+            {
+                fields.push_back({field.first, field.second, size});
+                size += fieldSize(field.second);
+            }
+        }
+
+        /// Layout of the given section's records, or nullptr.
+        static RecordLayout const *of(Ogre::String const &sectionName);
+
+        /// Appends the typed fields of value, then the other ones as a generic object. read gives value back exactly.
+        void write(Json::Value const &value, std::string &bytes) const;
+        /// Inverse of write.
+        bool read(char const *begin, char const *end, Json::Value &value) const;
+
+        std::vector<Field> fields;
+        /// Of the typed part.
+        size_t size;
+    };
+
+    BinaryLevelFile::RecordLayout const *BinaryLevelFile::RecordLayout::of(Ogre::String const &sectionName)
+    {
+        // model ids of agents (see Agent::toJson)
+        static RecordLayout const agents([]()
+        {
+            std::vector<std::pair<Ogre::String, FieldType> > fields;
+
+            for(auto modelTypeInt = toIntegral(ModelType::FIRST); modelTypeInt != toIntegral(ModelType::LAST); ++modelTypeInt)
+                fields.push_back({toString((ModelType) modelTypeInt), FieldType::ID});
+
+            return fields;
+        }());
+        // see OgreModel::toJson
+        static RecordLayout const ogreModels({{"position", FieldType::VECTOR3}, {"rotation", FieldType::QUATERNION}, {"scale", FieldType::VECTOR3}});
+        // see PhysicsModel::toJson
+        static RecordLayout const physicsModels({{"mass", FieldType::REAL}, {"friction", FieldType::REAL}, {"damping", FieldType::REAL},
+            {"rotationFactor", FieldType::REAL}, {"keepVerticalFactor", FieldType::REAL}, {"levitate", FieldType::BOOL}, {"ghost", FieldType::BOOL}
+        });
+
+        if(AGENTS_SECTION == sectionName)
+            return &agents;
+
+        if(Ogre::String(MANAGERS_SECTION_PREFIX) + toString(ModelType::OGRE) == sectionName)
+            return &ogreModels;
+
+        if(Ogre::String(MANAGERS_SECTION_PREFIX) + toString(ModelType::PHYSICS) == sectionName)
+            return &physicsModels;
+
+        return nullptr;
+    }
+
+    void BinaryLevelFile::RecordLayout::write(Json::Value const &value, std::string &bytes) const
+    {
+        size_t const start = bytes.size();
+        bytes.resize(start + size, '\0');
+        u32 mask = 0;
+        // typed fields that were strings, formatted back when read
+        u32 textMask = 0;
+        u32 typedCount = 0;
+
+        for(size_t i = 0; i < fields.size() && value.isObject(); ++i)
+        {
+            Field const &field = fields[i];
+            Json::Value const &fieldValue = value[field.key];
+            size_t const pos = start + field.offset;
+            bool typed = false;
+            bool const text = fieldValue.isString();
+
+            switch(field.type)
+            {
+                case FieldType::ID:
+                {
+                    u64 id = 0;
+
+                    if(text)
+                        typed = parseId(fieldValue.asString(), id);
+                    else if((typed = Json::uintValue == fieldValue.type()))
+                        id = fieldValue.asLargestUInt();
+
+                    if(typed)
+                        putAt<u64>(bytes, pos, id);
+
+                    break;
+                }
+
+                case FieldType::VECTOR3:
+                case FieldType::QUATERNION:
+                {
+                    size_t const count = FieldType::VECTOR3 == field.type ? 3 : 4;
+                    f32 reals[4];
+
+                    if((typed = text && parseReals(fieldValue.asString(), count, reals) && formatReals(reals, count) == fieldValue.asString()))
+                        memcpy(&bytes[pos], reals, count * sizeof(f32));
+
+                    break;
+                }
+
+                case FieldType::REAL:
+                {
+                    f64 real = .0;
+
+                    if(text)
+                    {
+                        char const *begin = fieldValue.asCString();
+                        char *end = nullptr;
+                        real = std::strtod(begin, &end);
+                        typed = end != begin && '\0' == *end && formatReals(&real, 1) == fieldValue.asString();
+                    }
+                    else if((typed = Json::realValue == fieldValue.type()))
+                        real = fieldValue.asDouble();
+
+                    if(typed)
+                        putAt<f64>(bytes, pos, real);
+
+                    break;
+                }
+
+                case FieldType::BOOL:
+                {
+                    Ogre::String const text = fieldValue.isString() ? fieldValue.asString() : StringUtils::BLANK;
+
+                    if((typed = fieldValue.isBool() || "true" == text || "false" == text))
+                        putAt<u8>(bytes, pos, fieldValue.isBool() ? fieldValue.asBool() : "true" == text);
+
+                    break;
+                }
+            }
+
+            if(typed)
+            {
+                mask |= 1U << i;
+                textMask |= text ? 1U << i : 0U;
+                ++typedCount;
+            }
+        }
+
+        putAt<u32>(bytes, start, mask);
+        putAt<u32>(bytes, start + sizeof(u32), textMask);
+
+        if(0 == mask)
+        {
+            encode(value, bytes);
+            return;
+        }
+
+        // other fields, as encode would write them
+        put<u8>(bytes, OBJECT_TAG);
+        put<u32>(bytes, value.size() - typedCount);
+
+        for(Json::ValueConstIterator it = value.begin(); it != value.end(); ++it)
+        {
+            Ogre::String const key = it.memberName();
+            bool typed = false;
+
+            for(size_t i = 0; i < fields.size() && !typed; ++i)
+                typed = 0 != (mask & (1U << i)) && fields[i].key == key;
+
+            if(!typed)
+            {
+                putString(bytes, key);
+                encode(*it, bytes);
+            }
+        }
+    }
+
+    bool BinaryLevelFile::RecordLayout::read(char const *begin, char const *end, Json::Value &value) const
+    {
+        if((size_t)(end - begin) < size)
+            return false;
+
+        u32 mask, textMask;
+        memcpy(&mask, begin, sizeof(u32));
+        memcpy(&textMask, begin + sizeof(u32), sizeof(u32));
+        Reader reader(begin + size, end);
+
+        if(!reader.decode(value) || (0 != mask && !value.isObject()))
+            return false;
+
+        for(size_t i = 0; i < fields.size(); ++i)
+        {
+            if(0 == (mask & (1U << i)))
+                continue;
+
+            Field const &field = fields[i];
+            char const *const pos = begin + field.offset;
+            Json::Value &fieldValue = value[field.key];
+            bool const text = 0 != (textMask & (1U << i));
+
+            switch(field.type)
+            {
+                case FieldType::ID:
+                {
+                    u64 id;
+                    memcpy(&id, pos, sizeof(u64));
+                    fieldValue = text ? Json::Value(std::to_string(id)) : Json::Value((Json::Value::LargestUInt) id);
+                    break;
+                }
+
+                case FieldType::VECTOR3:
+                case FieldType::QUATERNION:
+                {
+                    size_t const count = FieldType::VECTOR3 == field.type ? 3 : 4;
+                    f32 reals[4];
+                    memcpy(reals, pos, count * sizeof(f32));
+                    fieldValue = formatReals(reals, count);
+                    break;
+                }
+
+                case FieldType::REAL:
+                {
+                    f64 real;
+                    memcpy(&real, pos, sizeof(f64));
+                    fieldValue = text ? Json::Value(formatReals(&real, 1)) : Json::Value(real);
+                    break;
+                }
+
+                case FieldType::BOOL:
+                    fieldValue = text ? Json::Value(0 != *pos ? "true" : "false") : Json::Value(0 != *pos);
+                    break;
+            }
+        }
+
+        return true;
+    }
+
+    namespace
+    {
+        class PendingSection
+        {
+        public:
+            Ogre::String name;
+            BinaryLevelFile::SectionKind kind;
+            std::string data;
+        };
+
+        void makeSection(Ogre::String const &name, Json::Value const &value, std::vector<PendingSection> &sections)
+        {
+            sections.push_back(PendingSection());
+            PendingSection &section = sections.back();
+            section.name = name;
+
+            if(!isKeyedByIds(value))
+            {
+                section.kind = BinaryLevelFile::SectionKind::TREE;
+                encode(value, section.data);
+                return;
+            }
+
+            section.kind = BinaryLevelFile::SectionKind::RECORDS;
+            BinaryLevelFile::RecordLayout const *const layout = BinaryLevelFile::RecordLayout::of(name);
+            std::string &data = section.data;
+            put<u64>(data, value.size());
+            size_t const table = data.size();
+            data.resize(table + value.size() * RECORD_ENTRY_SIZE);
+
+            size_t i = 0;
+
+            for(Json::ValueConstIterator it = value.begin(); it != value.end(); ++it, ++i)
+            {
+                u64 id = 0;
+                parseId(it.memberName(), id);
+                size_t const offset = data.size();
+
+                if(nullptr == layout)
+                    encode(*it, data);
+                else
+                    layout->write(*it, data);
+
+                size_t const entry = table + i * RECORD_ENTRY_SIZE;
+                putAt<u64>(data, entry, id);
+                putAt<u64>(data, entry + sizeof(u64), offset);
+                putAt<u64>(data, entry + 2 * sizeof(u64), data.size() - offset);
+            }
+        }
+
+        bool readWholeFile(Ogre::String const &path, std::vector<char> &buffer)
+        {
+            std::ifstream file(path.c_str(), std::ios::in | std::ios::binary | std::ios::ate);
+
+            if(!file.is_open())
+                return false;
+
+            buffer.resize((size_t) file.tellg());
+            file.seekg(0);
+            file.read(buffer.data(), buffer.size());
+            return file.good();
+        }
+    }
+
+    BinaryLevelFile::BinaryLevelFile(): mData(nullptr), mSize(0), mMapped(false), mBuffer(), mSections()
+    {
+    }
+
+    BinaryLevelFile::~BinaryLevelFile()
+    {
+        close();
+    }
+
+    bool BinaryLevelFile::open(Ogre::String const &path)
+    {
+        close();
+
+#if !defined(_WIN32)
+        int fd = ::open(path.c_str(), O_RDONLY);
+
+        if(fd < 0)
+        {
+            Debug::error(STEEL_METH_INTRO, "could not open ", path).endl();
+            return false;
+        }
+
+        struct stat st;
+
+        if(0 == fstat(fd, &st) && st.st_size > 0)
+        {
+            void *data = mmap(nullptr, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+            if(MAP_FAILED != data)
+            {
+                mData = static_cast<char const *>(data);
+                mSize = (size_t) st.st_size;
+                mMapped = true;
+            }
+        }
+
+        ::close(fd);
+#endif
+
+        if(!mMapped)
+        {
+            if(!readWholeFile(path, mBuffer))
+            {
+                Debug::error(STEEL_METH_INTRO, "could not read ", path).endl();
+                close();
+                return false;
+            }
+
+            mData = mBuffer.data();
+            mSize = mBuffer.size();
+        }
+
+        if(!parseHeader())
+        {
+            Debug::error(STEEL_METH_INTRO, path, " is not a valid binary level file.").endl();
+            close();
+            return false;
+        }
+
+        return true;
+    }
+
+    bool BinaryLevelFile::open(char const *data, size_t size)
+    {
+        close();
+        mData = data;
+        mSize = size;
+
+        if(!parseHeader())
+        {
+            close();
+            return false;
+        }
+
+        return true;
+    }
+
+    void BinaryLevelFile::close()
+    {
+#if !defined(_WIN32)
+
+        if(mMapped)
+            munmap(const_cast<char *>(mData), mSize);
+
+#endif
+        mData = nullptr;
+        mSize = 0;
+        mMapped = false;
+        mBuffer.clear();
+        mSections.clear();
+    }
+
+    bool BinaryLevelFile::parseHeader()
+    {
+        Reader reader(mData, mData + mSize);
+        u32 const magic = reader.get<u32>();
+        u32 const version = reader.get<u32>();
+        u32 const marker = reader.get<u32>();
+        u32 const count = reader.get<u32>();
+
+        if(!reader.ok() || MAGIC != magic)
+        {
+            Debug::error(STEEL_METH_INTRO, "bad magic number.").endl();
+            return false;
+        }
+
+        if(BYTE_ORDER_MARKER != marker)
+        {
+            Debug::error(STEEL_METH_INTRO, "file was written with another byte order.").endl();
+            return false;
+        }
+
+        if(VERSION != version && UNTYPED_RECORDS_VERSION != version)
+        {
+            Debug::error(STEEL_METH_INTRO, "unsupported version ", version, " (expected ", VERSION, ").").endl();
+            return false;
+        }
+
+        if((mSize - HEADER_SIZE) / SECTION_ENTRY_SIZE < count)
+        {
+            Debug::error(STEEL_METH_INTRO, "truncated section table.").endl();
+            return false;
+        }
+
+        mSections.resize(count);
+
+        for(Section &section : mSections)
+        {
+            u32 const kind = reader.get<u32>();
+            u32 const nameSize = reader.get<u32>();
+            u64 const nameOffset = reader.get<u64>();
+            section.offset = reader.get<u64>();
+            section.size = reader.get<u64>();
+            section.recordCount = 0;
+            section.layout = nullptr;
+
+            if(kind > (u32) SectionKind::RECORDS
+                    || nameOffset > mSize || nameSize > mSize - nameOffset
+                    || section.offset > mSize || section.size > mSize - section.offset)
+            {
+                Debug::error(STEEL_METH_INTRO, "section out of bounds.").endl();
+                return false;
+            }
+
+            section.kind = (SectionKind) kind;
+            section.name.assign(mData + nameOffset, nameSize);
+
+            if(SectionKind::RECORDS == section.kind)
+            {
+                Reader records(mData + section.offset, mData + section.offset + section.size);
+                section.recordCount = records.get<u64>();
+
+                if(UNTYPED_RECORDS_VERSION != version)
+                    section.layout = RecordLayout::of(section.name);
+
+                if(!records.ok() || (section.size - sizeof(u64)) / RECORD_ENTRY_SIZE < section.recordCount)
+                {
+                    Debug::error(STEEL_METH_INTRO, "truncated records table in section ", section.name).endl();
+                    return false;
+                }
+            }
+        }
+
+        return true;
+    }
+
+    BinaryLevelFile::Section const *BinaryLevelFile::section(Ogre::String const &name) const
+    {
+        for(Section const & section : mSections)
+        {
+            if(section.name == name)
+                return &section;
+        }
+
+        return nullptr;
+    }
+
+    bool BinaryLevelFile::readSection(Section const &section, Json::Value &value) const
+    {
+        if(SectionKind::TREE == section.kind)
+        {
+            Reader reader(mData + section.offset, mData + section.offset + section.size);
+
+            if(!reader.decode(value))
+            {
+                Debug::error(STEEL_METH_INTRO, "corrupted section ", section.name).endl();
+                return false;
+            }
+
+            return true;
+        }
+
+        value = Json::Value(Json::objectValue);
+        Json::Value record;
+        u64 id;
+
+        for(u64 i = 0; i < section.recordCount; ++i)
+        {
+            if(!readRecord(section, i, id, record))
+                return false;
+
+            value[std::to_string(id)].swap(record);
+        }
+
+        return true;
+    }
+
+    bool BinaryLevelFile::readRecord(Section const &section, u64 index, u64 &id, Json::Value &value) const
+    {
+        if(SectionKind::RECORDS != section.kind || index >= section.recordCount)
+        {
+            Debug::error(STEEL_METH_INTRO, "no record ", index, " in section ", section.name).endl();
+            return false;
+        }
+
+        char const *const begin = mData + section.offset;
+        Reader entry(begin + sizeof(u64) + index * RECORD_ENTRY_SIZE, begin + section.size);
+        id = entry.get<u64>();
+        u64 const offset = entry.get<u64>();
+        u64 const size = entry.get<u64>();
+
+        if(!entry.ok() || offset > section.size || size > section.size - offset)
+        {
+            Debug::error(STEEL_METH_INTRO, "record ", index, " of section ", section.name, " out of bounds.").endl();
+            return false;
+        }
+
+        char const *const record = begin + offset;
+        bool decoded;
+
+        if(nullptr == section.layout)
+        {
+            Reader reader(record, record + size);
+            decoded = reader.decode(value);
+        }
+        else
+            decoded = section.layout->read(record, record + size, value);
+
+        if(!decoded)
+        {
+            Debug::error(STEEL_METH_INTRO, "corrupted record ", id, " in section ", section.name).endl();
+            return false;
+        }
+
+        return true;
+    }
+
+    bool BinaryLevelFile::toJson(Json::Value &root) const
+    {
+        root = Json::Value(Json::objectValue);
+        Ogre::String const prefix = MANAGERS_SECTION_PREFIX;
+
+        for(Section const & section : mSections)
+        {
+            Json::Value value;
+
+            if(!readSection(section, value))
+                return false;
+
+            if(LEVEL_SECTION == section.name)
+            {
+                for(Json::ValueIterator it = value.begin(); it != value.end(); ++it)
+                    root[it.memberName()].swap(*it);
+            }
+            else if(AGENTS_SECTION == section.name)
+                root[AGENTS_KEY].swap(value);
+            else if(0 == section.name.compare(0, prefix.size(), prefix))
+                root[MANAGERS_KEY][section.name.substr(prefix.size())].swap(value);
+            else
+                Debug::warning(STEEL_METH_INTRO, "skipping unknown section ", section.name).endl();
+        }
+
+        return true;
+    }
+
+    void BinaryLevelFile::fromJson(Json::Value const &root, std::string &bytes)
+    {
+        std::vector<PendingSection> sections;
+        Json::Value level(Json::objectValue);
+
+        for(Json::ValueConstIterator it = root.begin(); it != root.end(); ++it)
+        {
+            Ogre::String const key = it.memberName();
+
+            if(AGENTS_KEY == key && isKeyedByIds(*it))
+                makeSection(AGENTS_SECTION, *it, sections);
+            else if(MANAGERS_KEY == key && it->isObject() && it->size() > 0)
+            {
+                for(Json::ValueConstIterator manager = it->begin(); manager != it->end(); ++manager)
+                    makeSection(Ogre::String(MANAGERS_SECTION_PREFIX) + manager.memberName(), *manager, sections);
+            }
+            else
+                level[key] = *it;
+        }
+
+        // as a tree, so that whatever it holds is kept as is
+        sections.push_back(PendingSection());
+        sections.back().name = LEVEL_SECTION;
+        sections.back().kind = SectionKind::TREE;
+        encode(level, sections.back().data);
+
+        bytes.clear();
+        put<u32>(bytes, MAGIC);
+        put<u32>(bytes, VERSION);
+        put<u32>(bytes, BYTE_ORDER_MARKER);
+        put<u32>(bytes, (u32) sections.size());
+        size_t const table = bytes.size();
+        bytes.resize(table + sections.size() * SECTION_ENTRY_SIZE);
+
+        for(size_t i = 0; i < sections.size(); ++i)
+        {
+            PendingSection &section = sections[i];
+            size_t const nameOffset = bytes.size();
+            bytes.append(section.name);
+
+            // 8 bytes aligned data
+            bytes.resize((bytes.size() + 7) & ~(size_t) 7);
+            size_t const offset = bytes.size();
+            bytes.append(section.data);
+
+            size_t const entry = table + i * SECTION_ENTRY_SIZE;
+            putAt<u32>(bytes, entry, (u32) section.kind);
+            putAt<u32>(bytes, entry + sizeof(u32), (u32) section.name.size());
+            putAt<u64>(bytes, entry + 2 * sizeof(u32), nameOffset);
+            putAt<u64>(bytes, entry + 2 * sizeof(u32) + sizeof(u64), offset);
+            putAt<u64>(bytes, entry + 2 * sizeof(u32) + 2 * sizeof(u64), section.data.size());
+
+            // release it early, levels can be big
+            std::string().swap(section.data);
+        }
+    }
+
+    bool BinaryLevelFile::write(Ogre::String const &path, std::string const &bytes)
+    {
+        Ogre::String const tmpPath = path + ".tmp";
+        {
+            std::ofstream file(tmpPath.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+
+            if(!file.is_open())
+            {
+                Debug::error(STEEL_METH_INTRO, "could not open ", tmpPath, " for writing.").endl();
+                return false;
+            }
+
+            file.write(bytes.data(), bytes.size());
+
+            if(!file.good())
+            {
+                Debug::error(STEEL_METH_INTRO, "could not write ", tmpPath).endl();
+                return false;
+            }
+        }
+
+        if(0 != std::rename(tmpPath.c_str(), path.c_str()))
+        {
+            Debug::error(STEEL_METH_INTRO, "could not rename ", tmpPath, " to ", path).endl();
+            std::remove(tmpPath.c_str());
+            return false;
+        }
+
+        return true;
+    }
+
+    namespace
+    {
+        /// A level root shaped as Level::serialize makes them.
+        void makeSyntheticLevel(u32 agentsCount, Json::Value &root)
+        {
+            root["name"] = "synthetic";
+            root["backgroundColor"] = "0 0 0 1";
+            root["gravity"] = "0 -9.8 0";
+            root["camera"]["position"] = "10.5 20.25 -3";
+            root["terrain"]["resourceGroup"] = "synthetic";
+            root["terrain"]["slots"] = Json::Value(Json::arrayValue);
+            root["terrain"]["blendRules"][0u]["minHeight"] = 15.;
+            root["terrain"]["blendRules"][0u]["layer"] = 1;
+            root["terrain"]["unsigned"] = Json::Value((Json::Value::LargestUInt) 1 << 40);
+            root["terrain"]["negative"] = -42;
+            root["terrain"]["tiny"] = 1e-300;
+            root["terrain"]["flags"][0u] = true;
+            root["terrain"]["flags"][1u] = false;
+            root["terrain"]["flags"][2u] = Json::Value();
+
+            Ogre::String const ogreType = toString(ModelType::OGRE), physicsType = toString(ModelType::PHYSICS);
+            Json::Value &agents = root["agents"];
+            Json::Value &ogreModels = root["managers"][ogreType];
+            Json::Value &physicsModels = root["managers"][physicsType];
+
+            for(u32 i = 0; i < agentsCount; ++i)
+            {
+                Ogre::String const id = std::to_string(i);
+                Json::Value &agent = agents[id];
+                agent[ogreType] = id;
+                agent[physicsType] = id;
+
+                if(0 == i % 7)
+                    agent["tags"][0u] = "tree";
+
+                // as Ogre::StringConverter formats them, but for a few
+                std::ostringstream position, mass;
+                position << i * .5f << " 1.25 " << -(float) i;
+                mass << i / 4.f;
+
+                Json::Value &ogreModel = ogreModels[id];
+                ogreModel["position"] = 0 == i % 11 ? std::to_string(i * .5f) + " 1.25 " + std::to_string(-(float) i) : position.str();
+                ogreModel["rotation"] = "1 0 0 0";
+                // not a vector, kept as is
+                ogreModel["scale"] = 0 == i % 5 ? "2" : "1 1 1";
+                ogreModel["entityMeshName"] = "Tree.mesh";
+
+                Json::Value &physicsModel = physicsModels[id];
+
+                if(0 == i % 2)
+                    physicsModel["mass"] = 0 == i % 4 ? mass.str() : std::to_string(i / 4.f);
+                else
+                    physicsModel["mass"] = (double) i / 3.;
+
+                physicsModel["shape"] = "convexHull";
+                physicsModel["ghost"] = 0 == i % 3 ? "true" : "false";
+            }
+
+            // not keyed by ids, stored as a tree
+            root["managers"]["LocationModel"]["pathRoots"]["road"] = 1;
+            root["managers"]["LocationModel"]["models"]["1"]["destination"] = "2";
+            // empty, but there
+            root["managers"]["BTModel"] = Json::Value(Json::objectValue);
+        }
+
+        /// Reads a transform as OgreModel::fromJson does, returns something to keep it from being optimized away.
+        float readTransform(Json::Value const &model)
+        {
+            Ogre::Vector3 const position = JsonUtils::asVector3(model["position"]);
+            Ogre::Quaternion const rotation = JsonUtils::asQuaternion(model["rotation"]);
+            Ogre::Vector3 const scale = JsonUtils::asVector3(model["scale"], Ogre::Vector3::UNIT_SCALE);
+            return position.x + rotation.w + scale.y;
+        }
+    }
+
+    bool utest_BinaryLevelFile(UnitTestExecutionContext const *context)
+    {
+        Json::Value root;
+        makeSyntheticLevel(100, root);
+
+        std::string bytes;
+        BinaryLevelFile::fromJson(root, bytes);
+
+        BinaryLevelFile file;
+
+        if(!file.open(bytes.data(), bytes.size()))
+        {
+            Debug::error(STEEL_METH_INTRO, "could not open encoded level.").endl();
+            return false;
+        }
+
+        Json::Value decoded;
+
+        if(!file.toJson(decoded))
+        {
+            Debug::error(STEEL_METH_INTRO, "could not decode encoded level.").endl();
+            return false;
+        }
+
+        if(decoded != root)
+        {
+            Debug::error(STEEL_METH_INTRO, "round trip differs: ", decoded.toStyledString()).endl();
+            return false;
+        }
+
+        // fields that format back the same way are typed, the others kept generic
+        Ogre::String const ogreSection = Ogre::String(BinaryLevelFile::MANAGERS_SECTION_PREFIX) + toString(ModelType::OGRE);
+        Ogre::String const physicsSection = Ogre::String(BinaryLevelFile::MANAGERS_SECTION_PREFIX) + toString(ModelType::PHYSICS);
+        std::vector<std::pair<Ogre::String, Ogre::String> > const samples = {{ogreSection, "1"}, {ogreSection, "10"}, {ogreSection, "11"},
+            {physicsSection, "4"}, {physicsSection, "6"}, {physicsSection, "3"}
+        };
+        std::vector<u32> const expectedMasks = {7, 3, 6, 1 | 1 << 6, 1 << 6, 1 | 1 << 6};
+
+        for(size_t i = 0; i < samples.size(); ++i)
+        {
+            Json::Value const &record = root["managers"][samples[i].first.substr(strlen(BinaryLevelFile::MANAGERS_SECTION_PREFIX))][samples[i].second];
+            std::string recordBytes;
+            BinaryLevelFile::RecordLayout::of(samples[i].first)->write(record, recordBytes);
+            u32 mask;
+            memcpy(&mask, recordBytes.data(), sizeof(u32));
+
+            if(expectedMasks[i] != mask)
+            {
+                Debug::error(STEEL_METH_INTRO, "record ", samples[i].second, " of ", samples[i].first, " has typed fields ", mask,
+                             " instead of ", expectedMasks[i]).endl();
+                return false;
+            }
+        }
+
+        // single record access
+        BinaryLevelFile::Section const *agents = file.section(BinaryLevelFile::AGENTS_SECTION);
+        BinaryLevelFile::Section const *locations = file.section(Ogre::String(BinaryLevelFile::MANAGERS_SECTION_PREFIX) + "LocationModel");
+
+
+        if(nullptr == agents || BinaryLevelFile::SectionKind::RECORDS != agents->kind || 100 != agents->recordCount
+                || nullptr == locations || BinaryLevelFile::SectionKind::TREE != locations->kind)
+        {
+            Debug::error(STEEL_METH_INTRO, "unexpected sections layout.").endl();
+            return false;
+        }
+
+        Json::Value agentsValue;
+
+        if(!file.readSection(*agents, agentsValue))
+            return false;
+
+        for(u64 i = 0; i < agents->recordCount; ++i)
+        {
+            u64 id;
+            Json::Value agent;
+
+            if(!file.readRecord(*agents, i, id, agent) || agent != agentsValue[std::to_string(id)])
+            {
+                Debug::error(STEEL_METH_INTRO, "record ", i, " differs.").endl();
+                return false;
+            }
+        }
+
+        // truncated files are refused
+        BinaryLevelFile truncated;
+
+        if(truncated.open(bytes.data(), bytes.size() / 2))
+        {
+            Debug::error(STEEL_METH_INTRO, "truncated file was accepted.").endl();
+            return false;
+        }
+
+        return true;
+    }
+
+    bool utest_BinaryLevelFileSpeed(UnitTestExecutionContext const *context)
+    {
+        u32 const agentsCount = 50000;
+        Json::Value root;
+        makeSyntheticLevel(agentsCount, root);
+
+        Ogre::String const basePath = Poco::Path::temp() + "steel_utest_BinaryLevelFileSpeed";
+        Ogre::String const jsonPath = basePath + ".lvl";
+        Ogre::String const binaryPath = basePath + ".lvlb";
+        Ogre::Timer timer;
+
+        // json, as Level::save/load
+        timer.reset();
+        {
+            std::string const s = root.toStyledString();
+            std::ofstream file(jsonPath.c_str(), std::ios::out | std::ios::trunc);
+            file.write(s.data(), s.size());
+        }
+        double const jsonSaveMs = timer.getMicroseconds() / 1000.;
+
+        // load times include reading transforms, as models do
+        timer.reset();
+        size_t jsonSize = 0;
+        u64 jsonRecords = 0;
+        float jsonChecksum = .0f;
+        {
+            std::vector<char> buffer;
+            readWholeFile(jsonPath, buffer);
+            jsonSize = buffer.size();
+
+            Json::Reader reader;
+            Json::Value loaded;
+            reader.parse(buffer.data(), buffer.data() + buffer.size(), loaded, false);
+            Json::Value const &ogreModels = loaded["managers"][toString(ModelType::OGRE)];
+            jsonRecords = loaded["agents"].size() + ogreModels.size() + loaded["managers"][toString(ModelType::PHYSICS)].size();
+
+            for(Json::ValueConstIterator it = ogreModels.begin(); it != ogreModels.end(); ++it)
+                jsonChecksum += readTransform(*it);
+        }
+        double const jsonLoadMs = timer.getMicroseconds() / 1000.;
+
+        // binary
+        timer.reset();
+        {
+            std::string bytes;
+            BinaryLevelFile::fromJson(root, bytes);
+            BinaryLevelFile::write(binaryPath, bytes);
+        }
+        double const binarySaveMs = timer.getMicroseconds() / 1000.;
+
+        timer.reset();
+        size_t binarySize = 0;
+        u64 binaryRecords = 0;
+        float binaryChecksum = .0f;
+        bool allWasFine = true;
+        {
+            // records are decoded one at a time, as Level does
+            BinaryLevelFile file;
+            allWasFine &= file.open(binaryPath);
+            Json::Value record;
+            u64 id;
+
+            for(BinaryLevelFile::Section const & section : file.sections())
+            {
+                binarySize = std::max<size_t>(binarySize, section.offset + section.size);
+
+                if(BinaryLevelFile::SectionKind::TREE == section.kind)
+                {
+                    allWasFine &= file.readSection(section, record);
+                    continue;
+                }
+
+                bool const isOgreModels = Ogre::String(BinaryLevelFile::MANAGERS_SECTION_PREFIX) + toString(ModelType::OGRE) == section.name;
+
+                for(u64 i = 0; i < section.recordCount; ++i)
+                {
+                    allWasFine &= file.readRecord(section, i, id, record);
+
+                    if(isOgreModels)
+                        binaryChecksum += readTransform(record);
+                }
+
+                binaryRecords += section.recordCount;
+            }
+        }
+        double const binaryLoadMs = timer.getMicroseconds() / 1000.;
+
+        std::remove(jsonPath.c_str());
+        std::remove(binaryPath.c_str());
+
+        if(!allWasFine || jsonRecords != binaryRecords || 3 * agentsCount != binaryRecords || jsonChecksum != binaryChecksum)
+        {
+            Debug::error(STEEL_METH_INTRO, "records mismatch: json ", jsonRecords, ", binary ", binaryRecords,
+                         ", checksums ", jsonChecksum, " and ", binaryChecksum).endl();
+            return false;
+        }
+
+        Debug::log(STEEL_METH_INTRO, agentsCount, " agents. json: ", jsonSize / 1024, "KB, save ", jsonSaveMs, "ms, load ",
+                   jsonLoadMs, "ms. binary: ", binarySize / 1024, "KB, save ", binarySaveMs, "ms, load ", binaryLoadMs, "ms").endl();
+        return true;
+    }
+}
+// kate: indent-mode cstyle; indent-width 4; replace-tabs on;
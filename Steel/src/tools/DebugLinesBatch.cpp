@@ -0,0 +1,223 @@
+#include "tools/DebugLinesBatch.h"
+
+#include <Ogre.h>
+#include <cassert>
+#include <limits>
+
+namespace Steel
+{
+    const DebugLinesBatch::LineId DebugLinesBatch::INVALID_LINE_ID = std::numeric_limits<DebugLinesBatch::LineId>::max();
+    const u32 DebugLinesBatch::INVALID_SLOT = std::numeric_limits<u32>::max();
+    u32 DebugLinesBatch::sNextId = 0;
+
+    DebugLinesBatch::DebugLinesBatch(): DynamicRenderable(),
+        mId(sNextId++), mMaterial(),
+        mVertices(), mPersistentCount(0),
+        mLineToSlot(), mSlotToLine(), mFreeLineIds(),
+        mDirtyBegin(0), mDirtyEnd(0), mLastFlushedVertexCount(0)
+    {
+    }
+
+    DebugLinesBatch::~DebugLinesBatch()
+    {
+        if(!mMaterial.isNull())
+        {
+            auto name = mMaterial->getName();
+            mMaterial.setNull();
+            Ogre::MaterialManager::getSingleton().remove(name);
+        }
+    }
+
+    void DebugLinesBatch::init(Ogre::String const &resourceGroup)
+    {
+        clear();
+        initialize(Ogre::RenderOperation::OT_LINE_LIST, false);
+
+        {
+            Ogre::MaterialPtr const whiteNoLignthing = Ogre::MaterialManager::getSingleton().getByName("BaseWhiteNoLighting");
+            Ogre::String const resName = "DebugLinesBatch_" + Ogre::StringConverter::toString(mId) + "_BaseWhiteNoLighting_" + resourceGroup;
+            mMaterial = Ogre::MaterialManager::getSingleton().getByName(resName);
+
+            if(mMaterial.isNull())
+            {
+                mMaterial = whiteNoLignthing->clone(resName, true, resourceGroup);
+                mMaterial->getTechnique(0)->getPass(0)->setVertexColourTracking(Ogre::TVC_DIFFUSE);
+                mMaterial->load();
+            }
+        }
+        setMaterial(mMaterial->getName());
+        setRenderQueueGroup(Ogre::RENDER_QUEUE_MAIN);
+
+        // lines can be anywhere in the level, no point in maintaining a tight box.
+        mBox.setInfinite();
+        fillHardwareBuffers();
+    }
+
+    DebugLinesBatch::LineId DebugLinesBatch::addLine(Ogre::Vector3 const &from, Ogre::Vector3 const &to,
+            Ogre::ColourValue const &color/* = Ogre::ColourValue::White*/)
+    {
+        LineId id;
+
+        if(mFreeLineIds.size())
+        {
+            id = mFreeLineIds.back();
+            mFreeLineIds.pop_back();
+        }
+        else
+        {
+            id = (LineId) mLineToSlot.size();
+            mLineToSlot.push_back(INVALID_SLOT);
+        }
+
+        size_t const slot = mPersistentCount++;
+        mLineToSlot[id] = (u32) slot;
+        mSlotToLine.push_back(id);
+
+        Vertex vertex;
+        vertex.color = Ogre::VertexElement::convertColourValue(color, Ogre::VertexElement::getBestColourVertexElementType());
+        // persistent lines are kept before transient ones
+        mVertices.insert(mVertices.begin() + slot * 2, 2, vertex);
+        writeLine(slot, from, to);
+        return id;
+    }
+
+    bool DebugLinesBatch::setLine(LineId id, Ogre::Vector3 const &from, Ogre::Vector3 const &to)
+    {
+        if(!isValid(id))
+            return false;
+
+        writeLine(mLineToSlot[id], from, to);
+        return true;
+    }
+
+    void DebugLinesBatch::removeLine(LineId id)
+    {
+        if(!isValid(id))
+            return;
+
+        size_t const slot = mLineToSlot[id];
+        size_t const last = mPersistentCount - 1;
+
+        // fill the hole with the last persistent line, so that the buffer stays contiguous
+        if(slot != last)
+        {
+            mVertices[slot * 2] = mVertices[last * 2];
+            mVertices[slot * 2 + 1] = mVertices[last * 2 + 1];
+            LineId const movedId = mSlotToLine[last];
+            mSlotToLine[slot] = movedId;
+            mLineToSlot[movedId] = (u32) slot;
+            markDirty(slot * 2, slot * 2 + 2);
+        }
+
+        mVertices.erase(mVertices.begin() + last * 2, mVertices.begin() + last * 2 + 2);
+        mSlotToLine.pop_back();
+        --mPersistentCount;
+
+        mLineToSlot[id] = INVALID_SLOT;
+        mFreeLineIds.push_back(id);
+    }
+
+    void DebugLinesBatch::addTransientLine(Ogre::Vector3 const &from, Ogre::Vector3 const &to,
+                                           Ogre::ColourValue const &color/* = Ogre::ColourValue::White*/)
+    {
+        Vertex vertex;
+        vertex.color = Ogre::VertexElement::convertColourValue(color, Ogre::VertexElement::getBestColourVertexElementType());
+
+        writeVertex(vertex, from);
+        mVertices.push_back(vertex);
+        writeVertex(vertex, to);
+        mVertices.push_back(vertex);
+    }
+
+    void DebugLinesBatch::clear()
+    {
+        mVertices.clear();
+        mPersistentCount = 0;
+        mLineToSlot.clear();
+        mSlotToLine.clear();
+        mFreeLineIds.clear();
+        mDirtyBegin = mDirtyEnd = 0;
+    }
+
+    void DebugLinesBatch::writeVertex(Vertex &vertex, Ogre::Vector3 const &pos)
+    {
+        vertex.x = pos.x;
+        vertex.y = pos.y;
+        vertex.z = pos.z;
+    }
+
+    void DebugLinesBatch::writeLine(size_t slot, Ogre::Vector3 const &from, Ogre::Vector3 const &to)
+    {
+        writeVertex(mVertices[slot * 2], from);
+        writeVertex(mVertices[slot * 2 + 1], to);
+        markDirty(slot * 2, slot * 2 + 2);
+    }
+
+    void DebugLinesBatch::markDirty(size_t firstVertex, size_t lastVertex)
+    {
+        if(mDirtyBegin >= mDirtyEnd)
+        {
+            mDirtyBegin = firstVertex;
+            mDirtyEnd = lastVertex;
+        }
+        else
+        {
+            mDirtyBegin = std::min(mDirtyBegin, firstVertex);
+            mDirtyEnd = std::max(mDirtyEnd, lastVertex);
+        }
+    }
+
+    void DebugLinesBatch::flush()
+    {
+        size_t const persistentEnd = mPersistentCount * 2;
+
+        // transient lines are rewritten every frame
+        if(mVertices.size() > persistentEnd)
+            markDirty(persistentEnd, mVertices.size());
+
+        if(mDirtyBegin < mDirtyEnd || mVertices.size() != mLastFlushedVertexCount)
+            fillHardwareBuffers();
+
+        mLastFlushedVertexCount = mVertices.size();
+        mVertices.resize(persistentEnd);
+    }
+
+    void DebugLinesBatch::createVertexDeclaration()
+    {
+        Ogre::VertexDeclaration *decl = mRenderOp.vertexData->vertexDeclaration;
+        size_t offset = 0;
+
+        decl->addElement(0, offset, Ogre::VET_FLOAT3, Ogre::VES_POSITION);
+        offset += Ogre::VertexElement::getTypeSize(Ogre::VET_FLOAT3);
+        decl->addElement(0, offset, Ogre::VET_COLOUR, Ogre::VES_DIFFUSE);
+        offset += Ogre::VertexElement::getTypeSize(Ogre::VET_COLOUR);
+
+        assert(offset == sizeof(Vertex));
+    }
+
+    void DebugLinesBatch::fillHardwareBuffers()
+    {
+        size_t const count = mVertices.size();
+        size_t const previousCapacity = mVertexBufferCapacity;
+
+        prepareHardwareBuffers(count, 0);
+
+        // a reallocated buffer has lost its previous content
+        if(previousCapacity != mVertexBufferCapacity)
+        {
+            mDirtyBegin = 0;
+            mDirtyEnd = count;
+        }
+
+        mDirtyEnd = std::min(mDirtyEnd, count);
+
+        if(mDirtyBegin < mDirtyEnd)
+        {
+            Ogre::HardwareVertexBufferSharedPtr vbuf = mRenderOp.vertexData->vertexBufferBinding->getBuffer(0);
+            vbuf->writeData(mDirtyBegin * sizeof(Vertex), (mDirtyEnd - mDirtyBegin) * sizeof(Vertex), &(mVertices[mDirtyBegin]), false);
+        }
+
+        mDirtyBegin = mDirtyEnd = 0;
+    }
+}
+// kate: indent-mode cstyle; indent-width 4; replace-tabs on;
@@ -411,6 +411,22 @@ namespace Steel
 #endif
     }
 
+    u64 File::lastModified() const
+    {
+#ifdef __unix
+        struct stat st_buf;
+
+        if(0 != stat(fullPath().c_str(), &st_buf))
+            return 0;
+
+        return (u64) st_buf.st_mtim.tv_sec * 1000000ULL + (u64) st_buf.st_mtim.tv_nsec / 1000ULL;
+#else
+#warning u64 File::lastModified() is not implemented for this platform.
+        Debug::error("File::lastModified() is not implemented for this platform").endl().breakHere();
+        return 0;
+#endif
+    }
+
     bool File::isValid() const
     {
         std::fstream f(fullPath().c_str());
@@ -0,0 +1,372 @@
+#include "tools/JsonRecordPrefetcher.h"
+
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <fstream>
+#include <mutex>
+#include <thread>
+
+#include <OgreStringConverter.h>
+#include <OgreTimer.h>
+#include <Poco/Path.h>
+
+#include "Debug.h"
+#include "tests/UnitTestManager.h"
+#include "tools/JsonStreamReader.h"
+
+namespace Steel
+{
+    const size_t JsonRecordPrefetcher::DEFAULT_MAX_QUEUED_RECORDS = 1024;
+
+    class JsonRecordPrefetcher::Channel
+    {
+    public:
+        Ogre::String path;
+        u64 position;
+        std::thread worker;
+        /// Guards all below.
+        std::mutex mutex;
+        std::condition_variable condition;
+        std::deque<Record> records;
+        /// The worker is done parsing (successfully or not).
+        bool done;
+        bool failed;
+        Ogre::String errorMessage;
+        bool mustStop;
+    };
+
+    JsonRecordPrefetcher::JsonRecordPrefetcher(size_t maxQueuedRecords): mMaxQueuedRecords(std::max<size_t>(maxQueuedRecords, 1)),
+        mChannels()
+    {
+    }
+
+    JsonRecordPrefetcher::~JsonRecordPrefetcher()
+    {
+        stop();
+    }
+
+    JsonRecordPrefetcher::ChannelId JsonRecordPrefetcher::add(Ogre::String const &path, u64 position)
+    {
+        mChannels.push_back(std::unique_ptr<Channel>(new Channel()));
+        Channel *channel = mChannels.back().get();
+        channel->path = path;
+        channel->position = position;
+        channel->done = channel->failed = channel->mustStop = false;
+        channel->worker = std::thread(&JsonRecordPrefetcher::run, this, channel);
+        return mChannels.size() - 1;
+    }
+
+    bool JsonRecordPrefetcher::next(ChannelId channelId, Record &record)
+    {
+        if(channelId >= mChannels.size())
+        {
+            Debug::error(STEEL_METH_INTRO, "invalid channel ", channelId).endl();
+            return false;
+        }
+
+        Channel &channel = *mChannels[channelId];
+        std::unique_lock<std::mutex> lock(channel.mutex);
+        channel.condition.wait(lock, [&channel] {return channel.done || !channel.records.empty();});
+
+        if(channel.records.empty() || channel.failed)
+            return false;
+
+        record.key.swap(channel.records.front().key);
+        record.value.swap(channel.records.front().value);
+        channel.records.pop_front();
+        channel.condition.notify_all();
+        return true;
+    }
+
+    bool JsonRecordPrefetcher::ok(ChannelId channelId)
+    {
+        if(channelId >= mChannels.size())
+            return false;
+
+        std::lock_guard<std::mutex> lock(mChannels[channelId]->mutex);
+        return !mChannels[channelId]->failed;
+    }
+
+    Ogre::String JsonRecordPrefetcher::errorMessage(ChannelId channelId)
+    {
+        if(channelId >= mChannels.size())
+            return "invalid channel";
+
+        std::lock_guard<std::mutex> lock(mChannels[channelId]->mutex);
+        return mChannels[channelId]->errorMessage;
+    }
+
+    void JsonRecordPrefetcher::stop()
+    {
+        for(auto &channel : mChannels)
+        {
+            {
+                std::lock_guard<std::mutex> lock(channel->mutex);
+                channel->mustStop = true;
+            }
+            channel->condition.notify_all();
+        }
+
+        for(auto &channel : mChannels)
+        {
+            if(channel->worker.joinable())
+                channel->worker.join();
+        }
+    }
+
+    void JsonRecordPrefetcher::run(Channel *channel)
+    {
+        std::ifstream stream(channel->path.c_str(), std::ios::in | std::ios::binary);
+        JsonStreamReader reader(stream);
+        Ogre::String errorMessage;
+
+        if(!stream.is_open())
+            errorMessage = "could not open " + channel->path;
+        else if(reader.seek(channel->position))
+        {
+            Json::ValueType const type = reader.nextType();
+
+            if(Json::nullValue == type && reader.ok())
+                reader.skipValue();
+            else if(Json::objectValue != type)
+                errorMessage = "expected an object at " + Ogre::StringConverter::toString((unsigned long) channel->position);
+            else
+            {
+                Record record;
+                reader.beginObject();
+
+                while(reader.nextKey(record.key) && reader.readValue(record.value))
+                {
+                    std::unique_lock<std::mutex> lock(channel->mutex);
+                    channel->condition.wait(lock, [this, channel] {return channel->mustStop || channel->records.size() < mMaxQueuedRecords;});
+
+                    if(channel->mustStop)
+                        break;
+
+                    channel->records.push_back(Record());
+                    channel->records.back().key.swap(record.key);
+                    channel->records.back().value.swap(record.value);
+                    channel->condition.notify_all();
+                }
+            }
+        }
+
+        if(errorMessage.empty() && !reader.ok())
+            errorMessage = reader.errorMessage();
+
+        std::lock_guard<std::mutex> lock(channel->mutex);
+        channel->done = true;
+        channel->failed = !errorMessage.empty();
+        channel->errorMessage = errorMessage;
+        channel->condition.notify_all();
+    }
+
+    namespace
+    {
+        Ogre::String const MODEL_TYPES[] = {"OgreModel", "PhysicsModel", "LocationModel", "BlackBoardModel", "BTModel"};
+
+        /// Writes a level shaped file of count records per model type, and returns its tree.
+        Json::Value writeSyntheticLevel(Ogre::String const &path, u32 count)
+        {
+            Json::Value root;
+            root["name"] = "synthetic";
+            root["managers"]["emptyModel"] = Json::Value();
+
+            for(u32 i = 0; i < count; ++i)
+            {
+                Ogre::String const id = std::to_string(i);
+                root["agents"][id]["OgreModel"] = id;
+
+                for(Ogre::String const & type : MODEL_TYPES)
+                {
+                    Json::Value &record = root["managers"][type][id];
+                    record["position"] = std::to_string(i * .5f) + " 1.25 " + std::to_string(-(float) i);
+                    record["rotation"] = "1 0 0 0";
+                    record["tags"][0u] = type;
+                }
+            }
+
+            std::ofstream file(path.c_str(), std::ios::out | std::ios::trunc);
+            file << Json::StyledWriter().write(root);
+            return root;
+        }
+
+        /// Positions of agents and of each manager's models, as Level::deserialize gets them.
+        std::vector<std::pair<Ogre::String, u64> > indexLevel(JsonStreamReader &reader)
+        {
+            std::vector<std::pair<Ogre::String, u64> > positions;
+            Ogre::String key, type;
+            reader.beginObject();
+
+            while(reader.nextKey(key))
+            {
+                if("agents" == key)
+                {
+                    positions.push_back(std::make_pair(key, reader.position()));
+                    reader.skipValue();
+                }
+                else if("managers" == key)
+                {
+                    reader.beginObject();
+
+                    while(reader.nextKey(type))
+                    {
+                        positions.push_back(std::make_pair(type, reader.position()));
+                        reader.skipValue();
+                    }
+                }
+                else
+                    reader.skipValue();
+            }
+
+            return positions;
+        }
+
+        /// Stands for the work of a manager on a model.
+        size_t consume(Json::Value const &value)
+        {
+            size_t checksum = 0;
+
+            for(Json::ValueConstIterator it = value.begin(); it != value.end(); ++it)
+            {
+                if(it->isString())
+                    checksum += (size_t) Ogre::StringConverter::parseUnsignedLong(it->asString().substr(0, it->asString().find(' ')));
+            }
+
+            return checksum;
+        }
+    }
+
+    bool utest_JsonRecordPrefetcher(UnitTestExecutionContext const *context)
+    {
+        Ogre::String const path = Poco::Path::temp() + "steel_utest_JsonRecordPrefetcher.lvl";
+        Json::Value const root = writeSyntheticLevel(path, 50);
+        bool allWasFine = true;
+
+        std::ifstream stream(path.c_str(), std::ios::in | std::ios::binary);
+        JsonStreamReader reader(stream);
+        auto const positions = indexLevel(reader);
+
+        {
+            // tiny queues, so that workers wait for the consumer a lot
+            JsonRecordPrefetcher prefetcher(2);
+            std::vector<JsonRecordPrefetcher::ChannelId> channels;
+
+            for(auto const & it : positions)
+                channels.push_back(prefetcher.add(path, it.second));
+
+            // consumed in another order than the file's
+            for(size_t i = positions.size(); i-- > 0 && allWasFine;)
+            {
+                Json::Value const &expected = "agents" == positions[i].first ? root["agents"] : root["managers"][positions[i].first];
+                JsonRecordPrefetcher::Record record;
+                Json::ArrayIndex count = 0;
+
+                while(prefetcher.next(channels[i], record))
+                {
+                    allWasFine &= record.value == expected[record.key];
+                    ++count;
+                }
+
+                allWasFine &= prefetcher.ok(channels[i]) && count == expected.size();
+            }
+        }
+
+        if(!allWasFine)
+            Debug::error(STEEL_METH_INTRO, "prefetched records differ.").endl();
+
+        {
+            // dropped before anything is consumed
+            JsonRecordPrefetcher prefetcher(1);
+
+            for(auto const & it : positions)
+                prefetcher.add(path, it.second);
+        }
+
+        {
+            JsonRecordPrefetcher prefetcher;
+            JsonRecordPrefetcher::Record record;
+            auto channel = prefetcher.add(path, 1);
+
+            if(prefetcher.next(channel, record) || prefetcher.ok(channel))
+            {
+                Debug::error(STEEL_METH_INTRO, "bad position was accepted.").endl();
+                allWasFine = false;
+            }
+        }
+
+        std::remove(path.c_str());
+        return allWasFine;
+    }
+
+    bool utest_JsonRecordPrefetcherSpeed(UnitTestExecutionContext const *context)
+    {
+        u32 const count = 40000;
+        Ogre::String const path = Poco::Path::temp() + "steel_utest_JsonRecordPrefetcherSpeed.lvl";
+        writeSyntheticLevel(path, count);
+        Ogre::Timer timer;
+
+        // parsed where consumed, as Level::deserialize(JsonStreamReader &) does
+        timer.reset();
+        size_t sequentialChecksum = 0;
+        {
+            std::ifstream stream(path.c_str(), std::ios::in | std::ios::binary);
+            JsonStreamReader reader(stream);
+            Ogre::String key;
+            Json::Value value;
+
+            for(auto const & it : indexLevel(reader))
+            {
+                reader.seek(it.second);
+
+                if(Json::objectValue != reader.nextType())
+                {
+                    reader.skipValue();
+                    continue;
+                }
+
+                reader.beginObject();
+
+                while(reader.nextKey(key) && reader.readValue(value))
+                    sequentialChecksum += consume(value);
+            }
+        }
+        double const sequentialMs = timer.getMicroseconds() / 1000.;
+
+        // prefetched
+        timer.reset();
+        size_t prefetchedChecksum = 0;
+        {
+            std::ifstream stream(path.c_str(), std::ios::in | std::ios::binary);
+            JsonStreamReader reader(stream);
+            JsonRecordPrefetcher prefetcher;
+            std::vector<JsonRecordPrefetcher::ChannelId> channels;
+
+            for(auto const & it : indexLevel(reader))
+                channels.push_back(prefetcher.add(path, it.second));
+
+            JsonRecordPrefetcher::Record record;
+
+            for(auto channel : channels)
+            {
+                while(prefetcher.next(channel, record))
+                    prefetchedChecksum += consume(record.value);
+            }
+        }
+        double const prefetchedMs = timer.getMicroseconds() / 1000.;
+
+        std::remove(path.c_str());
+
+        if(sequentialChecksum != prefetchedChecksum)
+        {
+            Debug::error(STEEL_METH_INTRO, "checksums differ: ", sequentialChecksum, " vs ", prefetchedChecksum).endl();
+            return false;
+        }
+
+        Debug::log(STEEL_METH_INTRO, count, " agents and ", count, " models of each of 5 types: sequential ", sequentialMs,
+                   "ms, prefetched ", prefetchedMs, "ms (", std::thread::hardware_concurrency(), " hardware threads)").endl();
+        return true;
+    }
+}
+// kate: indent-mode cstyle; indent-width 4; replace-tabs on;
@@ -0,0 +1,709 @@
+#include "tools/JsonStreamReader.h"
+
+#include <cstdlib>
+#include <sstream>
+
+#include <OgreStringConverter.h>
+#include <OgreTimer.h>
+
+#include "Debug.h"
+#include "tests/UnitTestManager.h"
+
+namespace Steel
+{
+    const size_t JsonStreamReader::DEFAULT_BUFFER_SIZE = 1 << 16;
+
+    namespace
+    {
+        /// As Json::Reader's default stack limit.
+        u32 const MAX_DEPTH = 1000;
+
+        bool isSpace(int c)
+        {
+            return ' ' == c || '\t' == c || '\n' == c || '\r' == c;
+        }
+
+        bool isNumberChar(int c)
+        {
+            return (c >= '0' && c <= '9') || '-' == c || '+' == c || '.' == c || 'e' == c || 'E' == c;
+        }
+
+        void appendUtf8(u32 codePoint, std::string &s)
+        {
+            if(codePoint < 0x80)
+                s += (char) codePoint;
+            else if(codePoint < 0x800)
+            {
+                s += (char)(0xC0 | (codePoint >> 6));
+                s += (char)(0x80 | (codePoint & 0x3F));
+            }
+            else if(codePoint < 0x10000)
+            {
+                s += (char)(0xE0 | (codePoint >> 12));
+                s += (char)(0x80 | ((codePoint >> 6) & 0x3F));
+                s += (char)(0x80 | (codePoint & 0x3F));
+            }
+            else
+            {
+                s += (char)(0xF0 | (codePoint >> 18));
+                s += (char)(0x80 | ((codePoint >> 12) & 0x3F));
+                s += (char)(0x80 | ((codePoint >> 6) & 0x3F));
+                s += (char)(0x80 | (codePoint & 0x3F));
+            }
+        }
+    }
+
+    JsonStreamReader::JsonStreamReader(std::istream &stream, size_t bufferSize): mStream(stream),
+        mBuffer(std::max<size_t>(bufferSize, 1)), mPos(0), mSize(0), mBufferOffset((u64) std::max<std::streamoff>(stream.tellg(), 0)),
+        mHasMembers(), mOk(true), mErrorMessage()
+    {
+    }
+
+    JsonStreamReader::~JsonStreamReader()
+    {
+    }
+
+    bool JsonStreamReader::fill()
+    {
+        mBufferOffset += mSize;
+        mPos = mSize = 0;
+
+        if(!mStream.good())
+            return false;
+
+        mStream.read(mBuffer.data(), mBuffer.size());
+        mSize = (size_t) mStream.gcount();
+        return mSize > 0;
+    }
+
+    int JsonStreamReader::peek()
+    {
+        while(true)
+        {
+            if(mPos == mSize && !fill())
+                return -1;
+
+            char const c = mBuffer[mPos];
+
+            if(!isSpace(c))
+                return (unsigned char) c;
+
+            ++mPos;
+        }
+    }
+
+    bool JsonStreamReader::expect(char c)
+    {
+        if(c != peek())
+            return fail(Ogre::String("expected '") + c + "'");
+
+        ++mPos;
+        return true;
+    }
+
+    bool JsonStreamReader::fail(Ogre::String const &message)
+    {
+        if(mOk)
+        {
+            mOk = false;
+            mErrorMessage = message + " at offset " + Ogre::StringConverter::toString((unsigned long)(mBufferOffset + mPos));
+        }
+
+        return false;
+    }
+
+    Json::ValueType JsonStreamReader::nextType()
+    {
+        if(!mOk)
+            return Json::nullValue;
+
+        switch(peek())
+        {
+            case '{':
+                return Json::objectValue;
+
+            case '[':
+                return Json::arrayValue;
+
+            case '"':
+                return Json::stringValue;
+
+            case 't':
+            case 'f':
+                return Json::booleanValue;
+
+            case 'n':
+                return Json::nullValue;
+
+            case -1:
+                fail("unexpected end of stream");
+                return Json::nullValue;
+
+            default:
+                // close enough, numbers are told apart once parsed
+                return Json::realValue;
+        }
+    }
+
+    bool JsonStreamReader::beginObject()
+    {
+        if(!mOk || !expect('{'))
+            return false;
+
+        mHasMembers.push_back(false);
+        return true;
+    }
+
+    bool JsonStreamReader::nextKey(Ogre::String &key)
+    {
+        if(!mOk)
+            return false;
+
+        if(mHasMembers.empty())
+            return fail("key read outside of any object");
+
+        if('}' == peek())
+        {
+            ++mPos;
+            mHasMembers.pop_back();
+            return false;
+        }
+
+        if(mHasMembers.back() && !expect(','))
+            return false;
+
+        mHasMembers.back() = true;
+
+        if('"' != peek())
+            return fail("expected a key");
+
+        return parseString(&key) && expect(':');
+    }
+
+    bool JsonStreamReader::readValue(Json::Value &value)
+    {
+        return mOk && parseValue(&value, 0);
+    }
+
+    bool JsonStreamReader::skipValue()
+    {
+        return mOk && parseValue(nullptr, 0);
+    }
+
+    u64 JsonStreamReader::position()
+    {
+        peek();
+        return mBufferOffset + mPos;
+    }
+
+    bool JsonStreamReader::seek(u64 position)
+    {
+        // still buffered
+        if(position >= mBufferOffset && position <= mBufferOffset + mSize)
+            mPos = (size_t)(position - mBufferOffset);
+        else
+        {
+            mStream.clear();
+            mStream.seekg((std::streamoff) position);
+
+            if(mStream.fail())
+                return fail("could not seek to " + Ogre::StringConverter::toString((unsigned long) position));
+
+            mBufferOffset = position;
+            mPos = mSize = 0;
+        }
+
+        mHasMembers.clear();
+        return mOk;
+    }
+
+    bool JsonStreamReader::parseValue(Json::Value *value, u32 depth)
+    {
+        if(depth > MAX_DEPTH)
+            return fail("values nested too deep");
+
+        int const c = peek();
+
+        switch(c)
+        {
+            case '{':
+            {
+                ++mPos;
+
+                if(nullptr != value)
+                    *value = Json::Value(Json::objectValue);
+
+                if('}' == peek())
+                {
+                    ++mPos;
+                    return true;
+                }
+
+                std::string key;
+
+                while(true)
+                {
+                    if('"' != peek())
+                        return fail("expected a key");
+
+                    if(!parseString(nullptr == value ? nullptr : &key) || !expect(':'))
+                        return false;
+
+                    if(!parseValue(nullptr == value ? nullptr : &(*value)[key], depth + 1))
+                        return false;
+
+                    int const next = peek();
+                    ++mPos;
+
+                    if('}' == next)
+                        return true;
+
+                    if(',' != next)
+                        return fail("expected ',' or '}'");
+                }
+            }
+
+            case '[':
+            {
+                ++mPos;
+
+                if(nullptr != value)
+                    *value = Json::Value(Json::arrayValue);
+
+                if(']' == peek())
+                {
+                    ++mPos;
+                    return true;
+                }
+
+                while(true)
+                {
+                    if(!parseValue(nullptr == value ? nullptr : &(*value)[value->size()], depth + 1))
+                        return false;
+
+                    int const next = peek();
+                    ++mPos;
+
+                    if(']' == next)
+                        return true;
+
+                    if(',' != next)
+                        return fail("expected ',' or ']'");
+                }
+            }
+
+            case '"':
+            {
+                if(nullptr == value)
+                    return parseString(nullptr);
+
+                std::string s;
+
+                if(!parseString(&s))
+                    return false;
+
+                *value = Json::Value(s);
+                return true;
+            }
+
+            case 't':
+                if(nullptr != value)
+                    *value = Json::Value(true);
+
+                return parseLiteral("true");
+
+            case 'f':
+                if(nullptr != value)
+                    *value = Json::Value(false);
+
+                return parseLiteral("false");
+
+            case 'n':
+                if(nullptr != value)
+                    *value = Json::Value();
+
+                return parseLiteral("null");
+
+            case -1:
+                return fail("unexpected end of stream");
+
+            default:
+                return parseNumber(value);
+        }
+    }
+
+    bool JsonStreamReader::parseString(std::string *s)
+    {
+        // opening quote
+        ++mPos;
+
+        if(nullptr != s)
+            s->clear();
+
+        while(true)
+        {
+            if(mPos == mSize && !fill())
+                return fail("unterminated string");
+
+            // copy plain chars in one go
+            size_t end = mPos;
+
+            while(end < mSize && '"' != mBuffer[end] && '\\' != mBuffer[end])
+                ++end;
+
+            if(nullptr != s)
+                s->append(mBuffer.data() + mPos, end - mPos);
+
+            mPos = end;
+
+            if(mPos == mSize)
+                continue;
+
+            if('"' == mBuffer[mPos++])
+                return true;
+
+            // escape sequence
+            if(mPos == mSize && !fill())
+                return fail("unterminated string");
+
+            char const escaped = mBuffer[mPos++];
+            char unescaped = 0;
+
+            switch(escaped)
+            {
+                case '"':
+                case '\\':
+                case '/':
+                    unescaped = escaped;
+                    break;
+
+                case 'b':
+                    unescaped = '\b';
+                    break;
+
+                case 'f':
+                    unescaped = '\f';
+                    break;
+
+                case 'n':
+                    unescaped = '\n';
+                    break;
+
+                case 'r':
+                    unescaped = '\r';
+                    break;
+
+                case 't':
+                    unescaped = '\t';
+                    break;
+
+                case 'u':
+                {
+                    u32 codePoint = 0;
+
+                    for(u32 units = 0; units < 2; ++units)
+                    {
+                        u32 unit = 0;
+
+                        for(u32 i = 0; i < 4; ++i)
+                        {
+                            if(mPos == mSize && !fill())
+                                return fail("unterminated string");
+
+                            char const h = mBuffer[mPos++];
+                            unit <<= 4;
+
+                            if(h >= '0' && h <= '9')
+                                unit += h - '0';
+                            else if(h >= 'a' && h <= 'f')
+                                unit += h - 'a' + 10;
+                            else if(h >= 'A' && h <= 'F')
+                                unit += h - 'A' + 10;
+                            else
+                                return fail("bad unicode escape sequence");
+                        }
+
+                        if(0 == units)
+                        {
+                            codePoint = unit;
+
+                            // high surrogate, the low one must follow
+                            if(unit < 0xD800 || unit > 0xDBFF)
+                                break;
+
+                            if(!expect('\\') || (mPos == mSize && !fill()) || 'u' != mBuffer[mPos++])
+                                return fail("expected a low surrogate");
+                        }
+                        else
+                        {
+                            if(unit < 0xDC00 || unit > 0xDFFF)
+                                return fail("bad low surrogate");
+
+                            codePoint = 0x10000 + ((codePoint & 0x3FF) << 10) + (unit & 0x3FF);
+                        }
+                    }
+
+                    if(nullptr != s)
+                        appendUtf8(codePoint, *s);
+
+                    continue;
+                }
+
+                default:
+                    return fail("bad escape sequence");
+            }
+
+            if(nullptr != s)
+                *s += unescaped;
+        }
+    }
+
+    bool JsonStreamReader::parseNumber(Json::Value *value)
+    {
+        std::string token;
+
+        while(true)
+        {
+            if(mPos == mSize && !fill())
+                break;
+
+            char const c = mBuffer[mPos];
+
+            if(!isNumberChar(c))
+                break;
+
+            token += c;
+            ++mPos;
+        }
+
+        if(token.empty())
+            return fail("unexpected character");
+
+        if(nullptr == value)
+            return true;
+
+        char *end = nullptr;
+        bool const isNegative = '-' == token[0];
+        bool isInteger = true;
+
+        for(char c : token)
+            isInteger &= c != '.' && c != 'e' && c != 'E';
+
+        if(isInteger)
+        {
+            // same value types as Json::Reader: small positive and all negative integers are ints, others uints
+            char const *digits = token.c_str() + (isNegative ? 1 : 0);
+            Json::Value::LargestUInt const maxValue = isNegative ?
+                    Json::Value::LargestUInt(Json::Value::maxLargestInt) + 1 : Json::Value::maxLargestUInt;
+            Json::Value::LargestUInt integer = 0;
+            bool overflow = '\0' == *digits;
+
+            for(char const *c = digits; '\0' != *c && !overflow; ++c)
+            {
+                if(*c < '0' || *c > '9')
+                    return fail("bad number " + token);
+
+                Json::Value::LargestUInt const digit = *c - '0';
+                overflow = integer > (maxValue - digit) / 10;
+                integer = integer * 10 + digit;
+            }
+
+            if(!overflow)
+            {
+                if(isNegative)
+                    *value = Json::Value(Json::Value::LargestInt(0 - integer));
+                else if(integer <= Json::Value::LargestUInt(Json::Value::maxInt))
+                    *value = Json::Value(Json::Value::LargestInt(integer));
+                else
+                    *value = Json::Value(integer);
+
+                return true;
+            }
+        }
+
+        double const real = std::strtod(token.c_str(), &end);
+
+        if(end != token.c_str() + token.size())
+            return fail("bad number " + token);
+
+        *value = Json::Value(real);
+        return true;
+    }
+
+    bool JsonStreamReader::parseLiteral(char const *literal)
+    {
+        for(char const *c = literal; '\0' != *c; ++c)
+        {
+            if(mPos == mSize && !fill())
+                return fail(Ogre::String("unterminated ") + literal);
+
+            if(*c != mBuffer[mPos++])
+                return fail(Ogre::String("expected ") + literal);
+        }
+
+        return true;
+    }
+
+    namespace
+    {
+        void makeRecord(u32 i, Json::Value &record)
+        {
+            record["position"] = std::to_string(i * .5f) + " 1.25 " + std::to_string(-(float) i);
+            record["rotation"] = "1 0 0 0";
+            record["scale"] = "1 1 1";
+            record["entityMeshName"] = "Tree.mesh";
+            record["mass"] = i / 3.;
+            record["tags"][0u] = "tree";
+        }
+    }
+
+    bool utest_JsonStreamReader(UnitTestExecutionContext const *context)
+    {
+        Ogre::String const document = "{\n"
+                                      "  \"agents\" : { \"1\" : { \"OgreModel\" : \"1\", \"tags\" : [ \"tree\", \"prop\" ] },\n"
+                                      "                 \"2\" : {} },\n"
+                                      "  \"empty\" : [],\n"
+                                      "  \"escapes\" : \"quote \\\" backslash \\\\ slash \\/ \\b\\f\\n\\r\\t \\u00e9 \\ud83d\\ude00\",\n"
+                                      "  \"numbers\" : [ 0, -0, 12, -12, 2147483647, 2147483648, -9223372036854775808,\n"
+                                      "                  18446744073709551615, 18446744073709551616, 1.5, -2.5e-3, 1E10 ],\n"
+                                      "  \"literals\" : [ true, false, null ],\n"
+                                      "  \"nested\" : { \"a\" : { \"b\" : { \"c\" : [ [ 1 ], { \"d\" : \"e\" } ] } } }\n"
+                                      "}\n";
+
+        Json::Value expected;
+        Json::Reader reader;
+
+        if(!reader.parse(document, expected, false))
+        {
+            Debug::error(STEEL_METH_INTRO, "reference parsing failed: ", reader.getFormattedErrorMessages()).endl();
+            return false;
+        }
+
+        // small buffers, to cross chunk boundaries everywhere
+        for(size_t bufferSize : {1, 3, 7, 64, 4096})
+        {
+            std::istringstream stream(document);
+            JsonStreamReader streamReader(stream, bufferSize);
+            Json::Value value;
+
+            if(!streamReader.readValue(value) || value != expected)
+            {
+                Debug::error(STEEL_METH_INTRO, "whole parsing differs with a buffer of ", bufferSize, ": ",
+                             streamReader.errorMessage(), value.toStyledString()).endl();
+                return false;
+            }
+
+            // walk, skip, and seek back to each member
+            stream.clear();
+            stream.seekg(0);
+            streamReader.seek(0);
+            std::vector<std::pair<Ogre::String, u64> > positions;
+            Ogre::String key;
+
+            streamReader.beginObject();
+
+            while(streamReader.nextKey(key))
+            {
+                positions.push_back(std::make_pair(key, streamReader.position()));
+                streamReader.skipValue();
+            }
+
+            if(!streamReader.ok() || positions.size() != expected.size())
+            {
+                Debug::error(STEEL_METH_INTRO, "walk failed with a buffer of ", bufferSize, ": ", streamReader.errorMessage()).endl();
+                return false;
+            }
+
+            for(auto it = positions.rbegin(); it != positions.rend(); ++it)
+            {
+                streamReader.seek(it->second);
+
+                if(!streamReader.readValue(value) || value != expected[it->first])
+                {
+                    Debug::error(STEEL_METH_INTRO, "member ", it->first, " differs after seeking, with a buffer of ", bufferSize).endl();
+                    return false;
+                }
+            }
+        }
+
+        // malformed documents are refused
+        for(Ogre::String const broken : {"{\"a\" : [1, 2}", "{\"a\" 1}", "{\"a\" : tru}", "{\"a\" : \"\\x\"}", "{\"a\" : 1"})
+        {
+            std::istringstream stream(broken);
+            JsonStreamReader streamReader(stream);
+            Json::Value value;
+
+            if(streamReader.readValue(value))
+            {
+                Debug::error(STEEL_METH_INTRO, "accepted ", broken).endl();
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    bool utest_JsonStreamReaderSpeed(UnitTestExecutionContext const *context)
+    {
+        u32 const count = 100000;
+        Ogre::String document;
+        {
+            Json::Value root;
+
+            for(u32 i = 0; i < count; ++i)
+                makeRecord(i, root["models"][std::to_string(i)]);
+
+            document = Json::StyledWriter().write(root);
+        }
+
+        Ogre::Timer timer;
+
+        // whole tree
+        timer.reset();
+        size_t treeRecords = 0;
+        {
+            Json::Reader reader;
+            Json::Value root;
+            reader.parse(document, root, false);
+
+            for(Json::ValueIterator it = root["models"].begin(); it != root["models"].end(); ++it)
+            {
+                Json::Value node = *it;
+                treeRecords += node.size() > 0;
+            }
+        }
+        double const treeMs = timer.getMicroseconds() / 1000.;
+
+        // record by record
+        timer.reset();
+        size_t streamedRecords = 0;
+        {
+            std::istringstream stream(document);
+            JsonStreamReader reader(stream);
+            Ogre::String key;
+            Json::Value node;
+
+            reader.beginObject();
+
+            while(reader.nextKey(key))
+            {
+                reader.beginObject();
+
+                while(reader.nextKey(key) && reader.readValue(node))
+                    streamedRecords += node.size() > 0;
+            }
+        }
+        double const streamedMs = timer.getMicroseconds() / 1000.;
+
+        if(treeRecords != count || streamedRecords != count)
+        {
+            Debug::error(STEEL_METH_INTRO, "records mismatch: tree ", treeRecords, ", streamed ", streamedRecords).endl();
+            return false;
+        }
+
+        Debug::log(STEEL_METH_INTRO, count, " records (", document.size() / 1024, "KB): tree ", treeMs, "ms, streamed ",
+                   streamedMs, "ms").endl();
+        return true;
+    }
+}
+// kate: indent-mode cstyle; indent-width 4; replace-tabs on;
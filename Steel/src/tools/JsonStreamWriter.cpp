@@ -0,0 +1,256 @@
+#include "tools/JsonStreamWriter.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+
+#include <OgreStringConverter.h>
+#include <OgreTimer.h>
+#include <Poco/Path.h>
+
+#include "Debug.h"
+#include "tests/UnitTestManager.h"
+
+namespace Steel
+{
+    namespace
+    {
+        /// Json::StyledWriter's.
+        size_t const INDENT_SIZE = 3;
+    }
+
+    JsonStreamWriter::JsonStreamWriter(std::ostream &stream): mStream(stream), mHasMembers(), mWriter()
+    {
+    }
+
+    JsonStreamWriter::~JsonStreamWriter()
+    {
+    }
+
+    void JsonStreamWriter::beginObject()
+    {
+        mStream << '{';
+        mHasMembers.push_back(false);
+    }
+
+    void JsonStreamWriter::endObject()
+    {
+        if(mHasMembers.empty())
+        {
+            Debug::error(STEEL_METH_INTRO, "no object to close.").endl();
+            return;
+        }
+
+        bool const hadMembers = mHasMembers.back();
+        mHasMembers.pop_back();
+
+        if(hadMembers)
+        {
+            mStream << '\n';
+            writeIndent();
+        }
+
+        mStream << '}';
+    }
+
+    void JsonStreamWriter::key(Ogre::String const &name)
+    {
+        if(mHasMembers.empty())
+        {
+            Debug::error(STEEL_METH_INTRO, "key ", name, " outside of any object.").endl();
+            return;
+        }
+
+        if(mHasMembers.back())
+            mStream << ',';
+
+        mHasMembers.back() = true;
+        mStream << '\n';
+        writeIndent();
+        mStream << Json::valueToQuotedString(name.c_str()) << " : ";
+    }
+
+    void JsonStreamWriter::value(Json::Value const &value)
+    {
+        // a nested value is rendered as a root one, with its lines shifted to the current depth
+        std::string const rendered = mWriter.write(value);
+        size_t const end = rendered.size() - ('\n' == rendered.back() ? 1 : 0);
+        size_t begin = 0;
+
+        while(begin < end)
+        {
+            size_t newLine = rendered.find('\n', begin);
+
+            if(std::string::npos == newLine || newLine > end)
+                newLine = end;
+
+            mStream.write(rendered.data() + begin, newLine - begin);
+
+            if(newLine < end)
+            {
+                mStream << '\n';
+                writeIndent();
+            }
+
+            begin = newLine + 1;
+        }
+    }
+
+    void JsonStreamWriter::end()
+    {
+        if(!mHasMembers.empty())
+            Debug::error(STEEL_METH_INTRO, mHasMembers.size(), " object(s) left open.").endl();
+
+        mStream << '\n';
+        mStream.flush();
+    }
+
+    void JsonStreamWriter::writeIndent()
+    {
+        static std::string const spaces(64, ' ');
+
+        for(size_t left = mHasMembers.size() * INDENT_SIZE; left > 0; left -= std::min(left, spaces.size()))
+            mStream.write(spaces.data(), std::min(left, spaces.size()));
+    }
+
+    namespace
+    {
+        /// Writes root's members with the stream writer, descending into objects down to maxDepth.
+        void streamMembers(Json::Value const &root, JsonStreamWriter &writer, u32 maxDepth)
+        {
+            writer.beginObject();
+
+            for(Json::ValueConstIterator it = root.begin(); it != root.end(); ++it)
+            {
+                writer.key(it.memberName());
+
+                if(it->isObject() && maxDepth > 0)
+                    streamMembers(*it, writer, maxDepth - 1);
+                else
+                    writer.value(*it);
+            }
+
+            writer.endObject();
+        }
+
+        void makeRecord(u32 i, Json::Value &record)
+        {
+            record["position"] = std::to_string(i * .5f) + " 1.25 " + std::to_string(-(float) i);
+            record["rotation"] = "1 0 0 0";
+            record["scale"] = "1 1 1";
+            record["entityMeshName"] = "Tree.mesh";
+            record["tags"][0u] = "tree";
+            record["tags"][1u] = "prop";
+        }
+    }
+
+    bool utest_JsonStreamWriter(UnitTestExecutionContext const *context)
+    {
+        Json::Value root;
+        root["name"] = "synthetic \"level\"\n";
+        root["gravity"] = "0 -9.8 0";
+        root["agents"] = Json::Value();
+        root["empty"] = Json::Value(Json::objectValue);
+        root["managers"]["BTModel"] = Json::Value();
+        root["managers"]["LocationModel"]["pathRoots"]["road"] = 1;
+        root["managers"]["LocationModel"]["models"]["3"]["destinations"][0u] = 4;
+        root["terrain"]["real"] = 1.5;
+        root["terrain"]["emptyArray"] = Json::Value(Json::arrayValue);
+
+        for(u32 i = 0; i < 20; ++i)
+        {
+            makeRecord(i, root["managers"]["OgreModel"][std::to_string(i)]);
+            root["terrain"]["longArray"][i] = std::to_string(i * 1000) + " is a long enough string";
+        }
+
+        std::string const expected = Json::StyledWriter().write(root);
+
+        for(u32 depth = 0; depth < 4; ++depth)
+        {
+            std::ostringstream stream;
+            JsonStreamWriter writer(stream);
+            streamMembers(root, writer, depth);
+            writer.end();
+
+            if(stream.str() != expected)
+            {
+                Debug::error(STEEL_METH_INTRO, "streamed output (depth ", depth, ") differs:").endl();
+                Debug::error(stream.str()).endl();
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    bool utest_JsonStreamWriterSpeed(UnitTestExecutionContext const *context)
+    {
+        u32 const count = 100000;
+        Ogre::String const path = Poco::Path::temp() + "steel_utest_JsonStreamWriterSpeed.lvl";
+        Ogre::Timer timer;
+
+        // whole tree, as Level::serialize used to
+        timer.reset();
+        size_t treeSize = 0;
+        {
+            Json::Value root;
+
+            for(u32 i = 0; i < count; ++i)
+                makeRecord(i, root["models"][std::to_string(i)]);
+
+            std::string const s = Json::StyledWriter().write(root);
+            treeSize = s.size();
+            std::ofstream file(path.c_str(), std::ios::out | std::ios::trunc);
+            file.write(s.data(), s.size());
+        }
+        double const treeMs = timer.getMicroseconds() / 1000.;
+
+        // streamed
+        timer.reset();
+        size_t streamedSize = 0;
+        {
+            std::ofstream file(path.c_str(), std::ios::out | std::ios::trunc);
+            JsonStreamWriter writer(file);
+            writer.beginObject();
+            writer.key("models");
+            writer.beginObject();
+
+            // Json::Value's order
+            std::vector<std::string> ids;
+
+            for(u32 i = 0; i < count; ++i)
+                ids.push_back(std::to_string(i));
+
+            std::sort(ids.begin(), ids.end());
+
+            for(auto const & id : ids)
+            {
+                Json::Value record;
+                makeRecord(Ogre::StringConverter::parseUnsignedInt(id), record);
+                writer.key(id);
+                writer.value(record);
+            }
+
+            writer.endObject();
+            writer.endObject();
+            writer.end();
+            streamedSize = (size_t) file.tellp();
+        }
+        double const streamedMs = timer.getMicroseconds() / 1000.;
+
+        std::remove(path.c_str());
+
+        if(streamedSize != treeSize)
+        {
+            Debug::error(STEEL_METH_INTRO, "sizes differ: tree ", treeSize, ", streamed ", streamedSize).endl();
+            return false;
+        }
+
+        double const megaBytes = treeSize / (1024. * 1024.);
+        Debug::log(STEEL_METH_INTRO, count, " records (", treeSize / 1024, "KB): tree ", treeMs, "ms (",
+                   megaBytes * 1000. / treeMs, "MB/s), streamed ", streamedMs, "ms (", megaBytes * 1000. / streamedMs, "MB/s)").endl();
+        return true;
+    }
+}
+// kate: indent-mode cstyle; indent-width 4; replace-tabs on;
@@ -144,6 +144,11 @@ namespace Steel
             float f = value.asFloat();
             return Ogre::Vector3(f, f, f);
         }
+        // as read from binary saves (see BinaryLevelFile)
+        else if(value.isArray() && 3 == value.size())
+        {
+            return Ogre::Vector3(value[0u].asFloat(), value[1u].asFloat(), value[2u].asFloat());
+        }
 
         return defaultValue;
     }
@@ -155,6 +160,10 @@ namespace Steel
         if(value.isString())
             returned = Ogre::StringConverter::parseQuaternion(value.asString(), defaultValue);
 
+        // w first, as read from binary saves (see BinaryLevelFile)
+        if(value.isArray() && 4 == value.size())
+            returned = Ogre::Quaternion(value[0u].asFloat(), value[1u].asFloat(), value[2u].asFloat(), value[3u].asFloat());
+
         return returned;
     }
 
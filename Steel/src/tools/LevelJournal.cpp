@@ -0,0 +1,486 @@
+#include "tools/LevelJournal.h"
+
+#include <cstdio>
+#include <fstream>
+
+#if !defined(_WIN32)
+#include <sys/stat.h>
+#endif
+
+#include <OgreStringConverter.h>
+#include <OgreTimer.h>
+#include <Poco/Path.h>
+
+#include "Debug.h"
+#include "tests/UnitTestManager.h"
+
+namespace Steel
+{
+    const char *LevelJournal::BASE_ATTRIBUTE = "base";
+    const char *LevelJournal::AGENTS_ATTRIBUTE = "agents";
+    const char *LevelJournal::MODELS_ATTRIBUTE = "models";
+    const char *LevelJournal::MANAGERS_ATTRIBUTE = "managers";
+    const char *LevelJournal::PROPERTIES_ATTRIBUTE = "properties";
+
+    namespace
+    {
+        /// Same attributes as Level's, which journals are applied to.
+        char const *const LEVEL_AGENTS_ATTRIBUTE = "agents";
+        char const *const LEVEL_MANAGERS_ATTRIBUTE = "managers";
+
+        /// Identifies a file as it is now (size and modification time), or returns an empty string if it does not exist.
+        Ogre::String fileStamp(Ogre::String const &path)
+        {
+#if !defined(_WIN32)
+            struct stat st;
+
+            if(0 != stat(path.c_str(), &st))
+                return Ogre::String();
+
+            return std::to_string((unsigned long long) st.st_size) + ":" + std::to_string((long long) st.st_mtim.tv_sec)
+                   + "." + std::to_string((long long) st.st_mtim.tv_nsec);
+#else
+            std::ifstream file(path.c_str(), std::ios::in | std::ios::binary | std::ios::ate);
+
+            if(!file.is_open())
+                return Ogre::String();
+
+            return std::to_string((unsigned long long) file.tellg());
+#endif
+        }
+
+        /// Upserts (or removes, for null values) records of changes into records.
+        void applyRecords(Json::Value const &changes, Json::Value &records)
+        {
+            if(!records.isObject())
+                records = Json::Value(Json::objectValue);
+
+            for(Json::ValueConstIterator it = changes.begin(); it != changes.end(); ++it)
+            {
+                if(it->isNull())
+                    records.removeMember(it.memberName());
+                else
+                    records[it.memberName()] = *it;
+            }
+
+            // as Level::serialize(Json::Value &) leaves them
+            if(0 == records.size())
+                records = Json::Value();
+        }
+    }
+
+    bool LevelJournal::reset(Ogre::String const &path, Ogre::String const &basePath)
+    {
+        Ogre::String const stamp = fileStamp(basePath);
+
+        if(stamp.empty())
+        {
+            Debug::error(STEEL_METH_INTRO, "base save ", basePath, " does not exist.").endl();
+            return false;
+        }
+
+        Json::Value header;
+        header[LevelJournal::BASE_ATTRIBUTE] = stamp;
+        Ogre::String const tmpPath = path + ".tmp";
+        {
+            std::ofstream file(tmpPath.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+            file << Json::FastWriter().write(header);
+
+            if(!file.good())
+            {
+                Debug::error(STEEL_METH_INTRO, "could not write ", tmpPath).endl();
+                return false;
+            }
+        }
+
+        if(0 != std::rename(tmpPath.c_str(), path.c_str()))
+        {
+            Debug::error(STEEL_METH_INTRO, "could not rename ", tmpPath, " to ", path).endl();
+            std::remove(tmpPath.c_str());
+            return false;
+        }
+
+        return true;
+    }
+
+    bool LevelJournal::append(Ogre::String const &path, Json::Value const &segment)
+    {
+        // one line, written at once
+        std::string line = Json::FastWriter().write(segment);
+
+        // never continued on a line left unterminated
+        {
+            std::ifstream previous(path.c_str(), std::ios::in | std::ios::binary | std::ios::ate);
+
+            if(previous.is_open() && previous.tellg() > 0)
+            {
+                previous.seekg(-1, std::ios::end);
+
+                if('\n' != previous.get())
+                    line.insert(line.begin(), '\n');
+            }
+        }
+
+        std::ofstream file(path.c_str(), std::ios::out | std::ios::binary | std::ios::app);
+
+        if(!file.is_open())
+        {
+            Debug::error(STEEL_METH_INTRO, "could not open ", path).endl();
+            return false;
+        }
+
+        file.write(line.data(), line.size());
+        file.flush();
+
+        if(!file.good())
+        {
+            Debug::error(STEEL_METH_INTRO, "could not write ", path).endl();
+            return false;
+        }
+
+        return true;
+    }
+
+    bool LevelJournal::belongsTo(Ogre::String const &path, Ogre::String const &basePath)
+    {
+        std::ifstream file(path.c_str(), std::ios::in | std::ios::binary);
+        std::string line;
+        Json::Value header;
+
+        if(!file.is_open() || !std::getline(file, line) || !Json::Reader().parse(line, header, false) || !header.isObject())
+            return false;
+
+        Ogre::String const stamp = fileStamp(basePath);
+        return !stamp.empty() && header[LevelJournal::BASE_ATTRIBUTE].asString() == stamp;
+    }
+
+    bool LevelJournal::read(Ogre::String const &path, Ogre::String const &basePath, std::vector<Json::Value> &segments)
+    {
+        if(!belongsTo(path, basePath))
+            return false;
+
+        std::ifstream file(path.c_str(), std::ios::in | std::ios::binary);
+        std::string line;
+        std::getline(file, line);
+        Json::Reader reader;
+        // lines read back fine, in case the journal has to be cut after them
+        std::string kept = line + "\n";
+        bool torn = false;
+
+        for(u32 lineNumber = 2; std::getline(file, line); ++lineNumber)
+        {
+            if(line.empty())
+                continue;
+
+            Json::Value segment;
+
+            // what was appended before is still consistent
+            if(!reader.parse(line, segment, false) || !segment.isObject())
+            {
+                Debug::warning(STEEL_METH_INTRO, "dropping segments of ", path, " from line ", lineNumber, " on: ",
+                               reader.getFormattedErrorMessages()).endl();
+                torn = true;
+                break;
+            }
+
+            kept += line + "\n";
+            segments.push_back(Json::Value());
+            segments.back().swap(segment);
+        }
+
+        file.close();
+
+        // later segments are not to be appended after a torn one, where they would be dropped as well
+        if(torn)
+        {
+            Ogre::String const tmpPath = path + ".tmp";
+            bool written = false;
+            {
+                std::ofstream out(tmpPath.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+                out.write(kept.data(), kept.size());
+                written = out.good();
+            }
+
+            if(!written || 0 != std::rename(tmpPath.c_str(), path.c_str()))
+            {
+                Debug::error(STEEL_METH_INTRO, "could not cut ", path, " after its last whole segment.").endl();
+                std::remove(tmpPath.c_str());
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    void LevelJournal::apply(Json::Value const &segment, Json::Value &root)
+    {
+        Json::Value const &properties = segment[LevelJournal::PROPERTIES_ATTRIBUTE];
+
+        for(Json::ValueConstIterator it = properties.begin(); it != properties.end(); ++it)
+            root[it.memberName()] = *it;
+
+        if(segment.isMember(LevelJournal::AGENTS_ATTRIBUTE))
+            applyRecords(segment[LevelJournal::AGENTS_ATTRIBUTE], root[LEVEL_AGENTS_ATTRIBUTE]);
+
+        Json::Value const &models = segment[LevelJournal::MODELS_ATTRIBUTE];
+
+        for(Json::ValueConstIterator it = models.begin(); it != models.end(); ++it)
+            applyRecords(*it, root[LEVEL_MANAGERS_ATTRIBUTE][it.memberName()]);
+
+        Json::Value const &managers = segment[LevelJournal::MANAGERS_ATTRIBUTE];
+
+        for(Json::ValueConstIterator it = managers.begin(); it != managers.end(); ++it)
+            root[LEVEL_MANAGERS_ATTRIBUTE][it.memberName()] = *it;
+    }
+
+    void LevelJournal::merge(Json::Value const &segment, Json::Value &merged)
+    {
+        if(!merged.isObject())
+            merged = Json::Value(Json::objectValue);
+
+        for(char const *attribute : {LevelJournal::PROPERTIES_ATTRIBUTE, LevelJournal::AGENTS_ATTRIBUTE, LevelJournal::MANAGERS_ATTRIBUTE})
+        {
+            Json::Value const &values = segment[attribute];
+
+            for(Json::ValueConstIterator it = values.begin(); it != values.end(); ++it)
+                merged[attribute][it.memberName()] = *it;
+        }
+
+        Json::Value const &models = segment[LevelJournal::MODELS_ATTRIBUTE];
+
+        for(Json::ValueConstIterator it = models.begin(); it != models.end(); ++it)
+        {
+            Json::Value &records = merged[LevelJournal::MODELS_ATTRIBUTE][it.memberName()];
+
+            for(Json::ValueConstIterator record = it->begin(); record != it->end(); ++record)
+                records[record.memberName()] = *record;
+        }
+    }
+
+    u64 LevelJournal::fileSize(Ogre::String const &path)
+    {
+        std::ifstream file(path.c_str(), std::ios::in | std::ios::binary | std::ios::ate);
+        return file.is_open() ? (u64) file.tellg() : 0;
+    }
+
+    namespace
+    {
+        void makeRecord(u32 i, Json::Value &record)
+        {
+            record["position"] = std::to_string(i * .5f) + " 1.25 " + std::to_string(-(float) i);
+            record["rotation"] = "1 0 0 0";
+            record["entityMeshName"] = "Tree.mesh";
+        }
+
+        void makeLevel(u32 count, Json::Value &root)
+        {
+            root = Json::Value();
+            root["name"] = "synthetic";
+            root["gravity"] = "0 -9.8 0";
+            root["managers"]["LocationModel"]["pathRoots"]["road"] = 0;
+            root["managers"]["BTModel"] = Json::Value();
+
+            for(u32 i = 0; i < count; ++i)
+            {
+                Ogre::String const id = std::to_string(i);
+                root["agents"][id]["OgreModel"] = id;
+                makeRecord(i, root["managers"]["OgreModel"][id]);
+            }
+        }
+
+        bool writeFile(Ogre::String const &path, std::string const &content)
+        {
+            std::ofstream file(path.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+            file.write(content.data(), content.size());
+            return file.good();
+        }
+    }
+
+    bool utest_LevelJournal(UnitTestExecutionContext const *context)
+    {
+        Ogre::String const basePath = Poco::Path::temp() + "steel_utest_LevelJournal.lvl";
+        Ogre::String const path = basePath + "j";
+        bool allWasFine = true;
+
+        Json::Value base, expected;
+        makeLevel(10, base);
+        allWasFine &= writeFile(basePath, Json::StyledWriter().write(base));
+        allWasFine &= LevelJournal::reset(path, basePath);
+
+        // first save: an agent and its model moved, another one deleted
+        Json::Value first;
+        first[LevelJournal::PROPERTIES_ATTRIBUTE]["gravity"] = "0 -1 0";
+        first[LevelJournal::AGENTS_ATTRIBUTE]["3"]["OgreModel"] = "7";
+        first[LevelJournal::AGENTS_ATTRIBUTE]["4"] = Json::Value();
+        makeRecord(100, first[LevelJournal::MODELS_ATTRIBUTE]["OgreModel"]["7"]);
+        first[LevelJournal::MODELS_ATTRIBUTE]["OgreModel"]["4"] = Json::Value();
+        allWasFine &= LevelJournal::append(path, first);
+
+        // second save: a new agent, a first BT, a location, and a name with a line break
+        Json::Value second;
+        second[LevelJournal::PROPERTIES_ATTRIBUTE]["name"] = "synthetic\nlevel";
+        second[LevelJournal::AGENTS_ATTRIBUTE]["42"]["BTModel"] = "0";
+        second[LevelJournal::MODELS_ATTRIBUTE]["BTModel"]["0"]["rootPath"] = "patrol";
+        second[LevelJournal::MANAGERS_ATTRIBUTE]["LocationModel"]["models"]["0"]["path"] = "road";
+        allWasFine &= LevelJournal::append(path, second);
+
+        // torn write
+        {
+            std::ofstream file(path.c_str(), std::ios::out | std::ios::binary | std::ios::app);
+            file << "{\"agents\":{\"1\":";
+        }
+
+        expected = base;
+        expected["gravity"] = "0 -1 0";
+        expected["agents"]["3"]["OgreModel"] = "7";
+        expected["agents"].removeMember("4");
+        makeRecord(100, expected["managers"]["OgreModel"]["7"]);
+        expected["managers"]["OgreModel"].removeMember("4");
+        expected["name"] = "synthetic\nlevel";
+        expected["agents"]["42"]["BTModel"] = "0";
+        expected["managers"]["BTModel"]["0"]["rootPath"] = "patrol";
+        expected["managers"]["LocationModel"] = Json::Value();
+        expected["managers"]["LocationModel"]["models"]["0"]["path"] = "road";
+
+        std::vector<Json::Value> segments;
+        allWasFine &= LevelJournal::read(path, basePath, segments) && 2 == segments.size();
+
+        Json::Value root = base;
+
+        for(auto const & segment : segments)
+            LevelJournal::apply(segment, root);
+
+        if(!allWasFine || root != expected)
+        {
+            Debug::error(STEEL_METH_INTRO, "journal did not replay as expected:").endl();
+            Debug::error(Json::StyledWriter().write(root)).endl();
+            allWasFine = false;
+        }
+
+        // a segment saved after the torn one is read back, after the previous ones
+        Json::Value appended;
+        appended[LevelJournal::PROPERTIES_ATTRIBUTE]["gravity"] = "0 -3 0";
+        allWasFine &= LevelJournal::append(path, appended);
+        std::vector<Json::Value> readBack;
+
+        if(!LevelJournal::read(path, basePath, readBack) || 3 != readBack.size() || readBack[0] != first
+                || readBack[1] != second || readBack[2] != appended)
+        {
+            Debug::error(STEEL_METH_INTRO, "segment appended after a torn one was not read back.").endl();
+            allWasFine = false;
+        }
+
+        // same, the journal not being read in between: the segment goes on its own line
+        {
+            std::ofstream file(path.c_str(), std::ios::out | std::ios::binary | std::ios::app);
+            file << "{\"agents\":{\"2\":";
+        }
+
+        allWasFine &= LevelJournal::append(path, appended);
+        std::ifstream lines(path.c_str(), std::ios::in | std::ios::binary);
+        std::string line;
+        u32 lineCount = 0;
+
+        while(std::getline(lines, line))
+        {
+            ++lineCount;
+
+            if(line.find("\"properties\"") != std::string::npos && line.find("{\"agents\":{\"2\":") != std::string::npos)
+            {
+                Debug::error(STEEL_METH_INTRO, "segment appended onto a torn one.").endl();
+                allWasFine = false;
+            }
+        }
+
+        allWasFine &= 6 == lineCount;
+        lines.close();
+        allWasFine &= LevelJournal::reset(path, basePath);
+        allWasFine &= LevelJournal::append(path, first) && LevelJournal::append(path, second);
+
+        // merged, with a third segment undoing some of the previous ones
+        Json::Value third;
+        third[LevelJournal::PROPERTIES_ATTRIBUTE]["gravity"] = "0 -2 0";
+        third[LevelJournal::AGENTS_ATTRIBUTE]["42"] = Json::Value();
+        third[LevelJournal::AGENTS_ATTRIBUTE]["4"]["OgreModel"] = "4";
+        third[LevelJournal::MODELS_ATTRIBUTE]["BTModel"]["0"] = Json::Value();
+        makeRecord(4, third[LevelJournal::MODELS_ATTRIBUTE]["OgreModel"]["4"]);
+        makeRecord(101, third[LevelJournal::MODELS_ATTRIBUTE]["OgreModel"]["7"]);
+        segments.push_back(third);
+        LevelJournal::apply(third, root);
+
+        Json::Value merged, mergedRoot = base;
+
+        for(auto const & segment : segments)
+            LevelJournal::merge(segment, merged);
+
+        LevelJournal::apply(merged, mergedRoot);
+
+        if(mergedRoot != root || !merged[LevelJournal::AGENTS_ATTRIBUTE]["42"].isNull()
+                || !merged[LevelJournal::AGENTS_ATTRIBUTE].isMember("42"))
+        {
+            Debug::error(STEEL_METH_INTRO, "merged segments did not replay as expected:").endl();
+            Debug::error(Json::StyledWriter().write(mergedRoot)).endl();
+            allWasFine = false;
+        }
+
+        // the base changes under the journal (a full save happened): journal is stale
+        allWasFine &= writeFile(basePath, Json::StyledWriter().write(expected));
+        segments.clear();
+
+        if(LevelJournal::belongsTo(path, basePath) || LevelJournal::read(path, basePath, segments))
+        {
+            Debug::error(STEEL_METH_INTRO, "stale journal was accepted.").endl();
+            allWasFine = false;
+        }
+
+        std::remove(path.c_str());
+        std::remove(basePath.c_str());
+        return allWasFine;
+    }
+
+    bool utest_LevelJournalSpeed(UnitTestExecutionContext const *context)
+    {
+        u32 const count = 100000, changes = 10;
+        Ogre::String const basePath = Poco::Path::temp() + "steel_utest_LevelJournalSpeed.lvl";
+        Ogre::String const path = basePath + "j";
+        Ogre::Timer timer;
+
+        Json::Value root;
+        makeLevel(count, root);
+
+        // full save
+        timer.reset();
+        bool allWasFine = writeFile(basePath, Json::StyledWriter().write(root));
+        double const fullMs = timer.getMicroseconds() / 1000.;
+
+        allWasFine &= LevelJournal::reset(path, basePath);
+
+        // journaled save of a few moved props
+        timer.reset();
+        Json::Value segment;
+        segment[LevelJournal::PROPERTIES_ATTRIBUTE]["name"] = root["name"];
+
+        for(u32 i = 0; i < changes; ++i)
+            makeRecord(count + i, segment[LevelJournal::MODELS_ATTRIBUTE]["OgreModel"][std::to_string(i * 997)]);
+
+        allWasFine &= LevelJournal::append(path, segment);
+        double const journaledMs = timer.getMicroseconds() / 1000.;
+
+        std::vector<Json::Value> segments;
+        allWasFine &= LevelJournal::read(path, basePath, segments) && 1 == segments.size();
+        u64 const journalSize = LevelJournal::fileSize(path);
+        std::remove(path.c_str());
+        std::remove(basePath.c_str());
+
+        if(!allWasFine)
+        {
+            Debug::error(STEEL_METH_INTRO, "could not write saves.").endl();
+            return false;
+        }
+
+        Debug::log(STEEL_METH_INTRO, count, " records: full save ", fullMs, "ms, journaled save of ", changes, " changes ",
+                   journaledMs, "ms (", journalSize, " bytes of journal)").endl();
+        return true;
+    }
+}
+// kate: indent-mode cstyle; indent-width 4; replace-tabs on;
@@ -0,0 +1,534 @@
+#include "tools/LevelSnapshotWriter.h"
+
+#include <cstdio>
+#include <fstream>
+
+#include <OgreTimer.h>
+#include <Poco/Path.h>
+
+#include "Debug.h"
+#include "tests/UnitTestManager.h"
+#include "tools/BinaryLevelFile.h"
+#include "tools/JsonStreamReader.h"
+#include "tools/JsonStreamWriter.h"
+#include "tools/LevelJournal.h"
+
+namespace Steel
+{
+    namespace
+    {
+        /// Size of the file buffer json snapshots are streamed through.
+        size_t const WRITE_BUFFER_SIZE = 1 << 20;
+        /// root, managers, model types: records below are rendered one at a time.
+        u32 const STREAMED_DEPTH = 2;
+
+        /// Writes members of node one by one, descending into objects down to depth.
+        void streamMembers(Json::Value const &node, JsonStreamWriter &writer, u32 depth)
+        {
+            writer.beginObject();
+
+            for(Json::ValueConstIterator it = node.begin(); it != node.end(); ++it)
+            {
+                writer.key(it.memberName());
+
+                if(it->isObject() && depth > 0)
+                    streamMembers(*it, writer, depth - 1);
+                else
+                    writer.value(*it);
+            }
+
+            writer.endObject();
+        }
+
+        bool writeJson(Ogre::String const &path, Json::Value const &root)
+        {
+            Ogre::String const tmpPath = path + ".tmp";
+            {
+                std::vector<char> buffer(WRITE_BUFFER_SIZE);
+                std::ofstream stream;
+                stream.rdbuf()->pubsetbuf(buffer.data(), buffer.size());
+                stream.open(tmpPath.c_str(), std::ios::out | std::ios::trunc);
+
+                if(!stream.is_open())
+                    return false;
+
+                JsonStreamWriter writer(stream);
+
+                if(root.isObject())
+                    streamMembers(root, writer, STREAMED_DEPTH);
+                else
+                    writer.value(root);
+
+                writer.end();
+
+                if(!writer.good())
+                {
+                    stream.close();
+                    std::remove(tmpPath.c_str());
+                    return false;
+                }
+            }
+
+            if(0 != std::rename(tmpPath.c_str(), path.c_str()))
+            {
+                std::remove(tmpPath.c_str());
+                return false;
+            }
+
+            return true;
+        }
+
+        /// Reads back a full save written as format (JSON or BINARY).
+        bool readSave(Ogre::String const &path, LevelSnapshotWriter::Format format, Json::Value &root)
+        {
+            if(LevelSnapshotWriter::Format::BINARY == format)
+            {
+                BinaryLevelFile file;
+                return file.open(path) && file.toJson(root);
+            }
+
+            std::ifstream stream(path.c_str(), std::ios::in | std::ios::binary);
+
+            if(!stream.is_open())
+                return false;
+
+            JsonStreamReader reader(stream);
+            return reader.readValue(root);
+        }
+    }
+
+    LevelSnapshotWriter::LevelSnapshotWriter(): mWorker(), mMutex(), mCondition(), mJobs(), mDone(),
+        mBusy(false), mMustStop(false)
+    {
+    }
+
+    LevelSnapshotWriter::~LevelSnapshotWriter()
+    {
+        shutdown();
+    }
+
+    void LevelSnapshotWriter::init()
+    {
+        if(mWorker.joinable())
+            return;
+
+        mMustStop = false;
+        mWorker = std::thread(&LevelSnapshotWriter::run, this);
+    }
+
+    void LevelSnapshotWriter::shutdown()
+    {
+        if(mWorker.joinable())
+        {
+            // snapshots are not dropped
+            flush();
+            {
+                std::lock_guard<std::mutex> lock(mMutex);
+                mMustStop = true;
+            }
+            mCondition.notify_all();
+            mWorker.join();
+        }
+
+        mJobs.clear();
+        mDone.clear();
+    }
+
+    void LevelSnapshotWriter::queue(Job &job)
+    {
+        if(!mWorker.joinable())
+        {
+            Debug::warning(STEEL_METH_INTRO, "worker not running, writing ", job.path, " synchronously.").endl();
+            Ogre::Timer timer;
+            Done done = {job.path, write(job), timer.getMicroseconds() / 1000.};
+            mDone.push_back(done);
+            job.root = Json::Value();
+            return;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            Job *queued = nullptr;
+
+            // only the last one, so that a replaced snapshot keeps its place relative to journal segments. An incremental
+            // one builds on what is queued before it.
+            if(!mJobs.empty() && mJobs.back().path == job.path && Format::JOURNAL != mJobs.back().format && Format::JOURNAL != job.format
+                    && !job.incremental)
+                queued = &mJobs.back();
+
+            if(nullptr == queued)
+            {
+                mJobs.push_back(Job());
+                queued = &mJobs.back();
+            }
+
+            queued->path = job.path;
+            queued->format = job.format;
+            queued->journalPath = job.journalPath;
+            queued->incremental = job.incremental;
+            queued->root.swap(job.root);
+            job.root = Json::Value();
+        }
+        mCondition.notify_all();
+    }
+
+    bool LevelSnapshotWriter::collect(std::vector<Done> &done)
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+
+        if(mDone.empty())
+            return false;
+
+        done.insert(done.end(), mDone.begin(), mDone.end());
+        mDone.clear();
+        return true;
+    }
+
+    void LevelSnapshotWriter::flush()
+    {
+        std::unique_lock<std::mutex> lock(mMutex);
+        mCondition.wait(lock, [this] {return mJobs.empty() && !mBusy;});
+    }
+
+    bool LevelSnapshotWriter::idle()
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        return mJobs.empty() && !mBusy;
+    }
+
+    void LevelSnapshotWriter::run()
+    {
+        std::unique_lock<std::mutex> lock(mMutex);
+
+        while(true)
+        {
+            mCondition.wait(lock, [this] {return mMustStop || !mJobs.empty();});
+
+            if(mJobs.empty())
+                break;
+
+            Job job;
+            job.path = mJobs.front().path;
+            job.format = mJobs.front().format;
+            job.journalPath = mJobs.front().journalPath;
+            job.incremental = mJobs.front().incremental;
+            job.root.swap(mJobs.front().root);
+            mJobs.pop_front();
+            mBusy = true;
+
+            lock.unlock();
+            Ogre::Timer timer;
+            bool const success = write(job);
+            double const milliseconds = timer.getMicroseconds() / 1000.;
+            // the tree is released off the main thread as well
+            job.root = Json::Value();
+            lock.lock();
+
+            Done done = {job.path, success, milliseconds};
+            mDone.push_back(done);
+            mBusy = false;
+            mCondition.notify_all();
+        }
+    }
+
+    bool LevelSnapshotWriter::write(Job const &job)
+    {
+        bool written = false;
+        Json::Value const *root = &job.root;
+        Json::Value rebuilt;
+
+        if(job.incremental && Format::JOURNAL != job.format)
+        {
+            if(!readSave(job.path, job.format, rebuilt))
+                return false;
+
+            // what is on disk is the save and its journal
+            std::vector<Json::Value> segments;
+
+            if(!job.journalPath.empty() && LevelJournal::belongsTo(job.journalPath, job.path)
+                    && !LevelJournal::read(job.journalPath, job.path, segments))
+                return false;
+
+            for(auto const & segment : segments)
+                LevelJournal::apply(segment, rebuilt);
+
+            LevelJournal::apply(job.root, rebuilt);
+            root = &rebuilt;
+        }
+
+        switch(job.format)
+        {
+            case Format::JSON:
+                written = writeJson(job.path, *root);
+                break;
+
+            case Format::BINARY:
+            {
+                std::string bytes;
+                BinaryLevelFile::fromJson(*root, bytes);
+                written = BinaryLevelFile::write(job.path, bytes);
+                break;
+            }
+
+            case Format::JOURNAL:
+                return LevelJournal::append(job.path, job.root);
+        }
+
+        // the journal was about the previous full save
+        if(written && !job.journalPath.empty())
+            written = LevelJournal::reset(job.journalPath, job.path);
+
+        return written;
+    }
+
+    namespace
+    {
+        void makeSnapshot(u32 count, Json::Value &root)
+        {
+            root = Json::Value();
+            root["name"] = "synthetic";
+            root["gravity"] = "0 -9.8 0";
+            root["terrain"] = Json::Value(Json::objectValue);
+            root["managers"]["BTModel"] = Json::Value();
+
+            for(u32 i = 0; i < count; ++i)
+            {
+                Ogre::String const id = std::to_string(i);
+                root["agents"][id]["OgreModel"] = id;
+                Json::Value &record = root["managers"]["OgreModel"][id];
+                record["position"] = std::to_string(i * .5f) + " 1.25 " + std::to_string(-(float) i);
+                record["rotation"] = "1 0 0 0";
+                record["entityMeshName"] = "Tree.mesh";
+                record["tags"][0u] = "tree";
+            }
+        }
+
+        Ogre::String readFile(Ogre::String const &path)
+        {
+            std::ifstream file(path.c_str(), std::ios::in | std::ios::binary);
+            return Ogre::String((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+        }
+    }
+
+    bool utest_LevelSnapshotWriter(UnitTestExecutionContext const *context)
+    {
+        Ogre::String const jsonPath = Poco::Path::temp() + "steel_utest_LevelSnapshotWriter.lvl";
+        Ogre::String const binaryPath = Poco::Path::temp() + "steel_utest_LevelSnapshotWriter.lvlb";
+        Ogre::String const journalPath = binaryPath + "j";
+        bool allWasFine = true;
+
+        Json::Value expected;
+        makeSnapshot(30, expected);
+        Json::Value older;
+        makeSnapshot(10, older);
+
+        {
+            LevelSnapshotWriter writer;
+            writer.init();
+
+            LevelSnapshotWriter::Job job;
+            job.path = jsonPath;
+            job.format = LevelSnapshotWriter::Format::JSON;
+
+            // the older ones are replaced if not started yet
+            for(u32 i = 0; i < 3; ++i)
+            {
+                job.root = older;
+                writer.queue(job);
+            }
+
+            job.root = expected;
+            writer.queue(job);
+            allWasFine &= job.root.isNull();
+
+            job.path = binaryPath;
+            job.format = LevelSnapshotWriter::Format::BINARY;
+            job.journalPath = journalPath;
+            job.root = expected;
+            writer.queue(job);
+
+            // segments all land, in order
+            job.path = journalPath;
+            job.format = LevelSnapshotWriter::Format::JOURNAL;
+            job.journalPath.clear();
+
+            for(u32 i = 0; i < 3; ++i)
+            {
+                job.root[LevelJournal::PROPERTIES_ATTRIBUTE]["name"] = std::to_string(i);
+                writer.queue(job);
+            }
+
+            writer.flush();
+            allWasFine &= writer.idle();
+
+            std::vector<LevelSnapshotWriter::Done> done;
+            writer.collect(done);
+
+            for(auto const & it : done)
+                allWasFine &= it.success;
+
+            // at least the last one of each full save, and all segments
+            allWasFine &= done.size() >= 5 && done.size() <= 8;
+            allWasFine &= !writer.collect(done);
+            writer.shutdown();
+        }
+
+        if(!allWasFine)
+            Debug::error(STEEL_METH_INTRO, "bad queue state.").endl();
+
+        if(readFile(jsonPath) != Json::StyledWriter().write(expected))
+        {
+            Debug::error(STEEL_METH_INTRO, "json snapshot differs from its tree.").endl();
+            allWasFine = false;
+        }
+
+        BinaryLevelFile file;
+        Json::Value root;
+
+        if(!file.open(binaryPath) || !file.toJson(root) || root != expected)
+        {
+            Debug::error(STEEL_METH_INTRO, "binary snapshot differs from its tree.").endl();
+            allWasFine = false;
+        }
+
+        file.close();
+
+        std::vector<Json::Value> segments;
+
+        if(!LevelJournal::read(journalPath, binaryPath, segments) || 3 != segments.size()
+                || "2" != segments.back()[LevelJournal::PROPERTIES_ATTRIBUTE]["name"].asString())
+        {
+            Debug::error(STEEL_METH_INTRO, "journal segments were not all appended.").endl();
+            allWasFine = false;
+        }
+
+        // rebuilt from what is on disk: the binary save has its journal applied, then restarted
+        Json::Value segment;
+        segment[LevelJournal::PROPERTIES_ATTRIBUTE]["name"] = "rebuilt";
+        segment[LevelJournal::AGENTS_ATTRIBUTE]["3"] = Json::Value();
+        segment[LevelJournal::MODELS_ATTRIBUTE]["OgreModel"]["3"] = Json::Value();
+        segment[LevelJournal::MODELS_ATTRIBUTE]["OgreModel"]["4"]["position"] = "1 2 3";
+
+        Json::Value rebuiltBinary = expected, rebuiltJson = expected;
+
+        for(auto const & it : segments)
+            LevelJournal::apply(it, rebuiltBinary);
+
+        LevelJournal::apply(segment, rebuiltBinary);
+        LevelJournal::apply(segment, rebuiltJson);
+
+        {
+            LevelSnapshotWriter writer;
+            writer.init();
+
+            LevelSnapshotWriter::Job job;
+            job.incremental = true;
+            job.path = binaryPath;
+            job.format = LevelSnapshotWriter::Format::BINARY;
+            job.journalPath = journalPath;
+            job.root = segment;
+            writer.queue(job);
+
+            job.path = jsonPath;
+            job.format = LevelSnapshotWriter::Format::JSON;
+            job.journalPath.clear();
+            job.root = segment;
+            writer.queue(job);
+            writer.flush();
+
+            std::vector<LevelSnapshotWriter::Done> done;
+            writer.collect(done);
+            writer.shutdown();
+
+            if(2 != done.size() || !done.front().success || !done.back().success)
+            {
+                Debug::error(STEEL_METH_INTRO, "could not rebuild saves.").endl();
+                allWasFine = false;
+            }
+        }
+
+        if(!file.open(binaryPath) || !file.toJson(root) || root != rebuiltBinary)
+        {
+            Debug::error(STEEL_METH_INTRO, "rebuilt binary save differs from its tree.").endl();
+            allWasFine = false;
+        }
+
+        file.close();
+
+        if(readFile(jsonPath) != Json::StyledWriter().write(rebuiltJson))
+        {
+            Debug::error(STEEL_METH_INTRO, "rebuilt json save differs from its tree.").endl();
+            allWasFine = false;
+        }
+
+        segments.clear();
+
+        if(!LevelJournal::read(journalPath, binaryPath, segments) || !segments.empty())
+        {
+            Debug::error(STEEL_METH_INTRO, "journal was not restarted over the rebuilt save.").endl();
+            allWasFine = false;
+        }
+
+        std::remove(journalPath.c_str());
+        std::remove(jsonPath.c_str());
+        std::remove(binaryPath.c_str());
+        return allWasFine;
+    }
+
+    bool utest_LevelSnapshotWriterSpeed(UnitTestExecutionContext const *context)
+    {
+        u32 const count = 100000;
+        Ogre::String const path = Poco::Path::temp() + "steel_utest_LevelSnapshotWriterSpeed.lvl";
+        Ogre::Timer timer;
+        LevelSnapshotWriter writer;
+        writer.init();
+
+        LevelSnapshotWriter::Job job;
+        job.path = path;
+        job.format = LevelSnapshotWriter::Format::JSON;
+
+        // synchronous, as Level::save does
+        makeSnapshot(count, job.root);
+        timer.reset();
+        bool const written = LevelSnapshotWriter::write(job);
+        double const synchronousMs = timer.getMicroseconds() / 1000.;
+
+        // captured then handed over to the worker, as Level::autosave does: the capture is most of what the frame pays
+        timer.reset();
+        makeSnapshot(count, job.root);
+        double const captureMs = timer.getMicroseconds() / 1000.;
+        writer.queue(job);
+        double const queueMs = timer.getMicroseconds() / 1000. - captureMs;
+        writer.flush();
+
+        // rebuilt by the worker from the save above and a segment of a few changed records, as Level::autosave does
+        // once the level has a save
+        timer.reset();
+        job.incremental = true;
+
+        for(u32 i = 0; i < 100; ++i)
+            job.root[LevelJournal::MODELS_ATTRIBUTE]["OgreModel"][std::to_string(i * 997)]["position"] = "1 2 3";
+
+        writer.queue(job);
+        double const incrementalMs = timer.getMicroseconds() / 1000.;
+        writer.flush();
+
+        std::vector<LevelSnapshotWriter::Done> done;
+        writer.collect(done);
+        writer.shutdown();
+        std::remove(path.c_str());
+
+        if(!written || 2 != done.size() || !done.front().success || !done.back().success)
+        {
+            Debug::error(STEEL_METH_INTRO, "could not write snapshot.").endl();
+            return false;
+        }
+
+        Debug::log(STEEL_METH_INTRO, count, " records: written on the calling thread in ", synchronousMs,
+                   "ms, captured in ", captureMs, "ms and queued in ", queueMs, "ms (", captureMs + queueMs,
+                   "ms on the calling thread, written by the worker in ", done.front().milliseconds, "ms); 100 changed records ",
+                   "captured and queued in ", incrementalMs, "ms, save rebuilt by the worker in ", done.back().milliseconds, "ms").endl();
+        return true;
+    }
+}
+// kate: indent-mode cstyle; indent-width 4; replace-tabs on;
@@ -4,28 +4,38 @@ namespace Steel
 {
     
     RigidBodyStateWrapper::RigidBodyStateWrapper(Ogre::SceneNode *node): BtOgre::RigidBodyState(node),
-        mIsTransformed(false)
+        mIsTransformed(false), mTransformedQueue(nullptr), mModelId(INVALID_ID)
     {
     }
     
     RigidBodyStateWrapper::RigidBodyStateWrapper(Ogre::SceneNode *node,
                                                  const btTransform &transform,
                                                  const btTransform &offset /*= btTransform::getIdentity()*/):BtOgre::RigidBodyState(node, transform, offset),
-        mIsTransformed(false)
+        mIsTransformed(false), mTransformedQueue(nullptr), mModelId(INVALID_ID)
     {
     }
 
     RigidBodyStateWrapper::RigidBodyStateWrapper(const RigidBodyStateWrapper &o): RigidBodyState(o),
-        mIsTransformed(o.mIsTransformed)
+        mIsTransformed(o.mIsTransformed), mTransformedQueue(o.mTransformedQueue), mModelId(o.mModelId)
     {
     }
 
     void RigidBodyStateWrapper::setWorldTransform(const btTransform &in)
     {
         BtOgre::RigidBodyState::setWorldTransform(in);
+
+        if(!mIsTransformed && nullptr != mTransformedQueue)
+            mTransformedQueue->push_back(mModelId);
+
         mIsTransformed = true;
     }
 
+    void RigidBodyStateWrapper::setTransformedQueue(std::vector<ModelId> *queue, ModelId mid)
+    {
+        mTransformedQueue = queue;
+        mModelId = mid;
+    }
+
     bool RigidBodyStateWrapper::poolTransform()
     {
         bool value = mIsTransformed;